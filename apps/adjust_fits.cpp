@@ -1,69 +1,186 @@
 /**
  * This program transforms a FITS file produced by the FITS C++ class in AstroIO to make it
  * as if it were produced by offline_correlator.
- * 
+ *
  * The reason this is needed is that offline_correlator informs the cfitsio library that it
- * is going to write integer values (BITPIX = LONG_IMG = 32) but then writes TFLOAT.
+ * is going to write integer values (BITPIX = LONG_IMG = 32) but then writes TFLOAT. This is
+ * reproduced by default; `--float-bitpix` declares FLOAT_IMG instead, keeping the values intact.
+ *
+ * Files are converted one HDU at a time, a group of rows at a time, so memory usage does not
+ * depend on the size of the files. Many files (or whole directories of them) can be converted
+ * in a single run, in parallel, one file per thread, if cfitsio was built reentrant. A file is
+ * never converted in place.
 */
 #include <iostream>
-#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <string>
+#include <vector>
 #include "../src/FITS.hpp"
+#include "../src/files.hpp"
+#include "../src/parallel.hpp"
 
-inline void print_fits_error(int errorCode){
-    char statusStr[FLEN_STATUS], errmsg[FLEN_ERRMSG];
-    fits_get_errstatus(errorCode, statusStr);
-    std::cerr << "Error occurred during a cfitsio call.\n\tCode: " << errorCode << ": " << std::string {statusStr} << std::endl;
-    // get all the messages
-    while(fits_read_errmsg(errmsg))
-        std::cerr << "\t" << std::string {errmsg} << std::endl;
-}
 
+struct AdjustOptions {
+    // Directory where converted files are written, with the name of the input file.
+    std::string output_dir;
+    unsigned int n_threads {0};
+    int bitpix {LONG_IMG};
+};
 
-#define CHECK_FITS_ERROR(X)({\
-    if((X)){\
-        print_fits_error(status);\
-        throw std::exception();\
-    }\
-})
 
 
-int main(int argc, char **argv){
+namespace {
+    // Number of pixels read and written at a time.
+    constexpr size_t CHUNK_PIXELS {1ul << 21};
+
 
-    if(argc < 3){
-        std::cout << argv[0] << " <AstroIO input FITS> <output file>" << std::endl;
-        return 0;
+    void convert_file(const std::string& input, const std::string& output, int bitpix){
+        // Only the headers are read here; pixels are read from the file when requested.
+        FITS inputFITS {input, FITS::Mode::READ};
+        // remove file if exists already - we overwrite by default.
+        std::remove(output.c_str());
+        fitsfile *fitsFP;
+        int status = 0;
+        CHECK_FITS_ERROR(fits_create_file(&fitsFP, output.c_str(), &status));
+        std::vector<float> buffer;
+        try {
+            for(const FITS::HDU& cHDU : inputFITS){
+                status = 0;
+                if(cHDU.has_image()){
+                    long axes[2] {cHDU.get_ydim(), cHDU.get_xdim()};
+                    CHECK_FITS_ERROR(fits_create_img(fitsFP, bitpix, 2, axes, &status));
+                    const long rows_per_chunk {std::max(1l, static_cast<long>(CHUNK_PIXELS) / std::max(1l, axes[0]))};
+                    buffer.resize(static_cast<size_t>(std::min(rows_per_chunk, axes[1])) * axes[0]);
+                    for(long row {0}; row < axes[1]; row += rows_per_chunk){
+                        const long n_rows {std::min(rows_per_chunk, axes[1] - row)};
+                        cHDU.read_image_rows(buffer.data(), TFLOAT, row, n_rows);
+                        CHECK_FITS_ERROR(fits_write_img(fitsFP, TFLOAT, static_cast<long long>(row) * axes[0] + 1,
+                            static_cast<long long>(n_rows) * axes[0], buffer.data(), &status));
+                    }
+                }else{
+                    CHECK_FITS_ERROR(fits_create_img(fitsFP, bitpix, 0, nullptr, &status));
+                }
+                for(const auto& entry : cHDU.get_header()){
+                    status = 0;
+                    CHECK_FITS_ERROR(fits_update_key(fitsFP, entry.data_type, entry.keyword.c_str(), const_cast<void*>(entry.value()),
+                        entry.comment.c_str(), &status));
+                }
+            }
+        } catch (...) {
+            status = 0;
+            fits_close_file(fitsFP, &status);
+            std::remove(output.c_str());
+            throw;
+        }
+        status = 0;
+        CHECK_FITS_ERROR(fits_close_file(fitsFP, &status));
     }
 
-    auto myFITSImage = FITS {argv[1], FITS::Mode::READ};
 
-    std::ifstream fp {argv[2]};
-    // remove file if exists already - we overwrite by default.
-    if(fp.good()){
-        fp.close();
-        std::remove(argv[2]);
+
+    // Whether `output` is the file `input`, which would be removed before being read.
+    bool same_file(const std::string& input, const std::string& output){
+        std::error_code error;
+        return std::filesystem::equivalent(input, output, error) && !error;
     }
-    fitsfile *fitsFP;
-    int status = 0;
-    long axes[2];
-    CHECK_FITS_ERROR(fits_create_file(&fitsFP, argv[2], &status));
-    for(FITS::HDU& cHDU : myFITSImage){
-        status = 0;
-        axes[0] = cHDU.get_ydim();
-        axes[1] = cHDU.get_xdim();
-        CHECK_FITS_ERROR(fits_create_img(fitsFP, LONG_IMG, 2,  axes, &status));
-        long fPixel[2] {1, 1};
-        CHECK_FITS_ERROR(fits_write_pix(fitsFP, TFLOAT, fPixel, axes[0] * axes[1], (char *) cHDU.get_image_data(), &status));
-        for(auto& header_entry : cHDU.get_header()){
-            auto key = header_entry.first;
-	    auto entry = header_entry.second;
-            status = 0;
-            if(entry.data_type == TSTRING){
-                CHECK_FITS_ERROR(fits_update_key(fitsFP, entry.data_type, key.c_str(), entry.data.sval, entry.comment.c_str(), &status));
-            }else{
-                CHECK_FITS_ERROR(fits_update_key(fitsFP, entry.data_type, key.c_str(), &entry.data, entry.comment.c_str(), &status));
+
+
+
+    std::string base_name(const std::string& path){
+        const size_t pos {path.find_last_of('/')};
+        return pos == std::string::npos ? path : path.substr(pos + 1);
+    }
+
+
+
+    void print_usage(const char *program){
+        std::cout << program << " [--float-bitpix] <AstroIO input FITS> <output file>\n"
+            << program << " [--float-bitpix] [-j <threads>] -o <output directory> <input FITS or directory>...\n\n"
+            "\t-o: write the converted files to the given directory, with the names of the input files.\n"
+            "\t    Directories given as input are converted in full (files ending in .fits).\n"
+            "\t-j: number of files converted in parallel. Default: all the hardware threads.\n"
+            "\t--float-bitpix: declare BITPIX = FLOAT_IMG rather than LONG_IMG as offline_correlator does." << std::endl;
+    }
+}
+
+
+
+int main(int argc, char **argv){
+    AdjustOptions options;
+    std::vector<std::string> inputs;
+    for(int i {1}; i < argc; i++){
+        const std::string arg {argv[i]};
+        const bool has_value {i + 1 < argc};
+        if(arg == "-o" && has_value) options.output_dir = argv[++i];
+        else if(arg == "-j" && has_value) options.n_threads = static_cast<unsigned int>(std::max(1, std::atoi(argv[++i])));
+        else if(arg == "--float-bitpix") options.bitpix = FLOAT_IMG;
+        else if(arg == "-h" || arg == "--help" || (!arg.empty() && arg[0] == '-')){
+            print_usage(argv[0]);
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+        else inputs.push_back(arg);
+    }
+
+    // (input, output) pairs.
+    std::vector<std::pair<std::string, std::string>> conversions;
+    if(options.output_dir.empty()){
+        if(inputs.size() != 2){
+            print_usage(argv[0]);
+            return inputs.empty() ? 0 : 1;
+        }
+        conversions.emplace_back(inputs[0], inputs[1]);
+    }else{
+        try {
+            blink::imager::create_directory(options.output_dir);
+            for(const std::string& input : inputs){
+                if(blink::imager::dir_exists(input)){
+                    for(const std::string& file : blink::imager::list_files_in_dir(input, ".fits"))
+                        conversions.emplace_back(file, options.output_dir + "/" + base_name(file));
+                }else{
+                    conversions.emplace_back(input, options.output_dir + "/" + base_name(input));
+                }
             }
+        } catch (std::exception& ex){
+            std::cerr << ex.what() << std::endl;
+            return 1;
+        }
+    }
+
+    int exit_code {0};
+    // A file cannot be converted in place: its pixels are read after the output is created.
+    std::vector<std::pair<std::string, std::string>> accepted;
+    for(const auto& conversion : conversions){
+        if(same_file(conversion.first, conversion.second)){
+            std::cerr << "blink_adjust_fits: " << conversion.first << " would be overwritten by its own conversion, skipped." << std::endl;
+            exit_code = 1;
+        }else{
+            accepted.push_back(conversion);
+        }
+    }
+    unsigned int n_threads {static_cast<unsigned int>(std::min<size_t>(resolve_n_threads(options.n_threads), std::max<size_t>(1, accepted.size())))};
+    // cfitsio handles different files concurrently only when built with --enable-reentrant.
+    if(n_threads > 1 && !fits_is_reentrant()){
+        if(options.n_threads > 1)
+            std::cerr << "blink_adjust_fits: cfitsio is not reentrant, files are converted one at a time." << std::endl;
+        n_threads = 1;
+    }
+    ThreadPool pool {n_threads};
+    std::vector<std::future<void>> results;
+    for(const auto& conversion : accepted)
+        results.push_back(pool.submit([&conversion, &options](){
+            convert_file(conversion.first, conversion.second, options.bitpix);
+        }));
+    // A file that cannot be converted does not prevent the others from being converted.
+    for(size_t i {0}; i < results.size(); i++){
+        try {
+            results[i].get();
+        } catch (std::exception& ex){
+            std::cerr << "blink_adjust_fits: error while converting " << accepted[i].first << ": " << ex.what() << std::endl;
+            exit_code = 1;
         }
     }
-    CHECK_FITS_ERROR(fits_close_file(fitsFP, &status));
-    return 0;
+    return exit_code;
 }
@@ -0,0 +1,446 @@
+/**
+ * Throughput benchmarks of the AstroIO readers and writers, on synthetic data.
+ *
+ * Each benchmark is run over a sweep of parameters (antennas, channels, integration steps, file
+ * sizes); every configuration is executed once to warm up and then `-r` more times. Results,
+ * in GB/s and samples/s computed from the median time, are written as JSON to standard output
+ * or to the file given with `-o`, so that runs on different releases can be compared.
+ *
+ * Input files are generated in the directory given with `-d` (default: $TMPDIR or /tmp) and
+ * removed at the end. Reads are served from the page cache unless `--cold` is passed, in which
+ * case the pages of the input file are dropped before each repetition.
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../src/astroio.hpp"
+#include "../src/memory_buffer.hpp"
+#include "../src/gpu_macros.hpp"
+
+
+struct BenchOptions {
+    std::string output_file;
+    std::string work_dir;
+    unsigned int repetitions {5};
+    bool quick {false};
+    bool cold_cache {false};
+    // Benchmarks whose name does not contain this string are skipped.
+    std::string filter;
+};
+
+
+struct BenchResult {
+    std::string name;
+    // Parameters of the configuration, already formatted as JSON values.
+    std::vector<std::pair<std::string, std::string>> params;
+    size_t bytes;
+    size_t samples;
+    std::vector<double> seconds;
+};
+
+
+class Benchmarks {
+    BenchOptions options;
+    std::vector<BenchResult> results;
+    std::vector<std::string> files;
+
+    public:
+    explicit Benchmarks(const BenchOptions& options) : options {options} {}
+
+    ~Benchmarks(){
+        for(const auto& file : files) std::remove(file.c_str());
+    }
+
+    const BenchOptions& opts() const { return options; }
+
+    bool enabled(const std::string& name) const {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    /**
+     * @brief Path of a temporary file in the working directory, removed at exit.
+     */
+    std::string temp_file(const std::string& name){
+        files.push_back(options.work_dir + "/blink_astroio_bench_" + std::to_string(getpid()) + "_" + name);
+        return files.back();
+    }
+
+    void drop_cache(const std::string& filename) const {
+        if(!options.cold_cache) return;
+        int fd {open(filename.c_str(), O_RDONLY)};
+        if(fd < 0) return;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+
+    /**
+     * @brief Time `fn` once to warm up, then `repetitions` times. `setup`, if given, is called
+     * before each execution and not timed.
+     */
+    void run(BenchResult&& result, const std::function<void()>& fn, const std::function<void()>& setup = {}){
+        using clock = std::chrono::steady_clock;
+        for(unsigned int r {0}; r <= options.repetitions; r++){
+            if(setup) setup();
+            const clock::time_point start {clock::now()};
+            fn();
+            const std::chrono::duration<double> elapsed {clock::now() - start};
+            if(r > 0) result.seconds.push_back(elapsed.count());
+        }
+        std::cerr << result.name;
+        for(const auto& p : result.params) std::cerr << " " << p.first << "=" << p.second;
+        std::cerr << ": " << median(result.seconds) << " s" << std::endl;
+        results.push_back(std::move(result));
+    }
+
+    static double median(std::vector<double> values){
+        if(values.empty()) return 0.0;
+        std::sort(values.begin(), values.end());
+        const size_t n {values.size()};
+        return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+    }
+
+    void write_json(std::ostream& out) const;
+};
+
+
+
+namespace {
+    std::string json_string(const std::string& value){
+        std::string result {"\""};
+        for(char c : value){
+            if(c == '"' || c == '\\') result += '\\';
+            if(static_cast<unsigned char>(c) < 0x20) continue;
+            result += c;
+        }
+        return result + "\"";
+    }
+
+
+    std::string simd_level(){
+    #if defined(__AVX512BW__)
+        return "avx512bw";
+    #elif defined(__AVX2__)
+        return "avx2";
+    #elif defined(__SSE2__)
+        return "sse2";
+    #elif defined(__ARM_NEON)
+        return "neon";
+    #else
+        return "none";
+    #endif
+    }
+
+
+    int n_gpus(){
+    #ifdef __GPU__
+        return num_available_gpus();
+    #else
+        return 0;
+    #endif
+    }
+
+
+    std::vector<int8_t> random_bytes(size_t n){
+        std::vector<int8_t> data(n);
+        std::mt19937_64 gen {12345};
+        for(size_t i {0}; i < n; i += 8){
+            const uint64_t value {gen()};
+            std::memcpy(data.data() + i, &value, std::min<size_t>(8, n - i));
+        }
+        return data;
+    }
+
+
+    void write_file(const std::string& filename, const std::vector<int8_t>& data){
+        std::ofstream out {filename, std::ios::binary};
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if(!out) throw std::runtime_error {"blink_astroio_bench: error while writing " + filename};
+    }
+
+
+    struct VoltageLayout {
+        const char *name;
+        unsigned int n_antennas;
+        unsigned int n_channels;
+    };
+
+
+    std::vector<VoltageLayout> voltage_layouts(const BenchOptions& options){
+        if(options.quick) return {{"vcs", 128, 128}};
+        return {{"vcs", 128, 128}, {"eda2", 256, 1}, {"small", 32, 16}};
+    }
+
+
+    std::vector<size_t> file_sizes(const BenchOptions& options){
+        const size_t mb {1024ul * 1024ul};
+        if(options.quick) return {16 * mb};
+        return {64 * mb, 256 * mb};
+    }
+
+
+    std::vector<unsigned int> integration_steps(const BenchOptions& options){
+        if(options.quick) return {100};
+        return {100, 1000};
+    }
+
+
+    // Observation of `layout` whose samples take about `bytes` bytes at `bytes_per_sample` each.
+    ObservationInfo make_obs_info(const VoltageLayout& layout, size_t bytes, size_t bytes_per_sample){
+        ObservationInfo obs_info {VCS_OBSERVATION_INFO};
+        obs_info.nAntennas = layout.n_antennas;
+        obs_info.nFrequencies = layout.n_channels;
+        const size_t timestep_bytes {static_cast<size_t>(layout.n_antennas) * layout.n_channels * obs_info.nPolarizations * bytes_per_sample};
+        obs_info.nTimesteps = static_cast<unsigned int>(std::max<size_t>(1, bytes / timestep_bytes));
+        return obs_info;
+    }
+
+
+    std::vector<std::pair<std::string, std::string>> voltage_params(const VoltageLayout& layout, const ObservationInfo& obs_info,
+            unsigned int n_steps){
+        return {{"layout", json_string(layout.name)}, {"antennas", std::to_string(obs_info.nAntennas)},
+            {"channels", std::to_string(obs_info.nFrequencies)}, {"timesteps", std::to_string(obs_info.nTimesteps)},
+            {"integration_steps", std::to_string(n_steps)}};
+    }
+
+
+
+    void bench_dat_files(Benchmarks& bench){
+        const bool cpu {bench.enabled("from_dat_file")}, gpu {bench.enabled("from_dat_file_gpu") && n_gpus() > 0};
+        if(!cpu && !gpu) return;
+        for(const auto& layout : voltage_layouts(bench.opts())){
+            for(size_t size : file_sizes(bench.opts())){
+                // One byte per complex sample (4 + 4 bits).
+                const ObservationInfo obs_info {make_obs_info(layout, size, 1)};
+                const size_t n_samples {static_cast<size_t>(obs_info.nTimesteps) * layout.n_antennas * layout.n_channels * obs_info.nPolarizations};
+                const std::string filename {bench.temp_file(std::string {layout.name} + "_" + std::to_string(size) + ".dat")};
+                write_file(filename, random_bytes(n_samples));
+                for(unsigned int n_steps : integration_steps(bench.opts())){
+                    if(cpu)
+                        bench.run({"from_dat_file", voltage_params(layout, obs_info, n_steps), n_samples, n_samples, {}},
+                            [&](){ Voltages::from_dat_file(filename, obs_info, n_steps); }, [&](){ bench.drop_cache(filename); });
+                    if(gpu)
+                        bench.run({"from_dat_file_gpu", voltage_params(layout, obs_info, n_steps), n_samples, n_samples, {}},
+                            [&](){
+                                auto voltages = Voltages::from_dat_file_gpu(filename, obs_info, n_steps);
+                            #ifdef __GPU__
+                                gpuDeviceSynchronize();
+                            #endif
+                            }, [&](){ bench.drop_cache(filename); });
+                }
+            }
+        }
+    }
+
+
+
+    void bench_from_memory(Benchmarks& bench){
+        const bool memory {bench.enabled("from_memory")}, eda2 {bench.enabled("from_eda2_file")};
+        const bool gpu {bench.enabled("from_memory_gpu") && n_gpus() > 0};
+        if(!memory && !eda2 && !gpu) return;
+        for(const auto& layout : voltage_layouts(bench.opts())){
+            for(size_t size : file_sizes(bench.opts())){
+                // 8-bit real and imaginary parts.
+                const ObservationInfo obs_info {make_obs_info(layout, size, 2)};
+                const size_t n_samples {static_cast<size_t>(obs_info.nTimesteps) * layout.n_antennas * layout.n_channels * obs_info.nPolarizations};
+                const std::vector<int8_t> data {random_bytes(2 * n_samples)};
+                std::string filename;
+                if(eda2){
+                    filename = bench.temp_file(std::string {layout.name} + "_" + std::to_string(size) + ".eda2");
+                    write_file(filename, data);
+                }
+                for(unsigned int n_steps : integration_steps(bench.opts())){
+                    if(memory)
+                        bench.run({"from_memory", voltage_params(layout, obs_info, n_steps), data.size(), n_samples, {}},
+                            [&](){ Voltages::from_memory(data.data(), data.size(), obs_info, n_steps); });
+                    if(gpu)
+                        bench.run({"from_memory_gpu", voltage_params(layout, obs_info, n_steps), data.size(), n_samples, {}},
+                            [&](){
+                                auto voltages = Voltages::from_memory_gpu(data.data(), data.size(), obs_info, n_steps);
+                            #ifdef __GPU__
+                                gpuDeviceSynchronize();
+                            #endif
+                            });
+                    if(eda2)
+                        bench.run({"from_eda2_file", voltage_params(layout, obs_info, n_steps), data.size(), n_samples, {}},
+                            [&](){ Voltages::from_eda2_file(filename, obs_info, n_steps); }, [&](){ bench.drop_cache(filename); });
+                }
+            }
+        }
+    }
+
+
+
+    void bench_fits(Benchmarks& bench){
+        const bool write {bench.enabled("to_fits_file")}, read {bench.enabled("from_fits_file")};
+        const bool mwax {bench.enabled("to_fits_file_mwax")};
+        if(!write && !read && !mwax) return;
+        const std::vector<unsigned int> antennas {bench.opts().quick ? std::vector<unsigned int> {128} : std::vector<unsigned int> {128, 256}};
+        const std::vector<unsigned int> channels {bench.opts().quick ? std::vector<unsigned int> {32} : std::vector<unsigned int> {32, 128}};
+        const unsigned int n_intervals {bench.opts().quick ? 1u : 2u};
+        for(unsigned int n_antennas : antennas){
+            for(unsigned int n_channels : channels){
+                ObservationInfo obs_info {VCS_OBSERVATION_INFO};
+                obs_info.nAntennas = n_antennas;
+                obs_info.nFrequencies = n_channels;
+                obs_info.nTimesteps = 100 * n_intervals;
+                obs_info.id = "1240826896";
+                const size_t n_baselines {static_cast<size_t>(n_antennas) * (n_antennas + 1) / 2};
+                const size_t n_values {n_baselines * 4 * n_channels * n_intervals};
+                MemoryBuffer<std::complex<float>> data {n_values};
+                std::mt19937 gen {1};
+                std::normal_distribution<float> dist;
+                for(size_t i {0}; i < n_values; i++) data[i] = {dist(gen), dist(gen)};
+                Visibilities vis {std::move(data), obs_info, 100, 1};
+                const size_t bytes {n_values * sizeof(std::complex<float>)};
+                const std::vector<std::pair<std::string, std::string>> params {{"antennas", std::to_string(n_antennas)},
+                    {"channels", std::to_string(n_channels)}, {"intervals", std::to_string(n_intervals)}};
+                const std::string filename {bench.temp_file("vis_" + std::to_string(n_antennas) + "_" + std::to_string(n_channels) + ".fits")};
+                // Each write starts without an existing file.
+                if(write)
+                    bench.run({"to_fits_file", params, bytes, n_values, {}}, [&](){ vis.to_fits_file(filename); },
+                        [&](){ std::remove(filename.c_str()); });
+                else if(read)
+                    vis.to_fits_file(filename);
+                if(read)
+                    bench.run({"from_fits_file", params, bytes, n_values, {}},
+                        [&](){ Visibilities::from_fits_file(filename, obs_info); }, [&](){ bench.drop_cache(filename); });
+                if(mwax)
+                    bench.run({"to_fits_file_mwax", params, bytes, n_values, {}}, [&](){ vis.to_fits_file_mwax(filename, 0); },
+                        [&](){ std::remove(filename.c_str()); });
+            }
+        }
+    }
+
+
+
+    void bench_memory_transfers(Benchmarks& bench){
+    #ifdef __GPU__
+        if(n_gpus() == 0) return;
+        const size_t mb {1024ul * 1024ul};
+        const std::vector<size_t> sizes {bench.opts().quick ? std::vector<size_t> {64 * mb} : std::vector<size_t> {16 * mb, 256 * mb}};
+        for(size_t size : sizes){
+            for(MemoryType type : {MemoryType::PAGEABLE, MemoryType::PINNED}){
+                const std::string type_name {type == MemoryType::PINNED ? "pinned" : "pageable"};
+                const std::vector<std::pair<std::string, std::string>> params {{"host_memory", json_string(type_name)}};
+                MemoryBuffer<char> buffer {size, type};
+                std::memset(buffer.data(), 1, size);
+                if(bench.enabled("host_to_device"))
+                    bench.run({"memory_buffer_host_to_device", params, size, size, {}},
+                        [&](){ buffer.to_gpu(); }, [&](){ buffer.to_cpu(type); });
+                if(bench.enabled("device_to_host"))
+                    bench.run({"memory_buffer_device_to_host", params, size, size, {}},
+                        [&](){ buffer.to_cpu(type); }, [&](){ buffer.to_gpu(); });
+            }
+        }
+    #else
+        (void) bench;
+    #endif
+    }
+
+
+
+    void print_usage(const char *program){
+        std::cout << program << " [-o <output JSON file>] [-d <working directory>] [-r <repetitions>] [-f <filter>] "
+            "[--quick] [--cold]\n\n"
+            "\t-o: write results to the given file instead of standard output.\n"
+            "\t-d: directory of the temporary input files. Default: $TMPDIR or /tmp.\n"
+            "\t-r: number of timed repetitions of each configuration. Default: 5.\n"
+            "\t-f: only run the benchmarks whose name contains the given string.\n"
+            "\t--quick: run a reduced parameter sweep.\n"
+            "\t--cold: drop the input files from the page cache before each repetition." << std::endl;
+    }
+}
+
+
+
+void Benchmarks::write_json(std::ostream& out) const {
+    char hostname[256] {};
+    gethostname(hostname, sizeof(hostname) - 1);
+    char timestamp[32];
+    const time_t now {time(nullptr)};
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    out << "{\n  \"format_version\": 1,\n"
+        << "  \"timestamp\": " << json_string(timestamp) << ",\n"
+        << "  \"host\": " << json_string(hostname) << ",\n"
+        << "  \"compiler\": " << json_string(__VERSION__) << ",\n"
+        << "  \"simd\": " << json_string(simd_level()) << ",\n"
+        << "  \"gpus\": " << n_gpus() << ",\n"
+        << "  \"repetitions\": " << options.repetitions << ",\n"
+        << "  \"cold_cache\": " << (options.cold_cache ? "true" : "false") << ",\n"
+        << "  \"results\": [";
+    for(size_t i {0}; i < results.size(); i++){
+        const BenchResult& r {results[i]};
+        const double med {median(r.seconds)};
+        const double min {r.seconds.empty() ? 0.0 : *std::min_element(r.seconds.begin(), r.seconds.end())};
+        double mean {0.0};
+        for(double s : r.seconds) mean += s;
+        mean = r.seconds.empty() ? 0.0 : mean / r.seconds.size();
+        out << (i == 0 ? "\n" : ",\n") << "    {\"benchmark\": " << json_string(r.name) << ", \"params\": {";
+        for(size_t p {0}; p < r.params.size(); p++)
+            out << (p == 0 ? "" : ", ") << json_string(r.params[p].first) << ": " << r.params[p].second;
+        out << "}, \"bytes\": " << r.bytes << ", \"samples\": " << r.samples
+            << ", \"seconds\": {\"min\": " << min << ", \"median\": " << med << ", \"mean\": " << mean << "}"
+            << ", \"gb_per_s\": " << (med > 0 ? r.bytes / med / 1e9 : 0.0)
+            << ", \"samples_per_s\": " << (med > 0 ? r.samples / med : 0.0) << "}";
+    }
+    out << "\n  ]\n}" << std::endl;
+}
+
+
+
+int main(int argc, char **argv){
+    BenchOptions options;
+    const char *tmpdir {std::getenv("TMPDIR")};
+    options.work_dir = tmpdir ? tmpdir : "/tmp";
+    for(int i {1}; i < argc; i++){
+        const std::string arg {argv[i]};
+        const bool has_value {i + 1 < argc};
+        if(arg == "-o" && has_value) options.output_file = argv[++i];
+        else if(arg == "-d" && has_value) options.work_dir = argv[++i];
+        else if(arg == "-r" && has_value) options.repetitions = static_cast<unsigned int>(std::max(1, std::atoi(argv[++i])));
+        else if(arg == "-f" && has_value) options.filter = argv[++i];
+        else if(arg == "--quick") options.quick = true;
+        else if(arg == "--cold") options.cold_cache = true;
+        else {
+            print_usage(argv[0]);
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+    int exit_code {0};
+    try {
+        Benchmarks bench {options};
+        // A failing group of benchmarks does not prevent the others from running.
+        for(auto group : {bench_dat_files, bench_from_memory, bench_fits, bench_memory_transfers}){
+            try {
+                group(bench);
+            } catch (std::exception& ex){
+                std::cerr << "blink_astroio_bench: benchmark failed: " << ex.what() << std::endl;
+                exit_code = 1;
+            }
+        }
+        if(options.output_file.empty()){
+            bench.write_json(std::cout);
+        }else{
+            std::ofstream out {options.output_file};
+            bench.write_json(out);
+            if(!out) throw std::runtime_error {"blink_astroio_bench: error while writing " + options.output_file};
+        }
+    } catch (std::exception& ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    return exit_code;
+}
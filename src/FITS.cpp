@@ -1,8 +1,9 @@
 #include <iostream>
 #include <fstream>
-#include <array>
-#include <regex>
+#include <limits>
+#include <mutex>
 #include "FITS.hpp"
+#include "instrumentation.hpp"
 
 
 void print_fits_error(int errorCode){
@@ -16,14 +17,180 @@ void print_fits_error(int errorCode){
 
 
 
-inline bool is_special_keyword(const std::string& key){
-    const std::array<std::string, 5> special_keywords {"SIMPLE", "BITPIX", "COMMENT", "EXTEND", "NAXIS"};
-    for(auto& special : special_keywords)
-        if(key == special) return true;
+/*
+    A file open in READ mode. It is shared by the FITS object and by all the HDUs whose pixels
+    have not been loaded yet, and closed when the last of them is destroyed. cfitsio keeps a
+    current HDU per file handle, hence reads are serialised.
+*/
+class FITS::Reader {
+    fitsfile *fitsFP {nullptr};
+    std::mutex mutex;
+    // 16-bit pixels read before they are decoded.
+    std::vector<int16_t> encoded;
 
-    static const std::regex naxis_regex {"^NAXIS[1-9][0-9]*$"};
-    if(std::regex_search(key, naxis_regex)) return true;
-    return false; 
+    public:
+    explicit Reader(fitsfile *fp) : fitsFP {fp} {}
+
+    ~Reader(){
+        int status = 0;
+        if(fitsFP) fits_close_file(fitsFP, &status);
+    }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    /*
+        Read `n_pixels` pixels starting from `first_row` (0-based). cfitsio decompresses and
+        rescales them; pixels with a 16-bit `encoding` are decoded here, unless read as TSHORT.
+        Undefined pixels (BLANK) are read as NaN in floating point types.
+    */
+    void read_pixels(int hdu_number, int datatype, long long n_pixels, void *buffer, long first_row = 0,
+            PixelEncoding encoding = PixelEncoding::FLOAT32){
+        std::lock_guard<std::mutex> lock {mutex};
+        ASTROIO_TIMED_SCOPE("fits_read_pixels", static_cast<size_t>(n_pixels) * HDU::pixel_bytes(datatype), static_cast<size_t>(n_pixels));
+        int status = 0;
+        CHECK_FITS_ERROR(fits_movabs_hdu(fitsFP, hdu_number, NULL, &status));
+        if(encoding == PixelEncoding::FLOAT32 || datatype == TSHORT){
+            long fPixel[2] {1, first_row + 1};
+            float float_null {std::numeric_limits<float>::quiet_NaN()};
+            double double_null {std::numeric_limits<double>::quiet_NaN()};
+            void *null_value {datatype == TFLOAT ? static_cast<void*>(&float_null) : (datatype == TDOUBLE ? &double_null : nullptr)};
+            CHECK_FITS_ERROR(fits_read_pix(fitsFP, datatype, fPixel, n_pixels, null_value, buffer, nullptr, &status));
+            return;
+        }
+        if(datatype != TFLOAT) throw std::invalid_argument {"FITS::HDU: 16-bit floats can only be read as TFLOAT or TSHORT."};
+        long axes[2];
+        CHECK_FITS_ERROR(fits_get_img_size(fitsFP, 2, axes, &status));
+        const long long first_pixel {static_cast<long long>(first_row) * axes[0] + 1};
+        const long long chunk {std::min<long long>(n_pixels, 1ll << 18)};
+        encoded.resize(static_cast<size_t>(chunk));
+        float *output {static_cast<float*>(buffer)};
+        for(long long p {0}; p < n_pixels; p += chunk){
+            const long long n {std::min(chunk, n_pixels - p)};
+            CHECK_FITS_ERROR(fits_read_img(fitsFP, TSHORT, first_pixel + p, n, nullptr, encoded.data(), nullptr, &status));
+            decode_pixels(encoded.data(), static_cast<size_t>(n), encoding, 1.0f, output + p);
+        }
+    }
+};
+
+
+
+void FITS::HDU::load_image() const {
+    std::shared_ptr<char[]> pixels {new char[image_bytes()]};
+    source->read_pixels(hdu_number, datatype, static_cast<long long>(axes[0]) * axes[1], pixels.get(), 0, encoding);
+    storage = std::move(pixels);
+    data = storage.get();
+    source.reset();
+}
+
+
+
+void FITS::HDU::read_image(void *buffer, int datatype) const {
+    if(data){
+        if(datatype != this->datatype)
+            throw std::invalid_argument {"FITS::HDU::read_image: cannot convert pixels already in memory."};
+        memcpy(buffer, data, image_bytes());
+    }else if(source){
+        source->read_pixels(hdu_number, datatype, static_cast<long long>(axes[0]) * axes[1], buffer, 0, encoding);
+    }else{
+        throw std::runtime_error {"FITS::HDU::read_image: the HDU holds no pixels and is not backed by a file."};
+    }
+}
+
+
+
+void FITS::HDU::read_image_rows(void *buffer, int datatype, long first_row, long n_rows) const {
+    if(first_row < 0 || n_rows < 0 || first_row + n_rows > axes[1])
+        throw std::invalid_argument {"FITS::HDU::read_image_rows: rows out of the image bounds."};
+    if(data){
+        if(datatype != this->datatype)
+            throw std::invalid_argument {"FITS::HDU::read_image_rows: cannot convert pixels already in memory."};
+        const size_t row_bytes {static_cast<size_t>(axes[0]) * std::abs(bitpix) / 8};
+        memcpy(buffer, static_cast<const char*>(data) + first_row * row_bytes, n_rows * row_bytes);
+    }else if(source){
+        source->read_pixels(hdu_number, datatype, static_cast<long long>(axes[0]) * n_rows, buffer, first_row, encoding);
+    }else{
+        throw std::runtime_error {"FITS::HDU::read_image_rows: the HDU holds no pixels and is not backed by a file."};
+    }
+}
+
+
+
+size_t FITS::HDU::pixel_bytes(int datatype){
+    switch (datatype) {
+        case TBYTE: return 1;
+        case TSHORT: return sizeof(short);
+        case TINT: return sizeof(int);
+        case TLONG: return sizeof(long);
+        case TFLOAT: return sizeof(float);
+        case TDOUBLE: return sizeof(double);
+        default: throw std::invalid_argument {"FITS::HDU::pixel_bytes: data type not supported."};
+    }
+}
+
+
+
+// `prefix` followed by a positive integer, e.g. NAXIS2.
+inline bool is_indexed_keyword(std::string_view key, std::string_view prefix){
+    if(key.size() <= prefix.size() || key.substr(0, prefix.size()) != prefix || key[prefix.size()] == '0') return false;
+    for(char c : key.substr(prefix.size()))
+        if(c < '0' || c > '9') return false;
+    return true;
+}
+
+
+
+/*
+    Keywords managed by cfitsio, which are not stored in the HDU header. These include the
+    structure of the binary tables holding compressed images and the scaling of the pixels,
+    which `FITS` reads as physical values.
+*/
+inline bool is_special_keyword(std::string_view key){
+    static constexpr std::string_view keywords[] {"SIMPLE", "BITPIX", "COMMENT", "EXTEND", "NAXIS",
+        "BSCALE", "BZERO", "BLANK", "PIXENC", "XTENSION", "PCOUNT", "GCOUNT", "TFIELDS", "THEAP",
+        "ZIMAGE", "ZSIMPLE", "ZTENSION", "ZBITPIX", "ZNAXIS", "ZCMPTYPE", "ZQUANTIZ", "ZDITHER0",
+        "ZEXTEND", "ZBLOCKED", "ZPCOUNT", "ZGCOUNT", "ZHECKSUM", "ZDATASUM", "ZBLANK"};
+    for(std::string_view k : keywords)
+        if(key == k) return true;
+    static constexpr std::string_view indexed[] {"NAXIS", "ZNAXIS", "ZTILE", "ZNAME", "ZVAL", "TTYPE", "TFORM"};
+    for(std::string_view prefix : indexed)
+        if(is_indexed_keyword(key, prefix)) return true;
+    return false;
+}
+
+
+
+/*
+    Parse the value of a string card, e.g. 'O''Neil  ', into `output`, which must be able to hold
+    FLEN_VALUE characters: quotes are removed, doubled quotes unescaped and trailing spaces dropped.
+    Returns `false` if `card` does not hold a string.
+*/
+inline bool parse_string_card(const char *card, char *output){
+    if(card[0] != '\'') return false;
+    size_t length {0};
+    for(const char *c {card + 1}; *c; c++){
+        if(*c == '\''){
+            if(c[1] != '\'') break;
+            c++;
+        }
+        output[length++] = *c;
+    }
+    while(length > 0 && output[length - 1] == ' ') length--;
+    output[length] = '\0';
+    return true;
+}
+
+
+
+/*
+    Parse a floating point card, also accepting the Fortran 'D' exponent allowed by the standard.
+*/
+inline bool parse_double_card(const char *card, double& value){
+    char buffer[FLEN_VALUE];
+    size_t length {0};
+    for(; card[length] && length < FLEN_VALUE - 1; length++)
+        buffer[length] = (card[length] == 'D' || card[length] == 'd') ? 'E' : card[length];
+    return FITS::HDU::parse_value(std::string_view {buffer, length}, value);
 }
 
 FITS::FITS(std::string filename, Mode mode) : filename {filename}, open_mode {mode} {
@@ -42,15 +209,24 @@ FITS::FITS(std::string filename, Mode mode) : filename {filename}, open_mode {mo
 }
 
 FITS::~FITS() {
-    if(fitsFP){
+    if(fitsFP && !reader){
         int status = 0;
         fits_close_file(fitsFP, &status);
     }
 }
 
+void FITS::HDU::set_image(int bitpix, std::unique_ptr<char[]> data, long xDim, long yDim){
+    char *pixels {data.get()};
+    set_image(bitpix, pixels, xDim, yDim);
+    storage = std::shared_ptr<char[]> {std::move(data)};
+}
+
+
+
 void FITS::HDU::set_image(int bitpix, char *data, long xDim, long yDim){
-    if(this->data) delete[] static_cast<char*>(this->data);
     this->data = data;
+    this->storage.reset();
+    this->source.reset();
     this->bitpix = bitpix;
     axes[0] = xDim;
     axes[1] = yDim;
@@ -67,6 +243,9 @@ void FITS::HDU::set_image(int bitpix, char *data, long xDim, long yDim){
     case LONG_IMG:
         this->datatype = TLONG;
         break;
+    case SHORT_IMG:
+        this->datatype = TSHORT;
+        break;
     default:
         throw std::invalid_argument {"set_image: data type of first argument not recognised."};
         break;
@@ -76,6 +255,8 @@ void FITS::HDU::set_image(int bitpix, char *data, long xDim, long yDim){
 
 
 void FITS::read(){
+    // Headers only: pixels are timed as "fits_read_pixels" when they are read.
+    ASTROIO_TIMED_SCOPE("fits_read_headers");
     std::ifstream fp {filename.c_str()};
     if(!fp.good()){
         std::cerr << "FITS::from_file: requested file '" << filename << "' does not exist or is inaccessible." << std::endl;
@@ -84,63 +265,76 @@ void FITS::read(){
     fp.close();
     int status {0}, nHDUs {-1};
     CHECK_FITS_ERROR(fits_open_file(&fitsFP, filename.c_str(), READONLY, &status));
+    // From now on, the file is closed by the reader.
+    reader = std::make_shared<Reader>(fitsFP);
     CHECK_FITS_ERROR(fits_get_num_hdus(fitsFP, &nHDUs,  &status));
     HDUs.resize(nHDUs);
 
     int dims;
     int nKeys;
 
-    char *data;
     int bitPix {-1};
     int dataType {-1};
     long axes[2];
     char keyCard[FLEN_CARD];
     char valueCard[FLEN_CARD];
     char commentCard[FLEN_CARD];
+    char stringCard[FLEN_VALUE];
     for(int hdu {1}; hdu <= nHDUs; hdu++){
         HDU& cHDU {HDUs[hdu-1]};
         CHECK_FITS_ERROR(fits_movabs_hdu(fitsFP, hdu, NULL, &status));
         CHECK_FITS_ERROR(fits_get_hdrspace(fitsFP, &nKeys, NULL, &status));
+        cHDU.header.reserve(nKeys);
+        PixelEncoding encoding {PixelEncoding::FLOAT32};
         for(int key {1}; key <= nKeys; key++){
             CHECK_FITS_ERROR(fits_read_keyn(fitsFP, key, keyCard, valueCard, commentCard, &status));
-            if(!is_special_keyword(keyCard)){
-                std::stringstream ss;
-                ss << (char*)valueCard;
-                int ivalue;
-                ss >> ivalue;
-                if(!ss.fail() && ss.eof()) {
-                    cHDU.add_keyword(keyCard, ivalue, commentCard);
-                    continue;
-                }
-                ss.str(valueCard);
-                double dvalue;
-                ss >> dvalue;
-                if(!ss.fail() && ss.eof()) {
-                    cHDU.add_keyword(keyCard, dvalue, commentCard);
-                    continue;
-                }
-                cHDU.add_keyword(keyCard, valueCard, commentCard);
-            }    
+            if(std::string_view {keyCard} == "PIXENC" && parse_string_card(valueCard, stringCard)){
+                const std::string_view name {stringCard};
+                if(name == "FLOAT16") encoding = PixelEncoding::FLOAT16;
+                else if(name == "BFLOAT16") encoding = PixelEncoding::BFLOAT16;
+                else throw std::runtime_error {"FITS::from_file: unknown pixel encoding '" + std::string {name} + "'."};
+            }
+            if(is_special_keyword(keyCard)) continue;
+            long long ivalue;
+            double dvalue;
+            if(parse_string_card(valueCard, stringCard))
+                cHDU.add_keyword(keyCard, std::string_view {stringCard}, commentCard);
+            else if(HDU::parse_value(std::string_view {valueCard}, ivalue))
+                cHDU.add_keyword(keyCard, ivalue, commentCard);
+            else if(parse_double_card(valueCard, dvalue))
+                cHDU.add_keyword(keyCard, dvalue, commentCard);
+            else // logical and complex values
+                cHDU.add_keyword(keyCard, std::string_view {valueCard}, commentCard);
         }
             
         CHECK_FITS_ERROR(fits_get_img_dim(fitsFP, &dims, &status));
         if(dims == 2){
-            // it is an actual image.
-            // get the data type used
-            CHECK_FITS_ERROR(fits_get_img_type(fitsFP,&bitPix, &status));
+            // it is an actual image, possibly compressed.
+            // get the data type of the physical values, i.e. after BSCALE and BZERO are applied.
+            CHECK_FITS_ERROR(fits_get_img_equivtype(fitsFP, &bitPix, &status));
             CHECK_FITS_ERROR(fits_get_img_size(fitsFP, dims, axes, &status));
-            data = new char[axes[0] * axes[1] * abs(bitPix) / 8];
+            // Floats encoded with 16 bits are decoded when read.
+            if(encoding != PixelEncoding::FLOAT32){
+                if(bitPix != SHORT_IMG) throw std::runtime_error {"FITS::from_file: encoded pixels are not 16-bit integers."};
+                bitPix = FLOAT_IMG;
+            }
             switch (bitPix) {
                 case BYTE_IMG: dataType = TBYTE; break;
-                case LONG_IMG: dataType = TLONG; break;
+                case SHORT_IMG: dataType = TSHORT; break;
+                // 32 bit pixels: TLONG would be a 64 bit `long` and overflow the image buffer.
+                case LONG_IMG: dataType = TINT; break;
                 case FLOAT_IMG: dataType = TFLOAT; break;
                 case DOUBLE_IMG: dataType = TDOUBLE; break;
                 default: throw std::runtime_error{"FITS::from_file: data type not supported."};
             }
-            // read data
-            long fPixel[2] {1, 1};
-            CHECK_FITS_ERROR(fits_read_pix(fitsFP, dataType, fPixel, axes[0] * axes[1], nullptr, data, nullptr, &status));
-            cHDU.set_image(bitPix, data, axes[0], axes[1]);
+            // Pixels are read when first needed.
+            cHDU.bitpix = bitPix;
+            cHDU.datatype = dataType;
+            cHDU.axes[0] = axes[0];
+            cHDU.axes[1] = axes[1];
+            cHDU.source = reader;
+            cHDU.hdu_number = hdu;
+            cHDU.encoding = encoding;
         } else if(dims != 0){ // 0 is an empty HDU - it is ok, just header information.
             std::cerr << "Unexpected number of dimensions in fits file: " << dims << " instead of 2." << std::endl;
             throw std::exception();
@@ -150,35 +344,158 @@ void FITS::read(){
 
 
 void FITS::append_hdu(const FITS::HDU& hdu){
+    ASTROIO_TIMED_SCOPE("fits_append_hdu", hdu.image_bytes(), hdu.has_image() ? static_cast<size_t>(hdu.get_xdim()) * hdu.get_ydim() : 0);
     long axes[2];
     int status = 0;
-    if(hdu.data == nullptr) {
+    streamed_datatype = -1;
+    streamed_encoding = PixelEncoding::FLOAT32;
+    if(!hdu.has_image()) {
         // It is an empty HDU. Probably the primary HDU.
         // only containing header keywords
-        CHECK_FITS_ERROR(fits_create_img(fitsFP, 32, 0,  nullptr, &status));
+        create_image(32, 0, nullptr);
+        write_header(hdu);
+    }else if(hdu.bitpix == FLOAT_IMG && output_options.encoding != PixelEncoding::FLOAT32){
+        axes[0] = hdu.get_ydim();
+        axes[1] = hdu.get_xdim();
+        const float *pixels {static_cast<const float*>(hdu.get_image_data())};
+        const long long n_pixels {static_cast<long long>(axes[0]) * axes[1]};
+        const float scale {output_options.encoding == PixelEncoding::INT16_SCALED ?
+            int16_scale(max_abs_value(pixels, static_cast<size_t>(n_pixels))) : 1.0f};
+        create_image(SHORT_IMG, 2, axes);
+        write_encoded_pixels(pixels, 0, n_pixels, output_options.encoding, scale);
+        write_header(hdu);
+        HDU encoding_keywords;
+        encoding_keywords.add_encoding_keywords(output_options.encoding, scale);
+        write_header(encoding_keywords);
     }else{
         axes[0] = hdu.get_ydim();
         axes[1] = hdu.get_xdim();
-        CHECK_FITS_ERROR(fits_create_img(fitsFP, hdu.bitpix, 2,  axes, &status));
+        create_image(hdu.bitpix, 2, axes);
         long fPixel[2] {1, 1};
         CHECK_FITS_ERROR(fits_write_pix(fitsFP, hdu.datatype, fPixel, axes[0] * axes[1], (char *) hdu.get_image_data(), &status));
+        write_header(hdu);
     }
-    for(auto& header_entry : hdu.get_header()){
-    auto key = header_entry.first;
-    auto entry = header_entry.second;
-        status = 0;
-        if(entry.data_type == TSTRING){
-            CHECK_FITS_ERROR(fits_update_key(fitsFP, entry.data_type, key.c_str(), entry.data.sval, entry.comment.c_str(), &status));
-        }else{
-            CHECK_FITS_ERROR(fits_update_key(fitsFP, entry.data_type, key.c_str(), &entry.data, entry.comment.c_str(), &status));
+}
+
+
+
+void FITS::create_image(int bitpix, int naxis, long *axes){
+    int status = 0;
+    int compression {NOCOMPRESS};
+    if(naxis > 0){
+        switch (output_options.compression) {
+            case FitsCompression::RICE: compression = RICE_1; break;
+            case FitsCompression::HCOMPRESS: compression = HCOMPRESS_1; break;
+            case FitsCompression::GZIP: compression = GZIP_1; break;
+            default: break;
         }
     }
+    CHECK_FITS_ERROR(fits_set_compression_type(fitsFP, compression, &status));
+    if(compression != NOCOMPRESS){
+        // Only floating point pixels are quantised.
+        CHECK_FITS_ERROR(fits_set_quantize_level(fitsFP, output_options.quantize_level, &status));
+        if(compression == HCOMPRESS_1) CHECK_FITS_ERROR(fits_set_hcomp_scale(fitsFP, output_options.hcompress_scale, &status));
+    }
+    CHECK_FITS_ERROR(fits_create_img(fitsFP, bitpix, naxis, axes, &status));
+}
+
+
+
+void FITS::write_encoded_pixels(const float *data, long long first_pixel, long long n_pixels, PixelEncoding encoding, float scale){
+    int status = 0;
+    // Values are already scaled: cfitsio must write them as they are, whatever BSCALE says.
+    CHECK_FITS_ERROR(fits_set_bscale(fitsFP, 1.0, 0.0, &status));
+    const long long chunk {std::min<long long>(n_pixels, 1ll << 18)};
+    if(encoded_pixels.size() < static_cast<size_t>(chunk)) encoded_pixels.resize(static_cast<size_t>(chunk));
+    for(long long p {0}; p < n_pixels; p += chunk){
+        const long long n {std::min(chunk, n_pixels - p)};
+        encode_pixels(data + p, static_cast<size_t>(n), encoding, scale, encoded_pixels.data());
+        CHECK_FITS_ERROR(fits_write_img(fitsFP, TSHORT, first_pixel + p + 1, n, encoded_pixels.data(), &status));
+    }
+}
+
+
+
+void FITS::write_header(const FITS::HDU& hdu){
+    int status = 0;
+    for(const auto& entry : hdu.get_header()){
+        status = 0;
+        // cfitsio takes the value through a non-const pointer, but does not modify it.
+        CHECK_FITS_ERROR(fits_update_key(fitsFP, entry.data_type, entry.keyword.c_str(), const_cast<void*>(entry.value()),
+            entry.comment.c_str(), &status));
+    }
+}
+
+
+
+void FITS::append_image_hdu(const FITS::HDU& hdu, int bitpix, long x_dim, long y_dim, float max_abs){
+    if(open_mode != Mode::APPEND) throw std::runtime_error {"'FITS::append_image_hdu' can only be called in APPEND mode."};
+    switch (bitpix) {
+        case BYTE_IMG: streamed_datatype = TBYTE; break;
+        case SHORT_IMG: streamed_datatype = TSHORT; break;
+        case LONG_IMG: streamed_datatype = TLONG; break;
+        case FLOAT_IMG: streamed_datatype = TFLOAT; break;
+        case DOUBLE_IMG: streamed_datatype = TDOUBLE; break;
+        default: throw std::invalid_argument {"FITS::append_image_hdu: data type not supported."};
+    }
+    streamed_axes[0] = x_dim;
+    streamed_axes[1] = y_dim;
+    // Rows are still given as floats, and converted when written.
+    streamed_encoding = bitpix == FLOAT_IMG ? output_options.encoding : PixelEncoding::FLOAT32;
+    streamed_scale = streamed_encoding == PixelEncoding::INT16_SCALED ? int16_scale(max_abs) : 1.0f;
+    create_image(streamed_encoding == PixelEncoding::FLOAT32 ? bitpix : SHORT_IMG, 2, streamed_axes);
+    write_header(hdu);
+    if(streamed_encoding != PixelEncoding::FLOAT32){
+        HDU encoding_keywords;
+        encoding_keywords.add_encoding_keywords(streamed_encoding, streamed_scale);
+        write_header(encoding_keywords);
+    }
+}
+
+
+
+void FITS::write_image_rows(const void *data, long first_row, long n_rows){
+    if(streamed_datatype < 0) throw std::runtime_error {"FITS::write_image_rows: no image HDU is being written."};
+    if(first_row < 0 || first_row + n_rows > streamed_axes[1])
+        throw std::invalid_argument {"FITS::write_image_rows: rows out of the image bounds."};
+    const size_t n_pixels {static_cast<size_t>(streamed_axes[0]) * n_rows};
+    ASTROIO_TIMED_SCOPE("fits_write_image_rows", n_pixels * HDU::pixel_bytes(streamed_datatype), n_pixels);
+    if(streamed_encoding != PixelEncoding::FLOAT32){
+        write_encoded_pixels(static_cast<const float*>(data), static_cast<long long>(first_row) * streamed_axes[0],
+            static_cast<long long>(n_pixels), streamed_encoding, streamed_scale);
+        return;
+    }
+    int status = 0;
+    long fPixel[2] {1, first_row + 1};
+    CHECK_FITS_ERROR(fits_write_pix(fitsFP, streamed_datatype, fPixel, n_pixels,
+        const_cast<void*>(data), &status));
+}
+
+
+
+void FITS::HDU::add_encoding_keywords(PixelEncoding encoding, float scale){
+    switch (encoding) {
+        case PixelEncoding::INT16_SCALED:
+            add_keyword("BSCALE", static_cast<double>(scale), "Physical value = BSCALE * stored value");
+            add_keyword("BZERO", 0.0, "Offset of the physical values");
+            add_keyword("BLANK", static_cast<int>(INT16_BLANK), "Stored value of NaNs");
+            break;
+        case PixelEncoding::FLOAT16:
+            add_keyword("PIXENC", std::string_view {"FLOAT16"}, "Pixels are IEEE half precision floats");
+            break;
+        case PixelEncoding::BFLOAT16:
+            add_keyword("PIXENC", std::string_view {"BFLOAT16"}, "Pixels are bfloat16 floats");
+            break;
+        default:
+            break;
+    }
 }
 
 
 
 void FITS::write(){
     if(open_mode != Mode::WRITE) throw std::runtime_error {"'FITS::to_file' can only be called in WRITE mode."};
+    ASTROIO_TIMED_SCOPE("fits_write");
     std::ifstream fp {filename.c_str()};
     // remove file if exists already - we overwrite by default.
     if(fp.good()){
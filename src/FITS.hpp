@@ -11,6 +11,13 @@
 #include <cmath>
 #include <iostream>
 #include <filesystem>
+#include <memory>
+#include <string_view>
+#include <charconv>
+#include <algorithm>
+#include <type_traits>
+#include "array_view.hpp"
+#include "pixel_encoding.hpp"
 
 
 void print_fits_error(int errorCode);
@@ -23,131 +30,281 @@ void print_fits_error(int errorCode);
     }\
 })
 
+/**
+ * @brief Tile compression cfitsio applies to the images written by `FITS`.
+ */
+enum class FitsCompression {NONE, RICE, HCOMPRESS, GZIP};
+
+
+/**
+ * @brief How `FITS` stores the images it writes. Compressed images are written by cfitsio as
+ * tile compressed image extensions, which cfitsio, and hence `FITS`, reads like any other image.
+ * A compressed file always starts with a primary HDU without pixels.
+ */
+struct FitsOutputOptions {
+    FitsCompression compression {FitsCompression::NONE};
+    // Quantisation of FLOAT32 pixels before compression, as a fraction of the noise of each tile
+    // (see `fits_set_quantize_level`): higher values keep more precision. 0 keeps the floats
+    // exact, which cfitsio only supports by compressing them with GZIP.
+    float quantize_level {16.0f};
+    // HCOMPRESS scale factor; 0 is lossless.
+    float hcompress_scale {0.0f};
+    // Encoding of floating point images. 16-bit encodings halve the size of the images before
+    // any compression, which is then lossless.
+    PixelEncoding encoding {PixelEncoding::FLOAT32};
+};
+
+
 /**
  * @brief A class that handles I/O operations on FITS files.
 */
 class FITS {
 
+    // Shared handle to a file open in READ mode, used to load image data on demand.
+    class Reader;
+
     public:
 
     /**
      * @brief Represents Header Data Unit in a FITS file.
+     *
+     * HDUs of a file open in READ mode are loaded lazily: header keywords and image dimensions
+     * are read when the file is opened, pixels only when first requested with `get_image_data`.
+     * Alternatively, `read_image` reads the pixels straight into a caller provided buffer. The
+     * file stays open as long as one of its HDUs (or copies of them) still needs it.
      * 
      * @bug Need to check whether BITPIX is set.
     */
     class HDU {
 
+        public:
+        /**
+         * @brief A string stored inline, without heap allocations, when it is shorter than `N`
+         * characters. Longer strings, e.g. values that cfitsio writes with the CONTINUE
+         * convention, are kept whole on the heap.
+         */
+        template <size_t N>
+        class SmallString {
+            char buffer[N] {};
+            size_t length {0};
+            // Strings of `N` characters or more.
+            std::string long_str;
+
+            public:
+            SmallString() {}
+            SmallString(const char *str) { assign(str, std::strlen(str)); }
+            SmallString(const std::string& str) { assign(str.data(), str.size()); }
+            SmallString(std::string_view str) { assign(str.data(), str.size()); }
+
+            void assign(const char *str, size_t len){
+                length = len;
+                if(len < N){
+                    std::memcpy(buffer, str, len);
+                    buffer[len] = '\0';
+                    long_str.clear();
+                }else{
+                    buffer[0] = '\0';
+                    long_str.assign(str, len);
+                }
+            }
+
+            const char* c_str() const { return length < N ? buffer : long_str.c_str(); }
+            size_t size() const { return length; }
+            bool empty() const { return length == 0; }
+            std::string_view view() const { return {c_str(), length}; }
+            std::string str() const { return std::string {c_str(), length}; }
+
+            bool operator==(std::string_view other) const { return view() == other; }
+            bool operator!=(std::string_view other) const { return view() != other; }
+        };
+
+        /**
+         * @brief A header keyword, with its value and comment. Strings that fit in a card are
+         * stored inline, so that entries live in a contiguous array and are copied without
+         * allocations.
+         */
         class HeaderEntry {
             public:
-            // TODO use std::variant
+            // Value of the keyword, when `data_type` is TLONGLONG or TDOUBLE.
             union {
-                char *sval;
                 long long llval;
                 double dval;
-            } data;
-            int data_type;
-            std::string comment;
-            std::string keyword;
-
-            ~HeaderEntry(){
-                if (data_type == TSTRING && data.sval) {
-                    delete[] data.sval;
-                    data.sval = nullptr;
-                }
-            };
-
-            HeaderEntry(){};
-
-            HeaderEntry(const HeaderEntry& other){
-                this->data = other.data;
-                this->data_type = other.data_type;
-                this->comment = other.comment;
-                this->keyword = other.keyword;
-                if(this->data_type == TSTRING){
-                    this->data.sval = new char[strlen(other.data.sval) + 1];
-                    strcpy(this->data.sval, other.data.sval);
-                }
-            };
-
-            HeaderEntry(HeaderEntry&& other){
-                this->data = other.data;
-                this->data_type = other.data_type;
-                this->comment = std::move(other.comment);
-                this->keyword = std::move(other.keyword);
-                other.data.sval = nullptr;
-            };
-
-
-            HeaderEntry& operator=(const HeaderEntry& other){
-                this->data = other.data;
-                this->data_type = other.data_type;
-                this->comment = other.comment;
-                this->keyword = other.keyword;
-                if(this->data_type == TSTRING){
-                    this->data.sval = new char[strlen(other.data.sval) + 1];
-                    strcpy(this->data.sval, other.data.sval);
-                }
-                return *this;
+            } data {0};
+            int data_type {TLONGLONG};
+            // Value of the keyword, when `data_type` is TSTRING.
+            SmallString<FLEN_VALUE> sval;
+            SmallString<FLEN_COMMENT> comment;
+            SmallString<FLEN_KEYWORD> keyword;
+
+            /**
+             * @return pointer to the value, in the form expected by `fits_update_key`.
+             */
+            const void* value() const {
+                if(data_type == TSTRING) return sval.c_str();
+                return &data;
+            }
+        };
+
+        /**
+         * @brief Header keywords of an HDU, kept sorted by keyword in a contiguous array. Lookups
+         * are binary searches and the iteration order is the keyword one, as for a `std::map`.
+         */
+        class Header {
+            std::vector<HeaderEntry> entries;
+
+            std::vector<HeaderEntry>::const_iterator lower_bound(std::string_view key) const {
+                return std::lower_bound(entries.begin(), entries.end(), key,
+                    [](const HeaderEntry& entry, std::string_view k){ return entry.keyword.view() < k; });
             }
 
-            HeaderEntry& operator=(HeaderEntry&& other){
-                this->data = other.data;
-                this->data_type = other.data_type;
-                this->comment = std::move(other.comment);
-                this->keyword = std::move(other.keyword);
-                other.data.sval = nullptr;
-                return *this;
-            };
+            public:
+            using const_iterator = std::vector<HeaderEntry>::const_iterator;
+
+            /**
+             * @brief Insert `entry`, unless the header already holds its keyword.
+             * @return `true` if the entry was inserted.
+             */
+            bool insert(const HeaderEntry& entry){
+                auto it = lower_bound(entry.keyword.view());
+                if(it != entries.end() && it->keyword == entry.keyword.view()) return false;
+                entries.insert(it, entry);
+                return true;
+            }
+
+            /**
+             * @return pointer to the entry of `key`, or `nullptr` if the header does not hold it.
+             */
+            const HeaderEntry* find(std::string_view key) const {
+                auto it = lower_bound(key);
+                if(it == entries.end() || it->keyword != key) return nullptr;
+                return &*it;
+            }
+
+            /**
+             * @return the entry of `key`. Throws `std::out_of_range` if the header does not hold it.
+             */
+            const HeaderEntry& at(std::string_view key) const {
+                const HeaderEntry *entry {find(key)};
+                if(!entry) throw std::out_of_range {"FITS::HDU::Header: keyword '" + std::string {key} + "' not found."};
+                return *entry;
+            }
+
+            size_t count(std::string_view key) const { return find(key) ? 1 : 0; }
+            size_t size() const { return entries.size(); }
+            bool empty() const { return entries.empty(); }
+            void reserve(size_t n) { entries.reserve(n); }
+            const_iterator begin() const { return entries.begin(); }
+            const_iterator end() const { return entries.end(); }
         };
 
-        std::map<std::string, HeaderEntry> header;
+        /**
+         * @brief Parse a number, or a string, out of the value of a keyword. Leading and trailing
+         * spaces and a leading '+' sign are ignored.
+         *
+         * @return `true` if the whole of `str` was parsed.
+         */
+        template <typename T>
+        static bool parse_value(std::string_view str, T& value){
+            if constexpr (std::is_same_v<T, std::string>) {
+                value = std::string {str};
+                return true;
+            } else {
+                static_assert(std::is_arithmetic_v<T>, "FITS::HDU::parse_value: unsupported type.");
+                while(!str.empty() && str.front() == ' ') str.remove_prefix(1);
+                while(!str.empty() && str.back() == ' ') str.remove_suffix(1);
+                if(str.size() > 1 && str.front() == '+') str.remove_prefix(1);
+                if(str.empty()) return false;
+                // Parsed at full precision, then cast, as the numeric values stored in a header.
+                std::conditional_t<std::is_floating_point_v<T>, double, long long> parsed;
+                const char *last {str.data() + str.size()};
+                auto result = std::from_chars(str.data(), last, parsed);
+                if(result.ec != std::errc {} || result.ptr != last) return false;
+                value = static_cast<T>(parsed);
+                return true;
+            }
+        }
+
+        private:
+        Header header;
         long axes[2] {0, 0};
         int bitpix = -1;
         int datatype = -1;
-        void *data = nullptr;
+        // Image pixels: either a view of a buffer owned by the caller, or a pointer into `storage`.
+        // Pixels are loaded on first access, hence the `mutable`.
+        mutable void *data = nullptr;
+        // Pixels owned by the HDU, shared with its copies and deleted with the last of them.
+        mutable std::shared_ptr<char[]> storage;
+        // File the pixels are read from, if they have not been loaded yet, and HDU number within it.
+        mutable std::shared_ptr<Reader> source;
+        int hdu_number {0};
+        // Encoding of the 16-bit pixels of a FLOAT16 or BFLOAT16 image in the file, decoded when read.
+        PixelEncoding encoding {PixelEncoding::FLOAT32};
+
+        void load_image() const;
         
         friend class FITS;
         public:
 
+        HDU() {}
+        HDU(const HDU& other) = default;
+        HDU& operator=(const HDU& other) = default;
+
+        /*
+            A view of a caller buffer stays valid in the moved-from object, while owned pixels
+            are transferred to the new one.
+        */
+        HDU(HDU&& other) : header {std::move(other.header)}, bitpix {other.bitpix}, datatype {other.datatype},
+                data {other.data}, storage {std::move(other.storage)}, source {std::move(other.source)},
+                hdu_number {other.hdu_number}, encoding {other.encoding} {
+            axes[0] = other.axes[0];
+            axes[1] = other.axes[1];
+            if(storage) other.data = nullptr;
+        }
+
+        HDU& operator=(HDU&& other){
+            if(this == &other) return *this;
+            header = std::move(other.header);
+            axes[0] = other.axes[0];
+            axes[1] = other.axes[1];
+            bitpix = other.bitpix;
+            datatype = other.datatype;
+            data = other.data;
+            storage = std::move(other.storage);
+            source = std::move(other.source);
+            hdu_number = other.hdu_number;
+            encoding = other.encoding;
+            if(storage) other.data = nullptr;
+            return *this;
+        }
+
         /**
-         * @brief Add a new (keyword, value, comment) triple to the HDU header.
+         * @brief Add a new (keyword, value, comment) triple to the HDU header. If the header
+         * already holds the keyword, it is left unchanged.
          * 
          * @param key Unique string identifier for the new header entry.
          * @param value Value associated with the key. Its type must be one of the following:
-         * `char`, `char*`, `short`, `unsigned short`, `int`, `unsigned int`, `long`,
-         * `unsigned long`, `long long`, `float`, `double`. 
+         * `char`, `char*`, `std::string`, `short`, `unsigned short`, `int`, `unsigned int`, `long`,
+         * `unsigned long`, `long long`, `float`, `double`. Strings longer than a FITS card can
+         * hold are kept whole, and written with the CONTINUE convention.
          * @param comment A string describing the entry.
          * 
          * @author Cristian Di Pietrantonio
         */
-        void add_keyword(const std::string key, const std::string value, const std::string comment){
+        void add_keyword(std::string_view key, std::string_view value, std::string_view comment){
             HeaderEntry he;
             he.keyword = key;
             he.comment = comment;
-            size_t slen {value.length()};
-            he.data.sval = new char[slen + 1];
-            std::strcpy(he.data.sval, value.c_str());
+            he.sval = value;
             he.data_type = TSTRING;
-            this->header.insert({key, he});
+            this->header.insert(he);
         }
 
-        void add_keyword(const std::string key, char* const value, const std::string comment){
+        template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+        void add_keyword(std::string_view key, const T value, std::string_view comment){
             HeaderEntry he;
             he.keyword = key;
             he.comment = comment;
-            size_t slen {std::strlen(value)};
-            he.data.sval = new char[slen + 1];
-            std::strcpy(he.data.sval, value);
-            he.data_type = TSTRING;
-            this->header.insert({key, he});
-        }
-
-        template <typename T>
-        void add_keyword(const std::string key, const T value, const std::string comment){
-            HeaderEntry he;
-            he.keyword = key;
-            he.comment = comment;
-            if(typeid(T) == typeid(float) || typeid(T) == typeid(double)){
+            if(std::is_floating_point_v<T>){
                 if(std::isnan(value) || std::isinf(value)){
                     std::cerr << "WARNING: FITS::add_keyword: value for " << key << " is not valid." << std::endl;
                     he.data.dval = 0.0;
@@ -159,33 +316,35 @@ class FITS {
                 he.data.llval = static_cast<long long>(value);
                 he.data_type = TLONGLONG;
             }
-            this->header.insert({key, he});
+            this->header.insert(he);
         }
 
         /**
-         * @brief retrieve a header entry.
+         * @brief retrieve a header entry. String values are converted to `T`, which can also be
+         * `std::string`.
         */
         template <typename T>
-        std::pair<T, std::string> get_keyword(std::string key){
-            HeaderEntry& he {header.at(key)};
-            T val;
+        std::pair<T, std::string> get_keyword(std::string_view key) const {
+            const HeaderEntry& he {header.at(key)};
+            T val {};
             switch (he.data_type) {
-                case TSTRING:{
-                    std::stringstream extractor;
-                    extractor << he.data.sval;
-                    extractor >> val;
+                case TSTRING:
+                    if(!parse_value(he.sval.view(), val))
+                        throw std::invalid_argument {"FITS::HDU::get_keyword: cannot convert the value of '" +
+                            std::string {key} + "': " + he.sval.str()};
                     break;
-                }
                 case TDOUBLE:
-                    val = static_cast<T>(he.data.dval);
+                    if constexpr (std::is_arithmetic_v<T>) val = static_cast<T>(he.data.dval);
+                    else val = std::to_string(he.data.dval);
                     break;
                 case TLONGLONG:
-                    val = static_cast<T>(he.data.llval);
+                    if constexpr (std::is_arithmetic_v<T>) val = static_cast<T>(he.data.llval);
+                    else val = std::to_string(he.data.llval);
                     break;
                 default:
-                    throw std::exception(); // TODO better exception.
+                    throw std::runtime_error {"FITS::HDU::get_keyword: unexpected data type."};
             }
-            return std::make_pair(val, he.comment);
+            return std::make_pair(val, he.comment.str());
         }
 
         /**
@@ -193,6 +352,10 @@ class FITS {
          * data type cannot be inferred by the associated pointer. One such case is when
          * reading a FITS file using the cfitsio library, where the data type is given by the
          * BITPIX value.
+         *
+         * The HDU does not take ownership of `data`: it is a view of a buffer owned by the caller,
+         * which must stay valid as long as the HDU, or one of its copies, is used. Pixels are not
+         * copied when the HDU is copied nor when it is written to a file.
          * 
          * @param bitpix: BITPIX value as defined by the cfitsio library. This value is returned
          * by the `fits_get_img_type` function.
@@ -202,10 +365,28 @@ class FITS {
         */
         void set_image(int bitpix, char *data, long x_dim, long y_dim);
 
+        /**
+         * @brief Same as above, but the HDU takes ownership of `data`. Copies of the HDU share
+         * the array, which is deleted together with the last of them.
+         */
+        void set_image(int bitpix, std::unique_ptr<char[]> data, long x_dim, long y_dim);
+
+        /**
+         * @brief Add the keywords describing 16-bit pixels encoded with `encoding` and, for
+         * INT16_SCALED, `scale` (see `encode_pixels`). Used for images encoded by the caller,
+         * e.g. on GPU, and set with `set_image` as SHORT_IMG.
+         */
+        void add_encoding_keywords(PixelEncoding encoding, float scale = 1.0f);
+
+        /**
+         * @brief Set the array of data representing an image, inferring the data type from the
+         * pointer. As for the function above, `data` is a view of a buffer owned by the caller.
+         */
         template <typename T>
         void set_image(T *data, long xDim, long yDim){
-            if(this->data) delete[] static_cast<char*>(this->data);
             this->data = data;
+            this->storage.reset();
+            this->source.reset();
             if(typeid(T) == typeid(float)){
                 this->datatype = TFLOAT;
                 this->bitpix = FLOAT_IMG;
@@ -218,6 +399,9 @@ class FITS {
             }else if(typeid(T) == typeid(long)){
                 this->datatype = TLONG;
                 this->bitpix = LONG_IMG;
+            }else if(typeid(T) == typeid(short)){
+                this->datatype = TSHORT;
+                this->bitpix = SHORT_IMG;
             }else 
                 throw std::invalid_argument {"set_image: data type of first argument not recognised."};
             axes[0] = xDim;
@@ -229,8 +413,8 @@ class FITS {
         bool operator==(const HDU& other) const {
             if(axes[0] != other.axes[0] || axes[1] != other.axes[1] || 
                 bitpix != other.bitpix) return false;
-            char *pData {reinterpret_cast<char*>(data)};
-            char *pOtherData {reinterpret_cast<char*>(other.data)};
+            const char *pData {reinterpret_cast<const char*>(get_image_data())};
+            const char *pOtherData {reinterpret_cast<const char*>(other.get_image_data())};
 
             for(long long x {0}; x < axes[0] * axes[1] * std::abs(bitpix) / 8; x++){
                 if(*pData++ != *pOtherData++) return false;
@@ -242,8 +426,95 @@ class FITS {
             return !(*this == other);
         }
         
-        void *get_image_data(){ return data; }
-        const void *get_image_data() const { return data; }
+        /**
+         * @brief Return the image pixels, reading them from the file on the first call.
+         * @return pointer to the pixels, or `nullptr` if the HDU has no image.
+         */
+        void *get_image_data(){
+            if(!data && source) load_image();
+            return data;
+        }
+
+        const void *get_image_data() const {
+            if(!data && source) load_image();
+            return data;
+        }
+
+        /**
+         * @brief Copy the image pixels into `buffer`, which must be at least `image_bytes()` long.
+         * If the pixels were not loaded yet, they are read from the file straight into `buffer`
+         * and are not kept by the HDU. Throws `std::runtime_error` if the HDU holds no pixels
+         * and was not read from a file.
+         */
+        void read_image(void *buffer) const { read_image(buffer, datatype); }
+
+        /**
+         * @brief Same as above, but pixels are converted by cfitsio to the type `datatype`
+         * (e.g. TFLOAT) while they are read. `buffer` must be large enough to hold them.
+         * Conversion is only possible for pixels that were not loaded yet.
+         */
+        void read_image(void *buffer, int datatype) const;
+
+        /**
+         * @brief Copy `n_rows` consecutive rows of the image, starting from `first_row` (0-based),
+         * into `buffer`, converting pixels to `datatype` as above. Only the selected rows are read
+         * from the file.
+         */
+        void read_image_rows(void *buffer, int datatype, long first_row, long n_rows) const;
+
+        /**
+         * @brief Read the image into `out`, a view of `out.dim(0)` rows, each made of the elements
+         * along the other axes, e.g. a slice of a larger array. Pixels are converted to `datatype`,
+         * which must be the type of the elements (or of their components, for complex values).
+         * Rows not contiguous in memory are read in a small buffer and scattered into place. The
+         * view must reside in host memory.
+         */
+        template <typename T, size_t Rank>
+        void read_image(const ArrayView<T, Rank>& out, int datatype) const {
+            static_assert(Rank > 1, "FITS::HDU::read_image: the view must have at least two axes.");
+            const size_t row_elements {out.dim(0) == 0 ? 0 : out.size() / out.dim(0)};
+            if(out.on_gpu()) throw std::invalid_argument {"FITS::HDU::read_image: the view must reside in host memory."};
+            if(static_cast<long>(out.dim(0)) > get_xdim() || static_cast<size_t>(get_ydim()) * pixel_bytes(datatype) != row_elements * sizeof(T))
+                throw std::invalid_argument {"FITS::HDU::read_image: the view does not match the image size."};
+            if(out.is_contiguous()){
+                read_image_rows(out.data(), datatype, 0, static_cast<long>(out.dim(0)));
+                return;
+            }
+            const size_t rows_per_tile {std::max<size_t>(1, (1ul << 20) / std::max<size_t>(1, row_elements * sizeof(T)))};
+            std::vector<std::remove_const_t<T>> tile (std::min(rows_per_tile, out.dim(0)) * row_elements);
+            for(size_t r {0}; r < out.dim(0); r += rows_per_tile){
+                const ArrayView<T, Rank> rows {out.slice(0, r, rows_per_tile)};
+                read_image_rows(tile.data(), datatype, static_cast<long>(r), static_cast<long>(rows.dim(0)));
+                size_t dims[Rank];
+                for(size_t i {0}; i < Rank; i++) dims[i] = rows.dim(i);
+                copy_view(ArrayView<const std::remove_const_t<T>, Rank> {tile.data(), dims}, rows);
+            }
+        }
+
+        /**
+         * @return size, in bytes, of a pixel of type `datatype` (e.g. TFLOAT) in memory.
+         */
+        static size_t pixel_bytes(int datatype);
+
+        /**
+         * @return `true` if the HDU contains image data.
+         */
+        bool has_image() const { return data || source; }
+
+        /**
+         * @return `true` if the HDU owns its pixels, `false` if they are a view of a caller buffer.
+         */
+        bool owns_image() const { return storage != nullptr; }
+
+        /**
+         * @return `true` if the pixels are in memory, `false` if they still have to be read from the file.
+         */
+        bool image_loaded() const { return data != nullptr; }
+
+        /**
+         * @return size, in bytes, of the image.
+         */
+        size_t image_bytes() const { return has_image() ? static_cast<size_t>(axes[0]) * axes[1] * std::abs(bitpix) / 8 : 0; }
 
         long get_xdim() const { return axes[1]; }
 
@@ -253,8 +524,7 @@ class FITS {
 
         int get_datatype() const { return datatype; }
 
-        auto get_header() const { return header; }
-        auto get_header() { return header; }
+        const Header& get_header() const { return header; }
     };
 
     public:
@@ -267,9 +537,26 @@ class FITS {
     std::string filename;
     Mode open_mode {Mode::WRITE};
     fitsfile *fitsFP {nullptr};
+    // In READ mode, owns the open file together with the HDUs not loaded yet.
+    std::shared_ptr<Reader> reader;
+    // Shape and data type of the image HDU being written with `write_image_rows`.
+    long streamed_axes[2] {0, 0};
+    int streamed_datatype {-1};
+    // Encoding and scale of the pixels of that HDU, if they are converted to 16 bits.
+    PixelEncoding streamed_encoding {PixelEncoding::FLOAT32};
+    float streamed_scale {1.0f};
+    FitsOutputOptions output_options;
+    // Pixels converted to 16 bits, a chunk at a time, before they are written.
+    std::vector<int16_t> encoded_pixels;
 
     /*Append an HDU to a FITS file when FITS is opened in APPEND mode.*/
     void append_hdu(const HDU& hdu);
+    // Write the header keywords of `hdu` to the current HDU of the file.
+    void write_header(const HDU& hdu);
+    // Create an image HDU, compressed according to `output_options` if it has pixels.
+    void create_image(int bitpix, int naxis, long *axes);
+    // Encode `n_pixels` floats, stored from pixel `first_pixel` (0-based) on, and write them.
+    void write_encoded_pixels(const float *data, long long first_pixel, long long n_pixels, PixelEncoding encoding, float scale);
     // helper function to read a FITS file during object construction.
     void read();
 
@@ -279,6 +566,19 @@ class FITS {
     FITS(std::string filename, Mode mode = Mode::READ);
     ~FITS();
 
+    // The object owns an open file handle.
+    FITS(const FITS&) = delete;
+    FITS& operator=(const FITS&) = delete;
+
+    /**
+     * @brief Add an HDU to the file. In APPEND mode the HDU is written straight away, otherwise
+     * it is stored and written by `write`. Pixels are never copied: if the HDU holds a view of a
+     * caller buffer, the buffer must stay valid until the HDU is written.
+     *
+     * @param hdu the HDU to add.
+     * @param pos position of the HDU in the file. A negative value appends it at the end.
+     * Ignored in APPEND mode.
+     */
     void add_HDU(const HDU& hdu, int pos = -1) {
         if(open_mode == Mode::APPEND){
             append_hdu(hdu);
@@ -290,6 +590,20 @@ class FITS {
         }
     }
 
+    /**
+     * @brief Same as above, but the HDU is moved into the file rather than copied.
+     */
+    void add_HDU(HDU&& hdu, int pos = -1) {
+        if(open_mode == Mode::APPEND){
+            append_hdu(hdu);
+        }else{
+            if(pos < 0)
+                HDUs.push_back(std::move(hdu));
+            else
+                HDUs.insert(HDUs.begin() + pos, std::move(hdu));
+        }
+    }
+
     HDU& operator[](int idx) {
         return HDUs[idx];
     }
@@ -311,6 +625,63 @@ class FITS {
     } 
 
     void write();
+
+    /**
+     * @brief Set how the image HDUs written from now on are stored: compression, and encoding of
+     * the FLOAT_IMG ones, whose pixels are still given as floats. Other images are written as
+     * they are. See `FitsOutputOptions`.
+     */
+    void set_output_options(const FitsOutputOptions& options) { output_options = options; }
+
+    const FitsOutputOptions& get_output_options() const { return output_options; }
+
+    /**
+     * @brief Append an image HDU whose pixels are written later with `write_image_rows`,
+     * a group of rows at a time, so that the full image never needs to be held in memory.
+     * Only available in APPEND mode.
+     *
+     * @param hdu HDU holding the header keywords of the new HDU. Its image, if any, is ignored.
+     * @param bitpix BITPIX value of the image, as defined by the cfitsio library.
+     * @param x_dim dimension of the image along the fastest varying axis (NAXIS1).
+     * @param y_dim dimension of the image along the slowest varying axis (NAXIS2).
+     * @param max_abs largest absolute value of the pixels, which sets the scale of FLOAT_IMG
+     * images written with the INT16_SCALED encoding (see `max_abs_value`). Ignored otherwise.
+     */
+    void append_image_hdu(const HDU& hdu, int bitpix, long x_dim, long y_dim, float max_abs = 0.0f);
+
+    /**
+     * @brief Write `n_rows` consecutive rows, starting from `first_row` (0-based), of the image
+     * HDU last created with `append_image_hdu`.
+     *
+     * @param data array of `n_rows * x_dim` pixels of the type given by the HDU BITPIX.
+     */
+    void write_image_rows(const void *data, long first_row, long n_rows);
+
+    /**
+     * @brief Same as above, with the rows given as a view of `rows.dim(0)` rows, each made of the
+     * elements along the other axes, e.g. a slice of a larger array. Each row must hold `x_dim`
+     * pixels. Rows not contiguous in memory are gathered in a small buffer, a group at a time.
+     * The view must reside in host memory.
+     */
+    template <typename T, size_t Rank>
+    void write_image_rows(const ArrayView<T, Rank>& rows, long first_row){
+        static_assert(Rank > 1, "FITS::write_image_rows: the view must have at least two axes.");
+        if(rows.on_gpu()) throw std::invalid_argument {"FITS::write_image_rows: the view must reside in host memory."};
+        const size_t row_elements {rows.dim(0) == 0 ? 0 : rows.size() / rows.dim(0)};
+        if(streamed_datatype >= 0 && row_elements * sizeof(T) != static_cast<size_t>(streamed_axes[0]) * HDU::pixel_bytes(streamed_datatype))
+            throw std::invalid_argument {"FITS::write_image_rows: the rows do not match the image width."};
+        if(rows.is_contiguous()){
+            write_image_rows(rows.data(), first_row, static_cast<long>(rows.dim(0)));
+            return;
+        }
+        const size_t rows_per_tile {std::max<size_t>(1, (1ul << 20) / std::max<size_t>(1, row_elements * sizeof(T)))};
+        std::vector<std::remove_const_t<T>> tile (std::min(rows_per_tile, rows.dim(0)) * row_elements);
+        for(size_t r {0}; r < rows.dim(0); r += rows_per_tile){
+            const ArrayView<T, Rank> group {rows.slice(0, r, rows_per_tile)};
+            copy_view(group, tile.data());
+            write_image_rows(tile.data(), first_row + static_cast<long>(r), static_cast<long>(group.dim(0)));
+        }
+    }
 };
 
 #endif
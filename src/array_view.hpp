@@ -0,0 +1,295 @@
+#ifndef __ASTROIO_ARRAY_VIEW_H__
+#define __ASTROIO_ARRAY_VIEW_H__
+
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include "gpu_macros.hpp"
+
+/**
+ * @brief Non-owning, strided view of a multidimensional array of `Rank` axes.
+ *
+ * A view is a pointer to the first element together with the number of elements (`dim`) and
+ * the distance in elements between consecutive ones (`stride`) along each axis, from the
+ * slowest to the fastest varying. Views are cheap to copy and can be passed by value to GPU
+ * kernels: element access and slicing are available in device code. Slicing never allocates
+ * nor copies data; it only produces a new view over the same memory.
+ *
+ * Each view also remembers where its first element is within the array it was originally
+ * taken from (`offset`), so that e.g. the writer of a time range can label intervals correctly.
+ *
+ * The memory must stay valid as long as the view is used. Whether it resides on GPU is recorded
+ * when the view is created, by the containers' `view` methods.
+ *
+ * Example:
+ *      // Channels [64, 96) of the last interval, baselines with the first antenna only.
+ *      auto slice = vis.view().select(0, vis.integration_intervals() - 1).slice(0, 64, 32).slice(1, 0, 1);
+ *      std::complex<float> v {slice(ch, 0, pol)};
+ */
+template <typename T, size_t Rank>
+class ArrayView {
+    static_assert(Rank > 0, "ArrayView: rank must be at least one.");
+
+    T *_data {nullptr};
+    size_t _dims[Rank] {};
+    size_t _strides[Rank] {};
+    size_t _offsets[Rank] {};
+    bool _on_gpu {false};
+
+    template <typename U, size_t R> friend class ArrayView;
+
+    public:
+    using value_type = T;
+    static constexpr size_t rank {Rank};
+
+    /**
+     * @brief Create an empty view.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    ArrayView() {}
+
+    /**
+     * @brief View a contiguous array with dimensions `dims`, the last axis varying fastest.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    ArrayView(T *data, const size_t (&dims)[Rank], bool on_gpu = false) : _data {data}, _on_gpu {on_gpu} {
+        size_t stride {1};
+        for(size_t i {Rank}; i-- > 0;){
+            _dims[i] = dims[i];
+            _strides[i] = stride;
+            stride *= dims[i];
+        }
+    }
+
+    /**
+     * @brief View an array with dimensions `dims` and strides `strides`, in elements.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    ArrayView(T *data, const size_t (&dims)[Rank], const size_t (&strides)[Rank], bool on_gpu = false) :
+            _data {data}, _on_gpu {on_gpu} {
+        for(size_t i {0}; i < Rank; i++){
+            _dims[i] = dims[i];
+            _strides[i] = strides[i];
+        }
+    }
+
+    /**
+     * @brief A view of mutable elements converts to a view of constant ones.
+     */
+    template <typename U, typename = std::enable_if_t<std::is_same_v<const U, T> && !std::is_same_v<U, T>>>
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    ArrayView(const ArrayView<U, Rank>& other) : _data {other._data}, _on_gpu {other._on_gpu} {
+        for(size_t i {0}; i < Rank; i++){
+            _dims[i] = other._dims[i];
+            _strides[i] = other._strides[i];
+            _offsets[i] = other._offsets[i];
+        }
+    }
+
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    T* data() const { return _data; }
+
+    /**
+     * @return the number of elements along `axis`.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    size_t dim(size_t axis) const { return _dims[axis]; }
+
+    /**
+     * @return the distance, in elements, between consecutive elements along `axis`.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    size_t stride(size_t axis) const { return _strides[axis]; }
+
+    /**
+     * @return the index, along `axis`, of the first element of the view in the original array.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    size_t offset(size_t axis) const { return _offsets[axis]; }
+
+    /**
+     * @return the total number of elements in the view.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    size_t size() const {
+        size_t n {1};
+        for(size_t i {0}; i < Rank; i++) n *= _dims[i];
+        return n;
+    }
+
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    bool empty() const { return !_data || size() == 0; }
+
+    /**
+     * @return `true` if the elements reside in GPU memory.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    bool on_gpu() const { return _on_gpu; }
+
+    /**
+     * @return `true` if the elements are stored one after the other, in the order of the axes,
+     * so that the view can be used as a plain array of `size()` elements.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    bool is_contiguous() const {
+        size_t expected {1};
+        for(size_t i {Rank}; i-- > 0;){
+            if(_dims[i] > 1 && _strides[i] != expected) return false;
+            expected *= _dims[i];
+        }
+        return true;
+    }
+
+    /**
+     * @brief Access an element, given one index per axis.
+     */
+    template <typename... Indices>
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    T& operator()(Indices... indices) const {
+        static_assert(sizeof...(Indices) == Rank, "ArrayView: wrong number of indices.");
+        const size_t idx[Rank] {static_cast<size_t>(indices)...};
+        size_t pos {0};
+        for(size_t i {0}; i < Rank; i++) pos += idx[i] * _strides[i];
+        return _data[pos];
+    }
+
+    /**
+     * @brief Restrict the view to the elements [first, first + count) along `axis`. The range is
+     * clamped to the extent of the axis.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    ArrayView slice(size_t axis, size_t first, size_t count) const {
+        ArrayView result {*this};
+        first = first < _dims[axis] ? first : _dims[axis];
+        count = count < _dims[axis] - first ? count : _dims[axis] - first;
+        result._data += first * _strides[axis];
+        result._dims[axis] = count;
+        result._offsets[axis] += first;
+        return result;
+    }
+
+    /**
+     * @brief Fix the index of `axis` to `index`, obtaining a view with one axis less.
+     */
+    template <size_t R = Rank, typename = std::enable_if_t<(R > 1)>>
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    ArrayView<T, Rank - 1> select(size_t axis, size_t index) const {
+        ArrayView<T, Rank - 1> result;
+        result._data = _data + index * _strides[axis];
+        result._on_gpu = _on_gpu;
+        for(size_t i {0}, j {0}; i < Rank; i++){
+            if(i == axis) continue;
+            result._dims[j] = _dims[i];
+            result._strides[j] = _strides[i];
+            result._offsets[j] = _offsets[i];
+            j++;
+        }
+        return result;
+    }
+
+    /**
+     * @brief Same as `select(0, index)`.
+     */
+    template <size_t R = Rank, typename = std::enable_if_t<(R > 1)>>
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    ArrayView<T, Rank - 1> operator[](size_t index) const { return select(0, index); }
+
+    /**
+     * @brief Swap two axes, e.g. to iterate over baselines then channels data stored channel
+     * first. No data is moved.
+     */
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    ArrayView transpose(size_t axis_a, size_t axis_b) const {
+        ArrayView result {*this};
+        result._dims[axis_a] = _dims[axis_b];
+        result._dims[axis_b] = _dims[axis_a];
+        result._strides[axis_a] = _strides[axis_b];
+        result._strides[axis_b] = _strides[axis_a];
+        result._offsets[axis_a] = _offsets[axis_b];
+        result._offsets[axis_b] = _offsets[axis_a];
+        return result;
+    }
+};
+
+
+namespace detail {
+    template <typename T, typename U, size_t Rank>
+    void copy_strided(const ArrayView<T, Rank>& src, const ArrayView<U, Rank>& dst){
+        if constexpr (Rank == 1){
+            if(src.stride(0) == 1 && dst.stride(0) == 1){
+                std::copy(src.data(), src.data() + src.dim(0), dst.data());
+            }else{
+                for(size_t i {0}; i < src.dim(0); i++) dst(i) = src(i);
+            }
+        }else{
+            for(size_t i {0}; i < src.dim(0); i++) copy_strided(src[i], dst[i]);
+        }
+    }
+}
+
+
+/**
+ * @brief Copy the elements of `src` into `dst`, which must have the same dimensions. Both views
+ * must reside in host memory. Contiguous rows are copied as a block.
+ */
+template <typename T, typename U, size_t Rank>
+void copy_view(const ArrayView<T, Rank>& src, const ArrayView<U, Rank>& dst){
+    for(size_t i {0}; i < Rank; i++)
+        if(src.dim(i) != dst.dim(i)) throw std::invalid_argument {"copy_view: the views have different dimensions."};
+    if(src.on_gpu() || dst.on_gpu()) throw std::invalid_argument {"copy_view: views must reside in host memory."};
+    if(src.empty()) return;
+    if(src.is_contiguous() && dst.is_contiguous()){
+        std::copy(src.data(), src.data() + src.size(), dst.data());
+        return;
+    }
+    detail::copy_strided(src, dst);
+}
+
+
+/**
+ * @brief Copy the elements of `src`, in the order of its axes, into the contiguous array `dst`
+ * of at least `src.size()` elements.
+ */
+template <typename T, typename U, size_t Rank>
+void copy_view(const ArrayView<T, Rank>& src, U *dst){
+    size_t dims[Rank];
+    for(size_t i {0}; i < Rank; i++) dims[i] = src.dim(i);
+    copy_view(src, ArrayView<U, Rank> {dst, dims});
+}
+
+#endif
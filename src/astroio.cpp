@@ -6,9 +6,18 @@
 #include <chrono>
 #include <algorithm>
 #include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "utils.hpp"
 #include "astroio.hpp"
 #include "files.hpp"
+#include "mapped_file.hpp"
+#include "transpose.hpp"
+#include "voltage_expansion.hpp"
+#include "observation_catalogue.hpp"
+#include "instrumentation.hpp"
+#include "pixel_encoding.hpp"
 
 extern const ObservationInfo VCS_OBSERVATION_INFO {
     .nAntennas = 128u,
@@ -35,352 +44,279 @@ extern const ObservationInfo EDA2_OBSERVATION_INFO {
 
 
 
-namespace {
+Voltages Voltages::from_dat_file(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        unsigned int n_threads){
+    MemoryBuffer<std::complex<int8_t>> mbVoltages {dat_file_output_size(obsInfo, nIntegrationSteps)};
+    load_dat_file(filename, obsInfo, nIntegrationSteps, mbVoltages.data(), n_threads);
+    return Voltages {std::move(mbVoltages), obsInfo, nIntegrationSteps};
+}
 
-    int8_t eightBitLookup[65536][4] {};
-    bool lookupInitialized {false};
 
 
-    void build_eight_bit_lookup(){
-        uint32_t index = 0;
-        int value = 0;
-        uint8_t original = 0;
-        uint8_t answer = 0;
-        uint8_t outval = 0;
+#ifdef __GPU__
+Voltages Voltages::from_dat_file_gpu(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        VoltageLoadStats *stats, size_t chunk_size, int device_id, bool pin_mapping){
+    if(device_id < 0) gpuGetDevice(&device_id);
+    GpuDeviceGuard guard {device_id};
+    MemoryBuffer<std::complex<int8_t>> mbVoltages {dat_file_output_size(obsInfo, nIntegrationSteps), MemoryType::DEVICE};
+    load_dat_file_gpu(filename, obsInfo, nIntegrationSteps, mbVoltages.data(), stats, chunk_size, pin_mapping);
+    return Voltages {std::move(mbVoltages), obsInfo, nIntegrationSteps};
+}
+#else
+Voltages Voltages::from_dat_file_gpu(const std::string&, const ObservationInfo&, unsigned int, VoltageLoadStats*, size_t, int, bool){
+    throw std::runtime_error("from_dat_file_gpu cannot be called on a CPU-only compile of the code."); 
+}
+#endif
 
-        for (index=0; index <= 65535; index++){
-            for (outval = 0; outval < 4 ; outval++){
-                original = index >> (outval * 4);
-                original = original & 0xf; // the sample
-                if(original >= 0x8) { // it is a negative number
-                    // https://en.wikipedia.org/wiki/Two%27s_complement#Subtraction_from_2N
-                    value = original - 0x10;
-                }
-                else {
-                    value = original;
-                }
-                answer = value & 0xff;
-                eightBitLookup[index][outval] = answer;
-            }
-        }
+
+namespace {
+    // Number of timesteps in a buffer of `length` 8-bit values holding the observation `obsInfo`.
+    size_t count_8bit_timesteps(size_t length, const ObservationInfo& obsInfo){
+        const size_t bytesPerComplexSample {2}; // 8+8 bits
+        const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+        const size_t samplesSize {obsInfo.nTimesteps * nSamplesInTimestep * bytesPerComplexSample};
+        if(length != samplesSize)
+            throw std::invalid_argument {"Voltages::from_memory: unexpected buffer size (" + std::to_string(length)
+                + "). Expected " + std::to_string(samplesSize)};
+        return obsInfo.nTimesteps;
     }
 }
 
 
 
-Voltages Voltages::from_dat_file(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps){
-    // TODO: fix edge usage.
-    const unsigned int edge {0}, timestepsPerRead {100u};
-    std::ifstream fin;
-    fin.open(filename, std::ios::binary);
-    if(!fin && fin.gcount() == 0){
-        std::cerr << "Error happened when reading the input file." << std::endl;
-        throw std::exception();
-    }
-    if(!lookupInitialized) build_eight_bit_lookup();
-    const size_t bytesPerComplexSample {1}; // 4+4 bits 
-    const size_t nSamplesInTimestep {obsInfo.nFrequencies * obsInfo.nAntennas *  obsInfo.nPolarizations};
-    const size_t bytesPerTimestep {nSamplesInTimestep * bytesPerComplexSample};
-    const size_t bytesPerRead {timestepsPerRead * bytesPerTimestep};
-    char* buffer {new char[bytesPerRead]};
-    // We are going to read 2 complex samples at a time, one for each polarization of an antenna.
-    // Each sample is made of 2 4bit data points, that need to be expanded to 8bit data points to be
-    // processed.
-    int8_t expanded[4]; // Temp variable for doing the 4-bit expansion
-    fin.read(buffer, bytesPerRead);
-    long long bytesRead {fin.gcount()};
-
-    // variables used for output indexing
-    const size_t samplesInPol {nIntegrationSteps};
-    const size_t samplesInAntenna {samplesInPol * obsInfo.nPolarizations};
-    const size_t samplesInFrequency {samplesInAntenna * obsInfo.nAntennas};
-    const size_t samplesInTimeInterval {samplesInFrequency * obsInfo.nFrequencies};
-    const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1)/ nIntegrationSteps };
+Voltages Voltages::from_memory(const int8_t *buffer, size_t length, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        unsigned int n_threads){
+    const size_t nTimesteps {count_8bit_timesteps(length, obsInfo)};
+    const size_t nComplexSamples {length / 2};
+    ASTROIO_TIMED_SCOPE("from_memory_reorder", length, nComplexSamples);
     /*
         We allocate slightly more memory than simply nComplexSamples so we can avoid dealing with
         the boundary condition happening when obsInfo.nTimesteps % nIntegrationSteps != 0. 
     */
-    MemoryBuffer<std::complex<int8_t>> mbVoltages {nIntegrationIntervals * samplesInTimeInterval};
-    auto voltages = mbVoltages.data();
-    memset(voltages, 0, sizeof(std::complex<int8_t>) * nIntegrationIntervals * samplesInTimeInterval);
-
-    size_t currentTimeInterval;
-    size_t currentIntegratorStep;
-    size_t total_timesteps {0};
-    while(bytesRead == bytesPerRead){
-        size_t sample_idx {0};
-        for(size_t ts = 0; ts < timestepsPerRead; ts++, total_timesteps++){
-            currentTimeInterval = total_timesteps / nIntegrationSteps;
-            currentIntegratorStep = total_timesteps % nIntegrationSteps;
-            for(size_t ch = 0; ch < obsInfo.nFrequencies; ch++){
-                for(size_t a = 0; a < obsInfo.nAntennas; a++){
-                    // set edge channels to 0
-                    if(ch < edge || ch >= (obsInfo.nFrequencies - edge)){
-                        for (size_t r = 0; r < 4; r++)
-                            expanded[r] = 0;
-                    }else{
-                        uint16_t rawSamples = *reinterpret_cast<uint16_t*>(&buffer[sample_idx]);
-                        memcpy(expanded, eightBitLookup[rawSamples], 4);
-                    }
-                    // output layout is Time, Frequency, Antenna, Polarization, Integration Step
-                    size_t outIndex = currentTimeInterval * samplesInTimeInterval + ch * samplesInFrequency + a * samplesInAntenna;
-                    voltages[outIndex + currentIntegratorStep].real(expanded[0]);
-                    voltages[outIndex + currentIntegratorStep].imag(expanded[1]);
-                    voltages[outIndex + samplesInPol + currentIntegratorStep].real(expanded[2]);
-                    voltages[outIndex + samplesInPol + currentIntegratorStep].imag(expanded[3]);
-                    
-                    sample_idx += 2; // advances 2 samples at a time
-                }
-            }
-        }
-        fin.read(buffer, bytesPerRead);
-        bytesRead = fin.gcount();
-    }
-    fin.close();
-    delete[] buffer;
-    return Voltages {std::move(mbVoltages), obsInfo, nIntegrationSteps};
-}
-
-
-#ifdef __GPU__
-__global__ void dat_file_expansion_kernel(int8_t *input, size_t input_size, ObservationInfo obsInfo, unsigned int nIntegrationSteps, unsigned int edge, int8_t* output){
-
-    size_t start_index {blockDim.x * blockIdx.x + threadIdx.x};
-    size_t grid_size {gridDim.x * blockDim.x};
-    uint16_t *buffer = reinterpret_cast<uint16_t*>(input);
-    const size_t samplesInPol {nIntegrationSteps};
-    const size_t samplesInAntenna {samplesInPol * obsInfo.nPolarizations};
-    const size_t samplesInFrequency {samplesInAntenna * obsInfo.nAntennas};
-    const size_t samplesInTimeInterval {samplesInFrequency * obsInfo.nFrequencies};
-
-    int8_t expanded[4];
-
-    for(size_t idx {start_index}; idx < input_size / 2; idx += grid_size){
-        size_t sample_idx = idx * 2;
-        size_t a = idx % obsInfo.nAntennas;
-        size_t ch = (sample_idx / (obsInfo.nAntennas * obsInfo.nPolarizations)) % obsInfo.nFrequencies;
-        size_t currentTimeStep = sample_idx / (obsInfo.nAntennas * obsInfo.nPolarizations * obsInfo.nFrequencies);
-        size_t currentTimeInterval = currentTimeStep / nIntegrationSteps;
-        size_t currentIntegratorStep = currentTimeStep % nIntegrationSteps;
-
-        // set edge channels to 0
-        if(ch < edge || ch >= (obsInfo.nFrequencies - edge)){
-            expanded[0] = 0;
-            expanded[1] = 0;
-            expanded[2] = 0;
-            expanded[3] = 0;
-        }else{
-            uint16_t raw_samples = buffer[idx];
-            int value = 0;
-            uint8_t original = 0;
-            uint8_t answer = 0;
-            uint8_t outval = 0;
-            for (outval = 0; outval < 4 ; outval++){
-                original = raw_samples >> (outval * 4);
-                original = original & 0xf; // the sample
-                if(original >= 0x8) { // it is a negative number
-                    // https://en.wikipedia.org/wiki/Two%27s_complement#Subtraction_from_2N
-                    value = original - 0x10;
-                }
-                else {
-                    value = original;
-                }
-                answer = value & 0xff;
-                expanded[outval] = answer;
-            }
-        }
-
-        // output layout is Time, Frequency, Antenna, Polarization, Integration Step
-        size_t outIndex = currentTimeInterval * samplesInTimeInterval + ch * samplesInFrequency + a * samplesInAntenna;
-        output[2*(outIndex + currentIntegratorStep)] = expanded[0];
-        output[2*(outIndex + currentIntegratorStep) + 1] = expanded[1];
-        output[2*(outIndex + samplesInPol + currentIntegratorStep)] = expanded[2];
-        output[2*(outIndex + samplesInPol + currentIntegratorStep) + 1] = expanded[3];
-    }
+    MemoryBuffer<std::complex<int8_t>> mbVoltages {dat_file_output_size(obsInfo, nIntegrationSteps)};
+    load_8bit_samples(reinterpret_cast<const std::complex<int8_t>*>(buffer), nTimesteps, obsInfo, nIntegrationSteps,
+        mbVoltages.data(), n_threads);
+    return {std::move(mbVoltages), obsInfo, nIntegrationSteps};
 }
 
 
 
-Voltages Voltages::from_dat_file_gpu(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps){
-    std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
-    // Step 1: read the whole file in memory
-    std::ifstream fin;
-    fin.open(filename, std::ios::binary);
-    if(!fin && fin.gcount() == 0){
-        std::cerr << "Error happened when reading the input file." << std::endl;
-        throw std::exception();
-    }
-    // variables used for output indexing
-    const size_t samplesInPol {nIntegrationSteps};
-    const size_t samplesInAntenna {samplesInPol * obsInfo.nPolarizations};
-    const size_t samplesInFrequency {samplesInAntenna * obsInfo.nAntennas};
-    const size_t samplesInTimeInterval {samplesInFrequency * obsInfo.nFrequencies};
-    const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1)/ nIntegrationSteps };
-    const size_t nTotalSamples {nIntegrationIntervals * samplesInTimeInterval};
-
-    const int read_size {4096};
-    // char buffer[buff_size];  //= vcsmap->pointer;
-    int bytes_read = 0;
-    // MemoryBuffer<int8_t> mb_compressed_samples {nTotalSamples, true, false}; // use the XNACK feature
-    //char *input = reinterpret_cast<char*>(mb_compressed_samples.data());
-    int8_t*input;
-    size_t expected_buffer_size {sizeof(int8_t) * nTotalSamples};
-    // TODO: add managed memory support to MemoryBuffer
-    gpuMallocManaged(&input, expected_buffer_size);
-    int8_t * orig_input = input; // mb_compressed_samples.data();
-    // Copy to GPU memory
-    size_t total_bytes_read {0};
-    while(total_bytes_read < expected_buffer_size){
-        fin.read((char*)input, read_size);
-        bytes_read = fin.gcount();
-        total_bytes_read += bytes_read;
-        input += bytes_read;
-    }
-    fin.close();
-    MemoryBuffer<std::complex<int8_t>> mbVoltages {nTotalSamples, MemoryType::DEVICE};
-    struct gpuDeviceProp_t props;
-    int gpu_id = -1;
-    gpuGetDevice(&gpu_id);
-    gpuGetDeviceProperties(&props, gpu_id);
-    unsigned int n_blocks = props.multiProcessorCount * 2;
-    auto voltages = mbVoltages.data();
-    dat_file_expansion_kernel<<<n_blocks, 1024>>>(orig_input, nTotalSamples, obsInfo, nIntegrationSteps, 0, reinterpret_cast<int8_t*>(voltages));
-    gpuDeviceSynchronize();
-    gpuFree(orig_input);
-    std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> exec_time = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1);
-    std::cout << "'from_dat_file_gpu' took " << exec_time.count() << "seconds." << std::endl;
-    return Voltages {std::move(mbVoltages), obsInfo, nIntegrationSteps};
+#ifdef __GPU__
+Voltages Voltages::from_memory_gpu(const int8_t *buffer, size_t length, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        VoltageLoadStats *stats, size_t chunk_size, int device_id){
+    const size_t nTimesteps {count_8bit_timesteps(length, obsInfo)};
+    if(device_id < 0) gpuGetDevice(&device_id);
+    GpuDeviceGuard guard {device_id};
+    MemoryBuffer<std::complex<int8_t>> mbVoltages {dat_file_output_size(obsInfo, nIntegrationSteps), MemoryType::DEVICE};
+    load_8bit_samples_gpu(reinterpret_cast<const std::complex<int8_t>*>(buffer), nTimesteps, obsInfo, nIntegrationSteps,
+        mbVoltages.data(), stats, chunk_size);
+    return {std::move(mbVoltages), obsInfo, nIntegrationSteps};
 }
 #else
-Voltages Voltages::from_dat_file_gpu(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps){
-    throw std::runtime_error("from_dat_file_gpu cannot be called on a CPU-only compile of the code."); 
+Voltages Voltages::from_memory_gpu(const int8_t*, size_t, const ObservationInfo&, unsigned int, VoltageLoadStats*, size_t, int){
+    throw std::runtime_error("from_memory_gpu cannot be called on a CPU-only compile of the code."); 
 }
 #endif
 
 
-Voltages Voltages::from_memory(const int8_t *buffer, size_t length, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps){
-    const size_t bytesPerComplexSample {2}; // 4+4 bits 
-    const size_t nSamplesInTimestep {obsInfo.nFrequencies * obsInfo.nAntennas *  obsInfo.nPolarizations};
-    const size_t nComplexSamples {obsInfo.nTimesteps * nSamplesInTimestep};
-    const size_t samplesSize {nComplexSamples * bytesPerComplexSample};
-    if(length != nComplexSamples * bytesPerComplexSample){
-        std::cerr << "Error: unexpected buffer size (" << length << "). Expected " <<  samplesSize << std::endl;
-        throw std::exception(); // TODO bette exception.
-    }
-    size_t samplesInPol {nIntegrationSteps};
-    const size_t samplesInAntenna {samplesInPol * obsInfo.nPolarizations};
-    const size_t samplesInFrequency {samplesInAntenna * obsInfo.nAntennas};
-    const size_t samplesInTimeInterval {samplesInFrequency * obsInfo.nFrequencies};
-    size_t currentTimeInterval;
-    size_t currentIntegratorStep;
-    const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1)/ nIntegrationSteps };
-    size_t sample_idx {0};
-    /*
-        We allocate slightly more memory than simply nComplexSamples so we can avoid dealing with
-        the boundary condition happening when obsInfo.nTimesteps % nIntegrationSteps != 0. 
-    */
-    MemoryBuffer<std::complex<int8_t>> mbVoltages {nIntegrationIntervals * samplesInTimeInterval};
-    auto voltages = mbVoltages.data();
-    memset(voltages, 0, sizeof(std::complex<int8_t>) * nIntegrationIntervals * samplesInTimeInterval);
-    for(size_t ts = 0; ts < obsInfo.nTimesteps; ts++){
-        currentTimeInterval = ts / nIntegrationSteps;
-        currentIntegratorStep = ts % nIntegrationSteps;
-        for(size_t ch = 0; ch < obsInfo.nFrequencies; ch++){
-            for(size_t a = 0; a < obsInfo.nAntennas; a++){
-                // output layout is Time, Frequency, Antenna, Polarization, Integration Step
-                 size_t outIndex = currentTimeInterval * samplesInTimeInterval + ch * samplesInFrequency + a * samplesInAntenna;
-                voltages[outIndex + currentIntegratorStep].real(buffer[sample_idx++]);
-                voltages[outIndex + currentIntegratorStep].imag(buffer[sample_idx++]);
-                voltages[outIndex + samplesInPol + currentIntegratorStep].real(buffer[sample_idx++]);
-                voltages[outIndex + samplesInPol + currentIntegratorStep].imag(buffer[sample_idx++]);         
-            }
-        }
-    }
-    return {std::move(mbVoltages), obsInfo, nIntegrationSteps};
+
+Voltages Voltages::from_eda2_file(const std::string& filename, const ObservationInfo& obs_info, unsigned int nIntegrationSteps,
+        unsigned int n_threads){
+    // Samples are reordered straight from the page cache.
+    const MappedFile input {filename};
+    return Voltages::from_memory(reinterpret_cast<const int8_t*>(input.data()), input.size(), obs_info, nIntegrationSteps, n_threads);
 }
 
 
 
-Voltages Voltages::from_eda2_file(const std::string& filename, const ObservationInfo& obs_info, unsigned int nIntegrationSteps){
-    // TODO: more efficient implementation
-    char *buffer {nullptr};
-    size_t size {0};
-    read_data_from_file(filename, buffer, size);
-    auto volt = Voltages::from_memory(reinterpret_cast<int8_t*>(buffer), size, obs_info, nIntegrationSteps);
-    delete[] buffer;
-    return volt;
+Voltages Voltages::from_eda2_file_gpu(const std::string& filename, const ObservationInfo& obs_info, unsigned int nIntegrationSteps,
+        VoltageLoadStats *stats, size_t chunk_size, int device_id){
+    // Chunks are copied to the pinned buffers straight from the page cache.
+    const MappedFile input {filename};
+    return Voltages::from_memory_gpu(reinterpret_cast<const int8_t*>(input.data()), input.size(), obs_info, nIntegrationSteps,
+        stats, chunk_size, device_id);
 }
 
 
-Visibilities Visibilities::from_fits_file(const std::string& filename, const ObservationInfo& oInfo){
+
+Visibilities Visibilities::from_fits_file(const std::string& filename, const ObservationInfo& oInfo,
+        unsigned int first_interval, int n_intervals){
 
     FITS fitsImage {filename, FITS::Mode::READ};
     ObservationInfo obsInfo {oInfo};
     const unsigned int n_baselines {((obsInfo.nAntennas + 1) * obsInfo.nAntennas) / 2};
-    const size_t matrixSize {n_baselines * obsInfo.nPolarizations * obsInfo.nPolarizations};
+    const size_t n_pols {static_cast<size_t>(obsInfo.nPolarizations) * obsInfo.nPolarizations};
+    const size_t matrixSize {n_baselines * n_pols};
 
     size_t nHDUs {fitsImage.size()};
-
-    unsigned int nIntegrationIntervals {static_cast<unsigned int>(nHDUs)}, nAveragedChannels;
-    unsigned int nIntegrationSteps {obsInfo.nTimesteps / nIntegrationIntervals};
+    // MWAX files start with a primary HDU holding only header keywords, followed by a pair of
+    // (visibilities, weights) HDUs for each integration interval.
+    const bool mwax {nHDUs > 0 && !fitsImage[0].has_image() && fitsImage[0].get_header().count("CORR_VER") > 0};
+    // Compressed files also start with a primary HDU without pixels.
+    const size_t firstHDU {mwax || (nHDUs > 0 && !fitsImage[0].has_image()) ? 1ul : 0ul}, hduStride {mwax ? 2ul : 1ul};
+    if(nHDUs <= firstHDU) throw std::runtime_error {"Visibilities::from_fits_file: " + filename + " contains no visibilities."};
+
+    const unsigned int nIntervalsInFile {static_cast<unsigned int>((nHDUs - firstHDU + hduStride - 1) / hduStride)};
+    unsigned int nAveragedChannels;
+    unsigned int nIntegrationSteps {obsInfo.nTimesteps / nIntervalsInFile};
+    if(first_interval >= nIntervalsInFile || (n_intervals >= 0 && first_interval + n_intervals > nIntervalsInFile))
+        throw std::invalid_argument {"Visibilities::from_fits_file: interval range exceeds the number of intervals in " + filename};
+    const unsigned int nIntegrationIntervals {n_intervals < 0 ? nIntervalsInFile - first_interval : static_cast<unsigned int>(n_intervals)};
+    // The returned object only holds the selected intervals.
+    obsInfo.nTimesteps = nIntegrationIntervals * nIntegrationSteps;
     
-    size_t xcorrSize {obsInfo.nFrequencies * matrixSize * nIntegrationIntervals};
-
-    MemoryBuffer<std::complex<float>> mbXcorr {xcorrSize};
+    FITS::HDU& firstVisHDU {fitsImage[firstHDU]};
+    // TODO what about the following info
+    int msElapsed;
+    float integrationTime;
+    std::string comment;
+    std::tie(obsInfo.startTime, comment) = firstVisHDU.get_keyword<long>("TIME");
+    std::tie(msElapsed, comment) = firstVisHDU.get_keyword<int>("MILLITIM");
+    std::tie(integrationTime, comment) = firstVisHDU.get_keyword<float>("INTTIME");
+    // Each interval is an image of `nChannels` rows of `matrixSize` values, or of `n_baselines`
+    // rows of `nChannels * n_pols` values for MWAX files.
+    size_t nChannels;
+    if(!mwax){
+        std::tie(obsInfo.coarseChannel, comment) = firstVisHDU.get_keyword<unsigned int>("COARSE_CHAN");
+        if(firstVisHDU.get_ydim() != matrixSize * 2){
+            std::cerr << "Axis 1 is wrong. Value returned is " << firstVisHDU.get_ydim() << " instead of " << (matrixSize * 2) << std::endl;
+            throw std::exception();
+        }
+        nChannels = firstVisHDU.get_xdim();
+    }else{
+        if(firstVisHDU.get_xdim() != n_baselines || firstVisHDU.get_ydim() % (n_pols * 2) != 0){
+            std::cerr << "Unexpected MWAX image size: " << firstVisHDU.get_ydim() << " x " << firstVisHDU.get_xdim() << std::endl;
+            throw std::exception();
+        }
+        nChannels = firstVisHDU.get_ydim() / (n_pols * 2);
+    }
+    nAveragedChannels = obsInfo.nFrequencies / nChannels;
+    
+    const size_t nValuesInTimeInterval {matrixSize * nChannels};
+    MemoryBuffer<std::complex<float>> mbXcorr {nValuesInTimeInterval * nIntegrationIntervals};
     auto xcorr = mbXcorr.data();
-    for(size_t idx {0}; idx < nHDUs; idx++){
-        auto hdu = fitsImage[idx];
-        if(idx == 0){
-            // TODO what about the following info
-            int msElapsed;
-            float integrationTime;
-            std::string comment;
-            std::tie(obsInfo.startTime, comment) = hdu.get_keyword<long>("TIME");
-            std::tie(msElapsed, comment) = hdu.get_keyword<int>("MILLITIM");
-            std::tie(integrationTime, comment) = hdu.get_keyword<float>("INTTIME");
-            std::tie(obsInfo.coarseChannel, comment) = hdu.get_keyword<unsigned int>("COARSE_CHAN");
-            if(hdu.get_ydim() != matrixSize * 2){
-                std::cerr << "Axis 1 is wrong. Value returned is " << hdu.get_ydim() << " instead of " << (matrixSize * 2) << std::endl;
-                throw std::exception();
+    for(size_t interval {0}; interval < nIntegrationIntervals; interval++){
+        FITS::HDU& hdu {fitsImage[firstHDU + (first_interval + interval) * hduStride]};
+        if(static_cast<size_t>(hdu.get_xdim() * hdu.get_ydim()) != nValuesInTimeInterval * 2)
+            throw std::runtime_error {"Visibilities::from_fits_file: HDUs of " + filename + " have different sizes."};
+        // read data straight into its final location.
+        hdu.read_image(xcorr + interval * nValuesInTimeInterval, TFLOAT);
+    }
+    return Visibilities{std::move(mbXcorr), obsInfo, nIntegrationSteps, nAveragedChannels,
+        mwax ? VisibilityLayout::BASELINE_CHANNEL_POL : VisibilityLayout::CHANNEL_BASELINE_POL};
+}
+
+
+
+void Visibilities::convert_layout(VisibilityLayout target){
+    if(layout == target) return;
+    if(on_gpu()) throw std::runtime_error {"Visibilities::convert_layout: data must reside in CPU memory."};
+    ASTROIO_TIMED_SCOPE("convert_layout", MemoryBuffer::size() * sizeof(std::complex<float>), MemoryBuffer::size());
+    const size_t n_pols {static_cast<size_t>(obsInfo.nPolarizations) * obsInfo.nPolarizations};
+    const size_t n_baselines {this->matrix_size() / n_pols};
+    const size_t nValuesInTimeInterval {this->matrix_size() * nFrequencies};
+    // Rows and columns of each interval in the current layout.
+    const size_t rows {layout == VisibilityLayout::CHANNEL_BASELINE_POL ? nFrequencies : n_baselines};
+    const size_t cols {layout == VisibilityLayout::CHANNEL_BASELINE_POL ? n_baselines : nFrequencies};
+    MemoryBuffer<std::complex<float>> reordered {MemoryBuffer::size()};
+    for(size_t interval {0}; interval < this->integration_intervals(); interval++)
+        transpose_blocked(data() + interval * nValuesInTimeInterval, rows, cols, n_pols, reordered.data() + interval * nValuesInTimeInterval);
+    MemoryBuffer::operator=(std::move(reordered));
+    layout = target;
+}
+
+
+
+namespace {
+    /*
+        Largest absolute value among the real and imaginary parts of the visibilities in
+        `interval`, which set the scale of INT16_SCALED images. A whole interval spans a
+        contiguous range of memory whichever its layout, so it is scanned at once; slices of
+        it are scanned a group of polarizations at a time.
+    */
+    float max_abs_value(const ArrayView<const std::complex<float>, 3>& interval){
+        if(interval.is_contiguous() || interval.transpose(0, 1).is_contiguous())
+            return ::max_abs_value(reinterpret_cast<const float*>(interval.data()), 2 * interval.size());
+        float result {0.0f};
+        for(size_t r {0}; r < interval.dim(0); r++){
+            for(size_t c {0}; c < interval.dim(1); c++){
+                const float m {::max_abs_value(reinterpret_cast<const float*>(interval[r][c].data()), 2 * interval.dim(2))};
+                if(m > result) result = m;
             }
-            nAveragedChannels = obsInfo.nFrequencies / hdu.get_xdim();
         }
-        // read data
-        float *pMatrixOut {reinterpret_cast<float*>(xcorr) + idx * hdu.get_xdim() * hdu.get_ydim()};
-        memcpy(pMatrixOut, hdu.get_image_data(), hdu.get_xdim() * hdu.get_ydim() * sizeof(float));
+        return result;
     }
-    return Visibilities{std::move(mbXcorr), obsInfo, nIntegrationSteps, nAveragedChannels};
 }
 
 
 
-void Visibilities::to_fits_file(const std::string& filename) const{
-    FITS fitsImage {filename, FITS::Mode::WRITE};
-    const size_t nFrequencies {obsInfo.nFrequencies / nAveragedChannels}; 
+void Visibilities::to_fits_file(const std::string& filename, const FitsOutputOptions& options) const{
+    to_fits_file(filename, view(), options);
+}
+
+
+
+void Visibilities::to_fits_file(const std::string& filename, const ConstVisibilityView& vis, const FitsOutputOptions& options) const{
+    if(vis.on_gpu()) throw std::invalid_argument {"Visibilities::to_fits_file: data must reside in CPU memory."};
+    ASTROIO_TIMED_SCOPE("visibilities_to_fits");
+    // Intervals are streamed to the file in APPEND mode, so an existing one must be removed first.
+    std::remove(filename.c_str());
+    FITS fitsImage {filename, FITS::Mode::APPEND};
+    fitsImage.set_output_options(options);
+    const bool scaled {options.encoding == PixelEncoding::INT16_SCALED};
+    const size_t nChannels {vis.dim(1)}, n_baselines {vis.dim(2)}, n_pols {vis.dim(3)};
     // one axis for matrix, one for frequency
     float integrationTime {static_cast<float>(obsInfo.timeResolution * nIntegrationSteps)};
-    for(unsigned int interval {0}; interval < this->integration_intervals(); interval++){
+    // Data in MWAX layout is transposed back a tile of channels at a time.
+    const size_t channelsPerTile {std::min<size_t>(nChannels, 16)};
+    MemoryBuffer<std::complex<float>> tile_buffer;
+    for(unsigned int i {0}; i < vis.dim(0); i++){
         FITS::HDU hdu;
-        std::complex<float>* pToMatrix = const_cast<std::complex<float>*>(this->data() + interval * (nFrequencies * this->matrix_size()));
+        const size_t interval {vis.offset(0) + i};
+        const ArrayView<const std::complex<float>, 3> pInterval {vis[i]};
         int msElapsed {static_cast<int>(interval *  (obsInfo.timeResolution * nIntegrationSteps * 1e3))};
-        hdu.set_image(reinterpret_cast<float*>(pToMatrix), static_cast<long>(this->matrix_size()) * 2, static_cast<long>(nFrequencies));
         hdu.add_keyword("TIME", static_cast<long>(obsInfo.startTime), "Unix time (seconds)");
         hdu.add_keyword("MILLITIM", msElapsed, "Milliseconds since TIME");
         hdu.add_keyword("INTTIME", integrationTime, "Integration time (s)");
         hdu.add_keyword("COARSE_CHAN", obsInfo.coarseChannel, "Receiver Coarse Channel Number (only used in offline mode)");
-        fitsImage.add_HDU(hdu);
+        fitsImage.append_image_hdu(hdu, FLOAT_IMG, static_cast<long>(n_baselines * n_pols) * 2, static_cast<long>(nChannels),
+            scaled ? max_abs_value(pInterval) : 0.0f);
+        if(pInterval.transpose(0, 1).is_contiguous() && !pInterval.is_contiguous()){
+            // All the channels of a range of baselines in MWAX layout: blocked transpose.
+            if(!tile_buffer) tile_buffer.allocate(channelsPerTile * n_baselines * n_pols);
+            for(size_t ch {0}; ch < nChannels; ch += channelsPerTile){
+                const size_t ch_end {std::min<size_t>(ch + channelsPerTile, nChannels)};
+                {
+                    ASTROIO_TIMED_SCOPE("mwax_reorder", (ch_end - ch) * n_baselines * n_pols * sizeof(std::complex<float>));
+                    transpose_blocked(pInterval.data(), n_baselines, nChannels, n_pols, ch, ch_end, tile_buffer.data());
+                }
+                fitsImage.write_image_rows(tile_buffer.data(), static_cast<long>(ch), static_cast<long>(ch_end - ch));
+            }
+        }else{
+            fitsImage.write_image_rows(pInterval, 0);
+        }
     }
-    fitsImage.write();
 }
 
 
 
-void Visibilities::to_fits_file_mwax(const std::string& filename, int coarse_channel_ord) const{
+void Visibilities::to_fits_file_mwax(const std::string& filename, int coarse_channel_ord, const FitsOutputOptions& options) const{
+    to_fits_file_mwax(filename, view(), coarse_channel_ord, options);
+}
+
+
+
+void Visibilities::to_fits_file_mwax(const std::string& filename, const ConstVisibilityView& vis, int coarse_channel_ord,
+        const FitsOutputOptions& options) const{
+    if(vis.on_gpu()) throw std::invalid_argument {"Visibilities::to_fits_file_mwax: data must reside in CPU memory."};
+    ASTROIO_TIMED_SCOPE("visibilities_to_fits_mwax");
     float integrationTime {static_cast<float>(obsInfo.timeResolution * nIntegrationSteps)};
-    const size_t n_baselines {((obsInfo.nAntennas + 1) * obsInfo.nAntennas) / 2};
-    const unsigned int n_pols {obsInfo.nPolarizations * obsInfo.nPolarizations};
-    FITS fits_image {filename, FITS::Mode::WRITE};
+    const size_t nChannels {vis.dim(1)}, n_baselines {vis.dim(2)}, n_pols {vis.dim(3)};
+    // The file is written incrementally in APPEND mode, so an existing one must be removed first.
+    std::remove(filename.c_str());
+    FITS fits_image {filename, FITS::Mode::APPEND};
+    fits_image.set_output_options(options);
+    const bool scaled {options.encoding == PixelEncoding::INT16_SCALED};
     // Create primary HDU
     FITS::HDU primary_hdu;
     primary_hdu.add_keyword("TIME", static_cast<long>(obsInfo.startTime), "Unix time (seconds)");
@@ -390,42 +326,51 @@ void Visibilities::to_fits_file_mwax(const std::string& filename, int coarse_cha
     primary_hdu.add_keyword("PROJID", std::string {"XXX"}, "Project ID");
     primary_hdu.add_keyword("OBSID", atoi(obsInfo.id.c_str()), "Project ID");
     primary_hdu.add_keyword("FINECHAN", obsInfo.frequencyResolution * nAveragedChannels * 1e3, "Fine channel width in KHz");
-    primary_hdu.add_keyword("NFINECHS", nFrequencies, "Number of fine channels in coarse channel");
+    primary_hdu.add_keyword("NFINECHS", static_cast<unsigned int>(nChannels), "Number of fine channels in coarse channel");
     primary_hdu.add_keyword("NINPUTS", obsInfo.nAntennas * obsInfo.nPolarizations, "Number of RF inputs.");
     primary_hdu.add_keyword("CORRCHAN", coarse_channel_ord, "0-indexed coarse channel ordinal");
 
-    fits_image.add_HDU(primary_hdu);
+    fits_image.add_HDU(std::move(primary_hdu));
     MemoryBuffer<float> weights {4 * static_cast<size_t>(n_baselines)};
-    // for each integration interval, the oder of data is: baseline | channel | pol | r,i
-    // So, need to transform data.
-    MemoryBuffer<std::complex<float>> reordered_buffer {integration_intervals() * n_baselines * nFrequencies * n_pols};
-    // copy data in the format expected for MWAX visibilities
-    for(unsigned int interval {0}; interval < integration_intervals(); interval++){
-        for(size_t b {0}; b < n_baselines; b++){
-            for(unsigned int ch {0}; ch < nFrequencies; ch++){
-                for(unsigned int pol {0}; pol < n_pols; pol++)
-                    reordered_buffer[interval * (n_baselines * nFrequencies * n_pols) + b * (nFrequencies * n_pols) + ch*n_pols + pol] = \
-                        data()[interval * n_baselines * n_pols * nFrequencies + \
-                            ch * n_baselines * n_pols + b * n_pols + pol];
-            }
-        }
-    }
-    // As a test, set data to zero
-    // std::memset(reinterpret_cast<char*>(reordered_buffer.data()), 0, sizeof(std::complex<float>) * integration_intervals() * n_baselines * nFrequencies * n_pols );
     // currently, all weights should be 1
     for(int i {0}; i < weights.size(); i++) weights[i] = 1.0f;
+    /*
+        For each integration interval, the order of data expected in MWAX visibilities is
+        baseline | channel | pol | r,i, whereas it is channel | baseline | pol in the default layout. Data is
+        transposed a tile of baselines at a time into a small buffer which is written straight
+        to the file, so a reordered copy of the whole array is never held in memory.
+    */
+    const size_t baselinesPerTile {std::min<size_t>(n_baselines, 1024)};
+    MemoryBuffer<std::complex<float>> tile_buffer;
 
-    for(unsigned int interval {0}; interval < this->integration_intervals(); interval++){
+    for(unsigned int i {0}; i < vis.dim(0); i++){
         FITS::HDU image_hdu;
-        std::complex<float>* pToMatrix = reordered_buffer.data() + interval * (nFrequencies * n_pols * n_baselines);
+        const size_t interval {vis.offset(0) + i};
+        // Rows of MWAX images are baselines.
+        const ArrayView<const std::complex<float>, 3> pInterval {vis[i].transpose(0, 1)};
         int msElapsed {static_cast<int>(interval *  (obsInfo.timeResolution * nIntegrationSteps * 1e3))};
-        long naxis1 {n_pols * 2 * static_cast<long>(nFrequencies)};
-        image_hdu.set_image(reinterpret_cast<float*>(pToMatrix), naxis1, static_cast<long>(n_baselines));
+        long naxis1 {static_cast<long>(n_pols * 2 * nChannels)};
         image_hdu.add_keyword("TIME", static_cast<long>(obsInfo.startTime), "Unix time (seconds)");
         image_hdu.add_keyword("MILLITIM", msElapsed, "Milliseconds since TIME");
         image_hdu.add_keyword("INTTIME", integrationTime, "Integration time (s)");
         image_hdu.add_keyword("MARKER", static_cast<int>(interval), "Marker");
-        fits_image.add_HDU(image_hdu);
+        fits_image.append_image_hdu(image_hdu, FLOAT_IMG, naxis1, static_cast<long>(n_baselines),
+            scaled ? max_abs_value(pInterval) : 0.0f);
+        if(pInterval.transpose(0, 1).is_contiguous() && !pInterval.is_contiguous()){
+            // All the baselines of a range of channels in the default layout: blocked transpose.
+            if(!tile_buffer) tile_buffer.allocate(baselinesPerTile * nChannels * n_pols);
+            for(size_t b {0}; b < n_baselines; b += baselinesPerTile){
+                const size_t b_end {std::min(b + baselinesPerTile, n_baselines)};
+                {
+                    ASTROIO_TIMED_SCOPE("mwax_reorder", (b_end - b) * nChannels * n_pols * sizeof(std::complex<float>));
+                    transpose_blocked(pInterval.data(), nChannels, n_baselines, n_pols, b, b_end, tile_buffer.data());
+                }
+                fits_image.write_image_rows(tile_buffer.data(), static_cast<long>(b), static_cast<long>(b_end - b));
+            }
+        }else{
+            // Data already in MWAX layout is written as it is.
+            fits_image.write_image_rows(pInterval, 0);
+        }
 
         // Add the weight HDU now
         FITS::HDU weight_hdu;
@@ -434,10 +379,31 @@ void Visibilities::to_fits_file_mwax(const std::string& filename, int coarse_cha
         weight_hdu.add_keyword("MILLITIM", msElapsed, "Milliseconds since TIME");
         weight_hdu.add_keyword("INTTIME", integrationTime, "Integration time (s)");
         weight_hdu.add_keyword("MARKER", static_cast<int>(interval), "Marker");
-        fits_image.add_HDU(weight_hdu);
+        fits_image.add_HDU(std::move(weight_hdu));
+
+    }
+}
 
+
+
+void Visibilities::load_fits_file(const std::string& filename, const VisibilityView& out, unsigned int first_interval){
+    if(out.on_gpu()) throw std::invalid_argument {"Visibilities::load_fits_file: `out` must reside in CPU memory."};
+    FITS fitsImage {filename, FITS::Mode::READ};
+    const size_t nHDUs {fitsImage.size()};
+    const bool mwax {nHDUs > 0 && !fitsImage[0].has_image() && fitsImage[0].get_header().count("CORR_VER") > 0};
+    // Compressed files also start with a primary HDU without pixels.
+    const size_t firstHDU {mwax || (nHDUs > 0 && !fitsImage[0].has_image()) ? 1ul : 0ul}, hduStride {mwax ? 2ul : 1ul};
+    const size_t nIntervalsInFile {nHDUs > firstHDU ? (nHDUs - firstHDU + hduStride - 1) / hduStride : 0};
+    if(first_interval + out.dim(0) > nIntervalsInFile)
+        throw std::invalid_argument {"Visibilities::load_fits_file: interval range exceeds the number of intervals in " + filename};
+    for(size_t i {0}; i < out.dim(0); i++){
+        const FITS::HDU& hdu {fitsImage[static_cast<int>(firstHDU + (first_interval + i) * hduStride)]};
+        // Rows are channels, or baselines in MWAX files.
+        const ArrayView<std::complex<float>, 3> dest {mwax ? out[i].transpose(0, 1) : out[i]};
+        if(static_cast<size_t>(hdu.get_xdim()) != dest.dim(0))
+            throw std::invalid_argument {"Visibilities::load_fits_file: the shape of `out` does not match " + filename};
+        hdu.read_image(dest, TFLOAT);
     }
-    fits_image.write();
 }
 
 
@@ -451,17 +417,10 @@ void Visibilities::to_fits_file_mwax(const std::string& filename, int coarse_cha
 */
 ObservationInfo parse_mwa_phase1_dat_file_info(const std::string& file_path){
     ObservationInfo obs_info {VCS_OBSERVATION_INFO};
-    std::string filename {file_path.substr(file_path.find_last_of('/') + 1)};
-    size_t delimiter {filename.find('_')};
-    std::string obs_id {filename.substr(0, delimiter)};
-    time_t gps_time {atoll(filename.substr(delimiter + 1,
-        filename.find_last_of('_') - delimiter - 1).c_str())};
-    // position of the first digit of the coarse channel number. Reuse the
-    // delimiter variable.
-    delimiter = filename.find_last_of('_') + 3;
-    size_t dot_position = filename.find('.');
-    int coarse_channel {atoi(filename.substr(delimiter, dot_position - delimiter).c_str())};
-    obs_info.id = obs_id;
+    time_t gps_time {0};
+    unsigned int coarse_channel {0};
+    if(!ObservationCatalogue::parse_name(file_path, obs_info.id, gps_time, coarse_channel))
+        throw std::invalid_argument {"parse_mwa_phase1_dat_file_info: " + file_path + " is not the name of a .dat file."};
     obs_info.startTime = gps_to_unix(gps_time);
     obs_info.coarseChannel = coarse_channel;
     return obs_info;
@@ -469,90 +428,28 @@ ObservationInfo parse_mwa_phase1_dat_file_info(const std::string& file_path){
 
 
 
-/**
- * @brief 
- * 
- * @param file_list: the list of paths to .dat files making up on or more MWA observations to be 
- * processed. The files will be sorted by observation ID and then timestamp. Consecutive 24 .dat
- * files make up a second of observation over the entire MWA frequency bandwidth and will be
- * processed together. Hence, the total number of files must be a multiple of 24.
- * @todo Ideally we want to return a structured output that partitions input by observation and
- * and then by groups of 24 files each representing 1 sencond of observation. Assume now a single
- * observation, single 24 files.
-*/
 std::vector<std::vector<DatFile>> parse_mwa_dat_files(std::vector<std::string>& file_list){
     if(file_list.size() % 24 != 0) throw std::invalid_argument {
         "parse_mwa_dat_files: total number of files is not a multiple of 24."};
-    std::sort(file_list.begin(), file_list.end());
-
-    // Each observation is a list of .dat files.
-    std::string current_observation_id {};
-    time_t current_second {0ull};
-    
-    std::vector<std::vector<DatFile>> observation {};
-    std::vector<DatFile> one_second_data {};
-
+    ObservationCatalogue catalogue;
     for(const auto& file_path : file_list){
-        ObservationInfo obs_info {parse_mwa_phase1_dat_file_info(file_path)};
-        if(obs_info.id != current_observation_id){
-            // Finished loading the current observation. Proceed to save it
-            // in the array and get ready for the next one.
-            // For now, enforce parsing only one observation.
-            // TODO: handle mupliple observations.
-            if(current_observation_id != std::string {}) throw std::invalid_argument {
-                "read_mwa_dat_files: cannot read multiple observations."};
-            current_observation_id = obs_info.id;
-        }
-        if(current_second != obs_info.startTime){
-            if(current_second > 0ll){
-                // Finished loading one second of data (24 files).
-                if(one_second_data.size() != 24) {
-                    std::stringstream ss;
-                    ss << "read_mwa_dat_files: second " << current_second << " is missing " << (24 - one_second_data.size()) << " coarse channels (.dat files.)";
-                    throw std::invalid_argument {
-                        ss.str()
-                    };
-                }
-                observation.push_back(one_second_data);
-                one_second_data.clear();
-            }
-            current_second = obs_info.startTime;
-        }
-        one_second_data.push_back({file_path, obs_info});
+        if(!catalogue.add(file_path))
+            throw std::invalid_argument {"parse_mwa_dat_files: " + file_path + " is not the name of a .dat file."};
     }
-    // Add the last second of data to be listed.
-    if(one_second_data.size() != 24) throw std::invalid_argument {
-        "read_mwa_dat_files: one second of data missing .dat files."};
-    observation.push_back(one_second_data);
-    return observation;
+    if(catalogue.size() == 0) return {};
+    return catalogue.select_all(0);
 }
 
 
-/**
- * @brief Get all the dat files in a directory. Optionally, only select the dat files corresponding
- * to a certain range of seconds, specified with an offset from the first second and a count.
- * 
- * @param directory: path to the directory containing the .dat files
- * @param offset: offset in number of seconds from the start of the observation.
- * @param count: number of seconds to consider, starting from the offset.
- * @todo Ideally we want to return a structured output that partitions input by observation and
- * and then by groups of 24 files each representing 1 sencond of observation. Assume now a single
- * observation, single 24 files.
-*/
+
 std::vector<std::vector<DatFile>> parse_mwa_dat_files(std::string directory, int offset, int count){
-    auto dat_files = blink::imager::list_files_in_dir(directory, ".dat");
-    // check that the selected range is valid. 24 is the number of coarse channels in a second.
-    int start_file_index = offset * 24;
-    if(count < 0) {
-        count = dat_files.size() / 24 - offset;
-    }
-    int file_count = count * 24;
-    if(start_file_index < 0 || start_file_index >= dat_files.size())
-        throw std::invalid_argument {"parse_mwa_dat_files: invalid start offset specifiled."};
-    if(start_file_index + file_count > dat_files.size())
-        throw std::invalid_argument {"parse_mwa_dat_files: invalid count of seconds specifiled."};
-
-    std::sort(dat_files.begin(), dat_files.end());
-    auto selected_dat_files = std::vector<std::string>(dat_files.begin() + start_file_index, dat_files.begin() + start_file_index + file_count);
-    return parse_mwa_dat_files(selected_dat_files);
+    // Directories are indexed once per process, then only refreshed.
+    static std::mutex catalogues_mutex;
+    static std::map<std::string, std::unique_ptr<ObservationCatalogue>> catalogues;
+    if(offset < 0) throw std::invalid_argument {"parse_mwa_dat_files: invalid start offset specifiled."};
+    std::lock_guard<std::mutex> lock {catalogues_mutex};
+    std::unique_ptr<ObservationCatalogue>& catalogue {catalogues[directory]};
+    if(!catalogue) catalogue = std::make_unique<ObservationCatalogue>(directory);
+    else catalogue->refresh();
+    return catalogue->select_all(offset, count);
 }
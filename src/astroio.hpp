@@ -14,6 +14,7 @@
 
 #include "FITS.hpp"
 #include "memory_buffer.hpp"
+#include "array_view.hpp"
 
 enum class TelescopeID {MWA1, MWA2, MWA3, EDA2};
 /**
@@ -57,6 +58,27 @@ extern const ObservationInfo VCS_OBSERVATION_INFO;
 
 // Prefilled ObservationInfo structure for EDA2 data
 extern const ObservationInfo EDA2_OBSERVATION_INFO;
+
+
+/**
+ * @brief Statistics collected while loading voltages from disk.
+ */
+struct VoltageLoadStats {
+    // Number of bytes read from the input file.
+    size_t bytes_read {0};
+    // Time, in seconds, spent waiting for reads to complete.
+    double read_time {0.0};
+    // Wall time, in seconds, of the whole loading operation.
+    double total_time {0.0};
+
+    // End-to-end throughput in bytes per second.
+    double bandwidth() const { return total_time > 0.0 ? bytes_read / total_time : 0.0; }
+};
+
+// View of voltages, with axes [integration_interval][frequency][antenna][polarization][time_step].
+using VoltageView = ArrayView<std::complex<int8_t>, 5>;
+using ConstVoltageView = ArrayView<const std::complex<int8_t>, 5>;
+
 /**
  * @brief Voltage data making up an observation recorded by a radiotelescope.
  * 
@@ -111,6 +133,20 @@ class Voltages : public MemoryBuffer<std::complex<int8_t>> {
         return static_cast<size_t>(obsInfo.nPolarizations) * obsInfo.nAntennas * obsInfo.nFrequencies * obsInfo.nTimesteps;
     }
 
+    /**
+     * @brief View of the samples, with axes [integration_interval][frequency][antenna][polarization][time_step].
+     * Slice it to select a range of intervals, channels or antennas without copying the data, e.g.
+     * `voltages.view().slice(1, first_channel, n_channels)`.
+     */
+    VoltageView view() {
+        const size_t nIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1) / nIntegrationSteps};
+        return {data(), {nIntervals, obsInfo.nFrequencies, obsInfo.nAntennas, obsInfo.nPolarizations, nIntegrationSteps}, on_gpu()};
+    }
+
+    ConstVoltageView view() const {
+        return const_cast<Voltages*>(this)->view();
+    }
+
     /**
      * Read voltage data from a .dat file.
      * Data in the file is ordered according to the following axes, from the slowest to the fastest:
@@ -126,11 +162,37 @@ class Voltages : public MemoryBuffer<std::complex<int8_t>> {
      * @param edge: set to zero `edge` channels at the top and the bottom of the frequency band.
      * @param timestepsPerRead: number of timesteps o read from the file at each read call. Might be useful
      * to optimise memory consumption.
+     * @param n_threads: number of threads used to read and expand the samples. Defaults to all the
+     * hardware threads available. The output does not depend on this value.
      * @return A new instance of the Voltage class.
      */
-    static Voltages from_dat_file(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps);
+    static Voltages from_dat_file(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+            unsigned int n_threads = 0);
+
+    /**
+     * Read voltage data from a .dat file directly into GPU memory. The output is the same as
+     * `from_dat_file`, but the samples are expanded and reordered on the GPU.
+     *
+     * The file is read in chunks of `chunk_size` bytes into two pinned buffers used in turn: while
+     * a chunk is being copied to the GPU and expanded on its own stream, the next one is read from
+     * disk.
+     *
+     * @param filename: path to the .dat file.
+     * @param obsInfo: metadata information regarding the obervation.
+     * @param nIntegrationSteps: number of timesteps to integrate over when/if data will be correlated.
+     * @param stats: if not null, filled with timing information about the loading process.
+     * @param chunk_size: size, in bytes, of each read. It is rounded down to a whole number of timesteps.
+     * @param device_id: GPU the data is loaded on and expanded by, e.g. to spread coarse channels across
+     * the GPUs of a node. A negative value selects the current GPU. The current GPU is not changed.
+     * @param pin_mapping: map the file and register the mapping as pinned memory, so that chunks are
+     * copied to the GPU straight from the page cache, without the pinned buffers. Registering pins
+     * the whole file in memory.
+     * @return A new instance of the Voltage class, residing in GPU memory.
+     */
+    static Voltages from_dat_file_gpu(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+            VoltageLoadStats *stats = nullptr, size_t chunk_size = 64ul * 1024ul * 1024ul, int device_id = -1,
+            bool pin_mapping = false);
 
-    static Voltages from_dat_file_gpu(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps);
     /**
      * Read voltage data from a memory buffer.
      * Data in memory is ordered according to the following axes, from the slowest to the fastest:
@@ -145,13 +207,25 @@ class Voltages : public MemoryBuffer<std::complex<int8_t>> {
      * @param obsInfo; metadata information regarding the obervation. For VCS data, you can use the constant
      * VCS_OVSERVATION_INFO.
      * @param nIntegrationSteps: number of timesteps to integrate over when/if data will be correlated.
-     * @param use_pinned_mem: if GPU support is enabled, gives the option to pin CPU memory for fast memory
-     * transfers to GPU.
+     * The number of timesteps does not need to be a multiple of it: samples of the last interval
+     * past the last timestep are set to zero.
+     * @param n_threads: number of threads reordering blocks of timesteps. Defaults to all the
+     * hardware threads available. The output does not depend on this value.
      * @return A new instance of the Voltage class.
      * 
      * TODO: check if we need the edge feature.
      */
-    static Voltages from_memory(const int8_t *buffer, size_t length, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps);
+    static Voltages from_memory(const int8_t *buffer, size_t length, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+            unsigned int n_threads = 0);
+
+    /**
+     * Same as `from_memory`, but the samples are reordered on the GPU and the returned object
+     * resides in GPU memory. As in `from_dat_file_gpu`, the buffer is copied to the GPU in chunks
+     * of `chunk_size` bytes through two pinned buffers used in turn, so that copies overlap the
+     * reordering of the previous chunk. `stats`, `chunk_size` and `device_id` have the same meaning.
+     */
+    static Voltages from_memory_gpu(const int8_t *buffer, size_t length, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+            VoltageLoadStats *stats = nullptr, size_t chunk_size = 64ul * 1024ul * 1024ul, int device_id = -1);
 
 
 
@@ -159,11 +233,33 @@ class Voltages : public MemoryBuffer<std::complex<int8_t>> {
      * Read EDA2 voltage data from a binary dump of the corresponding HDF5 file.
      * (This is mainly used for testing purposes, we should probably read the HDF5 file directly)
     */
-    static Voltages from_eda2_file(const std::string& filename, const ObservationInfo& obs_info, unsigned int nIntegrationSteps);
+    static Voltages from_eda2_file(const std::string& filename, const ObservationInfo& obs_info, unsigned int nIntegrationSteps,
+            unsigned int n_threads = 0);
+
+    /**
+     * Same as `from_eda2_file`, with the samples reordered on the GPU (see `from_memory_gpu`).
+    */
+    static Voltages from_eda2_file_gpu(const std::string& filename, const ObservationInfo& obs_info, unsigned int nIntegrationSteps,
+            VoltageLoadStats *stats = nullptr, size_t chunk_size = 64ul * 1024ul * 1024ul, int device_id = -1);
 
 };
 
 
+/**
+ * @brief Order of the axes of the visibilities of an integration interval, from the slowest to
+ * the fastest varying one.
+ */
+enum class VisibilityLayout {
+    CHANNEL_BASELINE_POL, // [channel][baseline][polarization], the order produced by the correlator.
+    BASELINE_CHANNEL_POL  // [baseline][channel][polarization], the order of MWAX visibility files.
+};
+
+
+// View of visibilities, with axes [integration_interval][channel][baseline][polarization],
+// whatever the layout of the data in memory.
+using VisibilityView = ArrayView<std::complex<float>, 4>;
+using ConstVisibilityView = ArrayView<const std::complex<float>, 4>;
+
 /**
  * @brief Correlated voltages, also known as visibilities.
  * 
@@ -172,7 +268,8 @@ class Voltages : public MemoryBuffer<std::complex<int8_t>> {
  * `nAveragedChannels` class attributes. The latter indicates how many contiguous channels are
  * averaged to reduce the original number of frequencies to `nFrequecies` in the final `data` array.
  * 
- * The array `data` 
+ * The array `data` is made of one block of visibilities per integration interval, each laid out
+ * according to `layout`. Use `at` to access visibilities independently of the layout.
  */
 class Visibilities : public MemoryBuffer<std::complex<float>> {
     public:
@@ -180,13 +277,15 @@ class Visibilities : public MemoryBuffer<std::complex<float>> {
     unsigned int nIntegrationSteps;
     unsigned int nAveragedChannels;
     unsigned int nFrequencies;
+    VisibilityLayout layout {VisibilityLayout::CHANNEL_BASELINE_POL};
 
     Visibilities(MemoryBuffer<std::complex<float>>&& data, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
-            unsigned int nAveragedChannels) : MemoryBuffer {std::move(data)} {
+            unsigned int nAveragedChannels, VisibilityLayout layout = VisibilityLayout::CHANNEL_BASELINE_POL) : MemoryBuffer {std::move(data)} {
         this->obsInfo = obsInfo;
         this->nIntegrationSteps = nIntegrationSteps;
         this->nAveragedChannels = nAveragedChannels;
         this->nFrequencies = obsInfo.nFrequencies / nAveragedChannels;
+        this->layout = layout;
     }
 
     Visibilities(const Visibilities& other) : MemoryBuffer {other} {
@@ -194,6 +293,7 @@ class Visibilities : public MemoryBuffer<std::complex<float>> {
         nIntegrationSteps = other.nIntegrationSteps;
         nFrequencies = other.nFrequencies;
         nAveragedChannels = other.nAveragedChannels;
+        layout = other.layout;
     }
 
     Visibilities(Visibilities&& other) : MemoryBuffer {std::move(other)} {
@@ -201,6 +301,7 @@ class Visibilities : public MemoryBuffer<std::complex<float>> {
         nIntegrationSteps = other.nIntegrationSteps;
         nFrequencies = other.nFrequencies;
         nAveragedChannels = other.nAveragedChannels;
+        layout = other.layout;
     }
 
     Visibilities& operator=(Visibilities& other){
@@ -210,6 +311,7 @@ class Visibilities : public MemoryBuffer<std::complex<float>> {
         nIntegrationSteps = other.nIntegrationSteps;
         nFrequencies = other.nFrequencies;
         nAveragedChannels = other.nAveragedChannels;
+        layout = other.layout;
         return *this;
     }
 
@@ -219,27 +321,35 @@ class Visibilities : public MemoryBuffer<std::complex<float>> {
         nIntegrationSteps = other.nIntegrationSteps;
         nFrequencies = other.nFrequencies;
         nAveragedChannels = other.nAveragedChannels;
+        layout = other.layout;
         MemoryBuffer::operator=(std::move(other));
         return *this;
     }
 
 
+    /**
+     * @brief Index of the baseline formed by antennas `a1` and `a2`, in any order.
+     */
+    static unsigned int baseline_index(unsigned int a1, unsigned int a2){
+        const unsigned int min_a {a1 < a2 ? a1 : a2}, max_a {a1 < a2 ? a2 : a1};
+        return (max_a * (max_a + 1))/2 + min_a;
+    }
+
+    // Distance, in complex values, between the same baseline in consecutive channels.
+    size_t channel_stride() const {
+        const size_t n_pols {static_cast<size_t>(obsInfo.nPolarizations) * obsInfo.nPolarizations};
+        return layout == VisibilityLayout::CHANNEL_BASELINE_POL ? this->matrix_size() : n_pols;
+    }
+
+    // Distance, in complex values, between consecutive baselines in the same channel.
+    size_t baseline_stride() const {
+        const size_t n_pols {static_cast<size_t>(obsInfo.nPolarizations) * obsInfo.nPolarizations};
+        return layout == VisibilityLayout::CHANNEL_BASELINE_POL ? n_pols : n_pols * nFrequencies;
+    }
+
+
     std::complex<float> *at(unsigned int interval, unsigned int frequency, unsigned int a1, unsigned a2){
-        const size_t nValuesInTimeInterval {this->matrix_size() * nFrequencies};
-        // TODO: use actual frequency instead of a "frequency index". To do so, information must
-        // be provided by the user.
-        std::complex<float> *pData = this->data() + nValuesInTimeInterval * interval + this->matrix_size() * frequency;
-        unsigned int min_a, max_a;
-        if(a1 < a2) {
-            min_a = a1;
-            max_a = a2;
-        }else{
-            min_a = a2;
-            max_a = a1;
-        }
-        unsigned int baseline = (max_a * (max_a + 1))/2 + min_a;
-        pData += this->obsInfo.nPolarizations * this->obsInfo.nPolarizations * baseline;
-        return pData;
+        return at(interval, frequency, baseline_index(a1, a2));
     }
 
 
@@ -247,11 +357,30 @@ class Visibilities : public MemoryBuffer<std::complex<float>> {
         const size_t nValuesInTimeInterval {this->matrix_size() * nFrequencies};
         // TODO: use actual frequency instead of a "frequency index". To do so, information must
         // be provided by the user.
-        std::complex<float> *pData = this->data() + nValuesInTimeInterval * interval + this->matrix_size() * frequency;
-        pData += this->obsInfo.nPolarizations * this->obsInfo.nPolarizations * baseline;
-        return pData;
+        return this->data() + nValuesInTimeInterval * interval + channel_stride() * frequency + baseline_stride() * baseline;
+    }
+
+    /**
+     * @brief View of the visibilities, with axes [integration_interval][channel][baseline][polarization]
+     * in any layout. Slice it to select intervals, channels or a range of baselines without copies,
+     * and pass the result to `to_fits_file` or `to_fits_file_mwax` to save only that part.
+     */
+    VisibilityView view() {
+        const size_t n_pols {static_cast<size_t>(obsInfo.nPolarizations) * obsInfo.nPolarizations};
+        return {data(), {integration_intervals(), nFrequencies, this->matrix_size() / n_pols, n_pols},
+            {this->matrix_size() * nFrequencies, channel_stride(), baseline_stride(), 1}, on_gpu()};
+    }
+
+    ConstVisibilityView view() const {
+        return const_cast<Visibilities*>(this)->view();
     }
 
+    /**
+     * @brief Reorder the visibilities, in place, according to `target`. Nothing is done if the
+     * data is already in that layout.
+     */
+    void convert_layout(VisibilityLayout target);
+
     /**
      * Number of time intervals integrated over by the correlator.
      */
@@ -272,29 +401,62 @@ class Visibilities : public MemoryBuffer<std::complex<float>> {
     }
     
     /**
-     * @brief Save visibilities to a FITS file on disk.
+     * @brief Save visibilities to a FITS file on disk. Each interval is stored as an image
+     * with one row per channel, whatever the layout of the data in memory.
      * 
      * @param filename name of the output file.
+     * @param options compression and encoding of the images (see `FitsOutputOptions`). With the
+     * INT16_SCALED encoding, each interval gets its own scale. By default, images are written
+     * uncompressed as 32-bit floats.
      */
-    void to_fits_file(const std::string& filename) const;
+    void to_fits_file(const std::string& filename, const FitsOutputOptions& options = {}) const;
+
+    /**
+     * @brief Same as above, but only the visibilities in `vis`, a view of this object (or of data
+     * with the same observation), are saved. Header keywords are those of this object; interval
+     * timestamps account for the offset of the view. The view must reside in host memory.
+     */
+    void to_fits_file(const std::string& filename, const ConstVisibilityView& vis, const FitsOutputOptions& options = {}) const;
 
 
     /**
-     * @brief Save visibilities to a FITS file on disk using MWAX format.
+     * @brief Save visibilities to a FITS file on disk using MWAX format. If the data is already
+     * in `VisibilityLayout::BASELINE_CHANNEL_POL` layout, it is written without any reordering.
      * 
      * @param filename name of the output file.
+     * @param options compression and encoding of the images, as for `to_fits_file`.
+     */
+    void to_fits_file_mwax(const std::string& filename, int coarse_channel_idx, const FitsOutputOptions& options = {}) const;
+
+    /**
+     * @brief Same as above, but only the visibilities in `vis` are saved. See `to_fits_file`.
      */
-    void to_fits_file_mwax(const std::string& filename, int coarse_channel_idx) const;
+    void to_fits_file_mwax(const std::string& filename, const ConstVisibilityView& vis, int coarse_channel_idx,
+            const FitsOutputOptions& options = {}) const;
 
 
     /**
-     * @brief Load visibilities from a FITS file.
+     * @brief Load visibilities from a FITS file, either written by `to_fits_file` or in MWAX
+     * format. Data is not reordered: the layout of the returned object is the one of the file.
+     * Compressed and 16-bit encoded files are decoded to 32-bit floats.
      * 
      * @param filename path to the FITS file to read visibilities from.
      * @param oInfo Information about the observation. Default assumes data come from the MWA VCS dataser.
+     * @param first_interval index of the first integration interval to load.
+     * @param n_intervals number of integration intervals to load. A negative value means all the
+     * intervals from `first_interval` to the end of the file. Only the selected ones are read.
      * @return Visibilities instance.
      */
-    static Visibilities from_fits_file(const std::string& filename, const ObservationInfo &oInfo = VCS_OBSERVATION_INFO);
+    static Visibilities from_fits_file(const std::string& filename, const ObservationInfo &oInfo = VCS_OBSERVATION_INFO,
+            unsigned int first_interval = 0, int n_intervals = -1);
+
+    /**
+     * @brief Read `out.dim(0)` integration intervals, starting from `first_interval`, of a file
+     * written by `to_fits_file` or in MWAX format straight into `out`, e.g. a slice of a larger
+     * preallocated `Visibilities` object, in any layout. The number of channels, baselines and
+     * polarizations of `out` must match the file. The view must reside in host memory.
+     */
+    static void load_fits_file(const std::string& filename, const VisibilityView& out, unsigned int first_interval = 0);
 };
 
 
@@ -309,28 +471,28 @@ ObservationInfo parse_mwa_phase1_dat_file_info(const std::string& file_path);
 
 
 /**
- * @brief 
+ * @brief Group MWA .dat files by second of observation.
  * 
  * @param file_list: the list of paths to .dat files making up on or more MWA observations to be 
- * processed. The files will be sorted by observation ID and then timestamp. Consecutive 24 .dat
- * files make up a second of observation over the entire MWA frequency bandwidth and will be
- * processed together. Hence, the total number of files must be a multiple of 24.
- * @todo Ideally we want to return a structured output that partitions input by observation and
- * and then by groups of 24 files each representing 1 sencond of observation. Assume now a single
- * observation, single 24 files.
+ * processed. The files will be sorted by observation ID, then timestamp, then coarse channel.
+ * Consecutive 24 .dat files make up a second of observation over the entire MWA frequency
+ * bandwidth and will be processed together. Hence, the total number of files must be a multiple of 24.
+ * @return one group of 24 files for each second, the seconds of each observation following those
+ * of the previous one.
 */
 std::vector<std::vector<DatFile>> parse_mwa_dat_files(std::vector<std::string>& file_list);
 
 /**
  * @brief Get all the dat files in a directory. Optionally, only select the dat files corresponding
  * to a certain range of seconds, specified with an offset from the first second and a count.
+ *
+ * The directory is indexed by an `ObservationCatalogue` kept for the lifetime of the process:
+ * later calls on the same directory only look at the files added since. This function is thread safe.
  * 
  * @param directory: path to the directory containing the .dat files
- * @param offset: offset in number of seconds from the start of the observation.
+ * @param offset: offset in number of seconds from the start of the observation. If the directory
+ * holds several observations, seconds are counted across all of them, in order of observation ID.
  * @param count: number of seconds to consider, starting from the offset.
- * @todo Ideally we want to return a structured output that partitions input by observation and
- * and then by groups of 24 files each representing 1 sencond of observation. Assume now a single
- * observation, single 24 files.
 */
 std::vector<std::vector<DatFile>> parse_mwa_dat_files(std::string directory, int start_second = 0, int count = -1);
 #endif
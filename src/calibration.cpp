@@ -0,0 +1,445 @@
+#include <sys/stat.h>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <complex>
+#include <fstream>
+#include <stdexcept>
+#include "calibration.hpp"
+#include "parallel.hpp"
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+    // Number of coarse channels in an MWA observation.
+    constexpr unsigned int n_coarse_channels {24};
+
+    /*
+        Computes J1 * V * J2^H. Each argument holds the real and imaginary parts of XX, XY, YX and
+        YY, in this order; `v` is overwritten with the result. `F` is either `float` or a vector
+        type, in which case each lane is an independent product.
+    */
+    template <typename F>
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    inline void jones_product(const F *j1, const F *j2, F *v){
+        // M = J1 * V
+        F m[8];
+        m[0] = j1[0] * v[0] - j1[1] * v[1] + j1[2] * v[4] - j1[3] * v[5];
+        m[1] = j1[0] * v[1] + j1[1] * v[0] + j1[2] * v[5] + j1[3] * v[4];
+        m[2] = j1[0] * v[2] - j1[1] * v[3] + j1[2] * v[6] - j1[3] * v[7];
+        m[3] = j1[0] * v[3] + j1[1] * v[2] + j1[2] * v[7] + j1[3] * v[6];
+        m[4] = j1[4] * v[0] - j1[5] * v[1] + j1[6] * v[4] - j1[7] * v[5];
+        m[5] = j1[4] * v[1] + j1[5] * v[0] + j1[6] * v[5] + j1[7] * v[4];
+        m[6] = j1[4] * v[2] - j1[5] * v[3] + j1[6] * v[6] - j1[7] * v[7];
+        m[7] = j1[4] * v[3] + j1[5] * v[2] + j1[6] * v[7] + j1[7] * v[6];
+        // V' = M * J2^H, where (J2^H)_00 = XX*, (J2^H)_01 = YX*, (J2^H)_10 = XY*, (J2^H)_11 = YY*.
+        v[0] = m[0] * j2[0] + m[1] * j2[1] + m[2] * j2[2] + m[3] * j2[3];
+        v[1] = m[1] * j2[0] - m[0] * j2[1] + m[3] * j2[2] - m[2] * j2[3];
+        v[2] = m[0] * j2[4] + m[1] * j2[5] + m[2] * j2[6] + m[3] * j2[7];
+        v[3] = m[1] * j2[4] - m[0] * j2[5] + m[3] * j2[6] - m[2] * j2[7];
+        v[4] = m[4] * j2[0] + m[5] * j2[1] + m[6] * j2[2] + m[7] * j2[3];
+        v[5] = m[5] * j2[0] - m[4] * j2[1] + m[7] * j2[2] - m[6] * j2[3];
+        v[6] = m[4] * j2[4] + m[5] * j2[5] + m[6] * j2[6] + m[7] * j2[7];
+        v[7] = m[5] * j2[4] - m[4] * j2[5] + m[7] * j2[6] - m[6] * j2[7];
+    }
+
+
+
+    // Antennas (a1 >= a2) of baseline `baseline`.
+    #ifdef __GPU__
+    __host__ __device__
+    #endif
+    inline void baseline_antennas(unsigned int baseline, unsigned int& a1, unsigned int& a2){
+        a1 = static_cast<unsigned int>((sqrtf(8.0f * baseline + 1.0f) - 1.0f) / 2.0f);
+        // Rounding errors of the square root for large indices.
+        while(a1 * (a1 + 1) / 2 > baseline) a1--;
+        while((a1 + 1) * (a1 + 2) / 2 <= baseline) a1++;
+        a2 = baseline - a1 * (a1 + 1) / 2;
+    }
+
+
+
+#if defined(__AVX__)
+    using VecF = __m256;
+    constexpr size_t vec_width {8};
+
+    inline VecF vec_load(const float *p) { return _mm256_loadu_ps(p); }
+    inline VecF vec_broadcast(float value) { return _mm256_set1_ps(value); }
+
+    // Transpose the 8 x 8 matrix of floats stored in `r`, one row per register.
+    inline void transpose8(VecF *r){
+        const VecF t0 {_mm256_unpacklo_ps(r[0], r[1])}, t1 {_mm256_unpackhi_ps(r[0], r[1])};
+        const VecF t2 {_mm256_unpacklo_ps(r[2], r[3])}, t3 {_mm256_unpackhi_ps(r[2], r[3])};
+        const VecF t4 {_mm256_unpacklo_ps(r[4], r[5])}, t5 {_mm256_unpackhi_ps(r[4], r[5])};
+        const VecF t6 {_mm256_unpacklo_ps(r[6], r[7])}, t7 {_mm256_unpackhi_ps(r[6], r[7])};
+        const VecF s0 {_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0))}, s1 {_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2))};
+        const VecF s2 {_mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0))}, s3 {_mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2))};
+        const VecF s4 {_mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0))}, s5 {_mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2))};
+        const VecF s6 {_mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0))}, s7 {_mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2))};
+        r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+        r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+        r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+        r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+        r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+        r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+        r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+        r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    }
+
+    // Load the 8 values of each of 8 consecutive items as 8 planes.
+    inline void load_planes(const float *v, VecF *planes){
+        for(size_t k {0}; k < 8; k++) planes[k] = _mm256_loadu_ps(v + 8 * k);
+        transpose8(planes);
+    }
+
+    inline void store_planes(VecF *planes, float *v){
+        transpose8(planes);
+        for(size_t k {0}; k < 8; k++) _mm256_storeu_ps(v + 8 * k, planes[k]);
+    }
+#elif defined(__SSE2__)
+    using VecF = __m128;
+    constexpr size_t vec_width {4};
+
+    inline VecF vec_load(const float *p) { return _mm_loadu_ps(p); }
+    inline VecF vec_broadcast(float value) { return _mm_set1_ps(value); }
+
+    // Each item is split in two halves of 4 values, transposed separately.
+    inline void load_planes(const float *v, VecF *planes){
+        for(size_t k {0}; k < 4; k++){
+            planes[k] = _mm_loadu_ps(v + 8 * k);
+            planes[k + 4] = _mm_loadu_ps(v + 8 * k + 4);
+        }
+        _MM_TRANSPOSE4_PS(planes[0], planes[1], planes[2], planes[3]);
+        _MM_TRANSPOSE4_PS(planes[4], planes[5], planes[6], planes[7]);
+    }
+
+    inline void store_planes(VecF *planes, float *v){
+        _MM_TRANSPOSE4_PS(planes[0], planes[1], planes[2], planes[3]);
+        _MM_TRANSPOSE4_PS(planes[4], planes[5], planes[6], planes[7]);
+        for(size_t k {0}; k < 4; k++){
+            _mm_storeu_ps(v + 8 * k, planes[k]);
+            _mm_storeu_ps(v + 8 * k + 4, planes[k + 4]);
+        }
+    }
+#endif
+
+
+
+    /*
+        Calibrates `n` consecutive items of 8 floats (the four polarisations of a visibility)
+        starting at `v`. Element `e` of the matrices of item `k` is `j1[e * j1_stride + k]` and
+        `j2[e * j2_stride + k]`; if `BroadcastJ1` is set, the first matrix is `j1[e * j1_stride]`
+        for all the items.
+    */
+    template <bool BroadcastJ1>
+    void calibrate_items(float *v, size_t n, const float *j1, size_t j1_stride, const float *j2, size_t j2_stride){
+        size_t k {0};
+    #if defined(__AVX__) || defined(__SSE2__)
+        VecF j1_planes[8];
+        if(BroadcastJ1)
+            for(size_t e {0}; e < 8; e++) j1_planes[e] = vec_broadcast(j1[e * j1_stride]);
+        for(; k + vec_width <= n; k += vec_width){
+            VecF planes[8], j2_planes[8];
+            load_planes(v + 8 * k, planes);
+            for(size_t e {0}; e < 8; e++){
+                if(!BroadcastJ1) j1_planes[e] = vec_load(j1 + e * j1_stride + k);
+                j2_planes[e] = vec_load(j2 + e * j2_stride + k);
+            }
+            jones_product(j1_planes, j2_planes, planes);
+            store_planes(planes, v + 8 * k);
+        }
+    #endif
+        for(; k < n; k++){
+            float a[8], b[8];
+            for(size_t e {0}; e < 8; e++){
+                a[e] = j1[e * j1_stride + (BroadcastJ1 ? 0 : k)];
+                b[e] = j2[e * j2_stride + k];
+            }
+            jones_product(a, b, v + 8 * k);
+        }
+    }
+
+
+
+    /*
+        Index of the first solution channel matching channel 0 of `vis`.
+    */
+    unsigned int solution_channel_offset(const Visibilities& vis, const CalibrationSolutions& solutions){
+        if(vis.obsInfo.nPolarizations != 2)
+            throw std::invalid_argument {"apply_calibration: only dual polarisation visibilities can be calibrated."};
+        if(solutions.n_antennas() < vis.obsInfo.nAntennas)
+            throw std::invalid_argument {"apply_calibration: the solutions cover " + std::to_string(solutions.n_antennas()) +
+                " antennas, the visibilities " + std::to_string(vis.obsInfo.nAntennas) + "."};
+        if(solutions.n_channels() == vis.nFrequencies) return 0;
+        if(solutions.n_channels() == n_coarse_channels * vis.nFrequencies){
+            if(vis.obsInfo.coarse_channel_index >= n_coarse_channels)
+                throw std::invalid_argument {"apply_calibration: invalid coarse channel index."};
+            return vis.obsInfo.coarse_channel_index * vis.nFrequencies;
+        }
+        throw std::invalid_argument {"apply_calibration: the solutions have " + std::to_string(solutions.n_channels()) +
+            " channels, which do not match the " + std::to_string(vis.nFrequencies) + " of the visibilities."};
+    }
+
+
+
+    void apply_calibration_cpu(Visibilities& vis, const CalibrationSolutions& solutions, unsigned int channel_offset,
+            unsigned int n_threads){
+        const unsigned int n_antennas {vis.obsInfo.nAntennas}, n_channels {vis.nFrequencies};
+        const size_t n_intervals {vis.integration_intervals()};
+        const size_t n_baselines {vis.matrix_size() / 4};
+        const size_t sol_antennas {solutions.n_antennas()}, sol_channels {solutions.n_channels()};
+        if(vis.layout == VisibilityLayout::CHANNEL_BASELINE_POL){
+            // Baselines of the same first antenna are contiguous: the matrix of the second one is
+            // read from consecutive entries of the `by_channel` table.
+            parallel_for(n_intervals * n_channels, [&](size_t first, size_t last){
+                for(size_t item {first}; item < last; item++){
+                    const unsigned int interval {static_cast<unsigned int>(item / n_channels)};
+                    const unsigned int channel {static_cast<unsigned int>(item % n_channels)};
+                    float *matrix {reinterpret_cast<float*>(vis.at(interval, channel, 0u))};
+                    const float *table {solutions.by_channel() + (channel + channel_offset) * CalibrationSolutions::n_elements * sol_antennas};
+                    for(unsigned int a1 {0}; a1 < n_antennas; a1++)
+                        calibrate_items<true>(matrix + 8 * (static_cast<size_t>(a1) * (a1 + 1) / 2), a1 + 1,
+                            table + a1, sol_antennas, table, sol_antennas);
+                }
+            }, n_threads);
+        }else{
+            // Channels of the same baseline are contiguous, as in the `by_antenna` table.
+            const size_t antenna_stride {CalibrationSolutions::n_elements * sol_channels};
+            parallel_for(n_intervals * n_baselines, [&](size_t first, size_t last){
+                for(size_t item {first}; item < last; item++){
+                    const unsigned int interval {static_cast<unsigned int>(item / n_baselines)};
+                    const unsigned int baseline {static_cast<unsigned int>(item % n_baselines)};
+                    unsigned int a1, a2;
+                    baseline_antennas(baseline, a1, a2);
+                    float *values {reinterpret_cast<float*>(vis.at(interval, 0u, baseline))};
+                    calibrate_items<false>(values, n_channels, solutions.by_antenna() + a1 * antenna_stride + channel_offset,
+                        sol_channels, solutions.by_antenna() + a2 * antenna_stride + channel_offset, sol_channels);
+                }
+            }, n_threads);
+        }
+    }
+}
+
+
+
+#ifdef __GPU__
+/*
+    One thread per visibility matrix element group (interval, channel, baseline). Consecutive
+    threads handle the items that are contiguous in memory in the given layout.
+*/
+__global__ void calibration_kernel(float *vis, size_t n_items, unsigned int n_channels, unsigned int n_baselines,
+        bool channel_fastest, size_t interval_stride, size_t channel_stride, size_t baseline_stride,
+        const float *table, unsigned int sol_antennas, unsigned int channel_offset){
+    const size_t start_index {blockDim.x * blockIdx.x + threadIdx.x};
+    const size_t grid_size {gridDim.x * blockDim.x};
+    for(size_t i {start_index}; i < n_items; i += grid_size){
+        unsigned int channel, baseline;
+        size_t interval;
+        if(channel_fastest){
+            channel = i % n_channels;
+            baseline = (i / n_channels) % n_baselines;
+            interval = i / (static_cast<size_t>(n_channels) * n_baselines);
+        }else{
+            baseline = i % n_baselines;
+            channel = (i / n_baselines) % n_channels;
+            interval = i / (static_cast<size_t>(n_channels) * n_baselines);
+        }
+        unsigned int a1, a2;
+        baseline_antennas(baseline, a1, a2);
+        float *v {vis + interval * interval_stride + channel * channel_stride + baseline * baseline_stride};
+        const float *sol {table + static_cast<size_t>(channel + channel_offset) * CalibrationSolutions::n_elements * sol_antennas};
+        float values[8], j1[8], j2[8];
+        for(unsigned int e {0}; e < 8; e++){
+            values[e] = v[e];
+            j1[e] = sol[e * sol_antennas + a1];
+            j2[e] = sol[e * sol_antennas + a2];
+        }
+        jones_product(j1, j2, values);
+        for(unsigned int e {0}; e < 8; e++) v[e] = values[e];
+    }
+}
+
+
+
+namespace {
+    void apply_calibration_gpu(Visibilities& vis, const CalibrationSolutions& solutions, unsigned int channel_offset){
+        GpuDeviceGuard guard {vis.device_id()};
+        const unsigned int n_baselines {static_cast<unsigned int>(vis.matrix_size() / 4)};
+        const size_t n_items {vis.integration_intervals() * vis.nFrequencies * n_baselines};
+        if(n_items == 0) return;
+        const float *table {solutions.device_by_channel()};
+        // Strides in floats.
+        const size_t interval_stride {2 * vis.matrix_size() * vis.nFrequencies};
+        const bool channel_fastest {vis.layout == VisibilityLayout::BASELINE_CHANNEL_POL};
+        const unsigned int n_threads {1024};
+        const unsigned int n_blocks {static_cast<unsigned int>(std::min<size_t>((n_items + n_threads - 1) / n_threads, 65535))};
+        calibration_kernel<<<n_blocks, n_threads>>>(reinterpret_cast<float*>(vis.data()), n_items, vis.nFrequencies,
+            n_baselines, channel_fastest, interval_stride, 2 * vis.channel_stride(), 2 * vis.baseline_stride(), table,
+            solutions.n_antennas(), channel_offset);
+        gpuCheckLastError();
+    }
+}
+#endif
+
+
+
+CalibrationSolutions::CalibrationSolutions(unsigned int n_antennas, unsigned int n_channels) :
+        CalibrationSolutions {n_antennas, n_channels, std::vector<JonesMatrix<float>>(static_cast<size_t>(n_antennas) * n_channels,
+            JonesMatrix<float> {{1.0f, 0.0f}, {0.0f, 0.0f}, {0.0f, 0.0f}, {1.0f, 0.0f}})} {}
+
+
+
+CalibrationSolutions::CalibrationSolutions(unsigned int n_antennas, unsigned int n_channels,
+        const std::vector<JonesMatrix<float>>& solutions) : _n_antennas {n_antennas}, _n_channels {n_channels} {
+    const size_t n_matrices {static_cast<size_t>(n_antennas) * n_channels};
+    if(n_matrices == 0 || solutions.size() != n_matrices)
+        throw std::invalid_argument {"CalibrationSolutions: expected " + std::to_string(n_matrices) + " matrices, got " +
+            std::to_string(solutions.size()) + "."};
+    _by_channel.resize(n_matrices * n_elements);
+    _by_antenna.resize(n_matrices * n_elements);
+    for(size_t a {0}; a < n_antennas; a++){
+        for(size_t c {0}; c < n_channels; c++){
+            const JonesMatrix<float>& m {solutions[a * n_channels + c]};
+            const float values[n_elements] {m.XX.real, m.XX.imag, m.XY.real, m.XY.imag, m.YX.real, m.YX.imag, m.YY.real, m.YY.imag};
+            for(size_t e {0}; e < n_elements; e++){
+                _by_channel[(c * n_elements + e) * n_antennas + a] = values[e];
+                _by_antenna[(a * n_elements + e) * n_channels + c] = values[e];
+            }
+        }
+    }
+}
+
+
+
+JonesMatrix<float> CalibrationSolutions::get(unsigned int antenna, unsigned int channel) const {
+    if(antenna >= _n_antennas || channel >= _n_channels)
+        throw std::out_of_range {"CalibrationSolutions::get: antenna or channel out of range."};
+    const float *p {_by_antenna.data() + static_cast<size_t>(antenna) * n_elements * _n_channels + channel};
+    JonesMatrix<float> m;
+    m.XX = {p[0], p[_n_channels]};
+    m.XY = {p[2 * _n_channels], p[3 * _n_channels]};
+    m.YX = {p[4 * _n_channels], p[5 * _n_channels]};
+    m.YY = {p[6 * _n_channels], p[7 * _n_channels]};
+    return m;
+}
+
+
+
+const float *CalibrationSolutions::device_by_channel() const {
+#ifdef __GPU__
+    int device {0};
+    gpuGetDevice(&device);
+    std::lock_guard<std::mutex> lock {device_mutex};
+    auto it = device_tables.find(device);
+    if(it == device_tables.end()){
+        MemoryBuffer<float> table {_by_channel.size(), MemoryType::DEVICE};
+        gpuMemcpy(table.data(), _by_channel.data(), sizeof(float) * _by_channel.size(), gpuMemcpyHostToDevice);
+        it = device_tables.emplace(device, std::move(table)).first;
+    }
+    return it->second.data();
+#else
+    throw std::runtime_error {"CalibrationSolutions::device_by_channel: GPU support not available."};
+#endif
+}
+
+
+
+std::shared_ptr<const CalibrationSolutions> CalibrationSolutions::from_file(const std::string& filename, unsigned int interval){
+    std::ifstream fin {filename, std::ios::binary};
+    if(!fin) throw std::runtime_error {"CalibrationSolutions::from_file: impossible to open the file " + filename};
+    char intro[8];
+    uint32_t header[6];
+    double time_range[2];
+    fin.read(intro, sizeof(intro));
+    fin.read(reinterpret_cast<char*>(header), sizeof(header));
+    fin.read(reinterpret_cast<char*>(time_range), sizeof(time_range));
+    if(!fin || std::memcmp(intro, "MWAOCAL", 7) != 0)
+        throw std::invalid_argument {"CalibrationSolutions::from_file: " + filename + " is not a calibration solutions file."};
+    const uint32_t n_intervals {header[2]}, n_antennas {header[3]}, n_channels {header[4]}, n_pols {header[5]};
+    if(header[0] != 0 || header[1] != 0 || n_pols != 4)
+        throw std::invalid_argument {"CalibrationSolutions::from_file: unsupported file type or structure in " + filename};
+    if(interval >= n_intervals)
+        throw std::invalid_argument {"CalibrationSolutions::from_file: interval " + std::to_string(interval) +
+            " not in " + filename};
+    const size_t n_matrices {static_cast<size_t>(n_antennas) * n_channels};
+    std::vector<std::complex<double>> values(n_matrices * n_pols);
+    fin.seekg(sizeof(std::complex<double>) * values.size() * interval, std::ios::cur);
+    fin.read(reinterpret_cast<char*>(values.data()), sizeof(std::complex<double>) * values.size());
+    if(!fin) throw std::runtime_error {"CalibrationSolutions::from_file: " + filename + " is truncated."};
+    std::vector<JonesMatrix<float>> solutions(n_matrices);
+    for(size_t i {0}; i < n_matrices; i++){
+        const std::complex<double> *m {values.data() + 4 * i};
+        solutions[i].XX = {static_cast<float>(m[0].real()), static_cast<float>(m[0].imag())};
+        solutions[i].XY = {static_cast<float>(m[1].real()), static_cast<float>(m[1].imag())};
+        solutions[i].YX = {static_cast<float>(m[2].real()), static_cast<float>(m[2].imag())};
+        solutions[i].YY = {static_cast<float>(m[3].real()), static_cast<float>(m[3].imag())};
+    }
+    return std::make_shared<const CalibrationSolutions>(n_antennas, n_channels, solutions);
+}
+
+
+
+namespace {
+    struct CachedSolutions {
+        struct timespec mtime;
+        off_t size;
+        std::shared_ptr<const CalibrationSolutions> solutions;
+    };
+
+    std::mutex solutions_cache_mutex;
+    std::map<std::pair<std::string, unsigned int>, CachedSolutions> solutions_cache;
+}
+
+
+
+std::shared_ptr<const CalibrationSolutions> CalibrationSolutions::load(const std::string& filename, unsigned int interval){
+    struct stat file_stat;
+    if(stat(filename.c_str(), &file_stat) != 0)
+        throw std::runtime_error {"CalibrationSolutions::load: impossible to access the file " + filename};
+    const auto key = std::make_pair(filename, interval);
+    {
+        std::lock_guard<std::mutex> lock {solutions_cache_mutex};
+        auto it = solutions_cache.find(key);
+        if(it != solutions_cache.end() && it->second.size == file_stat.st_size &&
+                it->second.mtime.tv_sec == file_stat.st_mtim.tv_sec && it->second.mtime.tv_nsec == file_stat.st_mtim.tv_nsec)
+            return it->second.solutions;
+    }
+    // Read without holding the lock, as metafits files are.
+    std::shared_ptr<const CalibrationSolutions> solutions {from_file(filename, interval)};
+    std::lock_guard<std::mutex> lock {solutions_cache_mutex};
+    solutions_cache[key] = CachedSolutions {file_stat.st_mtim, file_stat.st_size, solutions};
+    return solutions;
+}
+
+
+
+void CalibrationSolutions::clear_cache(){
+    std::lock_guard<std::mutex> lock {solutions_cache_mutex};
+    solutions_cache.clear();
+}
+
+
+
+void apply_calibration(Visibilities& vis, const CalibrationSolutions& solutions, unsigned int n_threads){
+    const unsigned int channel_offset {solution_channel_offset(vis, solutions)};
+    if(vis.on_gpu()){
+    #ifdef __GPU__
+        apply_calibration_gpu(vis, solutions, channel_offset);
+        return;
+    #endif
+    }
+    apply_calibration_cpu(vis, solutions, channel_offset, n_threads);
+}
+
+
+
+void apply_calibration(Visibilities& vis, unsigned int n_threads){
+    if(vis.obsInfo.calibration_solutions_file.empty())
+        throw std::invalid_argument {"apply_calibration: no calibration solutions file in the observation information."};
+    apply_calibration(vis, *CalibrationSolutions::load(vis.obsInfo.calibration_solutions_file), n_threads);
+}
@@ -0,0 +1,112 @@
+#ifndef __CALIBRATION_H__
+#define __CALIBRATION_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "astroio.hpp"
+#include "jones_matrix.hpp"
+
+/**
+ * @brief Jones matrices of the antennas, for each frequency channel, stored in a layout suited to
+ * applying them to whole `Visibilities` buffers.
+ *
+ * The eight real values of the matrices (real and imaginary parts of XX, XY, YX and YY, in this
+ * order) are stored as separate planes, so that consecutive antennas, or consecutive channels,
+ * can be loaded into SIMD registers as they are. Two tables are kept, one for each visibility
+ * layout:
+ *  - `by_channel`, indexed [channel][element][antenna];
+ *  - `by_antenna`, indexed [antenna][element][channel].
+ *
+ * Objects are immutable and can be shared between threads. Antennas flagged in the solutions
+ * have NaN matrices, hence NaN calibrated visibilities.
+ */
+class CalibrationSolutions {
+
+    unsigned int _n_antennas {0};
+    unsigned int _n_channels {0};
+    std::vector<float> _by_channel;
+    std::vector<float> _by_antenna;
+    // Copies of `by_channel` uploaded to GPU on demand, by device.
+    mutable std::mutex device_mutex;
+    mutable std::map<int, MemoryBuffer<float>> device_tables;
+
+    public:
+    // Number of real values in a Jones matrix.
+    static constexpr unsigned int n_elements {8};
+
+    /**
+     * @brief Identity matrices for all the antennas and channels.
+     */
+    CalibrationSolutions(unsigned int n_antennas, unsigned int n_channels);
+
+    /**
+     * @brief Build the tables from `solutions`, indexed [antenna][channel].
+     */
+    CalibrationSolutions(unsigned int n_antennas, unsigned int n_channels, const std::vector<JonesMatrix<float>>& solutions);
+
+    CalibrationSolutions(const CalibrationSolutions&) = delete;
+    CalibrationSolutions& operator=(const CalibrationSolutions&) = delete;
+
+    /**
+     * @brief Read the solutions of integration interval `interval` from a binary file in the
+     * format of the AOCal tools ("MWAOCAL" header, followed by complex doubles indexed
+     * [interval][antenna][channel][polarisation]). The file is read in a single pass.
+     */
+    static std::shared_ptr<const CalibrationSolutions> from_file(const std::string& filename, unsigned int interval = 0);
+
+    /**
+     * @brief Same as `from_file`, but the result is cached for the lifetime of the process and
+     * shared by all the callers: the file is read again only when its modification time or size
+     * change. This function is thread safe.
+     */
+    static std::shared_ptr<const CalibrationSolutions> load(const std::string& filename, unsigned int interval = 0);
+
+    /**
+     * @brief Forget the solution files read so far by `load`.
+     */
+    static void clear_cache();
+
+    unsigned int n_antennas() const { return _n_antennas; }
+    unsigned int n_channels() const { return _n_channels; }
+
+    const float *by_channel() const { return _by_channel.data(); }
+    const float *by_antenna() const { return _by_antenna.data(); }
+
+    /**
+     * @brief Matrix of `antenna` in `channel`.
+     */
+    JonesMatrix<float> get(unsigned int antenna, unsigned int channel) const;
+
+    /**
+     * @brief Copy of the `by_channel` table on the current GPU, uploaded the first time it is
+     * requested on each device. Only available in GPU builds.
+     */
+    const float *device_by_channel() const;
+};
+
+
+
+/**
+ * @brief Calibrate the visibilities in place, computing J_a1 * V * J_a2^H for each baseline
+ * (a1, a2), channel and interval. Data is processed where it resides, on CPU or GPU, in any
+ * layout; GPU work is queued to the default stream.
+ *
+ * The solutions are matched to the channels of `vis` either one to one or, if they cover
+ * all the 24 coarse channels of the observation, by selecting those of coarse channel
+ * `vis.obsInfo.coarse_channel_index`.
+ *
+ * @param n_threads number of CPU threads to use; 0 means one per hardware thread.
+ * @throw std::invalid_argument if the solutions do not match the visibilities.
+ */
+void apply_calibration(Visibilities& vis, const CalibrationSolutions& solutions, unsigned int n_threads = 0);
+
+/**
+ * @brief Same as above, with the solutions read from `vis.obsInfo.calibration_solutions_file`
+ * through `CalibrationSolutions::load`.
+ */
+void apply_calibration(Visibilities& vis, unsigned int n_threads = 0);
+
+#endif
@@ -0,0 +1,504 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include "checkpoint.hpp"
+#include "mapped_file.hpp"
+#include "instrumentation.hpp"
+
+namespace {
+
+constexpr const char *MAGIC {"BLINK_CHECKPOINT"};
+// Data is written and uploaded in chunks of this size.
+constexpr size_t CHUNK_BYTES {16ul << 20};
+// Headers larger than this are considered corrupted.
+constexpr size_t MAX_HEADER_BYTES {64ul << 20};
+
+
+const char* content_name(CheckpointContent content){
+    switch(content){
+        case CheckpointContent::BUFFER: return "buffer";
+        case CheckpointContent::VOLTAGES: return "voltages";
+        case CheckpointContent::VISIBILITIES: return "visibilities";
+        case CheckpointContent::IMAGES: return "images";
+    }
+    return "unknown";
+}
+
+
+
+CheckpointContent parse_content(const std::string& name){
+    for(CheckpointContent c : {CheckpointContent::BUFFER, CheckpointContent::VOLTAGES, CheckpointContent::VISIBILITIES, CheckpointContent::IMAGES})
+        if(name == content_name(c)) return c;
+    throw std::runtime_error {"checkpoint: unknown content '" + name + "'."};
+}
+
+
+
+const char* telescope_names[] {"MWA1", "MWA2", "MWA3", "EDA2"};
+
+const char* layout_name(VisibilityLayout layout){
+    return layout == VisibilityLayout::CHANNEL_BASELINE_POL ? "channel_baseline_pol" : "baseline_channel_pol";
+}
+
+
+
+void add_attribute(CheckpointInfo& info, const std::string& key, const std::string& value){
+    if(value.find('\n') != std::string::npos)
+        throw std::invalid_argument {"save_checkpoint: the value of '" + key + "' contains a new line."};
+    info.attributes[key] = value;
+}
+
+
+
+template <typename V>
+void add_number(CheckpointInfo& info, const std::string& key, V value){
+    std::ostringstream ss;
+    ss << std::setprecision(17) << value;
+    info.attributes[key] = ss.str();
+}
+
+
+
+const std::string& get_attribute(const CheckpointInfo& info, const std::string& key){
+    auto it = info.attributes.find(key);
+    if(it == info.attributes.end()) throw std::runtime_error {"checkpoint: the header has no '" + key + "' key."};
+    return it->second;
+}
+
+
+
+template <typename V>
+V get_number(const CheckpointInfo& info, const std::string& key){
+    std::istringstream ss {get_attribute(info, key)};
+    V value;
+    ss >> value;
+    if(ss.fail() || !ss.eof()) throw std::runtime_error {"checkpoint: malformed value of '" + key + "'."};
+    return value;
+}
+
+
+
+void add_observation_info(CheckpointInfo& info, const ObservationInfo& obsInfo){
+    add_number(info, "obs.n_antennas", obsInfo.nAntennas);
+    add_number(info, "obs.n_frequencies", obsInfo.nFrequencies);
+    add_number(info, "obs.n_polarizations", obsInfo.nPolarizations);
+    add_number(info, "obs.n_timesteps", obsInfo.nTimesteps);
+    add_number(info, "obs.time_resolution", obsInfo.timeResolution);
+    add_number(info, "obs.frequency_resolution", obsInfo.frequencyResolution);
+    add_number(info, "obs.coarse_channel_bandwidth", obsInfo.coarseChannelBandwidth);
+    add_number(info, "obs.start_time", static_cast<long long>(obsInfo.startTime));
+    add_number(info, "obs.coarse_channel", obsInfo.coarseChannel);
+    add_number(info, "obs.geo_long_deg", obsInfo.geo_long_deg);
+    add_number(info, "obs.geo_lat_deg", obsInfo.geo_lat_deg);
+    add_number(info, "obs.coarse_channel_index", obsInfo.coarse_channel_index);
+    const int telescope {static_cast<int>(obsInfo.telescope)};
+    if(telescope >= 0 && telescope < 4) add_attribute(info, "obs.telescope", telescope_names[telescope]);
+    else add_number(info, "obs.telescope", telescope);
+    add_attribute(info, "obs.id", obsInfo.id);
+    add_attribute(info, "obs.metadata_file", obsInfo.metadata_file);
+    add_attribute(info, "obs.calibration_solutions_file", obsInfo.calibration_solutions_file);
+}
+
+
+
+ObservationInfo get_observation_info(const CheckpointInfo& info){
+    ObservationInfo obsInfo {};
+    obsInfo.nAntennas = get_number<unsigned int>(info, "obs.n_antennas");
+    obsInfo.nFrequencies = get_number<unsigned int>(info, "obs.n_frequencies");
+    obsInfo.nPolarizations = get_number<unsigned int>(info, "obs.n_polarizations");
+    obsInfo.nTimesteps = get_number<unsigned int>(info, "obs.n_timesteps");
+    obsInfo.timeResolution = get_number<double>(info, "obs.time_resolution");
+    obsInfo.frequencyResolution = get_number<double>(info, "obs.frequency_resolution");
+    obsInfo.coarseChannelBandwidth = get_number<double>(info, "obs.coarse_channel_bandwidth");
+    obsInfo.startTime = static_cast<time_t>(get_number<long long>(info, "obs.start_time"));
+    obsInfo.coarseChannel = get_number<unsigned int>(info, "obs.coarse_channel");
+    obsInfo.geo_long_deg = get_number<double>(info, "obs.geo_long_deg");
+    obsInfo.geo_lat_deg = get_number<double>(info, "obs.geo_lat_deg");
+    obsInfo.coarse_channel_index = get_number<unsigned int>(info, "obs.coarse_channel_index");
+    const std::string& telescope {get_attribute(info, "obs.telescope")};
+    const auto name = std::find(std::begin(telescope_names), std::end(telescope_names), telescope);
+    obsInfo.telescope = static_cast<TelescopeID>(name != std::end(telescope_names) ? name - std::begin(telescope_names)
+        : get_number<int>(info, "obs.telescope"));
+    obsInfo.id = get_attribute(info, "obs.id");
+    obsInfo.metadata_file = get_attribute(info, "obs.metadata_file");
+    obsInfo.calibration_solutions_file = get_attribute(info, "obs.calibration_solutions_file");
+    return obsInfo;
+}
+
+
+
+/*
+    Header text for `info`, whose `data_offset` must be set, without the padding.
+*/
+std::string header_text(const CheckpointInfo& info){
+    std::ostringstream ss;
+    ss << MAGIC << " " << info.version << "\n";
+    ss << "content=" << content_name(info.content) << "\n";
+    ss << "element_type=" << info.element_type << "\n";
+    ss << "element_size=" << info.element_size << "\n";
+    ss << "byte_order=little\n";
+    ss << "dims=";
+    for(size_t i {0}; i < info.dims.size(); i++) ss << (i > 0 ? "," : "") << info.dims[i];
+    ss << "\n";
+    ss << "data_offset=" << info.data_offset << "\n";
+    ss << "data_bytes=" << info.data_bytes << "\n";
+    for(const auto& item : info.attributes) ss << item.first << "=" << item.second << "\n";
+    ss << "end\n";
+    return ss.str();
+}
+
+
+
+void write_all(int fd, const char *data, size_t bytes, const std::string& filename){
+    while(bytes > 0){
+        const ssize_t written {::write(fd, data, bytes)};
+        if(written < 0){
+            if(errno == EINTR) continue;
+            throw std::runtime_error {"save_checkpoint: error while writing " + filename + ": " + std::strerror(errno)};
+        }
+        data += written;
+        bytes -= static_cast<size_t>(written);
+    }
+}
+
+
+
+/*
+    Flush to disk the directory entry of `filename`, e.g. after renaming it. File systems that
+    cannot sync directories report EINVAL, which is not an error.
+*/
+void sync_directory(const std::string& filename){
+    const size_t pos {filename.find_last_of('/')};
+    const std::string directory {pos == std::string::npos ? "." : pos == 0 ? "/" : filename.substr(0, pos)};
+    const int fd {::open(directory.c_str(), O_RDONLY | O_DIRECTORY)};
+    if(fd < 0) throw std::runtime_error {"save_checkpoint: cannot open " + directory + ": " + std::strerror(errno)};
+    const int result {::fsync(fd)};
+    const int error {errno};
+    ::close(fd);
+    if(result != 0 && error != EINVAL)
+        throw std::runtime_error {"save_checkpoint: error while syncing " + directory + ": " + std::strerror(error)};
+}
+
+
+
+#ifdef __GPU__
+/*
+    Write `bytes` bytes of device memory at `data` to `fd`, a chunk at a time: the download of
+    a chunk to one pinned buffer overlaps with the write of the previous chunk from the other.
+*/
+void write_device_data(int fd, const char *data, size_t bytes, int device, const std::string& filename){
+    GpuDeviceGuard guard {device};
+    const size_t chunk_bytes {std::min(bytes, CHUNK_BYTES)};
+    const size_t n_chunks {(bytes + chunk_bytes - 1) / chunk_bytes};
+    MemoryBuffer<char> staging[2];
+    gpuEvent_t downloaded[2];
+    gpuStream_t stream;
+    gpuStreamCreate(&stream);
+    for(int b {0}; b < 2; b++){
+        staging[b].allocate(chunk_bytes, MemoryType::PINNED);
+        gpuEventCreate(&downloaded[b]);
+    }
+    auto queue_download = [&](size_t c){
+        const size_t offset {c * chunk_bytes};
+        gpuMemcpyAsync(staging[c % 2].data(), data + offset, std::min(chunk_bytes, bytes - offset), gpuMemcpyDeviceToHost, stream);
+        gpuEventRecord(downloaded[c % 2], stream);
+    };
+    try {
+        queue_download(0);
+        for(size_t c {0}; c < n_chunks; c++){
+            // The other buffer was written to disk in the previous iteration.
+            if(c + 1 < n_chunks) queue_download(c + 1);
+            gpuEventSynchronize(downloaded[c % 2]);
+            write_all(fd, staging[c % 2].data(), std::min(chunk_bytes, bytes - c * chunk_bytes), filename);
+        }
+    } catch (...) {
+        gpuStreamSynchronize(stream);
+        gpuStreamDestroy(stream);
+        for(int b {0}; b < 2; b++) gpuEventDestroy(downloaded[b]);
+        throw;
+    }
+    gpuStreamDestroy(stream);
+    for(int b {0}; b < 2; b++) gpuEventDestroy(downloaded[b]);
+}
+#endif
+
+
+
+CheckpointInfo make_info(CheckpointContent content, const char *element_type, size_t element_size, std::vector<size_t> dims,
+        const ObservationInfo& obsInfo){
+    CheckpointInfo info;
+    info.content = content;
+    info.element_type = element_type;
+    info.element_size = element_size;
+    info.dims = std::move(dims);
+    add_observation_info(info, obsInfo);
+    return info;
+}
+
+}
+
+
+
+CheckpointInfo read_checkpoint_info(const std::string& filename){
+    std::ifstream fin {filename, std::ios::binary | std::ios::ate};
+    if(!fin) throw std::runtime_error {"read_checkpoint_info: cannot open " + filename + "."};
+    const size_t file_size {static_cast<size_t>(fin.tellg())};
+    fin.seekg(0);
+    // The header is read in blocks until its last line.
+    std::string header;
+    size_t end_pos {std::string::npos};
+    while(end_pos == std::string::npos){
+        const size_t block {std::min(CHECKPOINT_ALIGNMENT, file_size - header.size())};
+        if(block == 0 || header.size() >= MAX_HEADER_BYTES)
+            throw std::runtime_error {"read_checkpoint_info: " + filename + " is not a checkpoint file."};
+        const size_t old_size {header.size()};
+        header.resize(old_size + block);
+        fin.read(&header[old_size], static_cast<std::streamsize>(block));
+        if(!fin) throw std::runtime_error {"read_checkpoint_info: error while reading " + filename + "."};
+        if(old_size == 0 && header.compare(0, std::strlen(MAGIC), MAGIC) != 0)
+            throw std::runtime_error {"read_checkpoint_info: " + filename + " is not a checkpoint file."};
+        end_pos = header.find("\nend\n", old_size > 4 ? old_size - 4 : 0);
+    }
+    header.resize(end_pos + 1);
+
+    CheckpointInfo info;
+    std::istringstream lines {header};
+    std::string line;
+    std::getline(lines, line);
+    if(std::sscanf(line.c_str() + std::strlen(MAGIC), " %u", &info.version) != 1)
+        throw std::runtime_error {"read_checkpoint_info: malformed header in " + filename + "."};
+    if(info.version > CHECKPOINT_VERSION)
+        throw std::runtime_error {"read_checkpoint_info: " + filename + " was written by a newer version of the format (" +
+            std::to_string(info.version) + ")."};
+    while(std::getline(lines, line)){
+        const size_t eq {line.find('=')};
+        if(eq == std::string::npos) throw std::runtime_error {"read_checkpoint_info: malformed header line '" + line + "' in " + filename + "."};
+        info.attributes[line.substr(0, eq)] = line.substr(eq + 1);
+    }
+    // The fixed keys are moved out of the attributes.
+    info.content = parse_content(get_attribute(info, "content"));
+    info.element_type = get_attribute(info, "element_type");
+    info.element_size = get_number<size_t>(info, "element_size");
+    info.data_offset = get_number<size_t>(info, "data_offset");
+    info.data_bytes = get_number<size_t>(info, "data_bytes");
+    if(get_attribute(info, "byte_order") != "little")
+        throw std::runtime_error {"read_checkpoint_info: " + filename + " is not little endian."};
+    std::istringstream dims {get_attribute(info, "dims")};
+    std::string dim;
+    while(std::getline(dims, dim, ',')) info.dims.push_back(std::stoull(dim));
+    for(const char *key : {"content", "element_type", "element_size", "byte_order", "dims", "data_offset", "data_bytes"})
+        info.attributes.erase(key);
+    if(info.data_offset % CHECKPOINT_ALIGNMENT != 0 || info.data_offset < header.size() || info.data_offset + info.data_bytes > file_size)
+        throw std::runtime_error {"read_checkpoint_info: " + filename + " is truncated or corrupted."};
+    return info;
+}
+
+
+
+void write_checkpoint(const std::string& filename, CheckpointInfo& info, const void *data, size_t data_bytes,
+        bool on_gpu, int device){
+    ASTROIO_TIMED_SCOPE("checkpoint_write", data_bytes);
+    #ifndef __GPU__
+    (void) device;
+    if(on_gpu) throw std::invalid_argument {"write_checkpoint: GPU data on a CPU only build of the software."};
+    #endif
+    info.version = CHECKPOINT_VERSION;
+    info.data_bytes = data_bytes;
+    // The offset is part of the header: grow it until the header fits.
+    info.data_offset = CHECKPOINT_ALIGNMENT;
+    std::string header {header_text(info)};
+    while(header.size() > info.data_offset){
+        info.data_offset = (header.size() + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+        header = header_text(info);
+    }
+    header.resize(info.data_offset, '\0');
+
+    const std::string tmp_filename {filename + ".tmp"};
+    const int fd {::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)};
+    if(fd < 0) throw std::runtime_error {"save_checkpoint: cannot create " + tmp_filename + ": " + std::strerror(errno)};
+    try {
+        write_all(fd, header.data(), header.size(), tmp_filename);
+        const char *bytes {static_cast<const char*>(data)};
+        #ifdef __GPU__
+        if(on_gpu){
+            if(data_bytes > 0) write_device_data(fd, bytes, data_bytes, device, tmp_filename);
+        }else
+        #endif
+        for(size_t offset {0}; offset < data_bytes; offset += CHUNK_BYTES)
+            write_all(fd, bytes + offset, std::min(CHUNK_BYTES, data_bytes - offset), tmp_filename);
+        // The data must be on disk before the rename makes it the checkpoint.
+        if(::fsync(fd) != 0)
+            throw std::runtime_error {"save_checkpoint: error while syncing " + tmp_filename + ": " + std::strerror(errno)};
+    } catch (...) {
+        ::close(fd);
+        std::remove(tmp_filename.c_str());
+        throw;
+    }
+    if(::close(fd) != 0 || std::rename(tmp_filename.c_str(), filename.c_str()) != 0){
+        std::remove(tmp_filename.c_str());
+        throw std::runtime_error {"save_checkpoint: error while completing " + filename + ": " + std::strerror(errno)};
+    }
+    sync_directory(filename);
+}
+
+
+
+void read_checkpoint_data(const std::string& filename, const CheckpointInfo& info, void *dest, bool on_gpu){
+    ASTROIO_TIMED_SCOPE("checkpoint_read", info.data_bytes);
+    if(info.data_bytes == 0) return;
+    const MappedFile input {filename};
+    if(input.size() < info.data_offset + info.data_bytes)
+        throw std::runtime_error {"read_checkpoint_data: " + filename + " is truncated."};
+    const char *source {input.data() + info.data_offset};
+    if(!on_gpu){
+        std::memcpy(dest, source, info.data_bytes);
+        return;
+    }
+    #ifdef __GPU__
+    /*
+        Double buffering: while a chunk is uploaded from one pinned buffer, the next one is
+        copied from the page cache into the other. A buffer is refilled once its upload is done.
+    */
+    const size_t chunk_bytes {std::min(info.data_bytes, CHUNK_BYTES)};
+    const size_t n_chunks {(info.data_bytes + chunk_bytes - 1) / chunk_bytes};
+    MemoryBuffer<char> staging[2];
+    gpuEvent_t uploaded[2];
+    gpuStream_t stream;
+    gpuStreamCreate(&stream);
+    for(int b {0}; b < 2; b++){
+        staging[b].allocate(chunk_bytes, MemoryType::PINNED);
+        gpuEventCreate(&uploaded[b]);
+    }
+    for(size_t c {0}; c < n_chunks; c++){
+        const int b {static_cast<int>(c % 2)};
+        const size_t offset {c * chunk_bytes};
+        const size_t bytes {std::min(chunk_bytes, info.data_bytes - offset)};
+        if(c >= 2) gpuEventSynchronize(uploaded[b]);
+        std::memcpy(staging[b].data(), source + offset, bytes);
+        gpuMemcpyAsync(static_cast<char*>(dest) + offset, staging[b].data(), bytes, gpuMemcpyHostToDevice, stream);
+        gpuEventRecord(uploaded[b], stream);
+    }
+    gpuStreamSynchronize(stream);
+    gpuStreamDestroy(stream);
+    for(int b {0}; b < 2; b++) gpuEventDestroy(uploaded[b]);
+    #else
+    throw std::invalid_argument {"read_checkpoint_data: GPU destination on a CPU only build of the software."};
+    #endif
+}
+
+
+
+void save_checkpoint(const std::string& filename, const Voltages& voltages){
+    const ConstVoltageView view {voltages.view()};
+    CheckpointInfo info {make_info(CheckpointContent::VOLTAGES, CheckpointElement<std::complex<int8_t>>::name,
+        sizeof(std::complex<int8_t>), {view.dim(0), view.dim(1), view.dim(2), view.dim(3), view.dim(4)}, voltages.obsInfo)};
+    add_number(info, "n_integration_steps", voltages.nIntegrationSteps);
+    const MemoryBuffer<std::complex<int8_t>>& buffer {voltages};
+    write_checkpoint(filename, info, buffer.data(), buffer.size() * sizeof(std::complex<int8_t>), buffer.on_gpu(), buffer.device_id());
+}
+
+
+
+void save_checkpoint(const std::string& filename, const Visibilities& visibilities){
+    const size_t n_pols {static_cast<size_t>(visibilities.obsInfo.nPolarizations) * visibilities.obsInfo.nPolarizations};
+    const size_t n_baselines {visibilities.matrix_size() / n_pols};
+    const size_t intervals {visibilities.integration_intervals()};
+    // Dimensions in the order the data is stored.
+    std::vector<size_t> dims {intervals, visibilities.nFrequencies, n_baselines, n_pols};
+    if(visibilities.layout == VisibilityLayout::BASELINE_CHANNEL_POL) std::swap(dims[1], dims[2]);
+    CheckpointInfo info {make_info(CheckpointContent::VISIBILITIES, CheckpointElement<std::complex<float>>::name,
+        sizeof(std::complex<float>), dims, visibilities.obsInfo)};
+    add_number(info, "n_integration_steps", visibilities.nIntegrationSteps);
+    add_number(info, "n_averaged_channels", visibilities.nAveragedChannels);
+    add_attribute(info, "layout", layout_name(visibilities.layout));
+    const MemoryBuffer<std::complex<float>>& buffer {visibilities};
+    write_checkpoint(filename, info, buffer.data(), buffer.size() * sizeof(std::complex<float>), buffer.on_gpu(), buffer.device_id());
+}
+
+
+
+void save_checkpoint(const std::string& filename, const Images& images){
+    CheckpointInfo info {make_info(CheckpointContent::IMAGES, CheckpointElement<std::complex<float>>::name,
+        sizeof(std::complex<float>), {images.n_intervals, images.n_channels, images.side_size, images.side_size}, images.obsInfo)};
+    add_number(info, "ra_deg", images.ra_deg);
+    add_number(info, "dec_deg", images.dec_deg);
+    add_number(info, "pixscale_ra", images.pixscale_ra);
+    add_number(info, "pixscale_dec", images.pixscale_dec);
+    // One character per image, [interval][channel], only if some are flagged.
+    std::string flags(images.size(), '0');
+    bool any_flagged {false};
+    for(size_t i {0}; i < images.n_intervals; i++){
+        for(size_t ch {0}; ch < images.n_channels; ch++){
+            if(!images.is_flagged(i, ch)) continue;
+            flags[i * images.n_channels + ch] = '1';
+            any_flagged = true;
+        }
+    }
+    if(any_flagged) add_attribute(info, "flags", flags);
+    const MemoryBuffer<std::complex<float>>& buffer {images};
+    write_checkpoint(filename, info, buffer.data(), buffer.size() * sizeof(std::complex<float>), buffer.on_gpu(), buffer.device_id());
+}
+
+
+
+namespace checkpoint_detail {
+
+CheckpointInfo read_info(const std::string& filename, CheckpointContent content, const std::string& element_type){
+    CheckpointInfo info {read_checkpoint_info(filename)};
+    if(info.content != content)
+        throw std::runtime_error {"checkpoint: " + filename + " holds " + content_name(info.content) + ", not " + content_name(content) + "."};
+    if(info.element_type != element_type)
+        throw std::runtime_error {"checkpoint: " + filename + " holds elements of type " + info.element_type + ", not " + element_type + "."};
+    return info;
+}
+
+}
+
+
+
+Voltages load_voltages_checkpoint(const std::string& filename, MemoryType mem_type, int device_id){
+    const CheckpointInfo info {checkpoint_detail::read_info(filename, CheckpointContent::VOLTAGES, CheckpointElement<std::complex<int8_t>>::name)};
+    if(info.dims.size() != 5) throw std::runtime_error {"checkpoint: " + filename + " has wrong dimensions for voltages."};
+    return Voltages {checkpoint_detail::load_data<std::complex<int8_t>>(filename, info, mem_type, device_id), get_observation_info(info),
+        get_number<unsigned int>(info, "n_integration_steps")};
+}
+
+
+
+Visibilities load_visibilities_checkpoint(const std::string& filename, MemoryType mem_type, int device_id){
+    const CheckpointInfo info {checkpoint_detail::read_info(filename, CheckpointContent::VISIBILITIES, CheckpointElement<std::complex<float>>::name)};
+    if(info.dims.size() != 4) throw std::runtime_error {"checkpoint: " + filename + " has wrong dimensions for visibilities."};
+    const std::string& layout {get_attribute(info, "layout")};
+    if(layout != layout_name(VisibilityLayout::CHANNEL_BASELINE_POL) && layout != layout_name(VisibilityLayout::BASELINE_CHANNEL_POL))
+        throw std::runtime_error {"checkpoint: unknown visibility layout '" + layout + "' in " + filename + "."};
+    return Visibilities {checkpoint_detail::load_data<std::complex<float>>(filename, info, mem_type, device_id), get_observation_info(info),
+        get_number<unsigned int>(info, "n_integration_steps"), get_number<unsigned int>(info, "n_averaged_channels"),
+        layout == layout_name(VisibilityLayout::CHANNEL_BASELINE_POL) ? VisibilityLayout::CHANNEL_BASELINE_POL : VisibilityLayout::BASELINE_CHANNEL_POL};
+}
+
+
+
+Images load_images_checkpoint(const std::string& filename, MemoryType mem_type, int device_id){
+    const CheckpointInfo info {checkpoint_detail::read_info(filename, CheckpointContent::IMAGES, CheckpointElement<std::complex<float>>::name)};
+    if(info.dims.size() != 4 || info.dims[2] != info.dims[3])
+        throw std::runtime_error {"checkpoint: " + filename + " has wrong dimensions for images."};
+    Images images {checkpoint_detail::load_data<std::complex<float>>(filename, info, mem_type, device_id), get_observation_info(info),
+        static_cast<unsigned int>(info.dims[0]), static_cast<unsigned int>(info.dims[1]), static_cast<unsigned int>(info.dims[2]),
+        get_number<double>(info, "ra_deg"), get_number<double>(info, "dec_deg"),
+        get_number<double>(info, "pixscale_ra"), get_number<double>(info, "pixscale_dec")};
+    auto flags = info.attributes.find("flags");
+    if(flags != info.attributes.end()){
+        if(flags->second.size() != images.size()) throw std::runtime_error {"checkpoint: wrong number of flags in " + filename + "."};
+        std::vector<bool> values(flags->second.size());
+        for(size_t i {0}; i < values.size(); i++) values[i] = flags->second[i] == '1';
+        images.set_flags(values);
+    }
+    return images;
+}
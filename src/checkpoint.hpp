@@ -0,0 +1,192 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <complex>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <string>
+#include <vector>
+#include "astroio.hpp"
+#include "images.hpp"
+#include "memory_buffer.hpp"
+
+/**
+ * Checkpoint files hold a data product (a `MemoryBuffer`, `Voltages`, `Visibilities` or `Images`
+ * object) together with everything needed to rebuild it: element type, dimensions, layout,
+ * integration parameters and `ObservationInfo`.
+ *
+ * A file starts with a text header of "key=value" lines, the first of which is
+ * "BLINK_CHECKPOINT <version>" and the last "end", padded with zero bytes to a multiple of
+ * `CHECKPOINT_ALIGNMENT` bytes. The data follows, as raw little endian values, starting at byte
+ * `data_offset`. `head -c 4096 file` shows what a file contains.
+ *
+ * Reloading maps the data in memory, so restarting from a checkpoint reads nothing until the
+ * data is accessed. Files are written under a temporary name, flushed to disk and renamed when
+ * complete, and the rename is flushed as well: after a crash, a checkpoint is either the
+ * previous or the new version, never a partial one.
+ */
+
+constexpr unsigned int CHECKPOINT_VERSION {1};
+// Alignment, in bytes, of the data in checkpoint files.
+constexpr size_t CHECKPOINT_ALIGNMENT {4096};
+
+
+enum class CheckpointContent {BUFFER, VOLTAGES, VISIBILITIES, IMAGES};
+
+
+/**
+ * @brief Content of the header of a checkpoint file.
+ */
+struct CheckpointInfo {
+    unsigned int version {CHECKPOINT_VERSION};
+    CheckpointContent content {CheckpointContent::BUFFER};
+    // Name of the type of the elements, e.g. "complex_float32" (see `CheckpointElement`).
+    std::string element_type;
+    size_t element_size {0};
+    // Dimensions of the array, from the slowest to the fastest varying.
+    std::vector<size_t> dims;
+    size_t data_offset {0};
+    size_t data_bytes {0};
+    // The other keys, e.g. "layout" or "obs.n_antennas", with their values as written.
+    std::map<std::string, std::string> attributes;
+};
+
+
+/**
+ * @brief Name, in checkpoint headers, of the element types a checkpoint can hold.
+ */
+template <typename T> struct CheckpointElement;
+template <> struct CheckpointElement<int8_t> { static constexpr const char *name {"int8"}; };
+template <> struct CheckpointElement<uint8_t> { static constexpr const char *name {"uint8"}; };
+template <> struct CheckpointElement<int16_t> { static constexpr const char *name {"int16"}; };
+template <> struct CheckpointElement<int32_t> { static constexpr const char *name {"int32"}; };
+template <> struct CheckpointElement<float> { static constexpr const char *name {"float32"}; };
+template <> struct CheckpointElement<double> { static constexpr const char *name {"float64"}; };
+template <> struct CheckpointElement<std::complex<int8_t>> { static constexpr const char *name {"complex_int8"}; };
+template <> struct CheckpointElement<std::complex<int16_t>> { static constexpr const char *name {"complex_int16"}; };
+template <> struct CheckpointElement<std::complex<float>> { static constexpr const char *name {"complex_float32"}; };
+template <> struct CheckpointElement<std::complex<double>> { static constexpr const char *name {"complex_float64"}; };
+
+
+/**
+ * @brief Read the header of checkpoint `filename`.
+ *
+ * @throw std::runtime_error if the file is not a checkpoint, was written by a newer version of
+ * the format, or is shorter than its header says.
+ */
+CheckpointInfo read_checkpoint_info(const std::string& filename);
+
+/**
+ * @brief Write `data_bytes` bytes at `data`, described by `info`, to checkpoint `filename`.
+ * `data_offset` and `data_bytes` of `info` are filled in. Data on GPU (`on_gpu`, residing on
+ * device `device`) is not moved: it is downloaded in chunks through pinned buffers, overlapping
+ * each download with the write of the previous chunk. Host data is written in chunks too.
+ *
+ * Used by the `save_checkpoint` functions, which should be preferred.
+ */
+void write_checkpoint(const std::string& filename, CheckpointInfo& info, const void *data, size_t data_bytes,
+        bool on_gpu = false, int device = 0);
+
+/**
+ * @brief Copy the data of checkpoint `filename`, described by `info`, to `dest`, which holds at
+ * least `info.data_bytes` bytes and resides on GPU if `on_gpu` is true. GPU uploads are staged
+ * through pinned buffers, a chunk at a time, overlapping copies from the page cache with
+ * transfers over PCIe.
+ */
+void read_checkpoint_data(const std::string& filename, const CheckpointInfo& info, void *dest, bool on_gpu);
+
+
+/**
+ * @brief Save `buffer` to checkpoint `filename`. A buffer on GPU stays there.
+ */
+template <typename T>
+void save_checkpoint(const std::string& filename, const MemoryBuffer<T>& buffer){
+    CheckpointInfo info;
+    info.content = CheckpointContent::BUFFER;
+    info.element_type = CheckpointElement<T>::name;
+    info.element_size = sizeof(T);
+    info.dims = {buffer.size()};
+    write_checkpoint(filename, info, buffer.data(), buffer.size() * sizeof(T), buffer.on_gpu(), buffer.device_id());
+}
+
+void save_checkpoint(const std::string& filename, const Voltages& voltages);
+void save_checkpoint(const std::string& filename, const Visibilities& visibilities);
+void save_checkpoint(const std::string& filename, const Images& images);
+
+
+/**
+ * @brief Save `object` to checkpoint `filename` on a background thread, which owns the object
+ * until the file is written. The returned future rethrows the errors of the write. To keep using
+ * the data, pass a copy: for data on GPU, it is made on the device and the background thread
+ * downloads it, so the caller only waits for a device to device copy.
+ */
+template <typename T>
+std::future<void> save_checkpoint_async(const std::string& filename, T&& object){
+    static_assert(!std::is_lvalue_reference<T>::value, "save_checkpoint_async takes the ownership of the object.");
+    return std::async(std::launch::async, [filename](T data){
+        save_checkpoint(filename, data);
+    }, std::move(object));
+}
+
+
+namespace checkpoint_detail {
+    // Header of `filename`, checked to hold `content` with elements of type `element_type`.
+    CheckpointInfo read_info(const std::string& filename, CheckpointContent content, const std::string& element_type);
+
+    // Load the data of checkpoint `filename`, described by `info`, into a new buffer.
+    template <typename T>
+    MemoryBuffer<T> load_data(const std::string& filename, const CheckpointInfo& info, MemoryType mem_type, int device_id){
+        size_t n_elements {info.dims.empty() ? 0ul : 1ul};
+        for(size_t d : info.dims) n_elements *= d;
+        if(n_elements * sizeof(T) > info.data_bytes)
+            throw std::runtime_error {"checkpoint: " + filename + " holds less data than its dimensions require."};
+        const size_t n {info.data_bytes / sizeof(T)};
+        // Neither a mapping nor an allocation can be empty.
+        if(n == 0) return MemoryBuffer<T> {};
+        if(mem_type == MemoryType::PAGEABLE) return MemoryBuffer<T>::from_mapped_file(filename, info.data_offset, n);
+        #ifdef __GPU__
+        if(device_id < 0) gpuGetDevice(&device_id);
+        GpuDeviceGuard guard {device_id};
+        #else
+        (void) device_id;
+        #endif
+        MemoryBuffer<T> buffer {n, mem_type};
+        read_checkpoint_data(filename, info, buffer.data(), buffer.on_gpu());
+        return buffer;
+    }
+}
+
+
+/**
+ * @brief Load the buffer saved in checkpoint `filename`.
+ *
+ * @param mem_type memory the data is loaded to. With `MemoryType::PAGEABLE`, the buffer maps
+ * the file (see `MemoryBuffer::from_mapped_file`) and no data is read until accessed. With
+ * `MemoryType::DEVICE`, data is uploaded straight to GPU `device_id` (the current GPU if negative).
+ *
+ * @throw std::runtime_error if the file does not hold a buffer of elements of type `T`.
+ */
+template <typename T>
+MemoryBuffer<T> load_buffer_checkpoint(const std::string& filename, MemoryType mem_type = MemoryType::PAGEABLE, int device_id = -1){
+    const CheckpointInfo info {checkpoint_detail::read_info(filename, CheckpointContent::BUFFER, CheckpointElement<T>::name)};
+    return checkpoint_detail::load_data<T>(filename, info, mem_type, device_id);
+}
+
+/**
+ * @brief Load the voltages saved in checkpoint `filename`. See `load_buffer_checkpoint` for
+ * the meaning of `mem_type` and `device_id`.
+ */
+Voltages load_voltages_checkpoint(const std::string& filename, MemoryType mem_type = MemoryType::PAGEABLE, int device_id = -1);
+
+/**
+ * @brief Load the visibilities saved in checkpoint `filename`, in the layout they were saved in.
+ */
+Visibilities load_visibilities_checkpoint(const std::string& filename, MemoryType mem_type = MemoryType::PAGEABLE, int device_id = -1);
+
+/**
+ * @brief Load the images saved in checkpoint `filename`, with their flags and pointing.
+ */
+Images load_images_checkpoint(const std::string& filename, MemoryType mem_type = MemoryType::PAGEABLE, int device_id = -1);
+
+#endif
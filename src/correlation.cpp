@@ -0,0 +1,414 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include "correlation.hpp"
+#include "parallel.hpp"
+
+#if defined(__AVX2__) || defined(__AVX512BW__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+    // Time steps are processed in blocks whose length is a multiple of this value, so that
+    // the SIMD loops below have no remainder. Padding samples are zero.
+    constexpr size_t step_alignment {16};
+
+    // Target size, in bytes, of the expanded samples of a block of time steps.
+    constexpr size_t block_bytes {192 * 1024};
+
+    // Number of time steps whose products can be summed in 32-bit integers without overflow.
+    constexpr size_t max_block_steps {32768};
+
+    size_t round_up(size_t value, size_t multiple){
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+
+
+    /*
+        Sums of products of the 16-bit complex samples `p` and `q`, of `n` int16 values each
+        (real, imaginary interleaved):
+            re = sum p_r * q_r + p_i * q_i
+            im = sum p_i * q_r - p_r * q_i
+        i.e. the real and imaginary parts of sum p * conj(q). `q_swap` holds (-q_i, q_r) pairs.
+    */
+    struct PairProducts {
+        int32_t values[8];
+    };
+
+#if defined(__AVX512BW__)
+    inline int32_t horizontal_sum(__m512i v) { return _mm512_reduce_add_epi32(v); }
+
+    void correlate_antennas(const int16_t *x1, const int16_t *y1, const int16_t *x2, const int16_t *y2,
+            const int16_t *x2_swap, const int16_t *y2_swap, size_t n, PairProducts& out){
+        __m512i acc[8];
+        for(auto& a : acc) a = _mm512_setzero_si512();
+        for(size_t i {0}; i < n; i += 32){
+            const __m512i p1 {_mm512_loadu_si512(x1 + i)}, p2 {_mm512_loadu_si512(y1 + i)};
+            const __m512i q1 {_mm512_loadu_si512(x2 + i)}, q2 {_mm512_loadu_si512(y2 + i)};
+            const __m512i s1 {_mm512_loadu_si512(x2_swap + i)}, s2 {_mm512_loadu_si512(y2_swap + i)};
+            acc[0] = _mm512_add_epi32(acc[0], _mm512_madd_epi16(p1, q1));
+            acc[1] = _mm512_add_epi32(acc[1], _mm512_madd_epi16(p1, s1));
+            acc[2] = _mm512_add_epi32(acc[2], _mm512_madd_epi16(p1, q2));
+            acc[3] = _mm512_add_epi32(acc[3], _mm512_madd_epi16(p1, s2));
+            acc[4] = _mm512_add_epi32(acc[4], _mm512_madd_epi16(p2, q1));
+            acc[5] = _mm512_add_epi32(acc[5], _mm512_madd_epi16(p2, s1));
+            acc[6] = _mm512_add_epi32(acc[6], _mm512_madd_epi16(p2, q2));
+            acc[7] = _mm512_add_epi32(acc[7], _mm512_madd_epi16(p2, s2));
+        }
+        for(size_t k {0}; k < 8; k++) out.values[k] = horizontal_sum(acc[k]);
+    }
+#elif defined(__AVX2__)
+    inline int32_t horizontal_sum(__m256i v){
+        __m128i s {_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1))};
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(s);
+    }
+
+    void correlate_antennas(const int16_t *x1, const int16_t *y1, const int16_t *x2, const int16_t *y2,
+            const int16_t *x2_swap, const int16_t *y2_swap, size_t n, PairProducts& out){
+        __m256i acc[8];
+        for(auto& a : acc) a = _mm256_setzero_si256();
+        for(size_t i {0}; i < n; i += 16){
+            const __m256i p1 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x1 + i))};
+            const __m256i p2 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y1 + i))};
+            const __m256i q1 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x2 + i))};
+            const __m256i q2 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y2 + i))};
+            const __m256i s1 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x2_swap + i))};
+            const __m256i s2 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y2_swap + i))};
+            acc[0] = _mm256_add_epi32(acc[0], _mm256_madd_epi16(p1, q1));
+            acc[1] = _mm256_add_epi32(acc[1], _mm256_madd_epi16(p1, s1));
+            acc[2] = _mm256_add_epi32(acc[2], _mm256_madd_epi16(p1, q2));
+            acc[3] = _mm256_add_epi32(acc[3], _mm256_madd_epi16(p1, s2));
+            acc[4] = _mm256_add_epi32(acc[4], _mm256_madd_epi16(p2, q1));
+            acc[5] = _mm256_add_epi32(acc[5], _mm256_madd_epi16(p2, s1));
+            acc[6] = _mm256_add_epi32(acc[6], _mm256_madd_epi16(p2, q2));
+            acc[7] = _mm256_add_epi32(acc[7], _mm256_madd_epi16(p2, s2));
+        }
+        for(size_t k {0}; k < 8; k++) out.values[k] = horizontal_sum(acc[k]);
+    }
+#elif defined(__SSE2__)
+    inline int32_t horizontal_sum(__m128i s){
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(s);
+    }
+
+    void correlate_antennas(const int16_t *x1, const int16_t *y1, const int16_t *x2, const int16_t *y2,
+            const int16_t *x2_swap, const int16_t *y2_swap, size_t n, PairProducts& out){
+        __m128i acc[8];
+        for(auto& a : acc) a = _mm_setzero_si128();
+        for(size_t i {0}; i < n; i += 8){
+            const __m128i p1 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(x1 + i))};
+            const __m128i p2 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(y1 + i))};
+            const __m128i q1 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(x2 + i))};
+            const __m128i q2 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(y2 + i))};
+            const __m128i s1 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(x2_swap + i))};
+            const __m128i s2 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(y2_swap + i))};
+            acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(p1, q1));
+            acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(p1, s1));
+            acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(p1, q2));
+            acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(p1, s2));
+            acc[4] = _mm_add_epi32(acc[4], _mm_madd_epi16(p2, q1));
+            acc[5] = _mm_add_epi32(acc[5], _mm_madd_epi16(p2, s1));
+            acc[6] = _mm_add_epi32(acc[6], _mm_madd_epi16(p2, q2));
+            acc[7] = _mm_add_epi32(acc[7], _mm_madd_epi16(p2, s2));
+        }
+        for(size_t k {0}; k < 8; k++) out.values[k] = horizontal_sum(acc[k]);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    inline int32x4_t multiply_add(int32x4_t acc, int16x8_t a, int16x8_t b){
+        acc = vmlal_s16(acc, vget_low_s16(a), vget_low_s16(b));
+        return vmlal_s16(acc, vget_high_s16(a), vget_high_s16(b));
+    }
+
+    void correlate_antennas(const int16_t *x1, const int16_t *y1, const int16_t *x2, const int16_t *y2,
+            const int16_t *x2_swap, const int16_t *y2_swap, size_t n, PairProducts& out){
+        int32x4_t acc[8];
+        for(auto& a : acc) a = vdupq_n_s32(0);
+        for(size_t i {0}; i < n; i += 8){
+            const int16x8_t p1 {vld1q_s16(x1 + i)}, p2 {vld1q_s16(y1 + i)};
+            const int16x8_t q1 {vld1q_s16(x2 + i)}, q2 {vld1q_s16(y2 + i)};
+            const int16x8_t s1 {vld1q_s16(x2_swap + i)}, s2 {vld1q_s16(y2_swap + i)};
+            acc[0] = multiply_add(acc[0], p1, q1);
+            acc[1] = multiply_add(acc[1], p1, s1);
+            acc[2] = multiply_add(acc[2], p1, q2);
+            acc[3] = multiply_add(acc[3], p1, s2);
+            acc[4] = multiply_add(acc[4], p2, q1);
+            acc[5] = multiply_add(acc[5], p2, s1);
+            acc[6] = multiply_add(acc[6], p2, q2);
+            acc[7] = multiply_add(acc[7], p2, s2);
+        }
+        for(size_t k {0}; k < 8; k++) out.values[k] = vaddvq_s32(acc[k]);
+    }
+#else
+    inline int32_t dot(const int16_t *a, const int16_t *b, size_t n){
+        int32_t sum {0};
+        for(size_t i {0}; i < n; i++) sum += static_cast<int32_t>(a[i]) * b[i];
+        return sum;
+    }
+
+    void correlate_antennas(const int16_t *x1, const int16_t *y1, const int16_t *x2, const int16_t *y2,
+            const int16_t *x2_swap, const int16_t *y2_swap, size_t n, PairProducts& out){
+        out.values[0] = dot(x1, x2, n);
+        out.values[1] = dot(x1, x2_swap, n);
+        out.values[2] = dot(x1, y2, n);
+        out.values[3] = dot(x1, y2_swap, n);
+        out.values[4] = dot(y1, x2, n);
+        out.values[5] = dot(y1, x2_swap, n);
+        out.values[6] = dot(y1, y2, n);
+        out.values[7] = dot(y1, y2_swap, n);
+    }
+#endif
+
+
+
+    /*
+        Correlates the rows of baselines whose first antenna is in [first_row, last_row), for one
+        interval and output channel. It owns the corresponding part of the output.
+    */
+    class RowBlockCorrelator {
+        const Voltages& voltages;
+        const unsigned int n_antennas;
+        const size_t n_steps;
+        const size_t block_steps;
+        // Expanded samples of the current block, [input][step][re/im], and the same with
+        // (-im, re) pairs.
+        std::vector<int16_t> samples, swapped;
+
+        // Expand `n` steps from `first_step` of the inputs of antennas [0, n_used) of `channel`.
+        void expand(unsigned int interval, unsigned int channel, size_t first_step, size_t n, unsigned int n_used){
+            const size_t stride {2 * block_steps};
+            const std::complex<int8_t> *base {voltages.data() + (static_cast<size_t>(interval) * voltages.obsInfo.nFrequencies + channel)
+                * n_antennas * 2 * n_steps + first_step};
+            for(size_t input {0}; input < 2 * static_cast<size_t>(n_used); input++){
+                const int8_t *src {reinterpret_cast<const int8_t*>(base + input * n_steps)};
+                int16_t *dst {samples.data() + input * stride}, *dst_swap {swapped.data() + input * stride};
+                for(size_t s {0}; s < n; s++){
+                    const int16_t re {src[2 * s]}, im {src[2 * s + 1]};
+                    dst[2 * s] = re;
+                    dst[2 * s + 1] = im;
+                    dst_swap[2 * s] = static_cast<int16_t>(-im);
+                    dst_swap[2 * s + 1] = re;
+                }
+                std::fill(dst + 2 * n, dst + stride, int16_t {0});
+                std::fill(dst_swap + 2 * n, dst_swap + stride, int16_t {0});
+            }
+        }
+
+        public:
+        RowBlockCorrelator(const Voltages& voltages, size_t block_steps) : voltages {voltages},
+                n_antennas {voltages.obsInfo.nAntennas}, n_steps {voltages.nIntegrationSteps}, block_steps {block_steps},
+                samples(2 * static_cast<size_t>(n_antennas) * 2 * block_steps), swapped(samples.size()) {}
+
+        void run(unsigned int interval, unsigned int out_channel, unsigned int n_averaged, unsigned int first_row,
+                unsigned int last_row, std::complex<float> *matrix){
+            const size_t first_baseline {static_cast<size_t>(first_row) * (first_row + 1) / 2};
+            const size_t last_baseline {static_cast<size_t>(last_row) * (last_row + 1) / 2};
+            std::fill(matrix + 4 * first_baseline, matrix + 4 * last_baseline, std::complex<float> {0.0f, 0.0f});
+            const size_t first_step {static_cast<size_t>(interval) * n_steps};
+            const size_t valid_steps {std::min(n_steps, voltages.obsInfo.nTimesteps - first_step)};
+            const size_t stride {2 * block_steps};
+            PairProducts products;
+            for(unsigned int c {0}; c < n_averaged; c++){
+                const unsigned int channel {out_channel * n_averaged + c};
+                for(size_t t0 {0}; t0 < valid_steps; t0 += block_steps){
+                    const size_t n {std::min(block_steps, valid_steps - t0)};
+                    const size_t n_values {2 * round_up(n, step_alignment)};
+                    expand(interval, channel, t0, n, last_row);
+                    for(unsigned int a1 {first_row}; a1 < last_row; a1++){
+                        const int16_t *x1 {samples.data() + 2 * a1 * stride}, *y1 {x1 + stride};
+                        std::complex<float> *row {matrix + 4 * (static_cast<size_t>(a1) * (a1 + 1) / 2)};
+                        for(unsigned int a2 {0}; a2 <= a1; a2++){
+                            const int16_t *x2 {samples.data() + 2 * a2 * stride}, *y2 {x2 + stride};
+                            const int16_t *x2_swap {swapped.data() + 2 * a2 * stride}, *y2_swap {x2_swap + stride};
+                            correlate_antennas(x1, y1, x2, y2, x2_swap, y2_swap, n_values, products);
+                            for(size_t p {0}; p < 4; p++)
+                                row[4 * a2 + p] += std::complex<float> {static_cast<float>(products.values[2 * p]),
+                                    static_cast<float>(products.values[2 * p + 1])};
+                        }
+                    }
+                }
+            }
+            const float scale {valid_steps > 0 ? 1.0f / (static_cast<float>(valid_steps) * n_averaged) : 0.0f};
+            for(size_t i {4 * first_baseline}; i < 4 * last_baseline; i++) matrix[i] *= scale;
+        }
+    };
+
+
+
+    /*
+        Split the rows of the baseline triangle in `n_blocks` ranges with about the same number
+        of baselines each.
+    */
+    std::vector<unsigned int> row_boundaries(unsigned int n_antennas, unsigned int n_blocks){
+        std::vector<unsigned int> bounds {0};
+        for(unsigned int k {1}; k < n_blocks; k++){
+            const unsigned int row {static_cast<unsigned int>(std::lround(n_antennas * std::sqrt(static_cast<double>(k) / n_blocks)))};
+            if(row > bounds.back() && row < n_antennas) bounds.push_back(row);
+        }
+        bounds.push_back(n_antennas);
+        return bounds;
+    }
+
+
+
+    void cross_correlation_cpu(const Voltages& voltages, Visibilities& vis, unsigned int n_averaged, unsigned int n_threads){
+        const unsigned int n_antennas {voltages.obsInfo.nAntennas};
+        const size_t n_items {vis.integration_intervals() * vis.nFrequencies};
+        // Intervals and channels are independent. When there are fewer than the threads, the
+        // baselines of each are split as well.
+        const unsigned int n_workers {resolve_n_threads(n_threads)};
+        const unsigned int n_row_blocks {static_cast<unsigned int>(std::min<size_t>(n_antennas,
+            n_items >= n_workers ? 1 : (n_workers + n_items - 1) / n_items))};
+        const std::vector<unsigned int> rows {row_boundaries(n_antennas, n_row_blocks)};
+        const size_t n_blocks {rows.size() - 1};
+        const size_t n_inputs {2 * static_cast<size_t>(n_antennas)};
+        const size_t block_steps {std::min(round_up(voltages.nIntegrationSteps, step_alignment),
+            std::max(step_alignment, block_bytes / (n_inputs * 8) / step_alignment * step_alignment))};
+        if(block_steps > max_block_steps) throw std::logic_error {"cross_correlation: time block too long."};
+        parallel_for(n_items * n_blocks, [&](size_t first, size_t last){
+            RowBlockCorrelator correlator {voltages, block_steps};
+            for(size_t item {first}; item < last; item++){
+                const unsigned int block {static_cast<unsigned int>(item % n_blocks)};
+                const unsigned int out_channel {static_cast<unsigned int>((item / n_blocks) % vis.nFrequencies)};
+                const unsigned int interval {static_cast<unsigned int>(item / n_blocks / vis.nFrequencies)};
+                correlator.run(interval, out_channel, n_averaged, rows[block], rows[block + 1],
+                    vis.at(interval, out_channel, 0u));
+            }
+        }, n_threads);
+    }
+}
+
+
+
+#ifdef __GPU__
+namespace {
+    // Antennas in a side of the tile of baselines computed by a block.
+    constexpr unsigned int correlation_tile {16};
+    // Time steps staged in shared memory at a time.
+    constexpr unsigned int correlation_steps {32};
+}
+
+/*
+    Each block computes a 16 x 16 tile of baselines, one per thread, for one (interval, output
+    channel) pair at a time. The samples of the 16 + 16 antennas of the tile are staged in shared
+    memory `correlation_steps` time steps at a time; products are accumulated in 32-bit integers
+    within each stage.
+*/
+__global__ void correlation_kernel(const int8_t *voltages, unsigned int n_antennas, unsigned int n_channels,
+        unsigned int n_steps, unsigned int n_timesteps, unsigned int n_averaged, size_t n_items, unsigned int n_out_channels,
+        float *output){
+    __shared__ int8_t rows[correlation_tile][2][correlation_steps][2];
+    __shared__ int8_t cols[correlation_tile][2][correlation_steps][2];
+    // Tile (t1, t2), t1 >= t2, from the index of the block as for baselines.
+    const unsigned int tile {blockIdx.x};
+    unsigned int t1 {static_cast<unsigned int>((sqrtf(8.0f * tile + 1.0f) - 1.0f) / 2.0f)};
+    while(t1 * (t1 + 1) / 2 > tile) t1--;
+    while((t1 + 1) * (t1 + 2) / 2 <= tile) t1++;
+    const unsigned int t2 {tile - t1 * (t1 + 1) / 2};
+    const unsigned int i {threadIdx.x / correlation_tile}, j {threadIdx.x % correlation_tile};
+    const unsigned int a1 {t1 * correlation_tile + i}, a2 {t2 * correlation_tile + j};
+    const bool valid {a1 < n_antennas && a2 <= a1};
+    const size_t n_baselines {static_cast<size_t>(n_antennas) * (n_antennas + 1) / 2};
+    const unsigned int stage_samples {correlation_tile * 2 * correlation_steps};
+
+    for(size_t item {blockIdx.y}; item < n_items; item += gridDim.y){
+        const size_t interval {item / n_out_channels};
+        const unsigned int out_channel {static_cast<unsigned int>(item % n_out_channels)};
+        const size_t first_step {interval * n_steps};
+        const unsigned int valid_steps {static_cast<unsigned int>(n_timesteps - first_step < n_steps ? n_timesteps - first_step : n_steps)};
+        float acc[8] {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        for(unsigned int c {0}; c < n_averaged; c++){
+            const size_t channel {static_cast<size_t>(out_channel) * n_averaged + c};
+            const int8_t *base {voltages + 2 * (interval * n_channels + channel) * n_antennas * 2 * n_steps};
+            for(unsigned int t0 {0}; t0 < valid_steps; t0 += correlation_steps){
+                for(unsigned int s {threadIdx.x}; s < stage_samples; s += blockDim.x){
+                    const unsigned int ant {s / (2 * correlation_steps)}, pol {(s / correlation_steps) % 2};
+                    const unsigned int step {s % correlation_steps};
+                    const bool in_time {t0 + step < valid_steps};
+                    const unsigned int row_ant {t1 * correlation_tile + ant}, col_ant {t2 * correlation_tile + ant};
+                    const bool row_ok {in_time && row_ant < n_antennas}, col_ok {in_time && col_ant < n_antennas};
+                    const int8_t *row_src {base + 2 * ((static_cast<size_t>(row_ant) * 2 + pol) * n_steps + t0 + step)};
+                    const int8_t *col_src {base + 2 * ((static_cast<size_t>(col_ant) * 2 + pol) * n_steps + t0 + step)};
+                    rows[ant][pol][step][0] = row_ok ? row_src[0] : 0;
+                    rows[ant][pol][step][1] = row_ok ? row_src[1] : 0;
+                    cols[ant][pol][step][0] = col_ok ? col_src[0] : 0;
+                    cols[ant][pol][step][1] = col_ok ? col_src[1] : 0;
+                }
+                __syncthreads();
+                int partial[8] {0, 0, 0, 0, 0, 0, 0, 0};
+                for(unsigned int step {0}; step < correlation_steps; step++){
+                    for(unsigned int p {0}; p < 2; p++){
+                        const int pr {rows[i][p][step][0]}, pi {rows[i][p][step][1]};
+                        for(unsigned int q {0}; q < 2; q++){
+                            const int qr {cols[j][q][step][0]}, qi {cols[j][q][step][1]};
+                            partial[4 * p + 2 * q] += pr * qr + pi * qi;
+                            partial[4 * p + 2 * q + 1] += pi * qr - pr * qi;
+                        }
+                    }
+                }
+                for(unsigned int k {0}; k < 8; k++) acc[k] += static_cast<float>(partial[k]);
+                __syncthreads();
+            }
+        }
+        if(valid){
+            const float scale {valid_steps > 0 ? 1.0f / (static_cast<float>(valid_steps) * n_averaged) : 0.0f};
+            const size_t baseline {static_cast<size_t>(a1) * (a1 + 1) / 2 + a2};
+            float *out {output + 2 * 4 * (item * n_baselines + baseline)};
+            for(unsigned int k {0}; k < 8; k++) out[k] = acc[k] * scale;
+        }
+    }
+}
+
+
+
+namespace {
+    void cross_correlation_gpu(const Voltages& voltages, Visibilities& vis, unsigned int n_averaged){
+        const unsigned int n_antennas {voltages.obsInfo.nAntennas};
+        const unsigned int n_tiles {(n_antennas + correlation_tile - 1) / correlation_tile};
+        const unsigned int n_tile_pairs {n_tiles * (n_tiles + 1) / 2};
+        const size_t n_items {vis.integration_intervals() * vis.nFrequencies};
+        if(n_items == 0 || n_tile_pairs == 0) return;
+        const dim3 grid {n_tile_pairs, static_cast<unsigned int>(std::min<size_t>(n_items, 65535))};
+        correlation_kernel<<<grid, correlation_tile * correlation_tile>>>(reinterpret_cast<const int8_t*>(voltages.data()),
+            n_antennas, voltages.obsInfo.nFrequencies, voltages.nIntegrationSteps, voltages.obsInfo.nTimesteps, n_averaged,
+            n_items, vis.nFrequencies, reinterpret_cast<float*>(vis.data()));
+        gpuCheckLastError();
+    }
+}
+#endif
+
+
+
+Visibilities cross_correlation(const Voltages& voltages, unsigned int nAveragedChannels, unsigned int n_threads){
+    const ObservationInfo& obsInfo {voltages.obsInfo};
+    if(obsInfo.nPolarizations != 2)
+        throw std::invalid_argument {"cross_correlation: only dual polarisation voltages are supported."};
+    if(nAveragedChannels == 0 || obsInfo.nFrequencies % nAveragedChannels != 0)
+        throw std::invalid_argument {"cross_correlation: the number of averaged channels must divide the number of channels."};
+    if(voltages.nIntegrationSteps == 0 || !voltages)
+        throw std::invalid_argument {"cross_correlation: empty voltages."};
+    const size_t n_baselines {static_cast<size_t>(obsInfo.nAntennas) * (obsInfo.nAntennas + 1) / 2};
+    const size_t n_intervals {(obsInfo.nTimesteps + voltages.nIntegrationSteps - 1) / voltages.nIntegrationSteps};
+    const size_t n_values {n_intervals * (obsInfo.nFrequencies / nAveragedChannels) * n_baselines * 4};
+    if(voltages.on_gpu()){
+    #ifdef __GPU__
+        GpuDeviceGuard guard {voltages.device_id()};
+        MemoryBuffer<std::complex<float>> data {n_values, MemoryType::DEVICE};
+        Visibilities vis {std::move(data), obsInfo, voltages.nIntegrationSteps, nAveragedChannels};
+        cross_correlation_gpu(voltages, vis, nAveragedChannels);
+        return vis;
+    #endif
+    }
+    MemoryBuffer<std::complex<float>> data {n_values};
+    Visibilities vis {std::move(data), obsInfo, voltages.nIntegrationSteps, nAveragedChannels};
+    cross_correlation_cpu(voltages, vis, nAveragedChannels, n_threads);
+    return vis;
+}
@@ -0,0 +1,23 @@
+#ifndef __CORRELATION_H__
+#define __CORRELATION_H__
+
+#include "astroio.hpp"
+
+/**
+ * @brief Cross-correlate voltages, producing the visibilities of all the baselines, autocorrelations
+ * included, in `VisibilityLayout::CHANNEL_BASELINE_POL` layout.
+ *
+ * For baseline (a1, a2), with a1 >= a2, polarisation product PQ is the average over the time
+ * steps of an integration interval, and over `nAveragedChannels` adjacent channels, of
+ * V_{a1,P} * conj(V_{a2,Q}). The last interval is averaged over the time steps it actually has.
+ *
+ * Data is correlated where it resides: if `voltages` is on GPU, so is the result, and the work
+ * is queued to the default stream. On CPU, products are computed with integer SIMD instructions
+ * on blocks of time steps that fit in cache, by `n_threads` threads (0 means one per hardware
+ * thread).
+ *
+ * @throw std::invalid_argument if `nAveragedChannels` does not divide the number of channels.
+ */
+Visibilities cross_correlation(const Voltages& voltages, unsigned int nAveragedChannels = 1, unsigned int n_threads = 0);
+
+#endif
@@ -0,0 +1,193 @@
+#include "fft_plan_cache.hpp"
+
+#ifdef __GPU__
+
+#include <stdexcept>
+#include <limits>
+
+
+std::unique_ptr<FftPlanCache::Plan> FftPlanCache::create_plan(const FftPlanKey& key){
+    GpuDeviceGuard guard {key.device};
+    auto plan = std::make_unique<Plan>();
+    GPUFFT_CHECK_ERROR(gpufftCreate(&plan->handle));
+    try {
+        // The work area is allocated below, through the memory pool.
+        GPUFFT_CHECK_ERROR(gpufftSetAutoAllocation(plan->handle, 0));
+        const int side {static_cast<int>(key.side_size)};
+        int n[2] {side, side};
+        // Complex inputs of C2R transforms are full images, of which only the first
+        // (side / 2 + 1) columns are read: rows are `side` values apart in both cases.
+        int embed[2] {side, side};
+        const int dist {side * side};
+        const gpufftType type {key.type == FftType::C2C ? GPUFFT_C2C : GPUFFT_C2R};
+        size_t work_size {0};
+        GPUFFT_CHECK_ERROR(gpufftMakePlanMany(plan->handle, 2, n, embed, 1, dist, embed, 1, dist, type,
+            key.batch, &work_size));
+        if(work_size > 0){
+            plan->work_area.allocate(work_size, MemoryType::DEVICE);
+            GPUFFT_CHECK_ERROR(gpufftSetWorkArea(plan->handle, plan->work_area.data()));
+        }
+        GPUFFT_CHECK_ERROR(gpufftSetStream(plan->handle, key.stream));
+    } catch (...) {
+        gpufftDestroy(plan->handle);
+        throw;
+    }
+    return plan;
+}
+
+
+
+void FftPlanCache::destroy_plan(std::unique_ptr<Plan>&& plan, const FftPlanKey& key){
+    GpuDeviceGuard guard {key.device};
+    // Transforms still queued use the work area, which is released with the plan.
+    gpuStreamSynchronize(key.stream);
+    gpufftDestroy(plan->handle);
+    plan.reset();
+}
+
+
+
+FftPlanCache::Lease FftPlanCache::acquire(unsigned int side_size, int batch, FftType type, gpuStream_t stream){
+    if(side_size == 0 || batch <= 0)
+        throw std::invalid_argument {"FftPlanCache::acquire: `side_size` and `batch` must be positive numbers."};
+    int device {0};
+    gpuGetDevice(&device);
+    const FftPlanKey key {device, side_size, batch, type, stream};
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        _stats.requests++;
+        auto it = plans.find(key);
+        if(it != plans.end()){
+            for(auto& plan : it->second){
+                if(plan->busy) continue;
+                plan->busy = true;
+                n_idle--;
+                _stats.hits++;
+                return Lease {this, plan.get()};
+            }
+        }
+    }
+    // Plan creation is slow: other threads can obtain plans meanwhile.
+    std::unique_ptr<Plan> plan {create_plan(key)};
+    plan->busy = true;
+    Plan *ptr {plan.get()};
+    std::lock_guard<std::mutex> lock {mutex};
+    _stats.plans_created++;
+    _stats.work_area_bytes += plan->work_area.size();
+    plans[key].push_back(std::move(plan));
+    return Lease {this, ptr};
+}
+
+
+
+std::vector<std::pair<FftPlanKey, std::unique_ptr<FftPlanCache::Plan>>> FftPlanCache::evict(){
+    std::vector<std::pair<FftPlanKey, std::unique_ptr<Plan>>> evicted;
+    while(n_idle > max_idle_plans){
+        auto oldest_key = plans.end();
+        size_t oldest_idx {0}, oldest_time {std::numeric_limits<size_t>::max()};
+        for(auto it = plans.begin(); it != plans.end(); it++){
+            for(size_t i {0}; i < it->second.size(); i++){
+                const Plan& plan {*it->second[i]};
+                if(!plan.busy && plan.last_used < oldest_time){
+                    oldest_key = it;
+                    oldest_idx = i;
+                    oldest_time = plan.last_used;
+                }
+            }
+        }
+        auto& entry = oldest_key->second;
+        _stats.plans_destroyed++;
+        _stats.work_area_bytes -= entry[oldest_idx]->work_area.size();
+        evicted.emplace_back(oldest_key->first, std::move(entry[oldest_idx]));
+        entry.erase(entry.begin() + oldest_idx);
+        if(entry.empty()) plans.erase(oldest_key);
+        n_idle--;
+    }
+    return evicted;
+}
+
+
+
+void FftPlanCache::release(Plan *plan){
+    std::vector<std::pair<FftPlanKey, std::unique_ptr<Plan>>> evicted;
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        plan->busy = false;
+        plan->last_used = ++clock;
+        n_idle++;
+        evicted = evict();
+    }
+    for(auto& entry : evicted) destroy_plan(std::move(entry.second), entry.first);
+}
+
+
+
+void FftPlanCache::clear(){
+    std::vector<std::pair<FftPlanKey, std::unique_ptr<Plan>>> idle;
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        for(auto it = plans.begin(); it != plans.end();){
+            auto& entry = it->second;
+            for(size_t i {entry.size()}; i-- > 0;){
+                if(entry[i]->busy) continue;
+                _stats.plans_destroyed++;
+                _stats.work_area_bytes -= entry[i]->work_area.size();
+                idle.emplace_back(it->first, std::move(entry[i]));
+                entry.erase(entry.begin() + i);
+            }
+            it = entry.empty() ? plans.erase(it) : std::next(it);
+        }
+        n_idle = 0;
+    }
+    for(auto& entry : idle) destroy_plan(std::move(entry.second), entry.first);
+}
+
+
+
+FftPlanCache::~FftPlanCache(){
+    clear();
+}
+
+
+
+FftPlanCacheStats FftPlanCache::stats() const {
+    std::lock_guard<std::mutex> lock {mutex};
+    return _stats;
+}
+
+
+
+FftPlanCache& fft_plan_cache(){
+    // Never destroyed, as the memory pool: plans can be released by static destructors.
+    static FftPlanCache *cache {new FftPlanCache {}};
+    return *cache;
+}
+
+
+
+void fft_images_c2c(Images& images, int direction, gpuStream_t stream){
+    if(!images.on_gpu()) throw std::invalid_argument {"fft_images_c2c: the images must reside on GPU."};
+    if(images.size() == 0) return;
+    GpuDeviceGuard guard {images.device_id()};
+    FftPlanCache::Lease plan {fft_plan_cache().acquire(images.side_size, static_cast<int>(images.size()),
+        FftType::C2C, stream)};
+    gpufftComplex *data {reinterpret_cast<gpufftComplex*>(images.data())};
+    GPUFFT_CHECK_ERROR(gpufftExecC2C(plan.handle(), data, data, direction));
+}
+
+
+
+void fft_images_c2r(Images& images, MemoryBuffer<float>& output, gpuStream_t stream){
+    if(!images.on_gpu()) throw std::invalid_argument {"fft_images_c2r: the images must reside on GPU."};
+    if(images.size() == 0) return;
+    GpuDeviceGuard guard {images.device_id()};
+    const size_t n_pixels {images.size() * images.image_size()};
+    if(!output || output.size() != n_pixels || !output.on_gpu() || output.device_id() != images.device_id())
+        output.allocate(n_pixels, MemoryType::DEVICE);
+    FftPlanCache::Lease plan {fft_plan_cache().acquire(images.side_size, static_cast<int>(images.size()),
+        FftType::C2R, stream)};
+    GPUFFT_CHECK_ERROR(gpufftExecC2R(plan.handle(), reinterpret_cast<gpufftComplex*>(images.data()),
+        reinterpret_cast<gpufftReal*>(output.data())));
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef __FFT_PLAN_CACHE_H__
+#define __FFT_PLAN_CACHE_H__
+
+#include "gpu_macros.hpp"
+
+#ifdef __GPU__
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "gpu_fft.hpp"
+#include "memory_buffer.hpp"
+#include "images.hpp"
+
+enum class FftType {
+    C2C, // in place complex to complex transform
+    C2R // complex to real transform, reading full (side_size x side_size) complex grids
+};
+
+
+/**
+ * @brief Parameters identifying a plan of batched, two dimensional, square FFTs.
+ */
+struct FftPlanKey {
+    int device;
+    unsigned int side_size;
+    int batch;
+    FftType type;
+    gpuStream_t stream;
+
+    bool operator<(const FftPlanKey& other) const {
+        if(device != other.device) return device < other.device;
+        if(side_size != other.side_size) return side_size < other.side_size;
+        if(batch != other.batch) return batch < other.batch;
+        if(type != other.type) return type < other.type;
+        return stream < other.stream;
+    }
+};
+
+
+/**
+ * @brief Usage information of a `FftPlanCache`.
+ */
+struct FftPlanCacheStats {
+    // Number of plans requested.
+    size_t requests {0};
+    // Number of requests served with an existing plan.
+    size_t hits {0};
+    // Number of plans created and destroyed.
+    size_t plans_created {0};
+    size_t plans_destroyed {0};
+    // Bytes of GPU memory held by the work areas of the cached plans.
+    size_t work_area_bytes {0};
+};
+
+
+/**
+ * @brief Thread safe cache of GPU FFT plans.
+ *
+ * Creating a plan costs tens of milliseconds, more than transforming a batch of images: plans
+ * are kept once created and handed out again to requests with the same device, image size,
+ * batch size, transform type and stream. A plan is leased to one thread at a time; when all the
+ * plans for a key are in use, a new one is created. Work areas are not allocated by the FFT
+ * library but are `MemoryBuffer` objects, so they are served by the memory pool too.
+ *
+ * At most `max_idle_plans` plans not in use are kept; the least recently used ones are
+ * destroyed beyond that limit.
+ */
+class FftPlanCache {
+
+    struct Plan {
+        gpufftHandle handle;
+        MemoryBuffer<char> work_area;
+        bool busy {false};
+        size_t last_used {0};
+    };
+
+    size_t max_idle_plans;
+    std::map<FftPlanKey, std::vector<std::unique_ptr<Plan>>> plans;
+    size_t n_idle {0};
+    size_t clock {0};
+    FftPlanCacheStats _stats;
+    mutable std::mutex mutex;
+
+    std::unique_ptr<Plan> create_plan(const FftPlanKey& key);
+    void destroy_plan(std::unique_ptr<Plan>&& plan, const FftPlanKey& key);
+    void release(Plan *plan);
+    // Remove the least recently used idle plans beyond the limit. Called with the lock held.
+    std::vector<std::pair<FftPlanKey, std::unique_ptr<Plan>>> evict();
+
+    public:
+    /**
+     * @brief Exclusive use of a cached plan, returned to the cache when the object is destroyed.
+     * The transforms queued on the stream of the plan may still be running at that point: they
+     * are ordered before those of the next user of the plan, which share the stream.
+     */
+    class Lease {
+        FftPlanCache *cache {nullptr};
+        Plan *plan {nullptr};
+
+        friend class FftPlanCache;
+        Lease(FftPlanCache *cache, Plan *plan) : cache {cache}, plan {plan} {}
+
+        public:
+        Lease() {}
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease(Lease&& other) : cache {other.cache}, plan {other.plan} { other.plan = nullptr; }
+        Lease& operator=(Lease&& other){
+            if(this != &other){
+                if(plan) cache->release(plan);
+                cache = other.cache;
+                plan = other.plan;
+                other.plan = nullptr;
+            }
+            return *this;
+        }
+        ~Lease(){ if(plan) cache->release(plan); }
+
+        gpufftHandle handle() const { return plan->handle; }
+        explicit operator bool() const { return plan != nullptr; }
+    };
+
+    explicit FftPlanCache(size_t max_idle_plans = 32) : max_idle_plans {max_idle_plans} {}
+
+    ~FftPlanCache();
+
+    FftPlanCache(const FftPlanCache&) = delete;
+    FftPlanCache& operator=(const FftPlanCache&) = delete;
+
+    /**
+     * @brief Obtain a plan transforming `batch` images of `side_size` x `side_size` pixels,
+     * stored one after the other, on the current device. Transforms are queued on `stream`.
+     */
+    Lease acquire(unsigned int side_size, int batch, FftType type, gpuStream_t stream = 0);
+
+    /**
+     * @brief Destroy all the plans not currently in use.
+     */
+    void clear();
+
+    FftPlanCacheStats stats() const;
+};
+
+
+/**
+ * @return the process wide plan cache used by the functions below.
+ */
+FftPlanCache& fft_plan_cache();
+
+
+/**
+ * @brief Transform, in place, all the images in `images`, which must reside on GPU, with a
+ * single batched complex to complex FFT. `direction` is `GPUFFT_FORWARD` or `GPUFFT_BACKWARD`;
+ * as with cufft/hipfft, transforms are not normalised. The function returns once the transform
+ * has been queued on `stream`.
+ */
+void fft_images_c2c(Images& images, int direction, gpuStream_t stream = 0);
+
+/**
+ * @brief Compute the real images whose half spectrum is stored in the first
+ * (side_size / 2 + 1) columns of each image in `images`, which must reside on GPU, with a
+ * single batched complex to real FFT. The result is written to `output`, allocated on GPU if
+ * it does not hold `images.size() * images.image_size()` values. The content of `images` is
+ * overwritten. The function returns once the transform has been queued on `stream`.
+ */
+void fft_images_c2r(Images& images, MemoryBuffer<float>& output, gpuStream_t stream = 0);
+
+#endif
+#endif
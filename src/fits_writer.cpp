@@ -0,0 +1,226 @@
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include "fits_writer.hpp"
+#include "parallel.hpp"
+
+
+AsyncFitsWriter::AsyncFitsWriter(unsigned int n_threads, size_t max_queued_bytes) : max_queued_bytes {max_queued_bytes} {
+    const unsigned int nThreads {resolve_n_threads(n_threads)};
+    workers.reserve(nThreads);
+    for(unsigned int t {0}; t < nThreads; t++)
+        workers.emplace_back(&AsyncFitsWriter::run, this);
+}
+
+
+
+AsyncFitsWriter::~AsyncFitsWriter(){
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        stop = true;
+    }
+    work_cv.notify_all();
+    for(auto& worker : workers) worker.join();
+    if(error){
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+            std::cerr << "AsyncFitsWriter: error while writing FITS files: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "AsyncFitsWriter: error while writing FITS files." << std::endl;
+        }
+    }
+}
+
+
+
+std::deque<AsyncFitsWriter::Job>::iterator AsyncFitsWriter::next_job(){
+    // The oldest job whose file is not being written by another thread.
+    return std::find_if(queue.begin(), queue.end(), [this](const Job& job){ return busy.count(job.filename) == 0; });
+}
+
+
+
+void AsyncFitsWriter::release_fences(){
+    const size_t oldest {in_flight.empty() ? next_id : *in_flight.begin()};
+    while(!fences.empty() && fences.front().first <= oldest){
+        fences.front().second.set_value();
+        fences.pop_front();
+    }
+}
+
+
+
+void AsyncFitsWriter::rethrow_error(){
+    if(!error) return;
+    std::exception_ptr e {error};
+    error = nullptr;
+    std::rethrow_exception(e);
+}
+
+
+
+void AsyncFitsWriter::run(){
+    using clock = std::chrono::steady_clock;
+    std::unique_lock<std::mutex> lock {mutex};
+    while(true){
+        std::deque<Job>::iterator it;
+        work_cv.wait(lock, [&](){ return (it = next_job()) != queue.end() || (stop && queue.empty()); });
+        if(it == queue.end()) return;
+        Job job {std::move(*it)};
+        queue.erase(it);
+        busy.insert(job.filename);
+        std::unique_ptr<FITS> file;
+        auto cached = files.find(job.filename);
+        if(cached != files.end()){
+            file = std::move(cached->second);
+            files.erase(cached);
+        }
+        lock.unlock();
+
+        clock::time_point t1 = clock::now();
+        std::future<void> result {job.action.get_future()};
+        job.action(file);
+        std::exception_ptr failure;
+        try {
+            result.get();
+        } catch (...) {
+            failure = std::current_exception();
+            // The state of the file is unknown: do not append to it any more.
+            file.reset();
+        }
+        // Release the data before making room in the queue.
+        job.action = Action {};
+        const double elapsed {std::chrono::duration<double>(clock::now() - t1).count()};
+
+        lock.lock();
+        if(file) files[job.filename] = std::move(file);
+        busy.erase(job.filename);
+        in_flight.erase(job.id);
+        queued_bytes -= job.bytes;
+        if(failure && !error) error = failure;
+        _stats.jobs_written++;
+        _stats.bytes_written += job.bytes;
+        _stats.write_time += elapsed;
+        release_fences();
+        // Other jobs on the same file can now be picked up.
+        work_cv.notify_all();
+        done_cv.notify_all();
+    }
+}
+
+
+
+void AsyncFitsWriter::submit(const std::string& filename, size_t bytes, Action&& action){
+    using clock = std::chrono::steady_clock;
+    if(!action.valid()) throw std::invalid_argument {"AsyncFitsWriter::submit: `action` is not a valid operation."};
+    std::unique_lock<std::mutex> lock {mutex};
+    rethrow_error();
+    clock::time_point t1 = clock::now();
+    done_cv.wait(lock, [&](){ return queued_bytes == 0 || queued_bytes + bytes <= max_queued_bytes; });
+    _stats.producer_wait_time += std::chrono::duration<double>(clock::now() - t1).count();
+    queued_bytes += bytes;
+    _stats.max_queued_bytes = std::max(_stats.max_queued_bytes, queued_bytes);
+    const size_t id {next_id++};
+    in_flight.insert(id);
+    queue.push_back(Job {filename, bytes, id, std::move(action)});
+    lock.unlock();
+    work_cv.notify_all();
+}
+
+
+
+void AsyncFitsWriter::write_image(const std::string& filename, MemoryBuffer<float>&& pixels, long x_dim, long y_dim,
+        FITS::HDU header, const FitsOutputOptions& options){
+    if(!pixels || x_dim <= 0 || y_dim <= 0 || pixels.size() != static_cast<size_t>(x_dim) * y_dim)
+        throw std::invalid_argument {"AsyncFitsWriter::write_image: the image size does not match its dimensions."};
+    if(pixels.on_gpu()) pixels.to_cpu();
+    const size_t bytes {pixels.size() * sizeof(float)};
+    // The HDU is a view of the pixels, which are owned by the operation until it completes.
+    header.set_image(pixels.data(), x_dim, y_dim);
+    submit(filename, bytes, Action {[filename, pixels = std::move(pixels), header = std::move(header), options]
+            (std::unique_ptr<FITS>& file) mutable {
+        if(!file) file = std::make_unique<FITS>(filename, FITS::Mode::APPEND);
+        file->set_output_options(options);
+        file->add_HDU(std::move(header));
+    }});
+}
+
+
+
+void AsyncFitsWriter::write_encoded_image(const std::string& filename, MemoryBuffer<int16_t>&& pixels, long x_dim, long y_dim,
+        PixelEncoding encoding, float scale, FITS::HDU header, const FitsOutputOptions& options){
+    if(!pixels || x_dim <= 0 || y_dim <= 0 || pixels.size() != static_cast<size_t>(x_dim) * y_dim)
+        throw std::invalid_argument {"AsyncFitsWriter::write_encoded_image: the image size does not match its dimensions."};
+    if(encoding == PixelEncoding::FLOAT32)
+        throw std::invalid_argument {"AsyncFitsWriter::write_encoded_image: the pixels must have a 16-bit encoding."};
+    if(pixels.on_gpu()) pixels.to_cpu();
+    const size_t bytes {pixels.size() * sizeof(int16_t)};
+    header.set_image(pixels.data(), x_dim, y_dim);
+    header.add_encoding_keywords(encoding, scale);
+    submit(filename, bytes, Action {[filename, pixels = std::move(pixels), header = std::move(header), options]
+            (std::unique_ptr<FITS>& file) mutable {
+        if(!file) file = std::make_unique<FITS>(filename, FITS::Mode::APPEND);
+        file->set_output_options(options);
+        file->add_HDU(std::move(header));
+    }});
+}
+
+
+
+void AsyncFitsWriter::write_visibilities(const std::string& filename, Visibilities&& vis, const FitsOutputOptions& options){
+    if(vis.on_gpu()) vis.to_cpu();
+    const size_t bytes {vis.size() * sizeof(std::complex<float>)};
+    submit(filename, bytes, Action {[filename, vis = std::move(vis), options](std::unique_ptr<FITS>& file){
+        // The file is replaced as a whole.
+        file.reset();
+        vis.to_fits_file(filename, options);
+    }});
+}
+
+
+
+void AsyncFitsWriter::write_visibilities_mwax(const std::string& filename, Visibilities&& vis, int coarse_channel_ord,
+        const FitsOutputOptions& options){
+    if(vis.on_gpu()) vis.to_cpu();
+    const size_t bytes {vis.size() * sizeof(std::complex<float>)};
+    submit(filename, bytes, Action {[filename, vis = std::move(vis), coarse_channel_ord, options](std::unique_ptr<FITS>& file){
+        file.reset();
+        vis.to_fits_file_mwax(filename, coarse_channel_ord, options);
+    }});
+}
+
+
+
+std::shared_future<void> AsyncFitsWriter::fence(){
+    std::lock_guard<std::mutex> lock {mutex};
+    std::promise<void> promise;
+    std::shared_future<void> ready {promise.get_future().share()};
+    if(in_flight.empty()) promise.set_value();
+    else fences.emplace_back(next_id, std::move(promise));
+    return ready;
+}
+
+
+
+void AsyncFitsWriter::flush(){
+    std::unique_lock<std::mutex> lock {mutex};
+    done_cv.wait(lock, [&](){ return in_flight.empty(); });
+    // Closing a file flushes cfitsio buffers to disk. No thread may use them meanwhile.
+    files.clear();
+    rethrow_error();
+}
+
+
+
+size_t AsyncFitsWriter::pending() const {
+    std::lock_guard<std::mutex> lock {mutex};
+    return in_flight.size();
+}
+
+
+
+FitsWriterStats AsyncFitsWriter::stats() const {
+    std::lock_guard<std::mutex> lock {mutex};
+    return _stats;
+}
@@ -0,0 +1,193 @@
+#ifndef __ASTROIO_FITS_WRITER_H__
+#define __ASTROIO_FITS_WRITER_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <exception>
+#include "FITS.hpp"
+#include "memory_buffer.hpp"
+#include "astroio.hpp"
+
+/**
+ * @brief Information collected by `AsyncFitsWriter`. Times are in seconds.
+ */
+struct FitsWriterStats {
+    // Number of write operations completed, successfully or not.
+    size_t jobs_written {0};
+    // Total size of the data written.
+    size_t bytes_written {0};
+    // Time spent by the I/O threads writing, summed over the threads.
+    double write_time {0.0};
+    // Time producers spent blocked because the queue was full, i.e. waiting for the disk.
+    double producer_wait_time {0.0};
+    // Largest amount of data, in bytes, held by the writer at any time.
+    size_t max_queued_bytes {0};
+
+    // Average throughput of an I/O thread, in bytes per second.
+    double write_bandwidth() const { return write_time > 0.0 ? bytes_written / write_time : 0.0; }
+};
+
+
+/**
+ * @brief Write FITS files on background threads, so that the caller can keep computing while
+ * output drains to disk.
+ *
+ * Producers hand over completed data products, together with the ownership of the memory
+ * holding them, and return as soon as they are queued. I/O threads pick the products in
+ * submission order and append them to their file with `FITS` APPEND mode. Products of the same
+ * file are written one at a time and in submission order; different files are written in
+ * parallel when the writer has more than one thread. Files stay open between writes and are
+ * closed by `flush`.
+ *
+ * The queue is bounded by the amount of data it holds: when it is full, producers block until
+ * enough data is written (backpressure), so memory usage does not grow with the output rate.
+ *
+ * Errors raised by the I/O threads are rethrown to the producer by the next call to `submit`
+ * (or to one of the `write_*` functions) or `flush`.
+ *
+ * Example:
+ *      AsyncFitsWriter writer {2};
+ *      for(...){
+ *          Images images {imager.run(...)};
+ *          images.to_fits_files(writer, output_dir);
+ *      }
+ *      writer.flush();
+ */
+class AsyncFitsWriter {
+
+    public:
+    /**
+     * A write operation run on an I/O thread. It receives the handle of its file, open in
+     * APPEND mode by a previous operation, or null. The operation can open it, close it (e.g.
+     * before replacing the whole file) or leave it open for the next operation on the same file.
+     */
+    using Action = std::packaged_task<void(std::unique_ptr<FITS>& file)>;
+
+    private:
+    struct Job {
+        std::string filename;
+        size_t bytes;
+        size_t id;
+        Action action;
+    };
+
+    size_t max_queued_bytes;
+    std::vector<std::thread> workers;
+    std::deque<Job> queue;
+    // Files not being written by an I/O thread, still open from a previous operation.
+    std::map<std::string, std::unique_ptr<FITS>> files;
+    // Files an I/O thread is writing to.
+    std::set<std::string> busy;
+    // Identifiers of the jobs submitted and not completed yet, and of the next job.
+    std::set<size_t> in_flight;
+    size_t next_id {0};
+    size_t queued_bytes {0};
+    // Fences, with the identifier of the first job they do not wait for.
+    std::deque<std::pair<size_t, std::promise<void>>> fences;
+
+    FitsWriterStats _stats;
+    mutable std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    bool stop {false};
+    std::exception_ptr error;
+
+    void run();
+    std::deque<Job>::iterator next_job();
+    void release_fences();
+    void rethrow_error();
+
+    public:
+    /**
+     * @brief Start the I/O threads.
+     *
+     * @param n_threads number of I/O threads, i.e. of files written concurrently
+     * (0 = one per hardware thread).
+     * @param max_queued_bytes maximum amount of data held by the writer. A product larger than
+     * this is accepted when the queue is empty.
+     */
+    explicit AsyncFitsWriter(unsigned int n_threads = 1, size_t max_queued_bytes = 1ul << 30);
+
+    /**
+     * @brief Write all the queued products and close the files. Errors not yet reported are
+     * printed on the standard error.
+     */
+    ~AsyncFitsWriter();
+
+    AsyncFitsWriter(const AsyncFitsWriter&) = delete;
+    AsyncFitsWriter& operator=(const AsyncFitsWriter&) = delete;
+
+    /**
+     * @brief Queue a write operation on `filename`. Blocks while the queue is full.
+     *
+     * @param filename file the operation writes to.
+     * @param bytes amount of memory owned by `action`, counted towards the queue capacity.
+     * @param action the operation. It must own the data it writes.
+     */
+    void submit(const std::string& filename, size_t bytes, Action&& action);
+
+    /**
+     * @brief Queue an image, to be appended as a new HDU to `filename`.
+     *
+     * @param filename output file. It is created if it does not exist.
+     * @param pixels the image, of `x_dim * y_dim` values. It is moved to the CPU first, if needed.
+     * @param x_dim dimension of the image along the horizontal axis.
+     * @param y_dim dimension of the image along the vertical axis.
+     * @param header HDU holding the header keywords of the image.
+     * @param options compression and encoding of the image (see `FitsOutputOptions`).
+     */
+    void write_image(const std::string& filename, MemoryBuffer<float>&& pixels, long x_dim, long y_dim,
+            FITS::HDU header = {}, const FitsOutputOptions& options = {});
+
+    /**
+     * @brief Same as above, for an image already converted to 16 bits with `encoding`, e.g. on
+     * GPU by `encode_pixels_gpu`, and `scale` for INT16_SCALED. The pixels are written as they
+     * are: only the compression is taken from `options`.
+     */
+    void write_encoded_image(const std::string& filename, MemoryBuffer<int16_t>&& pixels, long x_dim, long y_dim,
+            PixelEncoding encoding, float scale, FITS::HDU header = {}, const FitsOutputOptions& options = {});
+
+    /**
+     * @brief Queue visibilities to be saved to `filename` by `Visibilities::to_fits_file`,
+     * replacing the file. Data is moved to the CPU first, if needed.
+     */
+    void write_visibilities(const std::string& filename, Visibilities&& vis, const FitsOutputOptions& options = {});
+
+    /**
+     * @brief Queue visibilities to be saved to `filename` by `Visibilities::to_fits_file_mwax`.
+     */
+    void write_visibilities_mwax(const std::string& filename, Visibilities&& vis, int coarse_channel_ord,
+            const FitsOutputOptions& options = {});
+
+    /**
+     * @brief Return a future that becomes ready when all the products queued so far are written.
+     * Unlike `flush`, it does not block the caller, nor close the files.
+     */
+    std::shared_future<void> fence();
+
+    /**
+     * @brief Block until all the products queued so far are written, then close the files so
+     * that they are complete on disk. Rethrows the first error raised since the last report.
+     */
+    void flush();
+
+    /**
+     * @return the number of products queued or being written.
+     */
+    size_t pending() const;
+
+    /**
+     * @return a snapshot of the information collected so far.
+     */
+    FitsWriterStats stats() const;
+};
+
+#endif
@@ -14,6 +14,15 @@
   #define gpufftPlan2d   cufftPlan2d
   #define gpufftExecC2C  cufftExecC2C
   #define gpufftExecC2R  cufftExecC2R
+  #define gpufftResult   cufftResult
+  #define gpufftType     cufftType
+  #define gpufftCreate   cufftCreate
+  #define gpufftDestroy  cufftDestroy
+  #define gpufftSetAutoAllocation cufftSetAutoAllocation
+  #define gpufftMakePlanMany cufftMakePlanMany
+  #define gpufftSetWorkArea cufftSetWorkArea
+  #define gpufftSetStream cufftSetStream
+  #define GPUFFT_SUCCESS CUFFT_SUCCESS
   #define GPUFFT_C2C     CUFFT_C2C
   #define GPUFFT_C2R     CUFFT_C2R
   #define GPUFFT_FORWARD CUFFT_FORWARD
@@ -30,11 +39,32 @@
   #define gpufftPlan2d   hipfftPlan2d
   #define gpufftExecC2C  hipfftExecC2C
   #define gpufftExecC2R  hipfftExecC2R
+  #define gpufftResult   hipfftResult
+  #define gpufftType     hipfftType
+  #define gpufftCreate   hipfftCreate
+  #define gpufftDestroy  hipfftDestroy
+  #define gpufftSetAutoAllocation hipfftSetAutoAllocation
+  #define gpufftMakePlanMany hipfftMakePlanMany
+  #define gpufftSetWorkArea hipfftSetWorkArea
+  #define gpufftSetStream hipfftSetStream
+  #define GPUFFT_SUCCESS HIPFFT_SUCCESS
   #define GPUFFT_C2C     HIPFFT_C2C
   #define GPUFFT_C2R     HIPFFT_C2R
   #define GPUFFT_FORWARD HIPFFT_FORWARD
   #define GPUFFT_BACKWARD 1
 #endif
 
+#include <cstdio>
+#include <exception>
+
+// Same as `GPU_CHECK_ERROR`, for the FFT library calls.
+inline void __gpufft_check_error(gpufftResult x, const char *file, int line){
+    if(x != GPUFFT_SUCCESS){
+        fprintf(stderr, "GPU FFT error (%s:%d): code %d\n", file, line, static_cast<int>(x));
+        throw std::exception();
+    }
+}
+
+#define GPUFFT_CHECK_ERROR(X) __gpufft_check_error((X), __FILE__, __LINE__)
 
 #endif
@@ -14,6 +14,24 @@ int num_available_gpus() {
     return num_gpus;
 }
 
+
+
+bool enable_peer_access(int device, int peer){
+    if(device == peer) return true;
+    int can_access {0};
+    gpuDeviceCanAccessPeer(&can_access, device, peer);
+    if(!can_access) return false;
+    GpuDeviceGuard guard {device};
+    gpuError_t status {gpuDeviceEnablePeerAccess(peer, 0)};
+    if(status == gpuErrorPeerAccessAlreadyEnabled){
+        // Clear the error, so that it is not reported by the next check.
+        gpuGetLastError();
+        return true;
+    }
+    GPU_CHECK_ERROR(status);
+    return true;
+}
+
 #else
 int num_available_gpus() {
     return 0;
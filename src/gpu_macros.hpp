@@ -49,15 +49,23 @@ void __gpu_check_error(gpuError_t x, const char *file, int line);
 #define gpuMemcpyDeviceToDevice cudaMemcpyDeviceToDevice
 #define gpuFree(...) GPU_CHECK_ERROR(cudaFree(__VA_ARGS__))
 #define gpuHostFree(...) GPU_CHECK_ERROR(cudaFreeHost(__VA_ARGS__))
+#define gpuHostRegister(...) GPU_CHECK_ERROR(cudaHostRegister(__VA_ARGS__))
+#define gpuHostUnregister(...) GPU_CHECK_ERROR(cudaHostUnregister(__VA_ARGS__))
+#define gpuHostRegisterReadOnly cudaHostRegisterReadOnly
 #define gpuStream_t cudaStream_t
 #define gpuEvent_t cudaEvent_t
 #define gpuStreamCreate(...) GPU_CHECK_ERROR(cudaStreamCreate(__VA_ARGS__))
 #define gpuStreamDestroy(...) GPU_CHECK_ERROR(cudaStreamDestroy(__VA_ARGS__))
+#define gpuStreamSynchronize(...) GPU_CHECK_ERROR(cudaStreamSynchronize(__VA_ARGS__))
+#define gpuMemsetAsync(...) GPU_CHECK_ERROR(cudaMemsetAsync(__VA_ARGS__))
 #define gpuEventCreate(...) GPU_CHECK_ERROR(cudaEventCreate(__VA_ARGS__))
 #define gpuEventDestroy(...) GPU_CHECK_ERROR(cudaEventDestroy(__VA_ARGS__))
 #define gpuEventRecord(...) GPU_CHECK_ERROR(cudaEventRecord(__VA_ARGS__))
 #define gpuEventSynchronize(...) GPU_CHECK_ERROR(cudaEventSynchronize(__VA_ARGS__))
 #define gpuEventElapsedTime(...) GPU_CHECK_ERROR(cudaEventElapsedTime(__VA_ARGS__))
+// Not checked: returns gpuErrorNotReady while the work preceding the event is running.
+#define gpuEventQuery(...) cudaEventQuery(__VA_ARGS__)
+#define gpuErrorNotReady cudaErrorNotReady
 #define gpuGetDeviceCount(...) GPU_CHECK_ERROR(cudaGetDeviceCount(__VA_ARGS__))
 #define gpuGetLastError cudaGetLastError
 #define gpuGetDevice(...) GPU_CHECK_ERROR(cudaGetDevice(__VA_ARGS__))
@@ -66,6 +74,19 @@ void __gpu_check_error(gpuError_t x, const char *file, int line);
 #define gpuDeviceAttributeWarpSize cudaDevAttrWarpSize
 #define gpuDeviceProp_t cudaDeviceProp
 #define gpuGetDeviceProperties(...) GPU_CHECK_ERROR(cudaGetDeviceProperties(__VA_ARGS__))
+#define gpuOccupancyMaxActiveBlocksPerMultiprocessor(...) GPU_CHECK_ERROR(cudaOccupancyMaxActiveBlocksPerMultiprocessor(__VA_ARGS__))
+#define gpuMemcpyPeer(...) GPU_CHECK_ERROR(cudaMemcpyPeer(__VA_ARGS__))
+#define gpuMemcpyPeerAsync(...) GPU_CHECK_ERROR(cudaMemcpyPeerAsync(__VA_ARGS__))
+#define gpuDeviceCanAccessPeer(...) GPU_CHECK_ERROR(cudaDeviceCanAccessPeer(__VA_ARGS__))
+// Not checked: enabling peer access twice returns gpuErrorPeerAccessAlreadyEnabled.
+#define gpuDeviceEnablePeerAccess(...) cudaDeviceEnablePeerAccess(__VA_ARGS__)
+#define gpuErrorPeerAccessAlreadyEnabled cudaErrorPeerAccessAlreadyEnabled
+#define gpuMemPrefetchAsync(...) GPU_CHECK_ERROR(cudaMemPrefetchAsync(__VA_ARGS__))
+#define gpuMemAdvise(...) GPU_CHECK_ERROR(cudaMemAdvise(__VA_ARGS__))
+#define gpuMemAdviseSetPreferredLocation cudaMemAdviseSetPreferredLocation
+#define gpuMemAdviseSetAccessedBy cudaMemAdviseSetAccessedBy
+#define gpuMemAdviseSetReadMostly cudaMemAdviseSetReadMostly
+#define gpuCpuDeviceId cudaCpuDeviceId
 #define __gpu_shfl_down(...) __shfl_down_sync(0xffffffff, __VA_ARGS__)
 
 #else
@@ -82,15 +103,23 @@ void __gpu_check_error(gpuError_t x, const char *file, int line);
 #define gpuMemcpyDeviceToDevice hipMemcpyDeviceToDevice
 #define gpuFree(...) GPU_CHECK_ERROR(hipFree(__VA_ARGS__))
 #define gpuHostFree(...) GPU_CHECK_ERROR(hipHostFree(__VA_ARGS__))
+#define gpuHostRegister(...) GPU_CHECK_ERROR(hipHostRegister(__VA_ARGS__))
+#define gpuHostUnregister(...) GPU_CHECK_ERROR(hipHostUnregister(__VA_ARGS__))
+#define gpuHostRegisterReadOnly hipHostRegisterReadOnly
 #define gpuStream_t hipStream_t
 #define gpuEvent_t hipEvent_t
 #define gpuStreamCreate(...) GPU_CHECK_ERROR(hipStreamCreate(__VA_ARGS__))
 #define gpuStreamDestroy(...) GPU_CHECK_ERROR(hipStreamDestroy(__VA_ARGS__))
+#define gpuStreamSynchronize(...) GPU_CHECK_ERROR(hipStreamSynchronize(__VA_ARGS__))
+#define gpuMemsetAsync(...) GPU_CHECK_ERROR(hipMemsetAsync(__VA_ARGS__))
 #define gpuEventCreate(...) GPU_CHECK_ERROR(hipEventCreate(__VA_ARGS__))
 #define gpuEventDestroy(...) GPU_CHECK_ERROR(hipEventDestroy(__VA_ARGS__))
 #define gpuEventRecord(...) GPU_CHECK_ERROR(hipEventRecord(__VA_ARGS__))
 #define gpuEventSynchronize(...) GPU_CHECK_ERROR(hipEventSynchronize(__VA_ARGS__))
 #define gpuEventElapsedTime(...) GPU_CHECK_ERROR(hipEventElapsedTime(__VA_ARGS__))
+// Not checked: returns gpuErrorNotReady while the work preceding the event is running.
+#define gpuEventQuery(...) hipEventQuery(__VA_ARGS__)
+#define gpuErrorNotReady hipErrorNotReady
 #define gpuGetDeviceCount(...) hipGetDeviceCount(__VA_ARGS__)
 #define gpuGetLastError hipGetLastError
 #define gpuGetDevice(...) GPU_CHECK_ERROR(hipGetDevice(__VA_ARGS__))
@@ -99,11 +128,56 @@ void __gpu_check_error(gpuError_t x, const char *file, int line);
 #define gpuDeviceAttributeWarpSize hipDeviceAttributeWarpSize
 #define gpuDeviceProp_t hipDeviceProp_t
 #define gpuGetDeviceProperties(...) GPU_CHECK_ERROR(hipGetDeviceProperties(__VA_ARGS__))
+#define gpuOccupancyMaxActiveBlocksPerMultiprocessor(...) GPU_CHECK_ERROR(hipOccupancyMaxActiveBlocksPerMultiprocessor(__VA_ARGS__))
+#define gpuMemcpyPeer(...) GPU_CHECK_ERROR(hipMemcpyPeer(__VA_ARGS__))
+#define gpuMemcpyPeerAsync(...) GPU_CHECK_ERROR(hipMemcpyPeerAsync(__VA_ARGS__))
+#define gpuDeviceCanAccessPeer(...) GPU_CHECK_ERROR(hipDeviceCanAccessPeer(__VA_ARGS__))
+#define gpuDeviceEnablePeerAccess(...) hipDeviceEnablePeerAccess(__VA_ARGS__)
+#define gpuErrorPeerAccessAlreadyEnabled hipErrorPeerAccessAlreadyEnabled
+#define gpuMemPrefetchAsync(...) GPU_CHECK_ERROR(hipMemPrefetchAsync(__VA_ARGS__))
+#define gpuMemAdvise(...) GPU_CHECK_ERROR(hipMemAdvise(__VA_ARGS__))
+#define gpuMemAdviseSetPreferredLocation hipMemAdviseSetPreferredLocation
+#define gpuMemAdviseSetAccessedBy hipMemAdviseSetAccessedBy
+#define gpuMemAdviseSetReadMostly hipMemAdviseSetReadMostly
+#define gpuCpuDeviceId hipCpuDeviceId
 
 #define __gpu_shfl_down(...) __shfl_down(__VA_ARGS__)
 
 #endif
 #define gpuCheckLastError(...) GPU_CHECK_ERROR(gpuGetLastError())
+
+/**
+ * @brief Make `device` the current GPU of the calling thread for the lifetime of the object,
+ * then restore the previous one.
+ */
+class GpuDeviceGuard {
+    int previous {0};
+    int device;
+
+    public:
+    explicit GpuDeviceGuard(int device) : device {device} {
+        gpuGetDevice(&previous);
+        if(device != previous) gpuSetDevice(device);
+    }
+
+    ~GpuDeviceGuard(){
+        try {
+            if(device != previous) gpuSetDevice(previous);
+        } catch (...) {}
+    }
+
+    GpuDeviceGuard(const GpuDeviceGuard&) = delete;
+    GpuDeviceGuard& operator=(const GpuDeviceGuard&) = delete;
+};
+
+/**
+ * @brief Let kernels and copies running on `device` access memory of `peer` directly, over
+ * NVLink or PCIe, if the hardware supports it. Can be called more than once.
+ *
+ * @return `true` if `device` can access `peer` memory directly. Otherwise peer copies are
+ * staged through host memory by the driver.
+ */
+bool enable_peer_access(int device, int peer);
 #else
 constexpr bool gpu_support() { return false;}
 #endif
@@ -1,5 +1,6 @@
 #include "images.hpp"
 #include "files.hpp"
+#include "fits_writer.hpp"
 #include <iomanip>
 #include <libnova/sidereal_time.h> // ln_get_apparent_sidereal_time
 #include <libnova/julian_day.h>    // ln_get_julian_from_timet
@@ -78,23 +79,140 @@ namespace {
    }    
 }
 
-void Images::save_fits_file(FITS& fits_file, float* data, long side_x, long side_y){
+#ifdef __GPU__
+/*
+    Split `n` interleaved complex values in their real and imaginary parts. `imag` can be null,
+    when only the real part is needed.
+*/
+__global__ void split_complex_kernel(const float *input, size_t n, float *real, float *imag){
+    const size_t start_index {blockDim.x * blockIdx.x + threadIdx.x};
+    const size_t grid_size {gridDim.x * blockDim.x};
+    for(size_t i {start_index}; i < n; i += grid_size){
+        real[i] = input[2 * i];
+        if(imag) imag[i] = input[2 * i + 1];
+    }
+}
+
+
+
+namespace {
+    // Queue on `stream` the split of the `n` pixels of `image` into `real` and `imag` (if not null).
+    void split_complex(const std::complex<float> *image, size_t n, float *real, float *imag, gpuStream_t stream){
+        const unsigned int n_threads {1024};
+        const unsigned int n_blocks {static_cast<unsigned int>(std::min<size_t>((n + n_threads - 1) / n_threads, 65535))};
+        split_complex_kernel<<<n_blocks, n_threads, 0, stream>>>(reinterpret_cast<const float*>(image), n, real, imag);
+        gpuCheckLastError();
+    }
+}
+
+
+
+void Images::download_image(size_t interval, size_t fine_channel, bool save_as_complex, bool save_imaginary,
+        float *real, float *imag, gpuStream_t stream){
+    const size_t n {this->image_size()};
+    const std::complex<float> *image {this->at(interval, fine_channel)};
+    if(save_as_complex){
+        gpuMemcpyAsync(real, image, n * sizeof(std::complex<float>), gpuMemcpyDeviceToHost, stream);
+        return;
+    }
+    if(!dev_planes || dev_planes.size() != 2 * n) dev_planes.allocate(2 * n, MemoryType::DEVICE);
+    float *dev_real {dev_planes.data()}, *dev_imag {save_imaginary ? dev_planes.data() + n : nullptr};
+    split_complex(image, n, dev_real, dev_imag, stream);
+    gpuMemcpyAsync(real, dev_real, n * sizeof(float), gpuMemcpyDeviceToHost, stream);
+    if(save_imaginary) gpuMemcpyAsync(imag, dev_imag, n * sizeof(float), gpuMemcpyDeviceToHost, stream);
+}
+
+
+
+void Images::download_encoded_image(size_t interval, size_t fine_channel, bool save_as_complex, bool save_imaginary,
+        PixelEncoding encoding, int16_t *real, int16_t *imag, float *scales, gpuStream_t stream){
+    const size_t n {this->image_size()};
+    const std::complex<float> *image {this->at(interval, fine_channel)};
+    if(!dev_encoded || dev_encoded.size() != 2 * n) dev_encoded.allocate(2 * n, MemoryType::DEVICE);
+    if(!dev_scales) dev_scales.allocate(2, MemoryType::DEVICE);
+    if(save_as_complex){
+        // The interleaved complex pixels form a single image, with a single scale.
+        encode_pixels_gpu(reinterpret_cast<const float*>(image), 2 * n, encoding, dev_encoded.data(), dev_scales.data(), stream);
+        gpuMemcpyAsync(real, dev_encoded.data(), 2 * n * sizeof(int16_t), gpuMemcpyDeviceToHost, stream);
+    }else{
+        if(!dev_planes || dev_planes.size() != 2 * n) dev_planes.allocate(2 * n, MemoryType::DEVICE);
+        float *dev_real {dev_planes.data()}, *dev_imag {save_imaginary ? dev_planes.data() + n : nullptr};
+        split_complex(image, n, dev_real, dev_imag, stream);
+        encode_pixels_gpu(dev_real, n, encoding, dev_encoded.data(), dev_scales.data(), stream);
+        gpuMemcpyAsync(real, dev_encoded.data(), n * sizeof(int16_t), gpuMemcpyDeviceToHost, stream);
+        if(save_imaginary){
+            encode_pixels_gpu(dev_imag, n, encoding, dev_encoded.data() + n, dev_scales.data() + 1, stream);
+            gpuMemcpyAsync(imag, dev_encoded.data() + n, n * sizeof(int16_t), gpuMemcpyDeviceToHost, stream);
+        }
+    }
+    gpuMemcpyAsync(scales, dev_scales.data(), 2 * sizeof(float), gpuMemcpyDeviceToHost, stream);
+}
+
+
+
+void Images::download_encoded_image(size_t interval, size_t fine_channel, bool save_as_complex, bool save_imaginary,
+        PixelEncoding encoding, float *staging, gpuStream_t stream){
+    int16_t *planes {reinterpret_cast<int16_t*>(staging)};
+    download_encoded_image(interval, fine_channel, save_as_complex, save_imaginary, encoding,
+        planes, planes + this->image_size(), staging + this->image_size(), stream);
+}
+
+
+
+void Images::save_encoded_planes(FITS& fits_file, size_t interval, float *staging, bool save_as_complex, bool save_imaginary,
+        PixelEncoding encoding){
+    const size_t n {this->image_size()};
+    short *pixels {reinterpret_cast<short*>(staging)};
+    const float *scales {staging + n};
+    const long side {static_cast<long>(this->side_size)}, side_y {save_as_complex ? 2 * side : side};
+    for(int plane {0}; plane < (save_imaginary && !save_as_complex ? 2 : 1); plane++){
+        FITS::HDU hdu {interval_header(interval, side, side_y)};
+        hdu.set_image(pixels + plane * n, side, side_y);
+        hdu.add_encoding_keywords(encoding, scales[plane]);
+        fits_file.add_HDU(std::move(hdu));
+    }
+}
+
+
+
+MemoryBuffer<float>& Images::staging_buffer(int slot){
+    // Two more values hold the scales of encoded planes, see `download_encoded_image`.
+    const size_t size {2 * this->image_size() + 2};
+    if(!staging[slot] || staging[slot].size() != size)
+        staging[slot].allocate(size, MemoryType::PINNED);
+    return staging[slot];
+}
+#endif
+
+
+
+void Images::save_planes(FITS& fits_file, size_t interval, float *real, float *imag, bool save_as_complex, bool save_imaginary){
+    if(save_as_complex){
+        save_fits_file(fits_file, interval, real, this->side_size, this->side_size * 2);
+        return;
+    }
+    save_fits_file(fits_file, interval, real, this->side_size, this->side_size);
+    if(save_imaginary) save_fits_file(fits_file, interval, imag, this->side_size, this->side_size);
+}
+
+
+
+FITS::HDU Images::image_header(double time, long side_x, long side_y, long x0, long y0) const {
     FITS::HDU hdu;
-    hdu.set_image(data,  side_x, side_y);
-    
+
     // calculate LST :
     double jd,xi,eta;
-    double lst_hours = get_local_sidereal_time( obsInfo.startTime, obsInfo.geo_long_deg, jd );
+    double lst_hours = get_local_sidereal_time( time, obsInfo.geo_long_deg, jd );
     fixCoordHdr( ra_deg, dec_deg, lst_hours, obsInfo.geo_long_deg, obsInfo.geo_lat_deg, xi, eta );
         
     hdu.add_keyword("CTYPE1", std::string { "RA---SIN"}, "");
-    hdu.add_keyword("CRPIX1", side_x / 2 + 1, "" );   
+    hdu.add_keyword("CRPIX1", side_x / 2 + 1 - x0, "" );   
     hdu.add_keyword("CDELT1", pixscale_ra, "Pixscale" );
     hdu.add_keyword("CRVAL1", ra_deg , "RA value in deg." ); // RA of the centre 
     hdu.add_keyword("CUNIT1", std::string { "deg"} , "" );
 
     hdu.add_keyword("CTYPE2", std::string {"DEC--SIN"}, "") ;
-    hdu.add_keyword("CRPIX2", side_y / 2 + 1 , "" );   
+    hdu.add_keyword("CRPIX2", side_y / 2 + 1 - y0, "" );   
     hdu.add_keyword("CDELT2", pixscale_dec , "Pixscale" );
     hdu.add_keyword("CRVAL2", dec_deg , "DEC value in deg." ); // RA of the centre 
     hdu.add_keyword("CUNIT2", std::string { "deg"} , "" );
@@ -103,7 +221,32 @@ void Images::save_fits_file(FITS& fits_file, float* data, long side_x, long side
     hdu.add_keyword("PV2_1", xi  , "" );
     hdu.add_keyword("PV2_2", eta , "" );
     
-    fits_file.add_HDU(hdu);
+    return hdu;
+}
+
+
+
+const FITS::HDU& Images::interval_header(size_t interval, long side_x, long side_y){
+    const WcsParameters parameters {static_cast<double>(obsInfo.startTime), interval_duration(), obsInfo.geo_long_deg,
+        obsInfo.geo_lat_deg, ra_deg, dec_deg, pixscale_ra, pixscale_dec, side_x, side_y};
+    if(!(parameters == wcs_parameters) || wcs_headers.size() != n_intervals){
+        wcs_parameters = parameters;
+        wcs_headers.assign(n_intervals, FITS::HDU {});
+        wcs_valid.assign(n_intervals, false);
+    }
+    if(!wcs_valid[interval]){
+        wcs_headers[interval] = image_header(interval_time(interval), side_x, side_y);
+        wcs_valid[interval] = true;
+    }
+    return wcs_headers[interval];
+}
+
+
+
+void Images::save_fits_file(FITS& fits_file, size_t interval, float* data, long side_x, long side_y){
+    FITS::HDU hdu {interval_header(interval, side_x, side_y)};
+    hdu.set_image(data,  side_x, side_y);
+    fits_file.add_HDU(std::move(hdu));
 }
 
 void Images::to_fits_file(const std::string& directory_path, size_t interval, size_t fine_channel, bool save_as_complex, bool save_imaginary){
@@ -124,30 +267,82 @@ void Images::to_fits_file(const std::string& directory_path, size_t interval, si
 
 
 void Images::to_fits_file(FITS& fits_file, size_t interval, size_t fine_channel, bool save_as_complex, bool save_imaginary){
-    if(on_gpu()) to_cpu();
+    #ifdef __GPU__
+    if(on_gpu()){
+        // Only the requested image leaves the GPU: the cube stays resident for the next stage.
+        const PixelEncoding encoding {fits_file.get_output_options().encoding};
+        float *planes {staging_buffer(0).data()};
+        const gpuStream_t stream {download_stream.get()};
+        if(encoding == PixelEncoding::FLOAT32)
+            download_image(interval, fine_channel, save_as_complex, save_imaginary, planes, planes + this->image_size(), stream);
+        else
+            download_encoded_image(interval, fine_channel, save_as_complex, save_imaginary, encoding, planes, stream);
+        gpuStreamSynchronize(stream);
+        if(encoding == PixelEncoding::FLOAT32)
+            save_planes(fits_file, interval, planes, planes + this->image_size(), save_as_complex, save_imaginary);
+        else
+            save_encoded_planes(fits_file, interval, planes, save_as_complex, save_imaginary, encoding);
+        return;
+    }
+    #endif
     if(!img_real) img_real.allocate(this->image_size());
     if(!img_imag) img_imag.allocate(this->image_size());
     std::complex<float> *current_data {this->data() + this->image_size() * this->n_channels * interval + fine_channel * this->image_size()}; 
     
     if(save_as_complex){
         std::complex<float>* p_data = this->at(interval, fine_channel);
-        save_fits_file(fits_file, reinterpret_cast<float*>(p_data), this->side_size, this->side_size * 2);
+        save_fits_file(fits_file, interval, reinterpret_cast<float*>(p_data), this->side_size, this->side_size * 2);
     }else{
         for(size_t i {0}; i < this->image_size(); i++){
             img_real[i] = current_data[i].real();
         }
-        save_fits_file(fits_file, img_real.data(), this->side_size, this->side_size);
+        save_fits_file(fits_file, interval, img_real.data(), this->side_size, this->side_size);
         if(save_imaginary){
             for(size_t i {0}; i < this->image_size(); i++){
                 img_imag[i] = current_data[i].imag();
             }
-            save_fits_file(fits_file, img_imag.data(), this->side_size, this->side_size);
+            save_fits_file(fits_file, interval, img_imag.data(), this->side_size, this->side_size);
         }
     }    
 }
 
 
-void Images::to_fits_files(const std::string& directory_path, bool save_as_complex, bool save_imaginary) {
+void Images::to_fits_file(FITS& fits_file, const ConstImageView& images, bool save_as_complex, bool save_imaginary){
+    if(images.on_gpu()) throw std::invalid_argument {"Images::to_fits_file: images must reside in CPU memory."};
+    const size_t height {images.dim(2)}, width {images.dim(3)};
+    const long side {static_cast<long>(this->side_size)};
+    const bool cutout {width != this->side_size || height != this->side_size};
+    const long x0 {static_cast<long>(images.offset(3))}, y0 {static_cast<long>(images.offset(2))};
+    MemoryBuffer<float> real {(save_as_complex ? 2 : 1) * width * height}, imag;
+    if(save_imaginary && !save_as_complex) imag.allocate(width * height);
+    for(size_t i {0}; i < images.dim(0); i++){
+        const size_t interval {images.offset(0) + i};
+        for(size_t ch {0}; ch < images.dim(1); ch++){
+            const ArrayView<const std::complex<float>, 2> image {images[i][ch]};
+            if(save_as_complex){
+                copy_view(image, reinterpret_cast<std::complex<float>*>(real.data()));
+            }else{
+                for(size_t y {0}, k {0}; y < height; y++){
+                    for(size_t x {0}; x < width; x++, k++){
+                        real[k] = image(y, x).real();
+                        if(imag) imag[k] = image(y, x).imag();
+                    }
+                }
+            }
+            // Complex images have twice as many rows, as in `save_planes`.
+            const long rows {static_cast<long>(save_as_complex ? 2 * height : height)};
+            const long side_y {save_as_complex ? 2 * side : side};
+            for(int plane {0}; plane < (imag ? 2 : 1); plane++){
+                FITS::HDU hdu {cutout ? image_header(interval_time(interval), side, side_y, x0, y0) : interval_header(interval, side, side_y)};
+                hdu.set_image(plane == 0 ? real.data() : imag.data(), static_cast<long>(width), rows);
+                fits_file.add_HDU(std::move(hdu));
+            }
+        }
+    }
+}
+
+
+std::string Images::fits_files_path(const std::string& directory_path, bool save_as_complex, bool save_imaginary) const {
     if(!blink::imager::dir_exists(directory_path))
         blink::imager::create_directory(directory_path);
     std::stringstream full_file_path;
@@ -157,13 +352,137 @@ void Images::to_fits_files(const std::string& directory_path, bool save_as_compl
     else full_file_path << "_real";
     if(save_imaginary) full_file_path  << "_imag";
     full_file_path << ".fits";
-    std::string full_file_path_str {full_file_path.str()};
+    return full_file_path.str();
+}
+
+
+void Images::to_fits_files(const std::string& directory_path, bool save_as_complex, bool save_imaginary,
+        const FitsOutputOptions& options) {
+    std::string full_file_path_str {fits_files_path(directory_path, save_as_complex, save_imaginary)};
 
     FITS fits_file {full_file_path_str, FITS::Mode::APPEND};
-    if(on_gpu()) to_cpu();
+    fits_file.set_output_options(options);
+    #ifdef __GPU__
+    if(on_gpu()){
+        /*
+            Double buffering: image `k + 1` is extracted and downloaded into one pinned buffer
+            while image `k`, already in the other one, is written to disk. Encoded images are
+            converted on the GPU, so only their 16-bit pixels cross the bus.
+        */
+        const size_t n_images {this->size()}, n {this->image_size()};
+        const bool encoded {options.encoding != PixelEncoding::FLOAT32};
+        const gpuStream_t stream {download_stream.get()};
+        gpuEvent_t downloaded[2];
+        for(int b {0}; b < 2; b++) gpuEventCreate(&downloaded[b]);
+        auto enqueue = [&](size_t k){
+            float *planes {staging_buffer(k % 2).data()};
+            if(encoded)
+                download_encoded_image(k / this->n_channels, k % this->n_channels, save_as_complex, save_imaginary,
+                    options.encoding, planes, stream);
+            else
+                download_image(k / this->n_channels, k % this->n_channels, save_as_complex, save_imaginary, planes, planes + n, stream);
+            gpuEventRecord(downloaded[k % 2], stream);
+        };
+        if(n_images > 0) enqueue(0);
+        for(size_t k {0}; k < n_images; k++){
+            if(k + 1 < n_images) enqueue(k + 1);
+            gpuEventSynchronize(downloaded[k % 2]);
+            float *planes {staging[k % 2].data()};
+            if(encoded)
+                save_encoded_planes(fits_file, k / this->n_channels, planes, save_as_complex, save_imaginary, options.encoding);
+            else
+                save_planes(fits_file, k / this->n_channels, planes, planes + n, save_as_complex, save_imaginary);
+        }
+        gpuStreamSynchronize(stream);
+        for(int b {0}; b < 2; b++) gpuEventDestroy(downloaded[b]);
+        return;
+    }
+    #endif
     for(size_t interval {0}; interval < this->n_intervals; interval++){
         for(size_t fine_channel {0}; fine_channel < this->n_channels; fine_channel++){
             to_fits_file(fits_file, interval, fine_channel, save_as_complex, save_imaginary);
         }
     }
 }
+
+
+void Images::to_fits_files(AsyncFitsWriter& writer, const std::string& directory_path, bool save_as_complex, bool save_imaginary,
+        const FitsOutputOptions& options) {
+    const std::string full_file_path_str {fits_files_path(directory_path, save_as_complex, save_imaginary)};
+    const long side {static_cast<long>(this->side_size)};
+    #ifdef __GPU__
+    if(on_gpu()){
+        /*
+            Each image is downloaded into its own pinned buffers, handed to the writer once the
+            copy completes. Image `k + 1` is extracted on the GPU while image `k` is queued.
+            Encoded images are converted on the GPU, as in the synchronous version.
+        */
+        const size_t n_images {this->size()}, n {this->image_size()};
+        const bool encoded {options.encoding != PixelEncoding::FLOAT32};
+        MemoryBuffer<float> real[2], imag[2];
+        MemoryBuffer<int16_t> encoded_real[2], encoded_imag[2];
+        MemoryBuffer<float> scales[2];
+        const gpuStream_t stream {download_stream.get()};
+        gpuEvent_t downloaded[2];
+        for(int b {0}; b < 2; b++) gpuEventCreate(&downloaded[b]);
+        auto hand_over = [&](size_t k){
+            const int b {static_cast<int>(k % 2)};
+            const size_t interval {k / this->n_channels};
+            const long side_y {save_as_complex ? 2 * side : side};
+            gpuEventSynchronize(downloaded[b]);
+            if(encoded){
+                writer.write_encoded_image(full_file_path_str, std::move(encoded_real[b]), side, side_y, options.encoding,
+                    scales[b][0], interval_header(interval, side, side_y), options);
+                if(save_imaginary && !save_as_complex)
+                    writer.write_encoded_image(full_file_path_str, std::move(encoded_imag[b]), side, side, options.encoding,
+                        scales[b][1], interval_header(interval, side, side), options);
+                return;
+            }
+            writer.write_image(full_file_path_str, std::move(real[b]), side, side_y, interval_header(interval, side, side_y), options);
+            if(save_imaginary && !save_as_complex)
+                writer.write_image(full_file_path_str, std::move(imag[b]), side, side, interval_header(interval, side, side), options);
+        };
+        for(size_t k {0}; k < n_images; k++){
+            const int b {static_cast<int>(k % 2)};
+            if(k >= 2) hand_over(k - 2);
+            if(encoded){
+                if(!scales[b]) scales[b].allocate(2, MemoryType::PINNED);
+                encoded_real[b].allocate(save_as_complex ? 2 * n : n, MemoryType::PINNED);
+                if(save_imaginary && !save_as_complex) encoded_imag[b].allocate(n, MemoryType::PINNED);
+                download_encoded_image(k / this->n_channels, k % this->n_channels, save_as_complex, save_imaginary,
+                    options.encoding, encoded_real[b].data(), encoded_imag[b].data(), scales[b].data(), stream);
+            }else{
+                real[b].allocate(save_as_complex ? 2 * n : n, MemoryType::PINNED);
+                if(save_imaginary && !save_as_complex) imag[b].allocate(n, MemoryType::PINNED);
+                download_image(k / this->n_channels, k % this->n_channels, save_as_complex, save_imaginary,
+                    real[b].data(), imag[b].data(), stream);
+            }
+            gpuEventRecord(downloaded[b], stream);
+        }
+        for(size_t k {n_images >= 2 ? n_images - 2 : 0}; k < n_images; k++) hand_over(k);
+        gpuStreamSynchronize(stream);
+        for(int b {0}; b < 2; b++) gpuEventDestroy(downloaded[b]);
+        return;
+    }
+    #endif
+    for(size_t interval {0}; interval < this->n_intervals; interval++){
+        for(size_t fine_channel {0}; fine_channel < this->n_channels; fine_channel++){
+            const std::complex<float> *current_data {this->at(interval, fine_channel)};
+            // Each image gets its own buffer, owned by the writer until it is on disk.
+            if(save_as_complex){
+                MemoryBuffer<float> image {2 * this->image_size()};
+                std::memcpy(image.data(), current_data, this->image_size() * sizeof(std::complex<float>));
+                writer.write_image(full_file_path_str, std::move(image), side, 2 * side, interval_header(interval, side, 2 * side), options);
+                continue;
+            }
+            MemoryBuffer<float> real {this->image_size()};
+            for(size_t i {0}; i < this->image_size(); i++) real[i] = current_data[i].real();
+            writer.write_image(full_file_path_str, std::move(real), side, side, interval_header(interval, side, side), options);
+            if(save_imaginary){
+                MemoryBuffer<float> imag {this->image_size()};
+                for(size_t i {0}; i < this->image_size(); i++) imag[i] = current_data[i].imag();
+                writer.write_image(full_file_path_str, std::move(imag), side, side, interval_header(interval, side, side), options);
+            }
+        }
+    }
+}
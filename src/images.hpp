@@ -3,9 +3,16 @@
 
 #include <complex>
 #include <string>
+#include <utility>
 #include "astroio.hpp"
 #include "memory_buffer.hpp"
 
+class AsyncFitsWriter;
+
+// View of images, with axes [integration_interval][channel][y][x].
+using ImageView = ArrayView<std::complex<float>, 4>;
+using ConstImageView = ArrayView<const std::complex<float>, 4>;
+
 class Images : public MemoryBuffer<std::complex<float>> {
     private:
     // Auxiliary buffers to save images to disk. Only allocated
@@ -14,6 +21,26 @@ class Images : public MemoryBuffer<std::complex<float>> {
     MemoryBuffer<float> img_imag;
     std::vector<bool> flags;
 
+    // Parameters the cached WCS headers were computed with.
+    struct WcsParameters {
+        double start_time {0.0}, interval_duration {0.0};
+        double geo_long_deg {0.0}, geo_lat_deg {0.0};
+        double ra_deg {0.0}, dec_deg {0.0}, pixscale_ra {0.0}, pixscale_dec {0.0};
+        long side_x {0}, side_y {0};
+
+        bool operator==(const WcsParameters& other) const {
+            return start_time == other.start_time && interval_duration == other.interval_duration &&
+                geo_long_deg == other.geo_long_deg && geo_lat_deg == other.geo_lat_deg &&
+                ra_deg == other.ra_deg && dec_deg == other.dec_deg && pixscale_ra == other.pixscale_ra &&
+                pixscale_dec == other.pixscale_dec && side_x == other.side_x && side_y == other.side_y;
+        }
+    };
+    // WCS headers of the images of each interval, computed when first needed and shared by
+    // all the images of the interval. See `interval_header`.
+    WcsParameters wcs_parameters;
+    std::vector<FITS::HDU> wcs_headers;
+    std::vector<bool> wcs_valid;
+
     public:
     ObservationInfo obsInfo;
     unsigned int n_intervals;
@@ -64,6 +91,34 @@ class Images : public MemoryBuffer<std::complex<float>> {
         const std::complex<float> *pData = this->data() + nValuesInTimeInterval * interval + image_size() * fine_channel;
         return pData;
     }
+    /**
+     * @brief View of the images, with axes [integration_interval][channel][y][x]. Slice it to
+     * select intervals, channels or a cutout of the images without copies.
+     */
+    ImageView view() {
+        return {data(), {n_intervals, n_channels, side_size, side_size}, on_gpu()};
+    }
+
+    ConstImageView view() const {
+        return const_cast<Images*>(this)->view();
+    }
+
+    /**
+     * @brief Duration, in seconds, of an integration interval, derived from the number and
+     * resolution of the timesteps in `obsInfo`. Zero if they are not known.
+     */
+    double interval_duration() const {
+        if(n_intervals == 0 || obsInfo.nTimesteps == 0 || obsInfo.timeResolution <= 0.0) return 0.0;
+        return obsInfo.nTimesteps * obsInfo.timeResolution / n_intervals;
+    }
+
+    /**
+     * @brief Unix time, in seconds, at which the integration interval `interval` starts.
+     */
+    double interval_time(size_t interval) const {
+        return static_cast<double>(obsInfo.startTime) + interval * interval_duration();
+    }
+
     /**
      * Number of time intervals integrated over by the correlator.
      */
@@ -93,10 +148,98 @@ class Images : public MemoryBuffer<std::complex<float>> {
 
     void to_fits_file(const std::string& directory_path, size_t interval, size_t fine_channel, bool save_as_complex = false, bool save_imaginary = false);
     void to_fits_file(FITS& fits_file, size_t interval, size_t fine_channel, bool save_as_complex = false, bool save_imaginary = false);
-    void to_fits_files(const std::string& directory_path, bool save_as_complex = false, bool save_imaginary = false);
+
+    /**
+     * @brief Save all the images to a single file in `directory_path`, one HDU per image.
+     * `options` sets the compression and encoding of the images (see `FitsOutputOptions`); with
+     * the INT16_SCALED encoding, each image gets its own scale. Images resident on GPU are
+     * encoded there, so that only 16-bit pixels are downloaded.
+     */
+    void to_fits_files(const std::string& directory_path, bool save_as_complex = false, bool save_imaginary = false,
+            const FitsOutputOptions& options = {});
+
+    /**
+     * @brief Append the images in `images`, a view of this object, to `fits_file`, e.g. a range of
+     * channels or a cutout around a source. The WCS keywords of cutouts are shifted accordingly.
+     * The view must reside in CPU memory.
+     */
+    void to_fits_file(FITS& fits_file, const ConstImageView& images, bool save_as_complex = false, bool save_imaginary = false);
+
+    /**
+     * @brief Same as above, but the images are written in background by `writer`. The function
+     * returns as soon as they are copied in the writer queue, so the `Images` object can be
+     * reused straight away. Call `writer.flush()` to wait for the file to be complete.
+     * `options` is the same as for the synchronous version.
+     */
+    void to_fits_files(AsyncFitsWriter& writer, const std::string& directory_path, bool save_as_complex = false, bool save_imaginary = false,
+            const FitsOutputOptions& options = {});
    
 private :
-    void save_fits_file(FITS& fits_file, float* data, long side_x, long side_y);
+    // Name of the file written by `to_fits_files`, creating `directory_path` if needed.
+    std::string fits_files_path(const std::string& directory_path, bool save_as_complex, bool save_imaginary) const;
+    // HDU holding the WCS keywords of an image of the given size taken at `time`, without pixels.
+    // For a cutout, `x0` and `y0` are the coordinates of its first pixel in the full image.
+    FITS::HDU image_header(double time, long side_x, long side_y, long x0 = 0, long y0 = 0) const;
+    // Cached WCS header of the images of `interval`. It is computed once per interval and
+    // recomputed only if the pointing, the observation or the image size change.
+    const FITS::HDU& interval_header(size_t interval, long side_x, long side_y);
+    void save_fits_file(FITS& fits_file, size_t interval, float* data, long side_x, long side_y);
+    // Write an image, split in its real and imaginary planes or as complex values in `real`.
+    void save_planes(FITS& fits_file, size_t interval, float *real, float *imag, bool save_as_complex, bool save_imaginary);
+
+    #ifdef __GPU__
+    // Device planes the real and imaginary parts of an image resident on GPU are extracted to,
+    // and pinned buffers they are downloaded into. Only allocated when needed.
+    MemoryBuffer<float> dev_planes;
+    MemoryBuffer<float> staging[2];
+    MemoryBuffer<float>& staging_buffer(int slot);
+
+    // Stream the images are downloaded on, created when first needed and kept with the staging
+    // buffers. Copies of an `Images` object get their own stream.
+    class DownloadStream {
+        gpuStream_t stream {nullptr};
+
+        public:
+        DownloadStream() {}
+        DownloadStream(const DownloadStream&) {}
+        DownloadStream(DownloadStream&& other) : stream {other.stream} { other.stream = nullptr; }
+        DownloadStream& operator=(const DownloadStream&) { return *this; }
+        DownloadStream& operator=(DownloadStream&& other) { std::swap(stream, other.stream); return *this; }
+        ~DownloadStream() { if(stream) gpuStreamDestroy(stream); }
+
+        gpuStream_t get() {
+            if(!stream) gpuStreamCreate(&stream);
+            return stream;
+        }
+    } download_stream;
+    // Device planes converted to 16 bits, and their scales, when images are written encoded.
+    MemoryBuffer<int16_t> dev_encoded;
+    MemoryBuffer<float> dev_scales;
+
+    /*
+        Queue on `stream` the extraction of image (interval, fine_channel) from the cube on GPU,
+        and its download to `real` and, if `save_imaginary` is set, `imag`. With `save_as_complex`,
+        the complex pixels are copied to `real` as they are. Host buffers should be pinned.
+    */
+    void download_image(size_t interval, size_t fine_channel, bool save_as_complex, bool save_imaginary,
+        float *real, float *imag, gpuStream_t stream);
+
+    /*
+        Same as above, but the planes are converted to `encoding` on the GPU: the 16-bit planes
+        are downloaded to `real` and `imag`, and their scales to `scales[0]` and `scales[1]`.
+    */
+    void download_encoded_image(size_t interval, size_t fine_channel, bool save_as_complex, bool save_imaginary,
+        PixelEncoding encoding, int16_t *real, int16_t *imag, float *scales, gpuStream_t stream);
+
+    // Same as above, with the layout of a staging buffer: the 16-bit planes, one after the
+    // other, followed by their scales, starting from `staging + image_size()`.
+    void download_encoded_image(size_t interval, size_t fine_channel, bool save_as_complex, bool save_imaginary,
+        PixelEncoding encoding, float *staging, gpuStream_t stream);
+
+    // Write an image downloaded by `download_encoded_image`.
+    void save_encoded_planes(FITS& fits_file, size_t interval, float *staging, bool save_as_complex, bool save_imaginary,
+        PixelEncoding encoding);
+    #endif
 };
 
 
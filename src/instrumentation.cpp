@@ -0,0 +1,445 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+#include "instrumentation.hpp"
+
+namespace instrumentation {
+
+namespace detail {
+std::atomic<bool> enabled_flag {false};
+}
+
+namespace {
+
+constexpr const char *TRACE_FILE_ENV {"BLINK_ASTROIO_TRACE"};
+// GPU tracks are numbered after the CPU threads, which are unlikely to be this many.
+constexpr int FIRST_GPU_TRACK {1000000};
+// Timings are read, without waiting, once this many are pending.
+constexpr size_t PENDING_GPU_LIMIT {4096};
+
+/*
+    One complete event ("ph": "X") of the trace, or the value of a counter ("ph": "C") when
+    `dur_ns` is negative.
+*/
+struct TraceEvent {
+    const char *name;
+    int64_t start_ns;
+    int64_t dur_ns;
+    size_t bytes;
+    size_t samples;
+    int track;
+};
+
+
+#ifdef __GPU__
+struct PendingGpuTiming {
+    const char *name;
+    int device;
+    gpuStream_t stream;
+    gpuEvent_t start;
+    gpuEvent_t stop;
+    size_t bytes;
+    size_t samples;
+};
+
+
+/*
+    Event recorded on the default stream of a device once the device was idle, and the host
+    time at which that happened, to place GPU events on the host time line.
+*/
+struct GpuReference {
+    gpuEvent_t event;
+    int64_t host_ns;
+};
+#endif
+
+
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, StageStats> stages;
+    std::vector<TraceEvent> events;
+    size_t max_events {1 << 20};
+    size_t dropped {0};
+    #ifdef __GPU__
+    std::vector<PendingGpuTiming> pending;
+    std::map<int, GpuReference> references;
+    std::map<int, std::vector<gpuEvent_t>> free_events;
+    std::map<std::pair<int, gpuStream_t>, int> gpu_tracks;
+    #endif
+};
+
+
+Registry& registry(){
+    // Never destroyed, so that it can be used by destructors of static objects and at exit.
+    static Registry *r {new Registry {}};
+    return *r;
+}
+
+
+
+int thread_track(){
+    static std::atomic<int> next_track {1};
+    thread_local int track {next_track.fetch_add(1)};
+    return track;
+}
+
+
+
+void write_trace_at_exit(){
+    const char *filename {std::getenv(TRACE_FILE_ENV)};
+    if(!filename) return;
+    try {
+        write_chrome_trace(std::string {filename});
+    } catch (std::exception& ex) {
+        std::cerr << "Could not write the trace to '" << filename << "': " << ex.what() << std::endl;
+    }
+}
+
+
+
+/*
+    The exit handler is installed on the first measurement rather than when the library is
+    loaded: handlers run in reverse order, so it runs before the GPU runtime, initialised in
+    the meantime, is shut down.
+*/
+void install_exit_handler(){
+    static std::once_flag once;
+    std::call_once(once, []{
+        if(std::getenv(TRACE_FILE_ENV)) std::atexit(write_trace_at_exit);
+    });
+}
+
+
+
+// Called with the registry lock held.
+void add_measurement(Registry& r, const char *name, bool gpu, int64_t start_ns, int64_t dur_ns,
+        size_t bytes, size_t samples, int track){
+    auto it = r.stages.find(name);
+    if(it == r.stages.end()){
+        StageStats s;
+        s.name = name;
+        s.gpu = gpu;
+        s.min_seconds = s.max_seconds = dur_ns * 1e-9;
+        it = r.stages.emplace(s.name, s).first;
+    }
+    StageStats& s {it->second};
+    const double seconds {dur_ns * 1e-9};
+    s.calls++;
+    s.bytes += bytes;
+    s.samples += samples;
+    s.total_seconds += seconds;
+    s.min_seconds = std::min(s.min_seconds, seconds);
+    s.max_seconds = std::max(s.max_seconds, seconds);
+    if(r.events.size() < r.max_events) r.events.push_back({name, start_ns, dur_ns, bytes, samples, track});
+    else r.dropped++;
+}
+
+
+
+#ifdef __GPU__
+// Called with the registry lock held.
+gpuEvent_t acquire_event(Registry& r, int device){
+    std::vector<gpuEvent_t>& free_events {r.free_events[device]};
+    if(!free_events.empty()){
+        gpuEvent_t event {free_events.back()};
+        free_events.pop_back();
+        return event;
+    }
+    gpuEvent_t event;
+    gpuEventCreate(&event);
+    return event;
+}
+
+
+
+// Called with the registry lock held, on `device`.
+void ensure_reference(Registry& r, int device){
+    if(r.references.count(device)) return;
+    gpuEvent_t event;
+    gpuEventCreate(&event);
+    gpuEventRecord(event, 0);
+    gpuEventSynchronize(event);
+    r.references[device] = {event, detail::now_ns()};
+}
+
+
+
+/*
+    Read the elapsed times of the pending GPU timings and turn them into measurements. Unless
+    `wait` is true, only the timings whose work has completed are read.
+*/
+void resolve_gpu_timings(Registry& r, bool wait){
+    std::vector<PendingGpuTiming> pending;
+    std::map<int, GpuReference> references;
+    {
+        std::lock_guard<std::mutex> lock {r.mutex};
+        pending.swap(r.pending);
+        references = r.references;
+    }
+    if(pending.empty()) return;
+    std::vector<PendingGpuTiming> not_ready;
+    std::vector<std::pair<PendingGpuTiming, std::pair<int64_t, int64_t>>> resolved;
+    for(const PendingGpuTiming& t : pending){
+        GpuDeviceGuard guard {t.device};
+        if(wait){
+            gpuEventSynchronize(t.stop);
+        }else{
+            const gpuError_t status {gpuEventQuery(t.stop)};
+            if(status == gpuErrorNotReady){
+                not_ready.push_back(t);
+                continue;
+            }
+            GPU_CHECK_ERROR(status);
+        }
+        float offset_ms, duration_ms;
+        gpuEventElapsedTime(&offset_ms, references[t.device].event, t.start);
+        gpuEventElapsedTime(&duration_ms, t.start, t.stop);
+        const int64_t start_ns {references[t.device].host_ns + static_cast<int64_t>(offset_ms * 1e6)};
+        resolved.push_back({t, {start_ns, static_cast<int64_t>(duration_ms * 1e6)}});
+    }
+    std::lock_guard<std::mutex> lock {r.mutex};
+    r.pending.insert(r.pending.begin(), not_ready.begin(), not_ready.end());
+    for(const auto& item : resolved){
+        const PendingGpuTiming& t {item.first};
+        const auto key = std::make_pair(t.device, t.stream);
+        auto track = r.gpu_tracks.find(key);
+        if(track == r.gpu_tracks.end())
+            track = r.gpu_tracks.emplace(key, FIRST_GPU_TRACK + static_cast<int>(r.gpu_tracks.size())).first;
+        add_measurement(r, t.name, true, item.second.first, item.second.second, t.bytes, t.samples, track->second);
+        r.free_events[t.device].push_back(t.start);
+        r.free_events[t.device].push_back(t.stop);
+    }
+}
+#endif
+
+
+
+void write_json_string(std::ostream& out, const std::string& str){
+    out << '"';
+    for(char c : str){
+        if(c == '"' || c == '\\') out << '\\' << c;
+        else if(static_cast<unsigned char>(c) < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+
+
+struct Initialiser {
+    Initialiser(){
+        if(std::getenv(TRACE_FILE_ENV)) detail::enabled_flag.store(true);
+    }
+} initialiser;
+
+}
+
+
+
+namespace detail {
+
+int64_t now_ns(){
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+
+
+void record(const char *name, int64_t start_ns, int64_t end_ns, size_t bytes, size_t samples){
+    install_exit_handler();
+    const int track {thread_track()};
+    Registry& r {registry()};
+    std::lock_guard<std::mutex> lock {r.mutex};
+    add_measurement(r, name, false, start_ns, end_ns - start_ns, bytes, samples, track);
+}
+
+}
+
+
+
+void enable(bool on){
+    // Fix the time origin before recording starts.
+    detail::now_ns();
+    detail::enabled_flag.store(on);
+}
+
+
+
+void count(const char *name, size_t bytes, size_t samples){
+    if(!enabled()) return;
+    install_exit_handler();
+    const int64_t now {detail::now_ns()};
+    const int track {thread_track()};
+    Registry& r {registry()};
+    std::lock_guard<std::mutex> lock {r.mutex};
+    auto it = r.stages.find(name);
+    if(it == r.stages.end()){
+        StageStats s;
+        s.name = name;
+        it = r.stages.emplace(s.name, s).first;
+    }
+    it->second.bytes += bytes;
+    it->second.samples += samples;
+    if(r.events.size() < r.max_events) r.events.push_back({name, now, -1, it->second.bytes, it->second.samples, track});
+    else r.dropped++;
+}
+
+
+
+std::vector<StageStats> stats(){
+    Registry& r {registry()};
+    #ifdef __GPU__
+    resolve_gpu_timings(r, true);
+    #endif
+    std::lock_guard<std::mutex> lock {r.mutex};
+    std::vector<StageStats> result;
+    for(const auto& item : r.stages) result.push_back(item.second);
+    return result;
+}
+
+
+
+StageStats stats(const std::string& name){
+    Registry& r {registry()};
+    #ifdef __GPU__
+    resolve_gpu_timings(r, true);
+    #endif
+    std::lock_guard<std::mutex> lock {r.mutex};
+    auto it = r.stages.find(name);
+    if(it != r.stages.end()) return it->second;
+    StageStats s;
+    s.name = name;
+    return s;
+}
+
+
+
+void reset(){
+    Registry& r {registry()};
+    #ifdef __GPU__
+    resolve_gpu_timings(r, true);
+    #endif
+    std::lock_guard<std::mutex> lock {r.mutex};
+    r.stages.clear();
+    r.events.clear();
+    r.dropped = 0;
+}
+
+
+
+void set_max_trace_events(size_t n){
+    Registry& r {registry()};
+    std::lock_guard<std::mutex> lock {r.mutex};
+    r.max_events = n;
+}
+
+
+
+size_t dropped_trace_events(){
+    Registry& r {registry()};
+    std::lock_guard<std::mutex> lock {r.mutex};
+    return r.dropped;
+}
+
+
+
+void write_chrome_trace(std::ostream& out){
+    Registry& r {registry()};
+    #ifdef __GPU__
+    resolve_gpu_timings(r, true);
+    #endif
+    std::vector<TraceEvent> events;
+    std::map<int, std::string> track_names;
+    size_t dropped;
+    {
+        std::lock_guard<std::mutex> lock {r.mutex};
+        events = r.events;
+        dropped = r.dropped;
+        #ifdef __GPU__
+        for(const auto& item : r.gpu_tracks){
+            char name[64];
+            std::snprintf(name, sizeof(name), "GPU %d stream %p", item.first.first, static_cast<void*>(item.first.second));
+            track_names[item.second] = name;
+        }
+        #endif
+    }
+    const long pid {static_cast<long>(getpid())};
+    const auto flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":0,\"args\":{\"name\":\"blink_astroio\"}}";
+    for(const auto& item : track_names){
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << item.first << ",\"args\":{\"name\":";
+        write_json_string(out, item.second);
+        out << "}}";
+    }
+    for(const TraceEvent& e : events){
+        out << ",\n{\"name\":";
+        write_json_string(out, e.name);
+        if(e.dur_ns < 0){
+            out << ",\"ph\":\"C\",\"ts\":" << e.start_ns * 1e-3 << ",\"pid\":" << pid << ",\"tid\":" << e.track
+                << ",\"args\":{\"bytes\":" << e.bytes << ",\"samples\":" << e.samples << "}}";
+        }else{
+            out << ",\"cat\":\"" << (e.track >= FIRST_GPU_TRACK ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"ts\":" << e.start_ns * 1e-3
+                << ",\"dur\":" << e.dur_ns * 1e-3 << ",\"pid\":" << pid << ",\"tid\":" << e.track
+                << ",\"args\":{\"bytes\":" << e.bytes << ",\"samples\":" << e.samples << "}}";
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+    out.flags(flags);
+}
+
+
+
+void write_chrome_trace(const std::string& filename){
+    std::ofstream out {filename};
+    if(!out) throw std::runtime_error {"write_chrome_trace: cannot open '" + filename + "' for writing."};
+    write_chrome_trace(out);
+    if(!out) throw std::runtime_error {"write_chrome_trace: error while writing '" + filename + "'."};
+}
+
+
+
+#ifdef __GPU__
+GpuTimer::GpuTimer(const char *name, gpuStream_t stream, size_t bytes, size_t samples) :
+    name {name}, stream {stream}, bytes {bytes}, samples {samples} {
+    if(!enabled()) return;
+    install_exit_handler();
+    gpuGetDevice(&device);
+    Registry& r {registry()};
+    {
+        std::lock_guard<std::mutex> lock {r.mutex};
+        ensure_reference(r, device);
+        start = acquire_event(r, device);
+    }
+    gpuEventRecord(start, stream);
+}
+
+
+
+GpuTimer::~GpuTimer(){
+    if(device < 0) return;
+    try {
+        GpuDeviceGuard guard {device};
+        Registry& r {registry()};
+        bool resolve {false};
+        {
+            std::lock_guard<std::mutex> lock {r.mutex};
+            gpuEvent_t stop {acquire_event(r, device)};
+            gpuEventRecord(stop, stream);
+            r.pending.push_back({name, device, stream, start, stop, bytes, samples});
+            resolve = r.pending.size() >= PENDING_GPU_LIMIT;
+        }
+        if(resolve) resolve_gpu_timings(r, false);
+    } catch (...) {}
+}
+#endif
+
+}
@@ -0,0 +1,194 @@
+#ifndef __INSTRUMENTATION_H__
+#define __INSTRUMENTATION_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "gpu_macros.hpp"
+
+/**
+ * Timers and counters around the I/O and transform stages of the library (file loaders, FITS
+ * reads and writes, transfers between CPU and GPU, layout conversions).
+ *
+ * Instrumentation is compiled in when `ASTROIO_INSTRUMENTATION` is defined (CMake option
+ * `ENABLE_INSTRUMENTATION`, on by default) and is off at runtime until `enable()` is called, or
+ * the `BLINK_ASTROIO_TRACE` environment variable is set to the path of the Chrome trace to write
+ * when the process exits. While off, a timed scope costs a relaxed atomic load.
+ *
+ * Only stages are timed, not samples: a stage such as the expansion of one chunk of a .dat file
+ * lasts milliseconds, so the cost of taking a timestamp and a lock is negligible.
+ */
+namespace instrumentation {
+
+/**
+ * @brief Aggregate measurements of one named stage.
+ */
+struct StageStats {
+    std::string name;
+    // True if the stage was timed on GPU, with events recorded on a stream.
+    bool gpu {false};
+    size_t calls {0};
+    size_t bytes {0};
+    size_t samples {0};
+    double total_seconds {0.0};
+    double min_seconds {0.0};
+    double max_seconds {0.0};
+
+    double mean_seconds() const { return calls > 0 ? total_seconds / calls : 0.0; }
+    // Bytes processed per second of stage time.
+    double bandwidth() const { return total_seconds > 0.0 ? bytes / total_seconds : 0.0; }
+};
+
+
+/**
+ * @brief Turn recording on or off, for all threads.
+ */
+void enable(bool on = true);
+
+namespace detail {
+extern std::atomic<bool> enabled_flag;
+
+// Nanoseconds since the first measurement of the process, on a steady clock.
+int64_t now_ns();
+
+void record(const char *name, int64_t start_ns, int64_t end_ns, size_t bytes, size_t samples);
+}
+
+inline bool enabled() { return detail::enabled_flag.load(std::memory_order_relaxed); }
+
+/**
+ * @brief Add `bytes` and `samples` to the counters of stage `name`, without timing anything.
+ */
+void count(const char *name, size_t bytes, size_t samples = 0);
+
+/**
+ * @return the measurements of all the stages recorded since the last `reset()`, sorted by name.
+ * Waits for pending GPU timings to complete.
+ */
+std::vector<StageStats> stats();
+
+/**
+ * @return the measurements of stage `name`; `calls` is 0 if it was never recorded.
+ */
+StageStats stats(const std::string& name);
+
+/**
+ * @brief Discard all the measurements and trace events recorded so far.
+ */
+void reset();
+
+/**
+ * @brief Set the maximum number of trace events kept in memory (1M by default). Beyond it, new
+ * events are dropped from the trace, but still accounted in `stats()`.
+ */
+void set_max_trace_events(size_t n);
+
+/**
+ * @return the number of trace events dropped because the limit was reached.
+ */
+size_t dropped_trace_events();
+
+/**
+ * @brief Write the recorded events in the Chrome trace event format (JSON), which can be opened
+ * with Perfetto (ui.perfetto.dev) or chrome://tracing. CPU stages are shown on one track per
+ * thread, GPU stages on one track per device and stream. Can be called while recording.
+ */
+void write_chrome_trace(std::ostream& out);
+
+/**
+ * @throw std::runtime_error if `filename` cannot be written.
+ */
+void write_chrome_trace(const std::string& filename);
+
+
+/**
+ * @brief Time the scope the object lives in as one call of stage `name`, which must be a string
+ * literal or outlive the measurements.
+ */
+class ScopedTimer {
+    const char *name;
+    size_t bytes;
+    size_t samples;
+    int64_t start_ns {-1};
+
+    public:
+    explicit ScopedTimer(const char *name, size_t bytes = 0, size_t samples = 0) :
+        name {name}, bytes {bytes}, samples {samples} {
+        if(enabled()) start_ns = detail::now_ns();
+    }
+
+    ~ScopedTimer(){
+        if(start_ns >= 0) detail::record(name, start_ns, detail::now_ns(), bytes, samples);
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    // Account data whose size is only known once the stage is running.
+    void add(size_t more_bytes, size_t more_samples = 0){
+        bytes += more_bytes;
+        samples += more_samples;
+    }
+};
+
+
+#ifdef __GPU__
+/**
+ * @brief Time the work queued on `stream` while the object lives, with a pair of GPU events.
+ * Does not synchronise: the elapsed time is read when the measurements are queried or exported,
+ * or when many timings are pending. Events are recorded on the current device.
+ */
+class GpuTimer {
+    const char *name;
+    gpuStream_t stream;
+    size_t bytes;
+    size_t samples;
+    int device {-1};
+    gpuEvent_t start;
+
+    public:
+    GpuTimer(const char *name, gpuStream_t stream = 0, size_t bytes = 0, size_t samples = 0);
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    void add(size_t more_bytes, size_t more_samples = 0){
+        bytes += more_bytes;
+        samples += more_samples;
+    }
+};
+#endif
+
+}
+
+
+#define ASTROIO_CONCAT_(A, B) A##B
+#define ASTROIO_CONCAT(A, B) ASTROIO_CONCAT_(A, B)
+
+#ifdef ASTROIO_INSTRUMENTATION
+// Time the rest of the enclosing scope: ASTROIO_TIMED_SCOPE(name[, bytes[, samples]]).
+#define ASTROIO_TIMED_SCOPE(...) instrumentation::ScopedTimer ASTROIO_CONCAT(_astroio_timer_, __LINE__) {__VA_ARGS__}
+// As above, with a timer called `VAR` whose counters can be increased with ASTROIO_TIMER_ADD.
+#define ASTROIO_NAMED_TIMER(VAR, ...) instrumentation::ScopedTimer VAR {__VA_ARGS__}
+#define ASTROIO_TIMER_ADD(VAR, ...) VAR.add(__VA_ARGS__)
+#define ASTROIO_COUNT(...) instrumentation::count(__VA_ARGS__)
+#ifdef __GPU__
+// Time the work queued on a stream: ASTROIO_GPU_TIMED_SCOPE(name, stream[, bytes[, samples]]).
+#define ASTROIO_GPU_TIMED_SCOPE(...) instrumentation::GpuTimer ASTROIO_CONCAT(_astroio_gpu_timer_, __LINE__) {__VA_ARGS__}
+#endif
+#else
+#define ASTROIO_TIMED_SCOPE(...)
+#define ASTROIO_NAMED_TIMER(VAR, ...)
+#define ASTROIO_TIMER_ADD(VAR, ...)
+#define ASTROIO_COUNT(...)
+#ifdef __GPU__
+#define ASTROIO_GPU_TIMED_SCOPE(...)
+#endif
+#endif
+
+#endif
@@ -0,0 +1,145 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "mapped_file.hpp"
+#include "gpu_macros.hpp"
+
+
+MappedFile::MappedFile(const std::string& filename, bool register_with_gpu){
+    #ifndef __GPU__
+    if(register_with_gpu)
+        throw std::invalid_argument {"MappedFile: cannot register memory with the GPU on a CPU only build of the software."};
+    #endif
+    int fd {open(filename.c_str(), O_RDONLY)};
+    if(fd < 0) throw std::runtime_error {"MappedFile: error while opening " + filename + ": " + std::strerror(errno)};
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0){
+        close(fd);
+        throw std::runtime_error {"MappedFile: error while reading the size of " + filename + ": " + std::strerror(errno)};
+    }
+    _size = static_cast<size_t>(file_stat.st_size);
+    if(_size > 0){
+        void *ptr {mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0)};
+        if(ptr == MAP_FAILED){
+            close(fd);
+            throw std::runtime_error {"MappedFile: error while mapping " + filename + ": " + std::strerror(errno)};
+        }
+        _data = static_cast<char*>(ptr);
+        // These are only hints, failures are not an error.
+        madvise(_data, _size, MADV_SEQUENTIAL);
+        #ifdef MADV_HUGEPAGE
+        madvise(_data, _size, MADV_HUGEPAGE);
+        #endif
+    }
+    // The mapping stays valid after the file descriptor is closed.
+    close(fd);
+    #ifdef __GPU__
+    if(register_with_gpu && _data){
+        try {
+            gpuHostRegister(_data, _size, gpuHostRegisterReadOnly);
+        } catch (...) {
+            release();
+            throw;
+        }
+        registered = true;
+    }
+    #endif
+}
+
+
+
+void MappedFile::release(){
+    #ifdef __GPU__
+    if(registered) gpuHostUnregister(_data);
+    #endif
+    if(_data) munmap(_data, _size);
+    _data = nullptr;
+    _size = 0;
+    registered = false;
+}
+
+
+
+MappedFile::~MappedFile(){
+    release();
+}
+
+
+
+MappedFile::MappedFile(MappedFile&& other) : _data {other._data}, _size {other._size}, registered {other.registered} {
+    other._data = nullptr;
+    other._size = 0;
+    other.registered = false;
+}
+
+
+
+MappedFile& MappedFile::operator=(MappedFile&& other){
+    if(this == &other) return *this;
+    release();
+    _data = other._data;
+    _size = other._size;
+    registered = other.registered;
+    other._data = nullptr;
+    other._size = 0;
+    other.registered = false;
+    return *this;
+}
+
+
+
+void* FileMappingAllocator::allocate(size_t, MemoryType){
+    throw std::logic_error {"FileMappingAllocator::allocate: arrays can only be obtained by mapping a file."};
+}
+
+
+
+void FileMappingAllocator::deallocate(void *ptr, size_t, MemoryType){
+    std::pair<void*, size_t> mapping;
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        auto it = mappings.find(ptr);
+        if(it == mappings.end()) return;
+        mapping = it->second;
+        mappings.erase(it);
+    }
+    munmap(mapping.first, mapping.second);
+}
+
+
+
+void* FileMappingAllocator::map(const std::string& filename, size_t offset, size_t bytes){
+    if(bytes == 0) throw std::invalid_argument {"FileMappingAllocator::map: cannot map an empty range."};
+    int fd {open(filename.c_str(), O_RDONLY)};
+    if(fd < 0) throw std::runtime_error {"FileMappingAllocator: error while opening " + filename + ": " + std::strerror(errno)};
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < offset + bytes){
+        close(fd);
+        throw std::runtime_error {"FileMappingAllocator: " + filename + " is shorter than the mapped range."};
+    }
+    // Mappings must start at a page boundary.
+    const size_t page_size {static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+    const size_t first_page {offset / page_size * page_size};
+    const size_t length {offset - first_page + bytes};
+    // Writable, but private: pages are copied when first written.
+    void *ptr {mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, static_cast<off_t>(first_page))};
+    close(fd);
+    if(ptr == MAP_FAILED)
+        throw std::runtime_error {"FileMappingAllocator: error while mapping " + filename + ": " + std::strerror(errno)};
+    void *array {static_cast<char*>(ptr) + (offset - first_page)};
+    std::lock_guard<std::mutex> lock {mutex};
+    mappings[array] = {ptr, length};
+    return array;
+}
+
+
+
+FileMappingAllocator& file_mapping_allocator(){
+    // Never destroyed, as buffers mapping files may outlive static objects.
+    static FileMappingAllocator *allocator {new FileMappingAllocator {}};
+    return *allocator;
+}
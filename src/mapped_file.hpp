@@ -0,0 +1,96 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <string>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include "memory_pool.hpp"
+
+/**
+ * @brief A read-only, memory mapped view of a file.
+ *
+ * The content of the file is accessed straight from the page cache, without copying it into
+ * a user space buffer. The kernel is told that the mapping will be read sequentially, so
+ * that it can read ahead aggressively, and, where supported, that it can be backed by huge pages.
+ *
+ * On GPU enabled builds, the mapping can also be registered as page-locked host memory, so
+ * that it can be used as the source of (asynchronous) host to device copies without a staging
+ * copy into a pinned buffer.
+ */
+class MappedFile {
+
+    private:
+    char *_data {nullptr};
+    size_t _size {0};
+    bool registered {false};
+
+    void release();
+
+    public:
+    /**
+     * @brief Map a file in memory.
+     *
+     * @param filename path to the file.
+     * @param register_with_gpu if `true`, the mapping is registered as pinned memory with the GPU
+     * runtime. Throws an exception on CPU-only builds.
+     */
+    explicit MappedFile(const std::string& filename, bool register_with_gpu = false);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+
+    /**
+     * @return pointer to the first byte of the file, or `nullptr` if the file is empty.
+     */
+    const char* data() const { return _data; }
+
+    /**
+     * @return size of the file in bytes.
+     */
+    size_t size() const { return _size; }
+
+    /**
+     * @return `true` if the mapping is registered as pinned memory with the GPU runtime.
+     */
+    bool gpu_registered() const { return registered; }
+};
+
+
+/**
+ * @brief Allocator of `MemoryBuffer` arrays that are private, copy on write mappings of files:
+ * the data is read from the page cache when first accessed, and changes made through the buffer
+ * are never written back. Releasing an array unmaps it.
+ *
+ * Arrays can only be obtained with `map`; `allocate` throws `std::logic_error`.
+ */
+class FileMappingAllocator : public MemoryAllocator {
+    // Mapping each array belongs to: first page and length.
+    std::map<void*, std::pair<void*, size_t>> mappings;
+    std::mutex mutex;
+
+    public:
+    void* allocate(size_t bytes, MemoryType type) override;
+    void deallocate(void *ptr, size_t bytes, MemoryType type) override;
+
+    /**
+     * @brief Map `bytes` bytes of `filename` starting from byte `offset`, which need not be a
+     * multiple of the page size.
+     *
+     * @throw std::runtime_error if the file cannot be mapped or is shorter than `offset + bytes`.
+     */
+    void* map(const std::string& filename, size_t offset, size_t bytes);
+};
+
+
+/**
+ * @return the process wide allocator of file mappings.
+ */
+FileMappingAllocator& file_mapping_allocator();
+
+#endif
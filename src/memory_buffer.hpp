@@ -2,16 +2,20 @@
 #define __MEMORY_BUFFER_H__
 
 #include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
 #include "gpu_macros.hpp"
+#include "memory_pool.hpp"
+#include "mapped_file.hpp"
+#include "array_view.hpp"
+#include "instrumentation.hpp"
 #include <iostream>
 
-enum class MemoryType {
-    PAGEABLE, // memory allocated with malloc or new[]
-    PINNED, // memory allocated with gpuHostAlloc
-    DEVICE, // GPU memory
-    MANAGED // Host memory accessible by GPUs
-};
-
 template <typename T>
 class MemoryBuffer {
 
@@ -19,6 +23,119 @@ class MemoryBuffer {
     T* _data = nullptr;
     size_t n {0};
     MemoryType mem_type;
+    // GPU holding the array, for device and managed memory.
+    int device {0};
+    // Allocator `_data` was obtained from, or null if the array was handed over to the constructor.
+    MemoryAllocator *allocator {nullptr};
+    // Array left behind by the last asynchronous transfer, kept to be reused by the next one.
+    T* _mirror = nullptr;
+    MemoryType mirror_type {MemoryType::PAGEABLE};
+    MemoryAllocator *mirror_allocator {nullptr};
+    int mirror_device {0};
+
+    // The GPU arrays of `allocate_array` are allocated on.
+    static int current_device(){
+        int dev {0};
+        #ifdef __GPU__
+        gpuGetDevice(&dev);
+        #endif
+        return dev;
+    }
+
+    // Allocate `n_elements` of memory type `type` from the default allocator, by default a pool
+    // recycling the arrays of released buffers. Pageable elements are default initialised, as
+    // with `new T[]`.
+    static T* allocate_array(size_t n_elements, MemoryType type, MemoryAllocator *&allocator){
+        allocator = &default_allocator();
+        T *ptr {static_cast<T*>(allocator->allocate(sizeof(T) * n_elements, type))};
+        if(type == MemoryType::PAGEABLE) std::uninitialized_default_construct_n(ptr, n_elements);
+        return ptr;
+    }
+
+    // Release an array obtained with `allocate_array`, or handed over to the constructor.
+    static void free_array(T *ptr, size_t n_elements, MemoryType type, MemoryAllocator *allocator){
+        if(!ptr) return;
+        if(!allocator){
+            if(type == MemoryType::PAGEABLE) delete[] ptr;
+            #ifdef __GPU__
+            if(type == MemoryType::PINNED) gpuHostFree(ptr);
+            if(type == MemoryType::DEVICE || type == MemoryType::MANAGED) gpuFree(ptr);
+            #endif
+            return;
+        }
+        if(type == MemoryType::PAGEABLE) std::destroy_n(ptr, n_elements);
+        allocator->deallocate(ptr, sizeof(T) * n_elements, type);
+    }
+
+    // Replace the content of this buffer with a copy of `other`.
+    void copy_from(const MemoryBuffer& other){
+        n = other.n;
+        mem_type = other.mem_type;
+        _data = nullptr;
+        allocator = nullptr;
+        _mirror = nullptr;
+        device = other.device;
+        if(!other._data) return;
+        #ifdef __GPU__
+        // The copy lives on the same GPU as the original.
+        GpuDeviceGuard guard {mem_type == MemoryType::PAGEABLE || mem_type == MemoryType::PINNED ? current_device() : device};
+        #endif
+        _data = allocate_array(n, mem_type, allocator);
+        #ifdef __GPU__
+        if(mem_type == MemoryType::DEVICE){
+            gpuMemcpy(_data, other._data, n * sizeof(T), gpuMemcpyDeviceToDevice);
+            return;
+        }
+        #endif
+        memcpy(_data, other._data, n * sizeof(T));
+    }
+
+    #ifdef __GPU__
+    // Copy the data to an array of type `dest_type`, on the other side of the PCIe bus, and make
+    // it the data of the buffer. The mirror is used as destination when it has the right type
+    // and, for device memory, resides on the current GPU. If `keep_source` is true the source
+    // array becomes the new mirror, otherwise it is released.
+    void transfer(MemoryType dest_type, gpuStream_t stream, bool async, bool keep_source){
+        T *dest;
+        MemoryAllocator *dest_allocator;
+        const int dest_device {dest_type == MemoryType::DEVICE ? current_device() : device};
+        if(_mirror && mirror_type == dest_type && (dest_type != MemoryType::DEVICE || mirror_device == dest_device)){
+            dest = _mirror;
+            dest_allocator = mirror_allocator;
+            _mirror = nullptr;
+        }else{
+            release_mirror();
+            dest = allocate_array(n, dest_type, dest_allocator);
+        }
+        const auto kind = dest_type == MemoryType::DEVICE ? gpuMemcpyHostToDevice : gpuMemcpyDeviceToHost;
+        if(async){
+            ASTROIO_GPU_TIMED_SCOPE(dest_type == MemoryType::DEVICE ? "memory_buffer_to_gpu_async" : "memory_buffer_to_cpu_async",
+                stream, sizeof(T) * n);
+            gpuMemcpyAsync(dest, _data, sizeof(T) * n, kind, stream);
+        }else{
+            ASTROIO_TIMED_SCOPE(dest_type == MemoryType::DEVICE ? "memory_buffer_to_gpu" : "memory_buffer_to_cpu", sizeof(T) * n);
+            gpuMemcpy(dest, _data, sizeof(T) * n, kind);
+        }
+        if(keep_source){
+            _mirror = _data;
+            mirror_type = mem_type;
+            mirror_allocator = allocator;
+            mirror_device = device;
+        }else{
+            free_array(_data, n, mem_type, allocator);
+        }
+        _data = dest;
+        allocator = dest_allocator;
+        mem_type = dest_type;
+        device = dest_device;
+    }
+
+    // Clamp the range of elements [first, first + count) to the buffer.
+    size_t range_bytes(size_t first, size_t count) const {
+        if(first >= n) return 0;
+        return sizeof(T) * std::min(count, n - first);
+    }
+    #endif
 
     public:
     /**
@@ -55,6 +172,7 @@ class MemoryBuffer {
         this->_data = buffer;
         this->n = n_elements;
         this->mem_type = mem_type;
+        this->device = current_device();
     }
 
     /**
@@ -74,7 +192,6 @@ class MemoryBuffer {
      * 
     */
     void allocate(size_t n_elements, MemoryType mem_type = MemoryType::PAGEABLE){
-        if(_data) this->~MemoryBuffer();
         #ifndef __GPU__
         if(mem_type != MemoryType::PAGEABLE)
             throw std::invalid_argument { "MemoryBuffer constructor: cannot use anything other than pageable memory "
@@ -82,20 +199,14 @@ class MemoryBuffer {
         #endif
         if(n_elements == 0) throw std::invalid_argument {"MemoryBuffer::allocate: `n_elements` "
         "must be a positive number."};
-        #ifdef __GPU__
-        if(mem_type == MemoryType::PINNED) {
-            gpuHostAlloc(&this->_data, sizeof(T) * n_elements);
-        }else if(mem_type == MemoryType::DEVICE){
-            gpuMalloc(&this->_data, sizeof(T) * n_elements);
-        }else if(mem_type == MemoryType::MANAGED){
-            gpuMallocManaged(&this->_data, sizeof(T) * n_elements);
-        }
-        #endif
-        if(mem_type == MemoryType::PAGEABLE){
-            this->_data = new T[n_elements];
-        }
+        // The previous arrays are released first, so that the pool can hand them out again.
+        release_mirror();
+        free_array(_data, n, this->mem_type, allocator);
+        this->_data = nullptr;
+        this->_data = allocate_array(n_elements, mem_type, allocator);
         this->n = n_elements;
         this->mem_type = mem_type;
+        this->device = current_device();
     }
 
     /**
@@ -104,18 +215,11 @@ class MemoryBuffer {
     void to_cpu(MemoryType to_type = MemoryType::PAGEABLE) {
         #ifdef __GPU__
         if(mem_type == MemoryType::DEVICE && _data){
-            T* tmp;
-            if(to_type == MemoryType::PINNED) {
-                gpuHostAlloc(&tmp, sizeof(T) * n);
-                mem_type =  MemoryType::PINNED;
-            } else {
-                tmp = new T[n];
-                mem_type = MemoryType::PAGEABLE;
-            }
-            gpuMemcpy(tmp, _data, sizeof(T) * n, gpuMemcpyDeviceToHost);
-            gpuFree(_data);
-            _data = tmp;
+            const MemoryType host_type {to_type == MemoryType::PINNED ? MemoryType::PINNED : MemoryType::PAGEABLE};
+            transfer(host_type, 0, false, false);
         }
+        #else
+        (void) to_type;
         #endif
     }
 
@@ -125,46 +229,212 @@ class MemoryBuffer {
     void to_gpu(){
         #ifdef __GPU__
         if(mem_type != MemoryType::DEVICE && _data){
-            T* tmp;
-            gpuMalloc(&tmp, sizeof(T) * n);
-            gpuMemcpy(tmp, _data, sizeof(T) * n, gpuMemcpyHostToDevice);
-            if(mem_type == MemoryType::PINNED) gpuHostFree(_data);
-            else if(mem_type == MemoryType::MANAGED) gpuFree(_data);
-            else delete[] _data;
-            _data = tmp;
-            mem_type = MemoryType::DEVICE;
+            transfer(MemoryType::DEVICE, 0, false, false);
         }
         #endif
     }
 
+    /**
+     * @brief Move data to GPU `device_id`, allocating on it.
+     *
+     * Host data is copied over PCIe. Device data residing on another GPU is copied device to
+     * device, directly when peer access is supported (see `enable_peer_access`). Managed memory
+     * is not copied: the pages are migrated to `device_id` and kept there with a preferred
+     * location hint, so that they stay on that GPU when accessed by others.
+     *
+     * The current device of the calling thread is not changed.
+     */
+    void to_gpu(int device_id){
+        #ifdef __GPU__
+        if(device_id < 0 || device_id >= num_available_gpus())
+            throw std::invalid_argument {"MemoryBuffer::to_gpu: invalid device identifier " + std::to_string(device_id) + "."};
+        if(!_data) return;
+        if(mem_type == MemoryType::MANAGED){
+            set_preferred_location(device_id);
+            GpuDeviceGuard guard {device_id};
+            prefetch(device_id);
+            return;
+        }
+        if(mem_type == MemoryType::DEVICE){
+            if(device == device_id) return;
+            enable_peer_access(device_id, device);
+            GpuDeviceGuard guard {device_id};
+            MemoryAllocator *dest_allocator;
+            T *dest {allocate_array(n, MemoryType::DEVICE, dest_allocator)};
+            {
+                ASTROIO_TIMED_SCOPE("memory_buffer_peer_copy", sizeof(T) * n);
+                gpuMemcpyPeer(dest, device_id, _data, device, sizeof(T) * n);
+            }
+            free_array(_data, n, mem_type, allocator);
+            _data = dest;
+            allocator = dest_allocator;
+            device = device_id;
+            return;
+        }
+        GpuDeviceGuard guard {device_id};
+        to_gpu();
+        #else
+        throw std::invalid_argument {"MemoryBuffer::to_gpu: cannot move data to GPU " + std::to_string(device_id) +
+            " on a CPU only build of the software."};
+        #endif
+    }
 
+    #ifdef __GPU__
     /**
-     * @brief Dump contents to a binary file.
+     * @brief Migrate the pages of managed memory holding elements [first, first + count) to GPU
+     * `device_id`, or to host memory if it is `gpuCpuDeviceId`, ahead of their use by work queued
+     * on `stream`. Has no effect on other memory types.
      */
-    void dump(std::string filename) {
-        this->to_cpu();
-        std::ofstream outfile;
-        outfile.open(filename, std::ofstream::binary);
-        outfile.write(reinterpret_cast<char*>(_data), n * sizeof(T));
-        if(!outfile){
-            throw std::runtime_error {"MemoryBuffer: error while dumping data to binary file."};
+    void prefetch(int device_id, gpuStream_t stream = 0, size_t first = 0,
+            size_t count = std::numeric_limits<size_t>::max()){
+        if(mem_type != MemoryType::MANAGED || !_data) return;
+        const size_t bytes {range_bytes(first, count)};
+        if(bytes > 0) gpuMemPrefetchAsync(_data + first, bytes, device_id, stream);
+    }
+
+    /**
+     * @brief Hint the driver to keep the pages of managed memory holding elements
+     * [first, first + count) on GPU `device_id`: other devices map them instead of migrating
+     * them. Has no effect on other memory types. The device of the buffer becomes `device_id`
+     * when the hint covers the whole buffer.
+     */
+    void set_preferred_location(int device_id, size_t first = 0, size_t count = std::numeric_limits<size_t>::max()){
+        if(mem_type != MemoryType::MANAGED || !_data) return;
+        const size_t bytes {range_bytes(first, count)};
+        if(bytes == 0) return;
+        gpuMemAdvise(_data + first, bytes, gpuMemAdviseSetPreferredLocation, device_id);
+        if(first == 0 && bytes == sizeof(T) * n) device = device_id;
+    }
+
+    /**
+     * @brief Queue the transfer of data to GPU on `stream` and return straight away, so that the copy
+     * overlaps with work on other streams or on the CPU.
+     *
+     * The host array is not released: it becomes the mirror of the buffer, and `to_cpu_async` copies
+     * the data back into it instead of allocating a new array. It must not be written until the
+     * transfer completes. If the buffer is already on GPU, only `event` is recorded.
+     *
+     * Only transfers from pinned memory are truly asynchronous. Pageable memory is staged by the
+     * driver before the call returns.
+     *
+     * @param stream stream the copy is queued on. Work queued afterwards on `stream` can use `data()`.
+     * @param event if not null, event recorded on `stream` after the copy, to synchronise with it.
+     */
+    void to_gpu_async(gpuStream_t stream, gpuEvent_t event = nullptr){
+        if(mem_type != MemoryType::DEVICE && _data) transfer(MemoryType::DEVICE, stream, true, true);
+        if(event) gpuEventRecord(event, stream);
+    }
+
+    /**
+     * @brief Queue the transfer of data to CPU on `stream` and return straight away. The data can be
+     * read on the host once `stream`, or `event`, is synchronised.
+     *
+     * The device array becomes the mirror of the buffer and is reused by the next `to_gpu_async`.
+     * The destination is the mirror left by the previous `to_gpu_async`, if it has type `to_type`.
+     *
+     * @param stream stream the copy is queued on, after the work producing the data.
+     * @param to_type type of host memory to copy to. The copy is asynchronous only for pinned memory.
+     * @param event if not null, event recorded on `stream` after the copy.
+     */
+    void to_cpu_async(gpuStream_t stream, MemoryType to_type = MemoryType::PINNED, gpuEvent_t event = nullptr){
+        if(mem_type == MemoryType::DEVICE && _data){
+            const MemoryType host_type {to_type == MemoryType::PINNED ? MemoryType::PINNED : MemoryType::PAGEABLE};
+            transfer(host_type, stream, true, true);
+        }
+        if(event) gpuEventRecord(event, stream);
+    }
+    #endif
+
+    /**
+     * @return `true` if the array on the other side of the last asynchronous transfer is still
+     * allocated.
+     */
+    bool mirrored() const {return _mirror != nullptr;}
+
+    /**
+     * @return the array the data was copied from by the last asynchronous transfer (e.g. the host
+     * copy after `to_gpu_async`), or null. It holds the data as it was at the time of the transfer.
+     */
+    T* mirror() {return _mirror;}
+    const T* mirror() const {return _mirror;}
+
+    /**
+     * @brief Free the mirror array, e.g. when the buffer stays on one side from now on. Transfers
+     * using it must have completed.
+     */
+    void release_mirror(){
+        free_array(_mirror, n, mirror_type, mirror_allocator);
+        _mirror = nullptr;
+    }
+
+
+    /**
+     * @brief Dump contents to a binary file, as raw bytes without any metadata (see
+     * `checkpoint.hpp` for a self-describing format). Data on GPU stays there: it is copied
+     * out a chunk at a time.
+     *
+     * The file is written under a temporary name and renamed when complete, so that buffers
+     * mapping the previous version of the file (see `from_dump`) are not affected.
+     */
+    void dump(const std::string& filename) const {
+        const std::string tmp_filename {filename + ".tmp"};
+        std::ofstream outfile {tmp_filename, std::ofstream::binary};
+        #ifdef __GPU__
+        if(mem_type == MemoryType::DEVICE && _data){
+            GpuDeviceGuard guard {device};
+            const size_t total_bytes {n * sizeof(T)};
+            const size_t chunk_bytes {std::min<size_t>(total_bytes, 64ul << 20)};
+            MemoryBuffer<char> staging {chunk_bytes, MemoryType::PINNED};
+            for(size_t offset {0}; offset < total_bytes && outfile; offset += chunk_bytes){
+                const size_t bytes {std::min(chunk_bytes, total_bytes - offset)};
+                gpuMemcpy(staging.data(), reinterpret_cast<const char*>(_data) + offset, bytes, gpuMemcpyDeviceToHost);
+                outfile.write(staging.data(), bytes);
+            }
+        }else
+        #endif
+        if(_data){
+            outfile.write(reinterpret_cast<const char*>(_data), n * sizeof(T));
         }
         outfile.close();
+        if(!outfile || std::rename(tmp_filename.c_str(), filename.c_str()) != 0){
+            std::remove(tmp_filename.c_str());
+            throw std::runtime_error {"MemoryBuffer: error while dumping data to binary file."};
+        }
+    }
+
+    /**
+     * @brief Load data from a binary file written by `dump`. The file is mapped in memory rather
+     * than read: see `from_mapped_file`.
+     */
+    static MemoryBuffer<T> from_dump(const std::string& filename) {
+        std::ifstream infile {filename, std::ifstream::binary | std::ifstream::ate};
+        if(!infile) throw std::runtime_error {"MemoryBuffer::from_dump: cannot open " + filename + "."};
+        const size_t size {static_cast<size_t>(infile.tellg())};
+        if(size == 0 || size % sizeof(T) != 0)
+            throw std::runtime_error {"MemoryBuffer::from_dump: the size of " + filename + " is not a positive multiple of the element size."};
+        return from_mapped_file(filename, 0, size / sizeof(T));
     }
 
     /**
-     * @brief load data from binary file and instantiate a new class of MemoryBuffer.
+     * @brief Create a buffer of `n_elements` elements whose array is a private mapping of
+     * `filename`, starting from byte `offset`: nothing is read until the data is accessed, and
+     * pages are then served from the page cache. Writing to the buffer does not modify the file.
+     *
+     * The file must not be truncated while the buffer is alive. Replacing it with a new file
+     * (e.g. by renaming) is safe.
      */
-    static MemoryBuffer<T> from_dump(std::string filename) {
-        std::ifstream infile (filename, std::ifstream::binary);
-        // get size of file
-        infile.seekg(0, infile.end);
-        size_t size = infile.tellg();
-        infile.seekg(0);
-        char* buffer = new char[size];
-        infile.read (buffer, size);
-        infile.close();
-        return MemoryBuffer<T> {reinterpret_cast<T*>(buffer), size / sizeof(T), MemoryType::PAGEABLE};
+    static MemoryBuffer<T> from_mapped_file(const std::string& filename, size_t offset, size_t n_elements) {
+        if(offset % alignof(T) != 0)
+            throw std::invalid_argument {"MemoryBuffer::from_mapped_file: `offset` is not aligned for the element type."};
+        if(n_elements == 0) throw std::invalid_argument {"MemoryBuffer::from_mapped_file: `n_elements` must be a positive number."};
+        MemoryBuffer<T> buffer;
+        FileMappingAllocator& mapping_allocator {file_mapping_allocator()};
+        buffer._data = static_cast<T*>(mapping_allocator.map(filename, offset, n_elements * sizeof(T)));
+        buffer.n = n_elements;
+        buffer.mem_type = MemoryType::PAGEABLE;
+        buffer.allocator = &mapping_allocator;
+        buffer.device = current_device();
+        return buffer;
     }
 
     /**
@@ -178,6 +448,12 @@ class MemoryBuffer {
 	__host__ __device__
 	#endif
     const T* data() const {return _data;}
+    /**
+     * @return a one dimensional view of the whole buffer.
+    */
+    ArrayView<T, 1> view() {return {_data, {n}, on_gpu()};}
+    ArrayView<const T, 1> view() const {return {_data, {n}, on_gpu()};}
+
     /**
      * @return `true` if memory resides on GPU, `false` otherwise.
     */
@@ -187,69 +463,57 @@ class MemoryBuffer {
      * @return `true` if memory has been allocated as pinned, `false` otherwise.
     */
     bool pinned() const {return mem_type == MemoryType::PINNED;}
+
+    /**
+     * @return the type of memory holding the data.
+    */
+    MemoryType memory_type() const {return mem_type;}
+
+    /**
+     * @return the GPU holding the data, for device and managed memory (the preferred location of
+     * managed memory set by `to_gpu(int)`, or the GPU that allocated it).
+    */
+    int device_id() const {return device;}
     /**
      * @brief return the number of elements in the buffer.
     */
     size_t size() const {return n;};
 
     MemoryBuffer(const MemoryBuffer& other){
-        n = other.n;
-        mem_type = other.mem_type;
-        _data = nullptr;
-        if(mem_type == MemoryType::PAGEABLE && other._data){
-            _data = new T[n];
-            memcpy(_data, other._data, n * sizeof(T));
-        }
-        #ifdef __GPU__
-        if(mem_type == MemoryType::PINNED && other._data){
-            gpuHostAlloc(&_data, n * sizeof(T));
-            memcpy(_data, other._data, n * sizeof(T));
-        }else if(mem_type == MemoryType::DEVICE && other._data){
-            gpuMalloc(&_data, n * sizeof(T));
-            gpuMemcpy(_data, other._data, n * sizeof(T), gpuMemcpyDeviceToDevice);
-        }else if(mem_type == MemoryType::MANAGED && other._data){
-            gpuMallocManaged(&_data, n * sizeof(T));
-            memcpy(_data, other._data, n * sizeof(T));
-        }
-        #endif
+        copy_from(other);
     }
 
-    MemoryBuffer(MemoryBuffer&& other) : n {other.n}, mem_type {other.mem_type},
-        _data {other._data}
+    MemoryBuffer(MemoryBuffer&& other) : _data {other._data}, n {other.n}, mem_type {other.mem_type},
+        device {other.device}, allocator {other.allocator}, _mirror {other._mirror}, mirror_type {other.mirror_type},
+        mirror_allocator {other.mirror_allocator}, mirror_device {other.mirror_device}
     {
         other._data = nullptr;
+        other._mirror = nullptr;
     }
 
     MemoryBuffer& operator=(const MemoryBuffer& other){
         if(this == &other) return *this;
-        if(_data) this->~MemoryBuffer();
-        n = other.n;
-        mem_type = other.mem_type;
-        if(mem_type == MemoryType::PAGEABLE && other._data){
-            _data = new T[n];
-            memcpy(_data, other._data, n * sizeof(T));
-        }
-        #ifdef __GPU__
-        if(mem_type == MemoryType::PINNED && other._data){
-            gpuHostAlloc(&_data, n * sizeof(T));
-            memcpy(_data, other._data, n * sizeof(T));
-        }else if(mem_type == MemoryType::DEVICE && other._data){
-            gpuMalloc(&_data, n * sizeof(T));
-            gpuMemcpy(_data, other._data, n * sizeof(T), gpuMemcpyDeviceToDevice);
-        }else if(mem_type == MemoryType::MANAGED && other._data){
-            gpuMallocManaged(&_data, n * sizeof(T));
-            memcpy(_data, other._data, n * sizeof(T));
-        }
-        #endif
+        release_mirror();
+        free_array(_data, n, mem_type, allocator);
+        copy_from(other);
         return *this;
     }
 
     MemoryBuffer& operator=(MemoryBuffer&& other){
-        if(_data) this->~MemoryBuffer();
+        if(this == &other) return *this;
+        release_mirror();
+        free_array(_data, n, mem_type, allocator);
         n = other.n;
         mem_type = other.mem_type;
+        device = other.device;
         _data = other._data;
+        allocator = other.allocator;
+        _mirror = other._mirror;
+        mirror_type = other.mirror_type;
+        mirror_allocator = other.mirror_allocator;
+        mirror_device = other.mirror_device;
         other._data = nullptr;
+        other._mirror = nullptr;
         return *this;
     }
 
@@ -257,12 +521,8 @@ class MemoryBuffer {
     const T& operator[](int i) const { return _data[i]; }
 
     ~MemoryBuffer(){
-        if(mem_type == MemoryType::PAGEABLE && _data) delete[] _data;
-        #ifdef __GPU__
-        if(mem_type == MemoryType::PINNED && _data) gpuHostFree(_data);
-        if((mem_type == MemoryType::DEVICE || 
-            mem_type == MemoryType::MANAGED) && _data) gpuFree(_data);
-        #endif
+        release_mirror();
+        free_array(_data, n, mem_type, allocator);
     }
 };
 
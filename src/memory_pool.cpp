@@ -0,0 +1,253 @@
+#include <new>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include "memory_pool.hpp"
+
+namespace {
+    // Alignment of pageable blocks, enough for any vector instruction set.
+    constexpr size_t host_alignment {64};
+
+    int current_device(MemoryType type){
+        int device {0};
+        #ifdef __GPU__
+        if(type != MemoryType::PAGEABLE) gpuGetDevice(&device);
+        #else
+        (void) type;
+        #endif
+        return device;
+    }
+}
+
+
+
+void* DirectAllocator::allocate(size_t bytes, MemoryType type){
+    #ifndef __GPU__
+    if(type != MemoryType::PAGEABLE)
+        throw std::invalid_argument {"DirectAllocator::allocate: cannot use anything other than pageable memory "
+            "on a CPU only build of the software."};
+    #endif
+    void *ptr {nullptr};
+    #ifdef __GPU__
+    if(type == MemoryType::PINNED) {
+        gpuHostAlloc(&ptr, bytes);
+    }else if(type == MemoryType::DEVICE){
+        gpuMalloc(&ptr, bytes);
+    }else if(type == MemoryType::MANAGED){
+        gpuMallocManaged(&ptr, bytes);
+    }
+    #endif
+    if(type == MemoryType::PAGEABLE){
+        ptr = ::operator new(bytes, std::align_val_t {host_alignment});
+    }
+    return ptr;
+}
+
+
+
+void DirectAllocator::deallocate(void *ptr, size_t bytes, MemoryType type){
+    (void) bytes;
+    if(!ptr) return;
+    if(type == MemoryType::PAGEABLE) ::operator delete(ptr, std::align_val_t {host_alignment});
+    #ifdef __GPU__
+    if(type == MemoryType::PINNED) gpuHostFree(ptr);
+    if(type == MemoryType::DEVICE || type == MemoryType::MANAGED) gpuFree(ptr);
+    #endif
+}
+
+
+
+size_t PoolAllocator::size_class(size_t bytes){
+    constexpr size_t min_size {256};
+    if(bytes <= min_size) return min_size;
+    size_t power {min_size};
+    while(power <= bytes / 2) power *= 2;
+    // Four classes between consecutive powers of two.
+    const size_t step {power / 4};
+    return (bytes + step - 1) / step * step;
+}
+
+
+
+void* PoolAllocator::allocate(size_t bytes, MemoryType type){
+    const Key key {type, current_device(type), size_class(bytes)};
+    CachedBlock block {nullptr};
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        MemoryPoolStats& stats {_stats[static_cast<int>(type)]};
+        stats.requests++;
+        auto it = free_blocks.find(key);
+        if(it != free_blocks.end() && !it->second.empty()){
+            block = it->second.back();
+            it->second.pop_back();
+            stats.hits++;
+            stats.bytes_cached -= key.size;
+            cached_bytes[{key.type, key.device}] -= key.size;
+            stats.bytes_in_use += key.size;
+            stats.high_water_mark = std::max(stats.high_water_mark, stats.bytes_in_use);
+            live_blocks[block.ptr] = key;
+        }
+    }
+    if(block.ptr){
+        #ifdef __GPU__
+        // Work queued before the block was returned may still be using it.
+        if(key.type != MemoryType::PAGEABLE){
+            GpuDeviceGuard guard {key.device};
+            gpuEventSynchronize(block.released);
+            gpuEventDestroy(block.released);
+        }
+        #endif
+        return block.ptr;
+    }
+    // Driver calls are slow: they are made without holding the lock.
+    void *ptr {system->allocate(key.size, type)};
+    std::lock_guard<std::mutex> lock {mutex};
+    MemoryPoolStats& stats {_stats[static_cast<int>(type)]};
+    stats.bytes_in_use += key.size;
+    stats.high_water_mark = std::max(stats.high_water_mark, stats.bytes_in_use);
+    live_blocks[ptr] = key;
+    return ptr;
+}
+
+
+
+void PoolAllocator::free_block(void *ptr, const Key& key){
+    #ifdef __GPU__
+    if(key.type != MemoryType::PAGEABLE){
+        GpuDeviceGuard guard {key.device};
+        system->deallocate(ptr, key.size, key.type);
+        return;
+    }
+    #endif
+    system->deallocate(ptr, key.size, key.type);
+}
+
+
+
+void PoolAllocator::deallocate(void *ptr, size_t bytes, MemoryType type){
+    (void) bytes;
+    (void) type;
+    release_block(ptr, 0);
+}
+
+
+
+#ifdef __GPU__
+void PoolAllocator::deallocate(void *ptr, size_t bytes, MemoryType type, gpuStream_t stream){
+    (void) bytes;
+    (void) type;
+    release_block(ptr, stream);
+}
+#endif
+
+
+
+void PoolAllocator::release_block(void *ptr, StreamHandle stream){
+    if(!ptr) return;
+    Key key;
+    bool cache {false};
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        auto it = live_blocks.find(ptr);
+        if(it == live_blocks.end())
+            throw std::invalid_argument {"PoolAllocator::deallocate: the block was not allocated by this pool."};
+        key = it->second;
+        live_blocks.erase(it);
+        MemoryPoolStats& stats {_stats[static_cast<int>(key.type)]};
+        stats.bytes_in_use -= key.size;
+        size_t& cached {cached_bytes[{key.type, key.device}]};
+        if(cached + key.size <= max_cached_bytes){
+            cache = true;
+            // Reserve the space now, so that concurrent frees respect the limit.
+            cached += key.size;
+            stats.bytes_cached += key.size;
+        }
+    }
+    if(!cache){
+        free_block(ptr, key);
+        return;
+    }
+    CachedBlock block {ptr};
+    #ifdef __GPU__
+    // Work queued on the GPU may still use the block: it is waited for when the block is reused.
+    if(key.type != MemoryType::PAGEABLE){
+        GpuDeviceGuard guard {key.device};
+        gpuEventCreate(&block.released);
+        gpuEventRecord(block.released, stream);
+    }
+    #else
+    (void) stream;
+    #endif
+    std::lock_guard<std::mutex> lock {mutex};
+    free_blocks[key].push_back(block);
+}
+
+
+
+void PoolAllocator::release_cached(){
+    std::map<Key, std::vector<CachedBlock>> blocks;
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        blocks.swap(free_blocks);
+        for(const auto& entry : blocks){
+            const size_t bytes {entry.first.size * entry.second.size()};
+            _stats[static_cast<int>(entry.first.type)].bytes_cached -= bytes;
+            cached_bytes[{entry.first.type, entry.first.device}] -= bytes;
+        }
+    }
+    for(const auto& entry : blocks){
+        for(const CachedBlock& block : entry.second){
+            #ifdef __GPU__
+            if(entry.first.type != MemoryType::PAGEABLE){
+                GpuDeviceGuard guard {entry.first.device};
+                gpuEventDestroy(block.released);
+            }
+            #endif
+            // Freeing device or pinned memory waits for the work using it.
+            free_block(block.ptr, entry.first);
+        }
+    }
+}
+
+
+
+PoolAllocator::~PoolAllocator(){
+    release_cached();
+}
+
+
+
+MemoryPoolStats PoolAllocator::stats(MemoryType type) const {
+    std::lock_guard<std::mutex> lock {mutex};
+    return _stats[static_cast<int>(type)];
+}
+
+
+
+namespace {
+    std::atomic<MemoryAllocator*>& allocator_slot(){
+        static std::atomic<MemoryAllocator*> allocator {&memory_pool()};
+        return allocator;
+    }
+}
+
+
+
+PoolAllocator& memory_pool(){
+    // Never destroyed: buffers can be released by static destructors, and freeing GPU memory
+    // after the runtime has shut down fails.
+    static PoolAllocator *pool {new PoolAllocator {}};
+    return *pool;
+}
+
+
+
+MemoryAllocator& default_allocator(){
+    return *allocator_slot().load();
+}
+
+
+
+void set_default_allocator(MemoryAllocator& allocator){
+    allocator_slot().store(&allocator);
+}
@@ -0,0 +1,190 @@
+#ifndef __MEMORY_POOL_H__
+#define __MEMORY_POOL_H__
+
+#include <cstddef>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include "gpu_macros.hpp"
+
+enum class MemoryType {
+    PAGEABLE, // memory allocated with malloc or new[]
+    PINNED, // memory allocated with gpuHostAlloc
+    DEVICE, // GPU memory
+    MANAGED // Host memory accessible by GPUs
+};
+
+
+/**
+ * @brief Interface of the objects `MemoryBuffer` obtains its memory from.
+ *
+ * Implementations must be thread safe. Device memory is allocated on the current GPU.
+ */
+class MemoryAllocator {
+    public:
+    virtual ~MemoryAllocator() {}
+
+    /**
+     * @brief Allocate `bytes` bytes of memory of type `type`, aligned to at least 64 bytes.
+     */
+    virtual void* allocate(size_t bytes, MemoryType type) = 0;
+
+    /**
+     * @brief Release a block returned by `allocate` with the same `bytes` and `type`.
+     */
+    virtual void deallocate(void *ptr, size_t bytes, MemoryType type) = 0;
+};
+
+
+/**
+ * @brief Allocator calling `new`, `gpuMalloc`, `gpuHostAlloc` or `gpuMallocManaged` on every
+ * allocation and freeing memory straight away.
+ */
+class DirectAllocator : public MemoryAllocator {
+    public:
+    void* allocate(size_t bytes, MemoryType type) override;
+    void deallocate(void *ptr, size_t bytes, MemoryType type) override;
+};
+
+
+/**
+ * @brief Usage information of a `PoolAllocator`, for one memory type. Sizes are in bytes,
+ * rounded up to the size class of each block.
+ */
+struct MemoryPoolStats {
+    // Number of allocations requested.
+    size_t requests {0};
+    // Number of allocations served with a cached block.
+    size_t hits {0};
+    // Memory held by live buffers.
+    size_t bytes_in_use {0};
+    // Largest value reached by `bytes_in_use`.
+    size_t high_water_mark {0};
+    // Memory of the free blocks kept for reuse.
+    size_t bytes_cached {0};
+
+    double hit_rate() const { return requests > 0 ? static_cast<double>(hits) / requests : 0.0; }
+};
+
+
+/**
+ * @brief Caching allocator: freed blocks are kept and handed out again to requests of the same
+ * size class, memory type and device, so that a pipeline allocating the same buffers every
+ * second calls the driver only during the first one.
+ *
+ * Sizes are rounded up to size classes four per power of two (at most 25% overhead). Each
+ * (memory type, device) pair caches at most `max_cached_bytes` bytes; blocks freed beyond that
+ * limit are returned to the system. Device and pinned blocks may still be used by work queued on
+ * the GPU when they are returned: an event is recorded on the stream that used them, and a block
+ * is handed out again only once its event has completed. Neither the caller returning the block
+ * nor the other streams of the device wait.
+ */
+class PoolAllocator : public MemoryAllocator {
+
+    struct Key {
+        MemoryType type;
+        int device;
+        size_t size;
+
+        bool operator<(const Key& other) const {
+            if(type != other.type) return type < other.type;
+            if(device != other.device) return device < other.device;
+            return size < other.size;
+        }
+    };
+
+    struct CachedBlock {
+        void *ptr;
+        #ifdef __GPU__
+        // Recorded, when the block was returned, on the stream that last used it.
+        gpuEvent_t released {};
+        #endif
+    };
+
+    DirectAllocator direct;
+    // Allocator the blocks come from, and are returned to.
+    MemoryAllocator *system;
+    size_t max_cached_bytes;
+    std::map<Key, std::vector<CachedBlock>> free_blocks;
+    // Size class and device of the blocks handed out.
+    std::unordered_map<void*, Key> live_blocks;
+    // Cached bytes for each (memory type, device) pair.
+    std::map<std::pair<MemoryType, int>, size_t> cached_bytes;
+    MemoryPoolStats _stats[4];
+    mutable std::mutex mutex;
+
+    #ifdef __GPU__
+    using StreamHandle = gpuStream_t;
+    #else
+    using StreamHandle = void*;
+    #endif
+
+    void free_block(void *ptr, const Key& key);
+    // Return `ptr` to the pool; device and pinned blocks are reused once the work queued on
+    // `stream` has completed.
+    void release_block(void *ptr, StreamHandle stream);
+
+    public:
+    /**
+     * @param max_cached_bytes largest amount of memory cached for each memory type and device.
+     * @param upstream allocator the blocks are obtained from and returned to, which must outlive
+     * the pool. A `DirectAllocator` if null.
+     */
+    explicit PoolAllocator(size_t max_cached_bytes = 4ul << 30, MemoryAllocator *upstream = nullptr) :
+        system {upstream ? upstream : &direct}, max_cached_bytes {max_cached_bytes} {}
+
+    ~PoolAllocator();
+
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+    void* allocate(size_t bytes, MemoryType type) override;
+    void deallocate(void *ptr, size_t bytes, MemoryType type) override;
+
+    #ifdef __GPU__
+    /**
+     * @brief Same as above, for a device or pinned block last used by work queued on `stream`.
+     * The version without stream assumes the legacy default stream, whose work completes only
+     * after the work queued before it on the other blocking streams.
+     */
+    void deallocate(void *ptr, size_t bytes, MemoryType type, gpuStream_t stream);
+    #endif
+
+    /**
+     * @brief Return all the cached blocks to the system, e.g. before allocating memory outside
+     * of `MemoryBuffer`.
+     */
+    void release_cached();
+
+    /**
+     * @return usage information for memory of type `type`, over all devices.
+     */
+    MemoryPoolStats stats(MemoryType type) const;
+
+    /**
+     * @return the size of the blocks serving requests of `bytes` bytes.
+     */
+    static size_t size_class(size_t bytes);
+};
+
+
+/**
+ * @return the allocator new `MemoryBuffer` allocations are served by. Unless changed with
+ * `set_default_allocator`, it is a process wide `PoolAllocator`.
+ */
+MemoryAllocator& default_allocator();
+
+/**
+ * @return the process wide `PoolAllocator`, also when it is not the default allocator.
+ */
+PoolAllocator& memory_pool();
+
+/**
+ * @brief Serve new `MemoryBuffer` allocations with `allocator`, e.g. a `DirectAllocator` to
+ * disable caching. Existing buffers are still released through the allocator they came from,
+ * which must outlive them.
+ */
+void set_default_allocator(MemoryAllocator& allocator);
+
+#endif
@@ -6,6 +6,12 @@
 #include <math.h>
 #include <fitsio.h>
 #include <iostream>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include <cmath>
+#include <sys/stat.h>
+#include "utils.hpp"
 
 #define MWA_LATTITUDE -26.703319        // Array latitude. degrees North
 #define MWA_LONGITUDE 116.67081         // Array longitude. degrees East
@@ -107,6 +113,10 @@ public :
    //double fiberFactor;
    double tilePointingRARad, tilePointingDecRad;
    double dateRequestedMJD;
+   double fineChannelKHz;          // width of the fine channels (kHz)
+   double exposureSec;             // duration of the observation (seconds)
+   long unixTime;                  // start of the observation (UNIXTIME keyword), 0 if absent
+   bool hasSubbandNumbers;
    
    bool HasMetaFits(){
       return m_bHasMetaFits;
@@ -215,11 +225,13 @@ CObsMetadata::CObsMetadata( const char* filename ) :
         centreSBNumber(0),
         //fiberFactor(VEL_FACTOR),
         tilePointingRARad(0.0), tilePointingDecRad(0.0),
-        dateRequestedMJD(0.0)
+        dateRequestedMJD(0.0),
+        fineChannelKHz(0.0), exposureSec(0.0), unixTime(0), hasSubbandNumbers(false)
 
 {
    for(size_t i=0; i!=16; ++i) delays[i] = 0;
    for(size_t i=0; i!=24; ++i) subbandGains[i] = 0;
+   for(size_t i=0; i!=24; ++i) subbandNumbers[i] = 0;
    
    if( filename && strlen(filename) ){
       m_filename = filename;
@@ -390,9 +402,11 @@ bool CObsMetadata::ReadMetaFitsFile( const char* filename )
    dateFirstScanMJD = GetDateFirstScanFromFields();
    
    // for now only read if not read earlier :
-   if( antenna_positions.size() == 0 ){
-      ReadAntPositions();
-   }else{
+   if( antenna_positions.size() == 0 && ReadAntPositions() != 0 ){
+      status = 0;
+      fits_close_file(_fptr, &status);
+      _fptr = NULL;
+      return false;
    }
    
    if( _fptr ){
@@ -490,15 +504,15 @@ bool CObsMetadata::parseKeyword( const std::string& keyName, const std::string&
                 if( !parseFitsString(keyValue.c_str(),observerName) ){
                    return false;
                 }
-        }else if(keyName == "PROJECT")
+        }else if(keyName == "PROJECT"){
                 if( !parseFitsString(keyValue.c_str(),projectName) ){ 
                    return false;
                 }
-        else if(keyName == "MODE")
+        }else if(keyName == "MODE"){
                 if( !parseFitsString(keyValue.c_str(),mode) ){
                    return false;
                 }
-        else if(keyName == "DELAYS"){
+        }else if(keyName == "DELAYS"){
                 if( !parseIntArray(keyValue.c_str(), delays, 16) ){
                    return false;
                 }
@@ -516,6 +530,12 @@ bool CObsMetadata::parseKeyword( const std::string& keyName, const std::string&
         //      fiberFactor = atof(keyValue.c_str());
         else if(keyName == "INTTIME")
                 integrationTime = atof(keyValue.c_str());
+        else if(keyName == "FINECHAN")
+                fineChannelKHz = atof(keyValue.c_str());
+        else if(keyName == "EXPOSURE")
+                exposureSec = atof(keyValue.c_str());
+        else if(keyName == "UNIXTIME")
+                unixTime = atol(keyValue.c_str());
         else if(keyName == "NSCANS")
                 nScans = atoi(keyValue.c_str());
         else if(keyName == "NINPUTS")
@@ -530,6 +550,7 @@ bool CObsMetadata::parseKeyword( const std::string& keyName, const std::string&
                 if( !parseIntArray(keyValue.c_str(), subbandNumbers, 24) ){
                    return false;
                 }
+                hasSubbandNumbers = true;
         }else if(keyName == "DATESTRT")
                 ; //parseFitsDate(keyValue, year, month, day, refHour, refMinute, refSecond);
         else if(keyName == "DATE")
@@ -546,9 +567,9 @@ bool CObsMetadata::parseKeyword( const std::string& keyName, const std::string&
                 }
         }else if(keyName == "TELESCOP")
                 ; // Ignore; will always be set to 'MWA'
-        else if( keyName == "EXPOSURE" || keyName == "MJD" || keyName == "LST" || keyName == "HA" || keyName == "AZIMUTH" || keyName == "ALTITUDE" || keyName == "SUN-DIST" || keyName == "MOONDIST" || 
+        else if( keyName == "MJD" || keyName == "LST" || keyName == "HA" || keyName == "AZIMUTH" || keyName == "ALTITUDE" || keyName == "SUN-DIST" || keyName == "MOONDIST" || 
                  keyName == "JUP-DIST" || keyName == "GRIDNUM" || keyName == "RECVRS" || keyName == "CHANNELS" || keyName == "SUN-ALT" || keyName == "TILEFLAG" || keyName == "NAV_FREQ" || 
-                 keyName == "FINECHAN" || keyName == "TIMEOFF" )
+                 keyName == "TIMEOFF" )
                 ; // Ignore these fields, they can be derived from others.
         else{
                 // printf("Ignored keyword: %s\n",keyName.c_str());
@@ -692,8 +713,7 @@ int CObsMetadata::ReadAntPositions()
 
    int hduType;
    fits_movabs_hdu(_fptr, 2, &hduType, &status);
-   checkStatus(status,"Could not open list of tiles");
-   
+   if( !checkStatus(status,"Could not open list of tiles") ){ return -1; }
    
    char
       inputColName[] = "Input",
@@ -701,20 +721,16 @@ int CObsMetadata::ReadAntPositions()
       tileColName[] = "Tile",
       tilenameColName[] = "TileName",
       polColName[] = "Pol",
-      rxColName[] = "Rx",
-      slotColName[] = "Slot",
       flagColName[] = "Flag",
-      lengthColName[] = "Length",
       eastColName[] = "East",
       northColName[] = "North",
-      heightColName[] = "Height",
-      gainsColName[] = "Gains";
-   int inputCol, antennaCol, tileCol, tilenameCol, polCol, rxCol, slotCol, flagCol, lengthCol, northCol, eastCol, heightCol, gainsCol;
+      heightColName[] = "Height";
+   int inputCol, antennaCol, tileCol, tilenameCol, polCol, flagCol, northCol, eastCol, heightCol;
 
    fits_get_colnum(_fptr, CASESEN, inputColName, &inputCol, &status);
    fits_get_colnum(_fptr, CASESEN, antennaColName, &antennaCol, &status);
    fits_get_colnum(_fptr, CASESEN, tileColName, &tileCol, &status);
-   checkStatus(status, "Could not read column names for list of tiles");
+   if( !checkStatus(status, "Could not read column names for list of tiles") ){ return -1; }
 
    // The tile name column doesn't exist in older metafits files
    fits_get_colnum(_fptr, CASESEN, tilenameColName, &tilenameCol, &status);
@@ -725,110 +741,78 @@ int CObsMetadata::ReadAntPositions()
    }
 
    fits_get_colnum(_fptr, CASESEN, polColName, &polCol, &status);
-   fits_get_colnum(_fptr, CASESEN, rxColName, &rxCol, &status);
-   fits_get_colnum(_fptr, CASESEN, slotColName, &slotCol, &status);
    fits_get_colnum(_fptr, CASESEN, flagColName, &flagCol, &status);
-   fits_get_colnum(_fptr, CASESEN, lengthColName, &lengthCol, &status);
    fits_get_colnum(_fptr, CASESEN, eastColName, &eastCol, &status);
    fits_get_colnum(_fptr, CASESEN, northColName, &northCol, &status);
    fits_get_colnum(_fptr, CASESEN, heightColName, &heightCol, &status);
-   checkStatus(status,"Could not read column names for list of tiles (PART2)");
-
-   // The gains col is not present in older metafits files
-   fits_get_colnum(_fptr, CASESEN, gainsColName, &gainsCol, &status);
-   if(status != 0)
-   {
-      gainsCol = -1;
-      status = 0;
-   }
+   if( !checkStatus(status,"Could not read column names for list of tiles (PART2)") ){ return -1; }
 
    long int nrow;
    fits_get_num_rows(_fptr, &nrow, &status);
-   checkStatus(status,"Could not get number of rows");
+   if( !checkStatus(status,"Could not get number of rows") ){ return -1; }
+
+   // Each column is read with a single call: reading row by row costs one call into cfitsio
+   // per value, which dominates the time needed to parse the file.
+   std::vector<int> inputs(nrow), antennas(nrow), tiles(nrow), flags(nrow);
+   std::vector<unsigned char> pols(nrow);
+   std::vector<double> easts(nrow), norths(nrow), heights(nrow);
+   const size_t nameSize = 81;
+   std::vector<char> names(gotTileName ? nrow * nameSize : 0, '\0');
+   std::vector<char*> namePtrs(gotTileName ? nrow : 0);
+   for(size_t i=0; i<namePtrs.size(); ++i) namePtrs[i] = names.data() + i * nameSize;
+
+   fits_read_col(_fptr, TINT, inputCol, 1, 1, nrow, 0, inputs.data(), 0, &status);
+   fits_read_col(_fptr, TINT, antennaCol, 1, 1, nrow, 0, antennas.data(), 0, &status);
+   fits_read_col(_fptr, TINT, tileCol, 1, 1, nrow, 0, tiles.data(), 0, &status);
+   if (gotTileName){
+      fits_read_col(_fptr, TSTRING, tilenameCol, 1, 1, nrow, 0, namePtrs.data(), 0, &status);
+   }
+   fits_read_col(_fptr, TBYTE, polCol, 1, 1, nrow, 0, pols.data(), 0, &status);
+   fits_read_col(_fptr, TINT, flagCol, 1, 1, nrow, 0, flags.data(), 0, &status);
+   fits_read_col(_fptr, TDOUBLE, eastCol, 1, 1, nrow, 0, easts.data(), 0, &status);
+   fits_read_col(_fptr, TDOUBLE, northCol, 1, 1, nrow, 0, norths.data(), 0, &status);
+   fits_read_col(_fptr, TDOUBLE, heightCol, 1, 1, nrow, 0, heights.data(), 0, &status);
+   if( !checkStatus(status,"Could not read tile") ){ return -1; }
 
    antenna_positions.resize(nrow/2); // was antennae.resize(nrow/2);
-//   inputs.resize(nrow);
    input_mapping.resize(nrow);
    for(long int i=0; i!=nrow; ++i)
    {
-      int input, antenna, tile, rx, slot, flag, gainValues[24];
-      double north, east, height;
-      char pol;
-      char length[81] = "";
-      char *lengthPtr[1] = { length };
-      char tilename[81] = "";
-      char *tilenamePtr[1] = { tilename };
-      fits_read_col(_fptr, TINT, inputCol, i+1, 1, 1, 0, &input, 0, &status);
-      fits_read_col(_fptr, TINT, antennaCol, i+1, 1, 1, 0, &antenna, 0, &status);
-      fits_read_col(_fptr, TINT, tileCol, i+1, 1, 1, 0, &tile, 0, &status);
-      if (gotTileName){
-          fits_read_col(_fptr, TSTRING, tilenameCol, i+1, 1, 1, 0, tilenamePtr, 0, &status);
+      const int antenna = antennas[i];
+      const char pol = static_cast<char>(pols[i]);
+      if(antenna < 0 || static_cast<size_t>(antenna) >= antenna_positions.size()){
+         printf("ERROR : tile data row %ld refers to antenna %d, beyond the %d antennas listed\n",i,antenna,int(antenna_positions.size()));
+         return -1;
       }
-
-      fits_read_col(_fptr, TBYTE, polCol, i+1, 1, 1, 0, &pol, 0, &status);
-      fits_read_col(_fptr, TINT, rxCol, i+1, 1, 1, 0, &rx, 0, &status);
-      fits_read_col(_fptr, TINT, slotCol, i+1, 1, 1, 0, &slot, 0, &status);
-      fits_read_col(_fptr, TINT, flagCol, i+1, 1, 1, 0, &flag, 0, &status);
-      fits_read_col(_fptr, TSTRING, lengthCol, i+1, 1, 1, 0, lengthPtr, 0, &status);
-      fits_read_col(_fptr, TDOUBLE, eastCol, i+1, 1, 1, 0, &east, 0, &status);
-      fits_read_col(_fptr, TDOUBLE, northCol, i+1, 1, 1, 0, &north, 0, &status);
-      fits_read_col(_fptr, TDOUBLE, heightCol, i+1, 1, 1, 0, &height, 0, &status);
-      if(gainsCol != -1)
-         fits_read_col(_fptr, TINT, gainsCol, i+1, 1, 24, 0, gainValues, 0, &status);
-      checkStatus(status,"Could not read tile");
       input_mapping[i] = 2 * antenna + (pol == 'X' ? 0 : 1);
-      
+      InputMapping& ant = antenna_positions[antenna]; // was MWAAntenna &ant = antennae[antenna];
+      // A tile is flagged when either of its inputs is.
+      if(flags[i] != 0) ant.flag = 1;
+
       if(pol == 'X'){
-          InputMapping& ant = antenna_positions[antenna]; // was MWAAntenna &ant = antennae[antenna];
           if (gotTileName){
-             tilename[80] = 0;
-             ant.szAntName = tilename;
+             namePtrs[i][nameSize - 1] = 0;
+             ant.szAntName = namePtrs[i];
           }else{
-             char szTmp[64];
-             sprintf(szTmp,"Tile%03d",tile);
-             ant.szAntName = szTmp;
+             std::string number = std::to_string(tiles[i]);
+             if(number.size() < 3) number.insert(0, 3 - number.size(), '0');
+             ant.szAntName = "Tile" + number;
           }
 
          ant.antenna = antenna; // CRISTIAN tile;
-		 ant.input = input;
-         ant.x = east;
-         ant.y = north;
-         ant.z = height;
+         ant.input = inputs[i];
+         ant.pol = pol;
+         ant.x = easts[i];
+         ant.y = norths[i];
+         ant.z = heights[i];
          // CRISTIAN PacerGeometry::ENH2XYZ_local(east, north, height, geo_lat*(M_PI/180.00), ant.x, ant.y, ant.z); // was MWAConfig::ArrayLattitudeRad()
-//         ant.stationIndex = antenna;
-         // PRINTF_DEBUG("DEBUG antenna positions : %d = %s : (%.4f,%.4f,%.4f) -> (%.4f,%.4f,%.4f)\n",antenna,ant.szAntName.c_str(), east, north, height, ant.x, ant.y, ant.z );
-         //std::cout << ant.name << ' ' << input << ' ' << antenna << ' ' << east << ' ' << north << ' ' << height << '\n';
        }else{
           if(pol != 'Y'){
              //throw std::runtime_error("Error parsing polarization");
-             printf("ERROR : polarisation cannot be Y");
+             printf("ERROR : polarisation is neither X nor Y");
           }
        }  
-
-       length[80] = 0;
-       std::string lengthStr = length;
-/*       if(input >= nrow){
-          std::ostringstream errstr;
-          errstr << "Tile " << tile << " has an input with index " << input << ", which is beyond the maximum index of " << (nrow-1);
-          throw std::runtime_error(errstr.str());
-       }
-       inputs[input].inputIndex = input;
-       inputs[input].antennaIndex = antenna;
-       if(lengthStr.substr(0, 3) == "EL_")
-          inputs[input].cableLenDelta = atof(&(lengthStr.c_str()[3]));
-       else
-          inputs[input].cableLenDelta = atof(lengthStr.c_str()) * MWAConfig::VelocityFactor();
-       inputs[input].polarizationIndex = (pol=='X') ? 0 : 1;
-       inputs[input].isFlagged = (flag!=0);
-       if(gainsCol != -1) {
-          for(size_t sb=0; sb!=24; ++sb) {
-            // The digital pfb gains are multiplied with 64 to allow more careful
-            // fine tuning of the gains.
-            inputs[input].pfbGains[sb] = (double) gainValues[sb] / 64.0;
-          }
-       }     */
    }   
-  
 
 // continue as in /home/msok/github/pacer/software/cotter/metafitsfile.cpp
 
@@ -837,27 +821,95 @@ int CObsMetadata::ReadAntPositions()
 
 }
 
-std::vector<int> read_metafits_mapping(const std::string& filename){
-   ::CObsMetadata meta;
-	if(!meta.ReadMetaData(filename.c_str())){
-      std::cerr << "impossible to read metadata file." << std::endl;
-      throw std::exception();
+namespace {
+   std::shared_ptr<const MetafitsInfo> parse_metafits(const std::string& filename){
+      ::CObsMetadata meta;
+      if(!meta.ReadMetaData(filename.c_str()))
+         throw std::runtime_error {"read_metafits: impossible to read metadata file " + filename};
+      auto result = std::make_shared<MetafitsInfo>();
+      MetafitsInfo& info = *result;
+      info.input_mapping = meta.input_mapping;
+      info.tiles.reserve(meta.antenna_positions.size());
+      for(const InputMapping& ant : meta.antenna_positions)
+         info.tiles.push_back({ant.szAntName, ant.antenna, ant.input, ant.flag != 0, ant.x, ant.y, ant.z});
+      if(meta.hasSubbandNumbers) info.coarse_channels.assign(meta.subbandNumbers, meta.subbandNumbers + 24);
+      info.ra_deg = meta.raHrs * 15.0;
+      info.dec_deg = meta.decDegs;
+      info.pointing_ra_deg = meta.tilePointingRARad * (180.0 / M_PI);
+      info.pointing_dec_deg = meta.tilePointingDecRad * (180.0 / M_PI);
+      info.integration_time = meta.integrationTime;
+      info.exposure = meta.exposureSec;
+
+      ObservationInfo& obs = info.obsInfo;
+      const size_t nCoarseChannels = info.coarse_channels.empty() ? 24 : info.coarse_channels.size();
+      obs.nAntennas = meta.antenna_positions.size();
+      obs.nPolarizations = 2;
+      obs.coarseChannelBandwidth = meta.bandwidthMHz / nCoarseChannels;
+      obs.frequencyResolution = meta.fineChannelKHz > 0 ? meta.fineChannelKHz / 1000.0 :
+         (meta.nChannels > 0 ? meta.bandwidthMHz / meta.nChannels : 0.0);
+      obs.nFrequencies = obs.frequencyResolution > 0 ?
+         static_cast<unsigned int>(std::lround(obs.coarseChannelBandwidth / obs.frequencyResolution)) : 0;
+      // Voltages of a fine channel are sampled at its bandwidth; a .dat file holds one second.
+      obs.timeResolution = obs.frequencyResolution > 0 ? 1.0 / (obs.frequencyResolution * 1e6) : 0.0;
+      obs.nTimesteps = obs.timeResolution > 0 ? static_cast<unsigned int>(std::lround(1.0 / obs.timeResolution)) : 0;
+      obs.startTime = meta.unixTime > 0 ? static_cast<time_t>(meta.unixTime) : gps_to_unix(meta.gpsTime);
+      obs.coarseChannel = meta.centreSBNumber;
+      obs.coarse_channel_index = 0;
+      for(size_t c = 0; c < info.coarse_channels.size(); c++)
+         if(info.coarse_channels[c] == meta.centreSBNumber) obs.coarse_channel_index = c;
+      obs.geo_long_deg = meta.geo_long;
+      obs.geo_lat_deg = meta.geo_lat;
+      obs.id = std::to_string(meta.gpsTime);
+      obs.telescope = meta.mode.compare(0, 4, "MWAX") == 0 ? TelescopeID::MWA3 : TelescopeID::MWA1;
+      obs.metadata_file = filename;
+      return result;
    }
-	std::vector<int> mapping = meta.input_mapping;
-   return mapping;
+
+   struct CachedMetafits {
+      struct timespec mtime;
+      off_t size;
+      std::shared_ptr<const MetafitsInfo> info;
+   };
+
+   std::mutex metafits_cache_mutex;
+   std::map<std::string, CachedMetafits> metafits_cache;
 }
 
 
-ObservationInfo read_obsinfo(const std::string& filename){
-   ::CObsMetadata meta;
-	if(!meta.ReadMetaData(filename.c_str())){
-      std::cerr << "impossible to read metadata file." << std::endl;
-      throw std::exception();
+
+std::shared_ptr<const MetafitsInfo> read_metafits(const std::string& filename){
+   struct stat file_stat;
+   if(stat(filename.c_str(), &file_stat) != 0)
+      throw std::runtime_error {"read_metafits: impossible to access metadata file " + filename};
+   {
+      std::lock_guard<std::mutex> lock {metafits_cache_mutex};
+      auto it = metafits_cache.find(filename);
+      if(it != metafits_cache.end() && it->second.size == file_stat.st_size &&
+            it->second.mtime.tv_sec == file_stat.st_mtim.tv_sec && it->second.mtime.tv_nsec == file_stat.st_mtim.tv_nsec)
+         return it->second.info;
    }
-   ObservationInfo info;
-   info.nAntennas;
-   info.nFrequencies;
-   info.nPolarizations;
-   info.nTimesteps;
-   info.timeResolution;
+   // Parsed without holding the lock; concurrent readers of the same new file may parse it twice.
+   std::shared_ptr<const MetafitsInfo> info {parse_metafits(filename)};
+   std::lock_guard<std::mutex> lock {metafits_cache_mutex};
+   metafits_cache[filename] = CachedMetafits {file_stat.st_mtim, file_stat.st_size, info};
+   return info;
+}
+
+
+
+void clear_metafits_cache(){
+   std::lock_guard<std::mutex> lock {metafits_cache_mutex};
+   metafits_cache.clear();
+}
+
+
+
+std::vector<int> read_metafits_mapping(const std::string& filename){
+   return read_metafits(filename)->input_mapping;
+}
+
+
+
+ObservationInfo read_obsinfo(const std::string& filename){
+   return read_metafits(filename)->obsInfo;
 }
@@ -3,7 +3,60 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include "astroio.hpp"
+
+/**
+ * @brief A tile of the array, as listed in the TILEDATA table of a metafits file.
+ */
+struct TileInfo {
+    std::string name;
+    // Index of the tile in the correlator output.
+    int antenna;
+    // Correlator input of the X polarisation.
+    int input;
+    // `true` if either of the inputs of the tile is flagged.
+    bool flagged;
+    // Position in metres with respect to the array centre.
+    double east, north, height;
+};
+
+
+/**
+ * @brief Content of a metafits file relevant to the processing of an observation.
+ */
+struct MetafitsInfo {
+    // Observation description. It refers to one second of data of the central coarse channel,
+    // i.e. the content of one .dat file: set `coarseChannel` and `coarse_channel_index` to
+    // describe another one.
+    ObservationInfo obsInfo;
+    // For each correlator input, 2 * antenna + polarisation (0 for X, 1 for Y).
+    std::vector<int> input_mapping;
+    // Tiles, indexed by antenna.
+    std::vector<TileInfo> tiles;
+    // Coarse channels of the observation (CHANNELS keyword).
+    std::vector<int> coarse_channels;
+    // Phase centre and pointing direction, in degrees.
+    double ra_deg, dec_deg;
+    double pointing_ra_deg, pointing_dec_deg;
+    // Correlator integration time and duration of the observation, in seconds.
+    double integration_time;
+    double exposure;
+};
+
+
+/**
+ * @brief Read a metafits file. The result is cached for the lifetime of the process and shared
+ * by all the callers: the file is parsed again only when its modification time or size change.
+ * This function is thread safe.
+ */
+std::shared_ptr<const MetafitsInfo> read_metafits(const std::string& filename);
+
+/**
+ * @brief Forget the metafits files parsed so far.
+ */
+void clear_metafits_cache();
+
 std::vector<int> read_metafits_mapping(const std::string& filename);
 ObservationInfo read_obsinfo(const std::string& filename);
 #endif
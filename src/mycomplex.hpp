@@ -3,7 +3,7 @@
 #define __MYCOMPLEX_H__
 
 #include <cmath>
-#include <gpu_macros.hpp>
+#include "gpu_macros.hpp"
 
 template <typename T>
 class Complex {
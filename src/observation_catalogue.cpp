@@ -0,0 +1,246 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <charconv>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "observation_catalogue.hpp"
+#include "utils.hpp"
+
+namespace {
+    // Number of coarse channels, hence of .dat files, in a second of MWA observation.
+    constexpr size_t n_coarse_channels {24};
+
+    // Parse the unsigned integer at the start of [first, last), storing the position after it in `next`.
+    template <typename T>
+    bool parse_number(const char *first, const char *last, T& value, const char *&next){
+        if(first == last || *first < '0' || *first > '9') return false;
+        auto result = std::from_chars(first, last, value);
+        if(result.ec != std::errc {}) return false;
+        next = result.ptr;
+        return true;
+    }
+}
+
+
+
+ObservationCatalogue::ObservationCatalogue(const std::string& directory) : directory {directory} {
+    refresh();
+}
+
+
+
+bool ObservationCatalogue::parse_name(const std::string& name, std::string& obs_id, time_t& gps_second,
+        unsigned int& coarse_channel){
+    const size_t slash {name.find_last_of('/')};
+    const char *first {name.c_str() + (slash == std::string::npos ? 0 : slash + 1)};
+    const char *last {name.c_str() + name.size()};
+    const char *p {first};
+    unsigned long long id {0}, second {0};
+    if(!parse_number(p, last, id, p) || p == last || *p++ != '_') return false;
+    const char *id_end {p - 1};
+    if(!parse_number(p, last, second, p) || last - p < 3 || std::strncmp(p, "_ch", 3) != 0) return false;
+    p += 3;
+    if(!parse_number(p, last, coarse_channel, p) || last - p != 4 || std::strncmp(p, ".dat", 4) != 0) return false;
+    obs_id.assign(first, id_end);
+    gps_second = static_cast<time_t>(second);
+    return true;
+}
+
+
+
+void ObservationCatalogue::insert(const std::string& path, const Entry& entry){
+    Observation& obs {_observations[entry.obs_id]};
+    auto it = obs.seconds.find(entry.gps_second);
+    if(it == obs.seconds.end()){
+        it = obs.seconds.emplace(entry.gps_second, Second {}).first;
+        // Files usually land in time order: the new second goes at the end.
+        obs.order.insert(std::upper_bound(obs.order.begin(), obs.order.end(), entry.gps_second), entry.gps_second);
+    }
+    if(it->second.emplace(entry.coarse_channel, path).second) n_files++;
+}
+
+
+
+void ObservationCatalogue::erase(const std::string& path){
+    auto entry = names.find(path);
+    if(entry == names.end()) return;
+    auto obs = _observations.find(entry->second.obs_id);
+    auto second = obs->second.seconds.find(entry->second.gps_second);
+    if(second->second.erase(entry->second.coarse_channel) > 0) n_files--;
+    if(second->second.empty()){
+        obs->second.seconds.erase(second);
+        auto pos = std::lower_bound(obs->second.order.begin(), obs->second.order.end(), entry->second.gps_second);
+        obs->second.order.erase(pos);
+        if(obs->second.seconds.empty()) _observations.erase(obs);
+    }
+    names.erase(entry);
+}
+
+
+
+bool ObservationCatalogue::add(const std::string& path){
+    Entry entry {};
+    if(names.count(path) || !parse_name(path, entry.obs_id, entry.gps_second, entry.coarse_channel)) return false;
+    // Known to `refresh`, which removes the file if it is not in the directory any more.
+    entry.generation = generation;
+    insert(path, entry);
+    names.emplace(path, entry);
+    return true;
+}
+
+
+
+size_t ObservationCatalogue::refresh(){
+    if(directory.empty()) return 0;
+    struct stat dir_stat;
+    if(stat(directory.c_str(), &dir_stat) != 0)
+        throw std::runtime_error {"ObservationCatalogue::refresh: error while accessing the directory " + directory};
+    // Unchanged since the previous scan. A directory modified within the same clock tick as the
+    // scan may look unchanged, hence the margin.
+    const bool same_mtime {dir_stat.st_mtim.tv_sec == dir_mtime.tv_sec && dir_stat.st_mtim.tv_nsec == dir_mtime.tv_nsec};
+    if(same_mtime && dir_mtime.tv_sec + 1 < scan_time) return 0;
+
+    const time_t started {time(nullptr)};
+    DIR *dir {opendir(directory.c_str())};
+    if(!dir) throw std::runtime_error {"ObservationCatalogue::refresh: error while opening the directory " + directory};
+    generation++;
+    size_t n_new {0};
+    std::string path {directory + "/"};
+    const size_t prefix {path.size()};
+    while(struct dirent *ent = readdir(dir)){
+        const size_t len {std::strlen(ent->d_name)};
+        if(len < 4 || std::strcmp(ent->d_name + len - 4, ".dat") != 0) continue;
+        path.replace(prefix, std::string::npos, ent->d_name, len);
+        auto known = names.find(path);
+        if(known != names.end()){
+            known->second.generation = generation;
+            continue;
+        }
+        Entry entry {};
+        if(!parse_name(path, entry.obs_id, entry.gps_second, entry.coarse_channel)) continue;
+        entry.generation = generation;
+        insert(path, entry);
+        names.emplace(path, entry);
+        n_new++;
+    }
+    closedir(dir);
+    // Files not seen in this scan were removed.
+    std::vector<std::string> removed;
+    for(const auto& name : names)
+        if(name.second.generation != generation) removed.push_back(name.first);
+    for(const auto& name : removed) erase(name);
+    dir_mtime = dir_stat.st_mtim;
+    scan_time = started;
+    return n_new;
+}
+
+
+
+std::vector<std::string> ObservationCatalogue::observations() const {
+    std::vector<std::string> ids;
+    ids.reserve(_observations.size());
+    for(const auto& obs : _observations) ids.push_back(obs.first);
+    return ids;
+}
+
+
+
+size_t ObservationCatalogue::n_seconds(const std::string& obs_id) const {
+    auto obs = _observations.find(obs_id);
+    return obs == _observations.end() ? 0 : obs->second.order.size();
+}
+
+
+
+size_t ObservationCatalogue::n_seconds() const {
+    size_t n {0};
+    for(const auto& obs : _observations) n += obs.second.order.size();
+    return n;
+}
+
+
+
+std::string ObservationCatalogue::find(const std::string& obs_id, time_t gps_second, unsigned int coarse_channel) const {
+    auto obs = _observations.find(obs_id);
+    if(obs == _observations.end()) return {};
+    auto second = obs->second.seconds.find(gps_second);
+    if(second == obs->second.seconds.end()) return {};
+    auto file = second->second.find(coarse_channel);
+    return file == second->second.end() ? std::string {} : file->second;
+}
+
+
+
+std::vector<DatFile> ObservationCatalogue::make_second(const std::string& obs_id, time_t gps_second, const Second& files) const {
+    if(files.size() != n_coarse_channels){
+        std::stringstream ss;
+        ss << "ObservationCatalogue: second " << gps_second << " of observation " << obs_id << " is missing "
+            << (n_coarse_channels - std::min(files.size(), n_coarse_channels)) << " coarse channels (.dat files).";
+        throw std::invalid_argument {ss.str()};
+    }
+    std::vector<DatFile> result;
+    result.reserve(files.size());
+    for(const auto& file : files){
+        ObservationInfo obs_info {VCS_OBSERVATION_INFO};
+        obs_info.id = obs_id;
+        obs_info.startTime = gps_to_unix(gps_second);
+        obs_info.coarseChannel = file.first;
+        result.push_back({file.second, obs_info});
+    }
+    return result;
+}
+
+
+
+std::vector<std::vector<DatFile>> ObservationCatalogue::select(const std::string& obs_id, size_t offset, int count) const {
+    auto obs = _observations.find(obs_id);
+    if(obs == _observations.end())
+        throw std::invalid_argument {"ObservationCatalogue::select: observation " + obs_id + " not found."};
+    const std::vector<time_t>& order {obs->second.order};
+    if(offset >= order.size()) throw std::invalid_argument {"ObservationCatalogue::select: invalid start offset specified."};
+    const size_t n {count < 0 ? order.size() - offset : static_cast<size_t>(count)};
+    if(offset + n > order.size()) throw std::invalid_argument {"ObservationCatalogue::select: invalid count of seconds specified."};
+    std::vector<std::vector<DatFile>> result;
+    result.reserve(n);
+    for(size_t i {offset}; i < offset + n; i++)
+        result.push_back(make_second(obs_id, order[i], obs->second.seconds.at(order[i])));
+    return result;
+}
+
+
+
+std::vector<std::vector<DatFile>> ObservationCatalogue::select_time_range(const std::string& obs_id, time_t first, time_t last) const {
+    std::vector<std::vector<DatFile>> result;
+    auto obs = _observations.find(obs_id);
+    if(obs == _observations.end()) return result;
+    const auto& seconds = obs->second.seconds;
+    for(auto it = seconds.lower_bound(first); it != seconds.end() && it->first <= last; it++)
+        result.push_back(make_second(obs_id, it->first, it->second));
+    return result;
+}
+
+
+
+std::vector<std::vector<DatFile>> ObservationCatalogue::select_all(size_t offset, int count) const {
+    const size_t total {n_seconds()};
+    if(offset >= total) throw std::invalid_argument {"ObservationCatalogue::select_all: invalid start offset specified."};
+    size_t n {count < 0 ? total - offset : static_cast<size_t>(count)};
+    if(offset + n > total) throw std::invalid_argument {"ObservationCatalogue::select_all: invalid count of seconds specified."};
+    std::vector<std::vector<DatFile>> result;
+    result.reserve(n);
+    for(auto obs = _observations.begin(); obs != _observations.end() && n > 0; obs++){
+        const size_t n_obs {obs->second.order.size()};
+        if(offset >= n_obs){
+            offset -= n_obs;
+            continue;
+        }
+        const size_t taken {std::min(n, n_obs - offset)};
+        auto part = select(obs->first, offset, static_cast<int>(taken));
+        std::move(part.begin(), part.end(), std::back_inserter(result));
+        n -= taken;
+        offset = 0;
+    }
+    return result;
+}
@@ -0,0 +1,138 @@
+#ifndef __OBSERVATION_CATALOGUE_H__
+#define __OBSERVATION_CATALOGUE_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <ctime>
+#include "astroio.hpp"
+
+/**
+ * @brief Index of the MWA Phase I .dat files in a directory, by observation, GPS second and
+ * coarse channel.
+ *
+ * File names have the form `<obsid>_<gps second>_ch<coarse channel>.dat`. They are parsed once,
+ * when the catalogue is built; `refresh` only parses the names of files that appeared since the
+ * previous scan, and does not read the directory at all if it has not been modified. Any number
+ * of observations can be stored in the same directory. Queries take logarithmic time in the
+ * number of files.
+ *
+ * The object is not thread safe. `parse_mwa_dat_files` keeps a catalogue of each directory it
+ * is called on for the lifetime of the process, so that only the first call scans it in full.
+ *
+ * Example:
+ *      ObservationCatalogue catalogue {"/data/1240826896"};
+ *      // Ten seconds from the start of the first observation.
+ *      auto seconds = catalogue.select(catalogue.observations().front(), 0, 10);
+ */
+class ObservationCatalogue {
+
+    // Files of a second of observation, by coarse channel.
+    using Second = std::map<unsigned int, std::string>;
+
+    struct Observation {
+        std::map<time_t, Second> seconds;
+        // GPS seconds in increasing order, for access by position.
+        std::vector<time_t> order;
+    };
+
+    struct Entry {
+        std::string obs_id;
+        time_t gps_second;
+        unsigned int coarse_channel;
+        // Last scan the file was seen in.
+        size_t generation;
+    };
+
+    std::string directory;
+    std::map<std::string, Observation> _observations;
+    // Paths of the files found in the directory, to recognise new and removed ones when refreshing.
+    std::unordered_map<std::string, Entry> names;
+    struct timespec dir_mtime {};
+    time_t scan_time {0};
+    size_t generation {0};
+    size_t n_files {0};
+
+    void insert(const std::string& path, const Entry& entry);
+    void erase(const std::string& path);
+    std::vector<DatFile> make_second(const std::string& obs_id, time_t gps_second, const Second& files) const;
+
+    public:
+    /**
+     * @brief Create an empty catalogue, to be populated with `add`.
+     */
+    ObservationCatalogue() {}
+
+    /**
+     * @brief Index the .dat files in `directory`.
+     */
+    explicit ObservationCatalogue(const std::string& directory);
+
+    /**
+     * @brief Parse the name of a .dat file. Only the name is used: the file is not accessed.
+     * @return `false` if `name` is not the name of an MWA Phase I .dat file.
+     */
+    static bool parse_name(const std::string& name, std::string& obs_id, time_t& gps_second, unsigned int& coarse_channel);
+
+    /**
+     * @brief Add a file to the catalogue, e.g. one not in the indexed directory.
+     * @return `false` if `path` is not the path to an MWA Phase I .dat file, or is already in
+     * the catalogue.
+     */
+    bool add(const std::string& path);
+
+    /**
+     * @brief Index the files added to or removed from the directory since the previous scan.
+     * @return the number of new files.
+     */
+    size_t refresh();
+
+    /**
+     * @return the identifiers of the observations in the catalogue, in increasing order.
+     */
+    std::vector<std::string> observations() const;
+
+    /**
+     * @return the number of seconds of observation `obs_id`, complete or not.
+     */
+    size_t n_seconds(const std::string& obs_id) const;
+
+    /**
+     * @return the total number of seconds, over all the observations.
+     */
+    size_t n_seconds() const;
+
+    size_t size() const { return n_files; }
+
+    /**
+     * @return the path to the file of coarse channel `coarse_channel` at GPS second `gps_second`
+     * of observation `obs_id`, or an empty string if it is not in the catalogue.
+     */
+    std::string find(const std::string& obs_id, time_t gps_second, unsigned int coarse_channel) const;
+
+    /**
+     * @brief Files of `count` consecutive seconds of observation `obs_id`, starting from the
+     * `offset`-th one, one group of 24 files sorted by coarse channel for each second. A negative
+     * `count` selects all the seconds from `offset` to the end of the observation.
+     *
+     * @throw std::invalid_argument if the range is not within the observation or a selected second
+     * does not have a file for each of the 24 coarse channels.
+     */
+    std::vector<std::vector<DatFile>> select(const std::string& obs_id, size_t offset, int count = -1) const;
+
+    /**
+     * @brief Same as above, for the seconds of `obs_id` in the GPS time range [first, last].
+     */
+    std::vector<std::vector<DatFile>> select_time_range(const std::string& obs_id, time_t first, time_t last) const;
+
+    /**
+     * @brief Same as `select`, with `offset` counting the seconds of all the observations one
+     * after the other, in increasing order of observation identifier. The selected range may
+     * span several observations.
+     */
+    std::vector<std::vector<DatFile>> select_all(size_t offset, int count = -1) const;
+};
+
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdexcept>
+#include "observation_prefetcher.hpp"
+
+
+ObservationPrefetcher::ObservationPrefetcher(const std::vector<std::vector<DatFile>>& seconds, unsigned int nIntegrationSteps,
+        unsigned int depth, const BatchLoadOptions& options) :
+        seconds {seconds}, nIntegrationSteps {nIntegrationSteps}, options {options} {
+    if(nIntegrationSteps == 0 || depth == 0)
+        throw std::invalid_argument {"ObservationPrefetcher: `nIntegrationSteps` and `depth` must be positive numbers."};
+    #ifndef __GPU__
+    if(options.use_gpu)
+        throw std::invalid_argument {"ObservationPrefetcher: cannot load data on GPU on a CPU only build of the software."};
+    #else
+    if(options.use_gpu) gpuGetDevice(&device);
+    #endif
+    if(seconds.empty()) return;
+    if(!this->options.io_pool){
+        io_pool = std::make_unique<ThreadPool>(this->options.n_io_threads);
+        this->options.io_pool = io_pool.get();
+    }
+    // One buffer for the second held by the consumer, `depth` for the ones being read ahead.
+    const size_t nSlots {std::min<size_t>(static_cast<size_t>(depth) + 1, seconds.size())};
+    slots.resize(nSlots);
+    states.resize(nSlots, SlotState::FREE);
+    loader = std::thread {&ObservationPrefetcher::load_seconds, this};
+}
+
+
+
+ObservationPrefetcher::~ObservationPrefetcher(){
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        stop = true;
+    }
+    cv.notify_all();
+    if(loader.joinable()) loader.join();
+}
+
+
+
+void ObservationPrefetcher::load_seconds(){
+    try {
+        #ifdef __GPU__
+        // The loader thread must allocate on the same device as the thread that created the prefetcher.
+        if(options.use_gpu) gpuSetDevice(device);
+        #endif
+        for(size_t s {0}; s < seconds.size(); s++){
+            const size_t slot {s % slots.size()};
+            clock::time_point t_wait = clock::now();
+            {
+                std::unique_lock<std::mutex> lock {mutex};
+                cv.wait(lock, [&](){ return stop || states[slot] == SlotState::FREE; });
+                if(stop) return;
+                states[slot] = SlotState::LOADING;
+                _stats.loader_wait_time += std::chrono::duration<double>(clock::now() - t_wait).count();
+            }
+            VoltageLoadStats loadStats;
+            slots[slot].load(seconds[s], nIntegrationSteps, options, &loadStats);
+            {
+                std::lock_guard<std::mutex> lock {mutex};
+                states[slot] = SlotState::READY;
+                _stats.batches_loaded++;
+                _stats.bytes_read += loadStats.bytes_read;
+                _stats.load_time += loadStats.total_time;
+            }
+            cv.notify_all();
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            error = std::current_exception();
+        }
+        cv.notify_all();
+    }
+}
+
+
+
+const VoltageBatch* ObservationPrefetcher::next(){
+    clock::time_point t_call = clock::now();
+    std::unique_lock<std::mutex> lock {mutex};
+    if(consumer_slot >= 0){
+        _stats.process_time += std::chrono::duration<double>(t_call - last_returned).count();
+        states[consumer_slot] = SlotState::FREE;
+        consumer_slot = -1;
+        cv.notify_all();
+    }
+    if(next_second >= seconds.size()) return nullptr;
+    const size_t slot {next_second % slots.size()};
+    cv.wait(lock, [&](){ return states[slot] == SlotState::READY || error; });
+    if(states[slot] != SlotState::READY) std::rethrow_exception(error);
+    states[slot] = SlotState::IN_USE;
+    consumer_slot = static_cast<long long>(slot);
+    next_second++;
+    last_returned = clock::now();
+    _stats.consumer_wait_time += std::chrono::duration<double>(last_returned - t_call).count();
+    return &slots[slot];
+}
+
+
+
+size_t ObservationPrefetcher::ready() const {
+    std::lock_guard<std::mutex> lock {mutex};
+    size_t n {0};
+    for(const auto& state : states)
+        if(state == SlotState::READY) n++;
+    return n;
+}
+
+
+
+PrefetchStats ObservationPrefetcher::stats() const {
+    std::lock_guard<std::mutex> lock {mutex};
+    return _stats;
+}
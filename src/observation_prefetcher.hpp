@@ -0,0 +1,127 @@
+#ifndef __OBSERVATION_PREFETCHER_H__
+#define __OBSERVATION_PREFETCHER_H__
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+#include "voltage_batch.hpp"
+
+/**
+ * @brief Timing information collected by `ObservationPrefetcher`. All times are in seconds.
+ */
+struct PrefetchStats {
+    // Number of seconds of observation loaded so far.
+    size_t batches_loaded {0};
+    // Total number of bytes read from disk.
+    size_t bytes_read {0};
+    // Time spent by the loader reading and expanding files.
+    double load_time {0.0};
+    // Time the loader spent waiting for a free buffer, i.e. blocked by a slow consumer.
+    double loader_wait_time {0.0};
+    // Time the consumer spent in `next` waiting for data, i.e. blocked by slow I/O.
+    double consumer_wait_time {0.0};
+    // Time the consumer spent between consecutive calls to `next`, i.e. processing data.
+    double process_time {0.0};
+
+    // Average throughput of the loader, in bytes per second.
+    double load_bandwidth() const { return load_time > 0.0 ? bytes_read / load_time : 0.0; }
+};
+
+
+/**
+ * @brief Read ahead the seconds of an MWA observation while the caller processes the current one.
+ *
+ * The prefetcher takes the groups of .dat files returned by `parse_mwa_dat_files` and loads them,
+ * in order, on a background thread into a fixed set of `depth + 1` recycled `VoltageBatch`
+ * buffers. While the caller holds second N, seconds N+1, ..., N+depth are loaded. When all the
+ * buffers are full, the loader blocks until the caller releases one (backpressure), so memory
+ * usage is bounded. In the steady state, throughput is set by the slower of disk and compute;
+ * `stats()` tells which one it is.
+ *
+ * Example:
+ *      ObservationPrefetcher prefetcher {parse_mwa_dat_files(directory), 100, 2};
+ *      while(const VoltageBatch *second = prefetcher.next()){
+ *          // process second `prefetcher.current_index()`.
+ *      }
+ */
+class ObservationPrefetcher {
+
+    private:
+    enum class SlotState {FREE, LOADING, READY, IN_USE};
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::vector<DatFile>> seconds;
+    unsigned int nIntegrationSteps;
+    BatchLoadOptions options;
+    std::unique_ptr<ThreadPool> io_pool;
+    // GPU the batches are loaded on, when `options.use_gpu` is set.
+    int device {0};
+
+    std::vector<VoltageBatch> slots;
+    std::vector<SlotState> states;
+    size_t next_second {0};
+    long long consumer_slot {-1};
+    clock::time_point last_returned;
+
+    PrefetchStats _stats;
+    std::thread loader;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    bool stop {false};
+    std::exception_ptr error;
+
+    void load_seconds();
+
+    public:
+    /**
+     * @brief Start prefetching.
+     *
+     * @param seconds groups of .dat files to load, one per second of observation, in processing order.
+     * @param nIntegrationSteps number of timesteps to integrate over when/if data will be correlated.
+     * @param depth maximum number of seconds loaded ahead of the one held by the caller.
+     * @param options options passed to `VoltageBatch::load`. If `options.io_pool` is null, the
+     * prefetcher creates its own I/O pool, shared by all the loads.
+     */
+    ObservationPrefetcher(const std::vector<std::vector<DatFile>>& seconds, unsigned int nIntegrationSteps,
+            unsigned int depth = 2, const BatchLoadOptions& options = {});
+
+    ~ObservationPrefetcher();
+
+    ObservationPrefetcher(const ObservationPrefetcher&) = delete;
+    ObservationPrefetcher& operator=(const ObservationPrefetcher&) = delete;
+
+    /**
+     * @brief Return the next second of observation, or `nullptr` when all of them were returned.
+     *
+     * The returned batch stays valid until the following call to `next`, when its buffer is
+     * given back to the loader. Errors raised while loading are rethrown here.
+     */
+    const VoltageBatch* next();
+
+    /**
+     * @return the number of seconds loaded and waiting to be returned by `next`. A value
+     * constantly equal to the depth means the consumer is the bottleneck; zero means I/O is.
+     */
+    size_t ready() const;
+
+    /**
+     * @return the number of seconds in the observation.
+     */
+    size_t size() const { return seconds.size(); }
+
+    /**
+     * @return the index of the second last returned by `next`.
+     */
+    size_t current_index() const { return next_second == 0 ? 0 : next_second - 1; }
+
+    /**
+     * @return a snapshot of the timing information collected so far.
+     */
+    PrefetchStats stats() const;
+};
+
+#endif
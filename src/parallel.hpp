@@ -0,0 +1,154 @@
+#ifndef __ASTROIO_PARALLEL_H__
+#define __ASTROIO_PARALLEL_H__
+
+#include <thread>
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <type_traits>
+#include <stdexcept>
+#include <cstddef>
+
+/**
+ * @brief Return the number of worker threads to use when the caller passes `n_threads`.
+ * A value of zero means "use all the hardware threads available".
+ */
+inline unsigned int resolve_n_threads(unsigned int n_threads){
+    if(n_threads > 0) return n_threads;
+    unsigned int hw {std::thread::hardware_concurrency()};
+    return hw > 0 ? hw : 1u;
+}
+
+
+/**
+ * @brief Split the range [0, n_items) in contiguous, equally sized partitions and process each
+ * of them on a separate thread.
+ *
+ * @param n_items number of work items.
+ * @param fn callable with signature `void(size_t begin, size_t end)`, invoked once per partition.
+ * @param n_threads maximum number of threads to use (0 = all hardware threads).
+ *
+ * The first exception raised by a worker is rethrown on the calling thread once all the workers
+ * have terminated.
+ */
+template <typename F>
+void parallel_for(size_t n_items, F&& fn, unsigned int n_threads = 0){
+    if(n_items == 0) return;
+    const size_t n_workers {std::min<size_t>(resolve_n_threads(n_threads), n_items)};
+    if(n_workers == 1){
+        fn(size_t {0}, n_items);
+        return;
+    }
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(n_workers);
+    const size_t items_per_worker {n_items / n_workers}, remainder {n_items % n_workers};
+    size_t begin {0};
+    for(size_t w {0}; w < n_workers; w++){
+        const size_t end {begin + items_per_worker + (w < remainder ? 1 : 0)};
+        workers.emplace_back([&fn, &errors, w, begin, end](){
+            try {
+                fn(begin, end);
+            } catch (...) {
+                errors[w] = std::current_exception();
+            }
+        });
+        begin = end;
+    }
+    for(auto& worker : workers) worker.join();
+    for(auto& error : errors)
+        if(error) std::rethrow_exception(error);
+}
+
+
+
+/**
+ * @brief A fixed-size pool of worker threads executing tasks in FIFO order.
+ *
+ * The number of threads, and hence the number of tasks running concurrently, is bounded by the
+ * value given at construction. This makes the pool suitable to throttle I/O, where issuing too
+ * many concurrent requests degrades performance. The destructor waits for all the queued tasks
+ * to complete.
+ *
+ * Example:
+ *      ThreadPool pool {4};
+ *      auto result = pool.submit([](){ return 42; });
+ *      int value = result.get(); // rethrows the exception raised by the task, if any.
+ */
+class ThreadPool {
+
+    private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop {false};
+
+    void run(){
+        while(true){
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock {mutex};
+                cv.wait(lock, [this](){ return stop || !tasks.empty(); });
+                if(tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    public:
+    /**
+     * @brief Start `n_threads` worker threads (0 = all hardware threads).
+     */
+    explicit ThreadPool(unsigned int n_threads = 0){
+        const unsigned int n_workers {resolve_n_threads(n_threads)};
+        workers.reserve(n_workers);
+        for(unsigned int i {0}; i < n_workers; i++)
+            workers.emplace_back(&ThreadPool::run, this);
+    }
+
+    ~ThreadPool(){
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            stop = true;
+        }
+        cv.notify_all();
+        for(auto& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Queue a callable for execution.
+     * @return a future holding the value returned, or the exception raised, by `fn`.
+     */
+    template <typename F>
+    std::future<std::invoke_result_t<std::decay_t<F>>> submit(F&& fn){
+        using R = std::invoke_result_t<std::decay_t<F>>;
+        // std::function requires copyable targets, hence the shared_ptr.
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+        std::future<R> result {task->get_future()};
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            if(stop) throw std::runtime_error {"ThreadPool::submit: the pool is shutting down."};
+            tasks.emplace([task](){ (*task)(); });
+        }
+        cv.notify_one();
+        return result;
+    }
+
+    /**
+     * @return the number of worker threads.
+     */
+    size_t size() const { return workers.size(); }
+};
+
+#endif
@@ -0,0 +1,331 @@
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "pixel_encoding.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifdef __GPU__
+#define HOST_DEVICE __host__ __device__
+#else
+#define HOST_DEVICE
+#endif
+
+namespace {
+
+    HOST_DEVICE inline uint32_t float_bits(float value){
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    HOST_DEVICE inline float bits_float(uint32_t bits){
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // IEEE half precision bits of `value`, rounded to the nearest even.
+    HOST_DEVICE inline uint16_t float_to_half(float value){
+        const uint32_t x {float_bits(value)};
+        const uint32_t sign {(x >> 16) & 0x8000u}, abs {x & 0x7fffffffu};
+        // NaN (kept quiet) and infinity.
+        if(abs >= 0x7f800000u) return static_cast<uint16_t>(sign | (abs > 0x7f800000u ? 0x7e00u : 0x7c00u));
+        // 65520 and above round to infinity.
+        if(abs >= 0x477ff000u) return static_cast<uint16_t>(sign | 0x7c00u);
+        if(abs < 0x38800000u){
+            // Below 2^-14 the result is subnormal; 2^-25 and below round to zero.
+            if(abs <= 0x33000000u) return static_cast<uint16_t>(sign);
+            const uint32_t shift {126u - (abs >> 23)};
+            const uint32_t mantissa {(abs & 0x7fffffu) | 0x800000u};
+            uint32_t result {mantissa >> shift};
+            const uint32_t rest {mantissa & ((1u << shift) - 1)}, half {1u << (shift - 1)};
+            if(rest > half || (rest == half && (result & 1u))) result++;
+            return static_cast<uint16_t>(sign | result);
+        }
+        // Rebias the exponent from 127 to 15; a carry out of the mantissa correctly bumps it.
+        const uint32_t rebiased {abs - 0x38000000u};
+        uint32_t result {rebiased >> 13};
+        const uint32_t rest {rebiased & 0x1fffu};
+        if(rest > 0x1000u || (rest == 0x1000u && (result & 1u))) result++;
+        return static_cast<uint16_t>(sign | result);
+    }
+
+    HOST_DEVICE inline float half_to_float(uint16_t h){
+        const uint32_t sign {static_cast<uint32_t>(h & 0x8000u) << 16};
+        uint32_t exponent {(h >> 10) & 0x1fu}, mantissa {h & 0x3ffu};
+        if(exponent == 0x1f) return bits_float(sign | 0x7f800000u | (mantissa << 13));
+        if(exponent == 0){
+            if(mantissa == 0) return bits_float(sign);
+            // Subnormal: normalise it.
+            exponent = 113;
+            while(!(mantissa & 0x400u)){
+                mantissa <<= 1;
+                exponent--;
+            }
+            return bits_float(sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13));
+        }
+        return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+    }
+
+    // The upper 16 bits of `value`, rounded to the nearest even.
+    HOST_DEVICE inline uint16_t float_to_bfloat16(float value){
+        const uint32_t x {float_bits(value)};
+        if((x & 0x7fffffffu) > 0x7f800000u) return static_cast<uint16_t>((x >> 16) | 0x40u);
+        return static_cast<uint16_t>((x + 0x7fffu + ((x >> 16) & 1u)) >> 16);
+    }
+
+    HOST_DEVICE inline int16_t float_to_int16(float value, float inv_scale){
+        float v {value * inv_scale};
+        if(v != v) return INT16_BLANK;
+        v = v > 32767.0f ? 32767.0f : (v < -32767.0f ? -32767.0f : v);
+        return static_cast<int16_t>(rintf(v));
+    }
+
+    HOST_DEVICE inline int16_t encode_value(float value, PixelEncoding encoding, float inv_scale){
+        switch(encoding){
+            case PixelEncoding::INT16_SCALED: return float_to_int16(value, inv_scale);
+            case PixelEncoding::FLOAT16: return static_cast<int16_t>(float_to_half(value));
+            default: return static_cast<int16_t>(float_to_bfloat16(value));
+        }
+    }
+
+    HOST_DEVICE inline float decode_value(int16_t value, PixelEncoding encoding, float scale){
+        switch(encoding){
+            case PixelEncoding::INT16_SCALED:
+                return value == INT16_BLANK ? bits_float(0x7fc00000u) : value * scale;
+            case PixelEncoding::FLOAT16: return half_to_float(static_cast<uint16_t>(value));
+            default: return bits_float(static_cast<uint32_t>(static_cast<uint16_t>(value)) << 16);
+        }
+    }
+
+
+    /*
+        Vectorised conversions. Each returns the number of values it converted, a multiple of
+        its vector width; the remaining ones are converted by the scalar code above.
+    */
+    size_t encode_int16_vector(const float *input, size_t n, float inv_scale, int16_t *output){
+        size_t i {0};
+        #if defined(__AVX2__)
+        const __m256 inv {_mm256_set1_ps(inv_scale)}, hi {_mm256_set1_ps(32767.0f)}, lo {_mm256_set1_ps(-32767.0f)};
+        for(; i + 16 <= n; i += 16){
+            // min and max return their second operand when the first is NaN, so NaNs survive
+            // the clamp and convert to INT_MIN, which saturates to INT16_BLANK.
+            __m256 a {_mm256_max_ps(lo, _mm256_min_ps(hi, _mm256_mul_ps(_mm256_loadu_ps(input + i), inv)))};
+            __m256 b {_mm256_max_ps(lo, _mm256_min_ps(hi, _mm256_mul_ps(_mm256_loadu_ps(input + i + 8), inv)))};
+            // pack works within 128-bit lanes, so lanes must be put back in order.
+            __m256i packed {_mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b))};
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_permute4x64_epi64(packed, 0xd8));
+        }
+        #elif defined(__SSE2__)
+        const __m128 inv {_mm_set1_ps(inv_scale)}, hi {_mm_set1_ps(32767.0f)}, lo {_mm_set1_ps(-32767.0f)};
+        for(; i + 8 <= n; i += 8){
+            __m128 a {_mm_max_ps(lo, _mm_min_ps(hi, _mm_mul_ps(_mm_loadu_ps(input + i), inv)))};
+            __m128 b {_mm_max_ps(lo, _mm_min_ps(hi, _mm_mul_ps(_mm_loadu_ps(input + i + 4), inv)))};
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+        }
+        #elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float32x4_t inv {vdupq_n_f32(inv_scale)}, hi {vdupq_n_f32(32767.0f)}, lo {vdupq_n_f32(-32767.0f)};
+        const int32x4_t blank {vdupq_n_s32(INT16_BLANK)};
+        for(; i + 8 <= n; i += 8){
+            int16x4_t halves[2];
+            for(int h {0}; h < 2; h++){
+                const float32x4_t v {vmulq_f32(vld1q_f32(input + i + 4 * h), inv)};
+                const int32x4_t q {vcvtnq_s32_f32(vmaxq_f32(lo, vminq_f32(hi, v)))};
+                // vcvtnq converts NaNs to 0.
+                halves[h] = vqmovn_s32(vbslq_s32(vceqq_f32(v, v), q, blank));
+            }
+            vst1q_s16(output + i, vcombine_s16(halves[0], halves[1]));
+        }
+        #else
+        (void) input; (void) n; (void) inv_scale; (void) output;
+        #endif
+        return i;
+    }
+
+
+
+    size_t encode_half_vector(const float *input, size_t n, int16_t *output){
+        size_t i {0};
+        #if defined(__F16C__)
+        for(; i + 8 <= n; i += 8)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm256_cvtps_ph(_mm256_loadu_ps(input + i), _MM_FROUND_TO_NEAREST_INT));
+        #elif defined(__ARM_NEON) && defined(__aarch64__)
+        for(; i + 4 <= n; i += 4)
+            vst1_s16(output + i, vreinterpret_s16_f16(vcvt_f16_f32(vld1q_f32(input + i))));
+        #else
+        (void) input; (void) n; (void) output;
+        #endif
+        return i;
+    }
+
+
+
+    size_t decode_half_vector(const int16_t *input, size_t n, float *output){
+        size_t i {0};
+        #if defined(__F16C__)
+        for(; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(output + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i))));
+        #elif defined(__ARM_NEON) && defined(__aarch64__)
+        for(; i + 4 <= n; i += 4)
+            vst1q_f32(output + i, vcvt_f32_f16(vreinterpret_f16_s16(vld1_s16(input + i))));
+        #else
+        (void) input; (void) n; (void) output;
+        #endif
+        return i;
+    }
+
+
+
+    size_t encode_bfloat16_vector(const float *input, size_t n, int16_t *output){
+        size_t i {0};
+        #if defined(__AVX2__)
+        const __m256i one {_mm256_set1_epi32(1)}, bias {_mm256_set1_epi32(0x7fff)}, quiet {_mm256_set1_epi32(0x40)};
+        auto round = [&](const float *in){
+            const __m256 f {_mm256_loadu_ps(in)};
+            const __m256i x {_mm256_castps_si256(f)}, upper {_mm256_srli_epi32(x, 16)};
+            const __m256i rounded {_mm256_srli_epi32(_mm256_add_epi32(x, _mm256_add_epi32(bias, _mm256_and_si256(upper, one))), 16)};
+            const __m256i nan {_mm256_castps_si256(_mm256_cmp_ps(f, f, _CMP_UNORD_Q))};
+            return _mm256_blendv_epi8(rounded, _mm256_or_si256(upper, quiet), nan);
+        };
+        for(; i + 16 <= n; i += 16){
+            // Values fit in 16 unsigned bits, so the saturating pack keeps them as they are.
+            __m256i packed {_mm256_packus_epi32(round(input + i), round(input + i + 8))};
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_permute4x64_epi64(packed, 0xd8));
+        }
+        #else
+        (void) input; (void) n; (void) output;
+        #endif
+        return i;
+    }
+}
+
+
+
+float max_abs_value(const float *data, size_t n){
+    float result {0.0f};
+    size_t i {0};
+    #if defined(__AVX2__)
+    const __m256 abs_mask {_mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff))};
+    __m256 acc {_mm256_setzero_ps()};
+    // max returns its second operand when the first is NaN, which is therefore skipped.
+    for(; i + 8 <= n; i += 8) acc = _mm256_max_ps(_mm256_and_ps(_mm256_loadu_ps(data + i), abs_mask), acc);
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    for(float v : lanes) result = v > result ? v : result;
+    #elif defined(__SSE2__)
+    const __m128 abs_mask {_mm_castsi128_ps(_mm_set1_epi32(0x7fffffff))};
+    __m128 acc {_mm_setzero_ps()};
+    for(; i + 4 <= n; i += 4) acc = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(data + i), abs_mask), acc);
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    for(float v : lanes) result = v > result ? v : result;
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t acc {vdupq_n_f32(0.0f)};
+    // maxnm ignores NaNs.
+    for(; i + 4 <= n; i += 4) acc = vmaxnmq_f32(acc, vabsq_f32(vld1q_f32(data + i)));
+    result = vmaxnmvq_f32(acc);
+    #endif
+    for(; i < n; i++){
+        const float v {std::fabs(data[i])};
+        if(v > result) result = v;
+    }
+    return result;
+}
+
+
+
+void encode_pixels(const float *input, size_t n, PixelEncoding encoding, float scale, int16_t *output){
+    if(encoding == PixelEncoding::FLOAT32) throw std::invalid_argument {"encode_pixels: FLOAT32 is not a 16-bit encoding."};
+    ASTROIO_TIMED_SCOPE("pixel_encode", n * sizeof(float), n);
+    const float inv_scale {1.0f / scale};
+    size_t i {0};
+    switch(encoding){
+        case PixelEncoding::INT16_SCALED: i = encode_int16_vector(input, n, inv_scale, output); break;
+        case PixelEncoding::FLOAT16: i = encode_half_vector(input, n, output); break;
+        default: i = encode_bfloat16_vector(input, n, output); break;
+    }
+    for(; i < n; i++) output[i] = encode_value(input[i], encoding, inv_scale);
+}
+
+
+
+void decode_pixels(const int16_t *input, size_t n, PixelEncoding encoding, float scale, float *output){
+    if(encoding == PixelEncoding::FLOAT32) throw std::invalid_argument {"decode_pixels: FLOAT32 is not a 16-bit encoding."};
+    ASTROIO_TIMED_SCOPE("pixel_decode", n * sizeof(int16_t), n);
+    size_t i {encoding == PixelEncoding::FLOAT16 ? decode_half_vector(input, n, output) : 0};
+    for(; i < n; i++) output[i] = decode_value(input[i], encoding, scale);
+}
+
+
+
+#ifdef __GPU__
+/*
+    Largest absolute value of the input, stored as the bits of a float in `result`: the bits of
+    non-negative floats compare as the floats do, hence the integer atomic. NaNs are skipped.
+*/
+__global__ void max_abs_kernel(const float *input, size_t n, unsigned int *result){
+    __shared__ float block_max[1024];
+    const size_t start_index {blockDim.x * blockIdx.x + threadIdx.x};
+    const size_t grid_size {gridDim.x * blockDim.x};
+    float m {0.0f};
+    for(size_t i {start_index}; i < n; i += grid_size){
+        const float v {fabsf(input[i])};
+        if(v > m) m = v;
+    }
+    block_max[threadIdx.x] = m;
+    __syncthreads();
+    for(unsigned int s {blockDim.x / 2}; s > 0; s >>= 1){
+        if(threadIdx.x < s && block_max[threadIdx.x + s] > block_max[threadIdx.x]) block_max[threadIdx.x] = block_max[threadIdx.x + s];
+        __syncthreads();
+    }
+    if(threadIdx.x == 0) atomicMax(result, __float_as_uint(block_max[0]));
+}
+
+
+
+// `max_bits` is the output of `max_abs_kernel`, only read for INT16_SCALED.
+__global__ void encode_kernel(const float *input, size_t n, PixelEncoding encoding, const unsigned int *max_bits, int16_t *output){
+    const float scale {encoding == PixelEncoding::INT16_SCALED ? int16_scale(__uint_as_float(*max_bits)) : 1.0f};
+    const float inv_scale {1.0f / scale};
+    const size_t start_index {blockDim.x * blockIdx.x + threadIdx.x};
+    const size_t grid_size {gridDim.x * blockDim.x};
+    for(size_t i {start_index}; i < n; i += grid_size)
+        output[i] = encode_value(input[i], encoding, inv_scale);
+}
+
+
+
+// Replace the largest absolute value, stored by `max_abs_kernel`, with the scale it gives.
+__global__ void store_scale_kernel(float *scale){
+    *scale = int16_scale(__uint_as_float(*reinterpret_cast<unsigned int*>(scale)));
+}
+
+
+
+void encode_pixels_gpu(const float *input, size_t n, PixelEncoding encoding, int16_t *output, float *scale, gpuStream_t stream){
+    if(encoding == PixelEncoding::FLOAT32) throw std::invalid_argument {"encode_pixels_gpu: FLOAT32 is not a 16-bit encoding."};
+    const bool scaled {encoding == PixelEncoding::INT16_SCALED};
+    if(scaled && !scale) throw std::invalid_argument {"encode_pixels_gpu: INT16_SCALED requires a scale."};
+    ASTROIO_GPU_TIMED_SCOPE("pixel_encode_gpu", stream, n * sizeof(float), n);
+    const unsigned int n_threads {1024};
+    const unsigned int n_blocks {static_cast<unsigned int>(std::max<size_t>(1, std::min<size_t>((n + n_threads - 1) / n_threads, 65535)))};
+    unsigned int *max_bits {reinterpret_cast<unsigned int*>(scale)};
+    if(scaled){
+        gpuMemsetAsync(max_bits, 0, sizeof(unsigned int), stream);
+        max_abs_kernel<<<n_blocks, n_threads, 0, stream>>>(input, n, max_bits);
+        gpuCheckLastError();
+    }
+    encode_kernel<<<n_blocks, n_threads, 0, stream>>>(input, n, encoding, scaled ? max_bits : nullptr, output);
+    gpuCheckLastError();
+    if(scaled){
+        store_scale_kernel<<<1, 1, 0, stream>>>(scale);
+        gpuCheckLastError();
+    }
+}
+#endif
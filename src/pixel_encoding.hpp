@@ -0,0 +1,63 @@
+#ifndef __PIXEL_ENCODING_H__
+#define __PIXEL_ENCODING_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#ifdef __GPU__
+#include "gpu_macros.hpp"
+#endif
+
+/**
+ * @brief How floating point pixels are stored in FITS images.
+ *
+ * - FLOAT32: 32-bit IEEE floats (BITPIX = -32), the default.
+ * - INT16_SCALED: 16-bit integers (BITPIX = 16) with the BSCALE keyword set so that the largest
+ *   absolute value of the image maps to 32767. Any FITS reader recovers the physical values.
+ *   NaNs are stored as -32768, the value of the BLANK keyword.
+ * - FLOAT16, BFLOAT16: IEEE half precision or bfloat16 values, whose bits are stored as 16-bit
+ *   integers. The PIXENC keyword names the encoding; `FITS` decodes them on reading.
+ */
+enum class PixelEncoding {FLOAT32, INT16_SCALED, FLOAT16, BFLOAT16};
+
+// Value INT16_SCALED images store in place of NaNs.
+constexpr int16_t INT16_BLANK {-32768};
+
+
+/**
+ * @brief The BSCALE with which INT16_SCALED stores values up to `max_abs` in absolute value.
+ */
+#ifdef __GPU__
+__host__ __device__
+#endif
+inline float int16_scale(float max_abs){
+    return (max_abs > 0.0f && max_abs <= 3.402823466e+38f) ? max_abs / 32767.0f : 1.0f;
+}
+
+/**
+ * @brief Largest absolute value among the `n` values at `data`, ignoring NaNs.
+ */
+float max_abs_value(const float *data, size_t n);
+
+/**
+ * @brief Convert `n` floats to the 16-bit `encoding`, which must not be FLOAT32. `scale` is the
+ * BSCALE of INT16_SCALED pixels (see `int16_scale`) and is ignored by the other encodings.
+ * Values are rounded to the nearest representable one; INT16_SCALED saturates values out of range.
+ */
+void encode_pixels(const float *input, size_t n, PixelEncoding encoding, float scale, int16_t *output);
+
+/**
+ * @brief Inverse of `encode_pixels`.
+ */
+void decode_pixels(const int16_t *input, size_t n, PixelEncoding encoding, float scale, float *output);
+
+#ifdef __GPU__
+/**
+ * @brief Same as `encode_pixels`, for data resident on GPU, queued on `stream`. With INT16_SCALED
+ * the scale is computed on the GPU from the data and stored at `scale`, device memory holding a
+ * float, so that it can be downloaded together with the pixels; `scale` can be null otherwise.
+ */
+void encode_pixels_gpu(const float *input, size_t n, PixelEncoding encoding, int16_t *output, float *scale, gpuStream_t stream = 0);
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __ASTROIO_TRANSPOSE_H__
+#define __ASTROIO_TRANSPOSE_H__
+
+#include <cstddef>
+#include <algorithm>
+#include "parallel.hpp"
+
+/**
+ * @brief Cache-blocked transpose of the two outer axes of a three dimensional array.
+ *
+ * `input` has layout [rows][cols][inner] and the columns in [first_col, last_col) are written to
+ * `output` with layout [last_col - first_col][rows][inner]. The `inner` elements are kept
+ * contiguous and copied as a unit. Work is split in square tiles so that both the input rows
+ * being read and the output rows being written stay in cache, which matters when `cols * inner`
+ * elements span many pages (e.g. the MWA baseline axis). Tiles are distributed across at most
+ * `n_threads` threads with `parallel_for`; transposes of a few tiles run on the calling thread,
+ * where starting threads would cost more than the copy.
+ *
+ * Transposing a range of columns at a time allows a large array to be reordered in pieces,
+ * with a small output buffer.
+ *
+ * @param input array to be transposed.
+ * @param rows number of rows of `input`.
+ * @param cols number of columns of `input`.
+ * @param inner number of contiguous elements making up a matrix entry.
+ * @param first_col index of the first column to transpose.
+ * @param last_col index past the last column to transpose.
+ * @param output array of at least `(last_col - first_col) * rows * inner` elements.
+ * @param n_threads maximum number of threads to use (0 = all hardware threads).
+ */
+template <typename T>
+void transpose_blocked(const T *input, size_t rows, size_t cols, size_t inner, size_t first_col, size_t last_col,
+        T *output, unsigned int n_threads = 0){
+    // Side of a tile, in entries. 32 x 32 entries of 4 complex floats are 32 KiB in total.
+    constexpr size_t tile {32};
+    // Tiles copied by each thread at least.
+    constexpr size_t min_tiles_per_thread {16};
+    const size_t n_cols {last_col - first_col};
+    const size_t n_row_tiles {(rows + tile - 1) / tile}, n_col_tiles {(n_cols + tile - 1) / tile};
+    const size_t n_tiles {n_row_tiles * n_col_tiles};
+    const unsigned int n_workers {static_cast<unsigned int>(std::min<size_t>(resolve_n_threads(n_threads),
+        std::max<size_t>(1, n_tiles / min_tiles_per_thread)))};
+    // Tiles are numbered down the columns of `input`, so that consecutive tiles fill the same
+    // rows of `output`.
+    parallel_for(n_tiles, [&](size_t first_tile, size_t last_tile){
+        for(size_t t {first_tile}; t < last_tile; t++){
+            const size_t c0 {first_col + t / n_row_tiles * tile}, c1 {std::min(c0 + tile, last_col)};
+            const size_t r0 {t % n_row_tiles * tile}, r1 {std::min(r0 + tile, rows)};
+            for(size_t c {c0}; c < c1; c++){
+                T *out {output + ((c - first_col) * rows + r0) * inner};
+                const T *in {input + (r0 * cols + c) * inner};
+                for(size_t r {r0}; r < r1; r++, out += inner, in += cols * inner)
+                    std::copy(in, in + inner, out);
+            }
+        }
+    }, n_workers);
+}
+
+
+/**
+ * @brief Transpose the two outer axes of the whole array. See the function above.
+ */
+template <typename T>
+void transpose_blocked(const T *input, size_t rows, size_t cols, size_t inner, T *output, unsigned int n_threads = 0){
+    transpose_blocked(input, rows, cols, inner, 0, cols, output, n_threads);
+}
+
+#endif
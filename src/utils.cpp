@@ -8,29 +8,19 @@
 
 void read_data_from_file(std::string filename, char*& data, size_t& file_size){
     std::ifstream f;
-    f.open(filename, std::ios::binary);
+    f.open(filename, std::ios::binary | std::ios::ate);
     if(!f){
         std::cerr << "read_data_from_file: error while reading the file." << std::endl;
         data = nullptr;
         return;
     }
-    size_t buff_size {4096};
-    data = new char[buff_size];
-    size_t bytes_read {0};
-    const size_t read_size {4096};
-    while(f){
-        // check if we need to reallocate memory
-         if(bytes_read + read_size > buff_size){
-            buff_size *= 2;
-            char *tmp = new char[buff_size];
-            memcpy(tmp, data, bytes_read);
-            delete[] data;
-            data = tmp;
-         }
-        f.read(data + bytes_read, read_size);
-        bytes_read += f.gcount();
-    }
-    file_size = bytes_read;
+    // Allocate the whole buffer at once, plus one byte so that text content can be null terminated.
+    const size_t buff_size {static_cast<size_t>(f.tellg())};
+    f.seekg(0);
+    data = new char[buff_size + 1];
+    f.read(data, buff_size);
+    file_size = static_cast<size_t>(f.gcount());
+    data[file_size] = '\0';
 }
 
 
@@ -12,6 +12,9 @@
  * @param data [OUT] reference to a pointer which will store the location of 
  * an array of bytes representing the file content.
  * @param file_size [OUT] number of bytes read.
+ *
+ * The whole file is copied into a newly allocated array. For large files, consider using
+ * `MappedFile` (see `mapped_file.hpp`) to access the content without copies.
  */
 void read_data_from_file(std::string filename, char*& data, size_t&file_size);
 
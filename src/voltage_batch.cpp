@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "voltage_batch.hpp"
+#include "voltage_expansion.hpp"
+
+
+void VoltageBatch::load(const std::vector<DatFile>& files, unsigned int nIntegrationSteps,
+        const BatchLoadOptions& options, VoltageLoadStats *stats){
+    using clock = std::chrono::steady_clock;
+    clock::time_point t1 = clock::now();
+    if(files.empty()) throw std::invalid_argument {"VoltageBatch::load: no files to read."};
+    if(nIntegrationSteps == 0) throw std::invalid_argument {"VoltageBatch::load: `nIntegrationSteps` must be a positive number."};
+    #ifndef __GPU__
+    if(options.use_gpu)
+        throw std::invalid_argument {"VoltageBatch::load: cannot load data on GPU on a CPU only build of the software."};
+    #endif
+    const ObservationInfo& first {files[0].second};
+    for(const auto& file : files){
+        const ObservationInfo& info {file.second};
+        if(info.nAntennas != first.nAntennas || info.nFrequencies != first.nFrequencies ||
+                info.nPolarizations != first.nPolarizations || info.nTimesteps != first.nTimesteps)
+            throw std::invalid_argument {"VoltageBatch::load: " + file.first + " has a different shape than " + files[0].first};
+    }
+    // Coarse channels are stored in increasing order of channel number.
+    std::vector<size_t> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&files](size_t a, size_t b){
+        return files[a].second.coarseChannel < files[b].second.coarseChannel;
+    });
+
+    const size_t channelSize {dat_file_output_size(first, nIntegrationSteps)};
+    const size_t totalSize {channelSize * files.size()};
+    const bool spread {options.use_gpu && !options.devices.empty()};
+    for(int dev : options.devices)
+        if(dev < 0 || dev >= num_available_gpus())
+            throw std::invalid_argument {"VoltageBatch::load: invalid device identifier " + std::to_string(dev) + "."};
+    const MemoryType memType {spread ? MemoryType::MANAGED : (options.use_gpu ? MemoryType::DEVICE : MemoryType::PAGEABLE)};
+    if(!*this || MemoryBuffer::size() != totalSize || memory_type() != memType)
+        allocate(totalSize, memType);
+    this->nIntegrationSteps = nIntegrationSteps;
+    obsInfos.clear();
+    for(size_t c {0}; c < files.size(); c++){
+        obsInfos.push_back(files[order[c]].second);
+        obsInfos.back().coarse_channel_index = static_cast<unsigned int>(c);
+    }
+
+    std::unique_ptr<ThreadPool> ownPool;
+    ThreadPool *pool {options.io_pool};
+    if(!pool){
+        const unsigned int nIoThreads {std::min<unsigned int>(resolve_n_threads(options.n_io_threads),
+            static_cast<unsigned int>(files.size()))};
+        ownPool = std::make_unique<ThreadPool>(nIoThreads);
+        pool = ownPool.get();
+    }
+    // Hardware threads left to each file for the expansion, when running on CPU.
+    const unsigned int expansionThreads {std::max<unsigned int>(1u,
+        resolve_n_threads(0) / static_cast<unsigned int>(std::min(pool->size(), files.size())))};
+    // The current device is a per-thread setting: workers must use the caller's one.
+    int device {0};
+    #ifdef __GPU__
+    if(options.use_gpu) gpuGetDevice(&device);
+    #endif
+
+    std::vector<std::future<size_t>> results;
+    results.reserve(files.size());
+    for(size_t c {0}; c < files.size(); c++){
+        const DatFile& file {files[order[c]]};
+        std::complex<int8_t> *output {channel_data(c)};
+        const int channelDevice {spread ? options.devices[c % options.devices.size()] : device};
+        #ifdef __GPU__
+        // Pages are placed before the expansion writes them, so they are not migrated afterwards.
+        if(spread){
+            set_preferred_location(channelDevice, c * channelSize, channelSize);
+            GpuDeviceGuard guard {channelDevice};
+            prefetch(channelDevice, 0, c * channelSize, channelSize);
+        }
+        #endif
+        results.push_back(pool->submit([&file, output, nIntegrationSteps, &options, expansionThreads, channelDevice]() -> size_t {
+            #ifdef __GPU__
+            if(options.use_gpu){
+                gpuSetDevice(channelDevice);
+                return load_dat_file_gpu(file.first, file.second, nIntegrationSteps, output, nullptr, options.gpu_chunk_size);
+            }
+            #endif
+            (void) channelDevice;
+            return load_dat_file(file.first, file.second, nIntegrationSteps, output, expansionThreads);
+        }));
+    }
+    // Wait for all the reads before rethrowing the first error, since they write into this buffer.
+    size_t bytesRead {0};
+    std::exception_ptr error;
+    for(auto& result : results){
+        try {
+            bytesRead += result.get();
+        } catch (...) {
+            if(!error) error = std::current_exception();
+        }
+    }
+    if(error) std::rethrow_exception(error);
+    if(stats){
+        stats->bytes_read = bytesRead;
+        stats->total_time = std::chrono::duration<double>(clock::now() - t1).count();
+    }
+}
+
+
+
+VoltageBatch VoltageBatch::from_dat_files(const std::vector<DatFile>& files, unsigned int nIntegrationSteps,
+        const BatchLoadOptions& options, VoltageLoadStats *stats){
+    VoltageBatch batch;
+    batch.load(files, nIntegrationSteps, options, stats);
+    return batch;
+}
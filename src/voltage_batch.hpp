@@ -0,0 +1,104 @@
+#ifndef __VOLTAGE_BATCH_H__
+#define __VOLTAGE_BATCH_H__
+
+#include <vector>
+#include <complex>
+#include "astroio.hpp"
+#include "parallel.hpp"
+
+/**
+ * @brief Options controlling how `VoltageBatch` loads a group of .dat files.
+ */
+struct BatchLoadOptions {
+    // Maximum number of files read concurrently. Zero means one file per hardware thread.
+    unsigned int n_io_threads {0};
+    // If `true`, samples are copied to and expanded on the current GPU. Each file in flight
+    // uses its own pair of streams, so up to `2 * n_io_threads` streams are active at once.
+    bool use_gpu {false};
+    // Size, in bytes, of the reads issued for each file by the GPU loader.
+    size_t gpu_chunk_size {16ul * 1024ul * 1024ul};
+    // GPUs the coarse channels are spread across when `use_gpu` is set: the `c`-th channel of the
+    // batch is expanded on `devices[c % devices.size()]`. The batch is then allocated in managed
+    // memory and each channel's pages are kept on its GPU with placement hints. If empty, all
+    // the channels are loaded on the current GPU, in device memory.
+    std::vector<int> devices;
+    // If not null, reads are executed on this pool instead of a pool created for the duration
+    // of the call. `n_io_threads` is then ignored. Useful when loading many batches in a row.
+    ThreadPool *io_pool {nullptr};
+};
+
+
+/**
+ * @brief Voltages of a group of coarse channels, typically one second of an MWA Phase I
+ * observation as returned by `parse_mwa_dat_files`, stored in a single contiguous buffer.
+ *
+ * The array represents a multidimensional matrix whose dimensions are
+ *  [coarse_channel][integration_interval][frequency][antenna][polarization][time_step],
+ * that is, the `Voltages` arrays of the coarse channels, sorted by coarse channel number, one
+ * after the other. `channel_data(c)` points to the data of the `c`-th coarse channel, which has
+ * the same layout of `Voltages::from_dat_file` output, and `obsInfos[c]` describes it.
+ */
+class VoltageBatch : public MemoryBuffer<std::complex<int8_t>> {
+
+    public:
+    std::vector<ObservationInfo> obsInfos;
+    unsigned int nIntegrationSteps {0};
+
+    /**
+     * @brief Create an empty batch. Memory is allocated by the first call to `load`.
+     */
+    VoltageBatch() {}
+
+    VoltageBatch(VoltageBatch&& other) : MemoryBuffer {std::move(other)} {
+        obsInfos = std::move(other.obsInfos);
+        nIntegrationSteps = other.nIntegrationSteps;
+    }
+
+    VoltageBatch& operator=(VoltageBatch&& other){
+        if(this == &other) return *this;
+        MemoryBuffer::operator=(std::move(other));
+        obsInfos = std::move(other.obsInfos);
+        nIntegrationSteps = other.nIntegrationSteps;
+        return *this;
+    }
+
+    /**
+     * @return the number of coarse channels in the batch.
+     */
+    size_t n_channels() const { return obsInfos.size(); }
+
+    /**
+     * @return the number of complex samples stored for each coarse channel.
+     */
+    size_t channel_size() const { return n_channels() == 0 ? 0 : MemoryBuffer::size() / n_channels(); }
+
+    /**
+     * @return pointer to the first sample of the `c`-th coarse channel.
+     */
+    std::complex<int8_t>* channel_data(size_t c) { return data() + c * channel_size(); }
+    const std::complex<int8_t>* channel_data(size_t c) const { return data() + c * channel_size(); }
+
+    /**
+     * @brief Read and expand a group of .dat files concurrently into this batch.
+     *
+     * Files are read on a bounded pool of I/O threads, each of them writing its own region of
+     * the output buffer. The current allocation is reused when it has the required size and
+     * memory type, so that repeatedly loading batches of the same observation does not allocate.
+     * All the files must have the same number of antennas, channels, polarisations and timesteps.
+     *
+     * @param files the .dat files to read, e.g. one element of `parse_mwa_dat_files` output.
+     * @param nIntegrationSteps number of timesteps to integrate over when/if data will be correlated.
+     * @param options see `BatchLoadOptions`.
+     * @param stats if not null, filled with the total number of bytes read and the wall time.
+     */
+    void load(const std::vector<DatFile>& files, unsigned int nIntegrationSteps,
+            const BatchLoadOptions& options = {}, VoltageLoadStats *stats = nullptr);
+
+    /**
+     * @brief Read a group of .dat files into a new batch. See `load`.
+     */
+    static VoltageBatch from_dat_files(const std::vector<DatFile>& files, unsigned int nIntegrationSteps,
+            const BatchLoadOptions& options = {}, VoltageLoadStats *stats = nullptr);
+};
+
+#endif
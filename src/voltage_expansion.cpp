@@ -0,0 +1,763 @@
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include "voltage_expansion.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "instrumentation.hpp"
+
+#if defined(__AVX2__) || defined(__AVX512BW__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+    constexpr int8_t sign_extend_nibble(uint8_t value){
+        // https://en.wikipedia.org/wiki/Two%27s_complement#Subtraction_from_2N
+        return static_cast<int8_t>(value >= 0x8 ? static_cast<int>(value) - 0x10 : static_cast<int>(value));
+    }
+
+    /*
+        For each possible byte, the pair (real, imaginary) of 8-bit values obtained by
+        sign-extending its lower and upper nibble. Built at compile time.
+    */
+    struct NibbleLookup {
+        int8_t values[256][2];
+
+        constexpr NibbleLookup() : values {} {
+            for(unsigned int b {0}; b < 256; b++){
+                values[b][0] = sign_extend_nibble(b & 0xf);
+                values[b][1] = sign_extend_nibble(b >> 4);
+            }
+        }
+    };
+
+    constexpr NibbleLookup nibble_lookup {};
+
+
+    void expand_4bit_samples_scalar(const uint8_t *input, size_t n_samples, int8_t *output){
+        for(size_t i {0}; i < n_samples; i++){
+            output[2*i] = nibble_lookup.values[input[i]][0];
+            output[2*i + 1] = nibble_lookup.values[input[i]][1];
+        }
+    }
+
+    // Number of samples processed per iteration of the vectorised loop.
+    #if defined(__AVX512BW__)
+    constexpr size_t vector_width {64};
+    #elif defined(__AVX2__)
+    constexpr size_t vector_width {32};
+    #elif defined(__SSE2__) || defined(__ARM_NEON)
+    constexpr size_t vector_width {16};
+    #else
+    constexpr size_t vector_width {0};
+    #endif
+
+    /*
+        Expand `vector_width` samples. Nibbles are isolated with a mask and a shift, sign-extended
+        with the identity (x ^ 8) - 8, and then interleaved so that real and imaginary parts of
+        each sample are contiguous.
+    */
+    inline void expand_vector(const uint8_t *input, int8_t *output){
+        #if defined(__AVX512BW__)
+        const __m512i mask {_mm512_set1_epi8(0x0f)}, eight {_mm512_set1_epi8(0x08)};
+        __m512i x {_mm512_loadu_si512(input)};
+        __m512i lo {_mm512_and_si512(x, mask)};
+        __m512i hi {_mm512_and_si512(_mm512_srli_epi16(x, 4), mask)};
+        lo = _mm512_sub_epi8(_mm512_xor_si512(lo, eight), eight);
+        hi = _mm512_sub_epi8(_mm512_xor_si512(hi, eight), eight);
+        // unpack works within 128-bit lanes, so lanes must be put back in order.
+        __m512i u0 {_mm512_unpacklo_epi8(lo, hi)}, u1 {_mm512_unpackhi_epi8(lo, hi)};
+        const __m512i first_half {_mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0)};
+        const __m512i second_half {_mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4)};
+        _mm512_storeu_si512(output, _mm512_permutex2var_epi64(u0, first_half, u1));
+        _mm512_storeu_si512(output + 64, _mm512_permutex2var_epi64(u0, second_half, u1));
+        #elif defined(__AVX2__)
+        const __m256i mask {_mm256_set1_epi8(0x0f)}, eight {_mm256_set1_epi8(0x08)};
+        __m256i x {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input))};
+        __m256i lo {_mm256_and_si256(x, mask)};
+        __m256i hi {_mm256_and_si256(_mm256_srli_epi16(x, 4), mask)};
+        lo = _mm256_sub_epi8(_mm256_xor_si256(lo, eight), eight);
+        hi = _mm256_sub_epi8(_mm256_xor_si256(hi, eight), eight);
+        __m256i u0 {_mm256_unpacklo_epi8(lo, hi)}, u1 {_mm256_unpackhi_epi8(lo, hi)};
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output), _mm256_permute2x128_si256(u0, u1, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + 32), _mm256_permute2x128_si256(u0, u1, 0x31));
+        #elif defined(__SSE2__)
+        const __m128i mask {_mm_set1_epi8(0x0f)}, eight {_mm_set1_epi8(0x08)};
+        __m128i x {_mm_loadu_si128(reinterpret_cast<const __m128i*>(input))};
+        __m128i lo {_mm_and_si128(x, mask)};
+        __m128i hi {_mm_and_si128(_mm_srli_epi16(x, 4), mask)};
+        lo = _mm_sub_epi8(_mm_xor_si128(lo, eight), eight);
+        hi = _mm_sub_epi8(_mm_xor_si128(hi, eight), eight);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_unpacklo_epi8(lo, hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), _mm_unpackhi_epi8(lo, hi));
+        #elif defined(__ARM_NEON)
+        const int8x16_t eight {vdupq_n_s8(0x08)};
+        uint8x16_t x {vld1q_u8(input)};
+        int8x16_t lo {vreinterpretq_s8_u8(vandq_u8(x, vdupq_n_u8(0x0f)))};
+        int8x16_t hi {vreinterpretq_s8_u8(vshrq_n_u8(x, 4))};
+        lo = vsubq_s8(veorq_s8(lo, eight), eight);
+        hi = vsubq_s8(veorq_s8(hi, eight), eight);
+        int8x16x2_t interleaved {vzipq_s8(lo, hi)};
+        vst1q_s8(output, interleaved.val[0]);
+        vst1q_s8(output + 16, interleaved.val[1]);
+        #else
+        (void) input; (void) output;
+        #endif
+    }
+
+    // Number of samples per tile in the cache-blocked transpose.
+    constexpr size_t transpose_tile {64};
+    // Input bytes reordered at a time by each thread of `load_8bit_samples`.
+    constexpr size_t reorder_block_bytes {256ul * 1024ul};
+    // Timesteps of a .dat file expanded at a time by `load_dat_file`.
+    constexpr size_t dat_timesteps_per_read {100};
+
+    /*
+        Timesteps loaded from a .dat file of `file_size` bytes: complete groups of
+        `dat_timesteps_per_read` timesteps only, and never more than the output holds. The CPU
+        and GPU loaders share it, so that they load the same samples.
+    */
+    size_t dat_file_timesteps(size_t file_size, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps){
+        const size_t bytesPerRead {dat_timesteps_per_read * obsInfo.nFrequencies * obsInfo.nAntennas * obsInfo.nPolarizations};
+        const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1)/ nIntegrationSteps };
+        return std::min(file_size / bytesPerRead * dat_timesteps_per_read, nIntegrationIntervals * nIntegrationSteps);
+    }
+}
+
+
+
+void expand_4bit_samples(const uint8_t *input, size_t n_samples, std::complex<int8_t> *output){
+    int8_t *out {reinterpret_cast<int8_t*>(output)};
+    size_t i {0};
+    if(vector_width > 0){
+        for(; i + vector_width <= n_samples; i += vector_width)
+            expand_vector(input + i, out + 2 * i);
+    }
+    expand_4bit_samples_scalar(input + i, n_samples - i, out + 2 * i);
+}
+
+
+
+void reorder_timesteps(const std::complex<int8_t> *input, size_t n_timesteps, size_t first_timestep,
+        const ObservationInfo& obsInfo, unsigned int nIntegrationSteps, unsigned int edge,
+        std::complex<int8_t> *output){
+    const size_t samplesInAntenna {static_cast<size_t>(nIntegrationSteps) * obsInfo.nPolarizations};
+    const size_t samplesInFrequency {samplesInAntenna * obsInfo.nAntennas};
+    const size_t samplesInTimeInterval {samplesInFrequency * obsInfo.nFrequencies};
+    const size_t samplesInChannel {static_cast<size_t>(obsInfo.nAntennas) * obsInfo.nPolarizations};
+    const size_t nSamplesInTimestep {samplesInChannel * obsInfo.nFrequencies};
+    /*
+        Within a time interval, the sample `s` ([channel][antenna][polarization] index) of timestep
+        `t` goes to position `s * nIntegrationSteps + t % nIntegrationSteps`. Timesteps are processed
+        in runs that do not cross an interval boundary, and samples in tiles so that the input
+        rows being read stay in cache while the contiguous output runs are written.
+    */
+    size_t ts {0};
+    while(ts < n_timesteps){
+        const size_t global_ts {first_timestep + ts};
+        const size_t interval {global_ts / nIntegrationSteps};
+        const size_t step {global_ts % nIntegrationSteps};
+        const size_t run {std::min<size_t>(n_timesteps - ts, nIntegrationSteps - step)};
+        const std::complex<int8_t> *rows {input + ts * nSamplesInTimestep};
+        std::complex<int8_t> *out_interval {output + interval * samplesInTimeInterval + step};
+        for(size_t tile {0}; tile < nSamplesInTimestep; tile += transpose_tile){
+            const size_t tile_end {std::min(tile + transpose_tile, nSamplesInTimestep)};
+            for(size_t s {tile}; s < tile_end; s++){
+                std::complex<int8_t> *out {out_interval + s * nIntegrationSteps};
+                const size_t ch {s / samplesInChannel};
+                if(ch < edge || ch >= (obsInfo.nFrequencies - edge)){
+                    for(size_t r {0}; r < run; r++) out[r] = {0, 0};
+                }else{
+                    for(size_t r {0}; r < run; r++) out[r] = rows[r * nSamplesInTimestep + s];
+                }
+            }
+        }
+        ts += run;
+    }
+}
+
+
+
+void expand_dat_timesteps(const uint8_t *input, size_t n_timesteps, size_t first_timestep,
+        const ObservationInfo& obsInfo, unsigned int nIntegrationSteps, unsigned int edge,
+        std::complex<int8_t> *scratch, std::complex<int8_t> *output){
+    const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+    expand_4bit_samples(input, n_timesteps * nSamplesInTimestep, scratch);
+    reorder_timesteps(scratch, n_timesteps, first_timestep, obsInfo, nIntegrationSteps, edge, output);
+}
+
+
+
+size_t dat_file_output_size(const ObservationInfo& obsInfo, unsigned int nIntegrationSteps){
+    const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1)/ nIntegrationSteps };
+    return nIntegrationIntervals * nIntegrationSteps * obsInfo.nFrequencies * obsInfo.nAntennas * obsInfo.nPolarizations;
+}
+
+
+
+size_t load_dat_file(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        std::complex<int8_t> *output, unsigned int n_threads){
+    ASTROIO_NAMED_TIMER(timer, "dat_file_load");
+    // TODO: fix edge usage.
+    const unsigned int edge {0};
+    const size_t timestepsPerRead {dat_timesteps_per_read};
+    // Samples are expanded straight from the page cache.
+    const MappedFile input {filename};
+    const uint8_t *buffer {reinterpret_cast<const uint8_t*>(input.data())};
+    const size_t bytesPerComplexSample {1}; // 4+4 bits 
+    const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas *  obsInfo.nPolarizations};
+    const size_t bytesPerTimestep {nSamplesInTimestep * bytesPerComplexSample};
+    const size_t bytesPerRead {timestepsPerRead * bytesPerTimestep};
+    /*
+        The output holds slightly more samples than simply nComplexSamples so we can avoid dealing with
+        the boundary condition happening when obsInfo.nTimesteps % nIntegrationSteps != 0. 
+    */
+    memset(output, 0, sizeof(std::complex<int8_t>) * dat_file_output_size(obsInfo, nIntegrationSteps));
+
+    // Only complete reads of `timestepsPerRead` timesteps are processed.
+    const size_t nTimesteps {dat_file_timesteps(input.size(), obsInfo, nIntegrationSteps)};
+    const size_t nReads {(nTimesteps + timestepsPerRead - 1) / timestepsPerRead};
+    // Each thread processes a contiguous range of reads. Different timesteps map to disjoint
+    // locations of the output, hence no synchronisation is needed.
+    parallel_for(nReads, [&](size_t first_read, size_t last_read){
+        // Includes reading from disk, through the page faults of the mapping.
+        ASTROIO_TIMED_SCOPE("dat_expand", (std::min(last_read * timestepsPerRead, nTimesteps) - first_read * timestepsPerRead) * bytesPerTimestep);
+        std::vector<std::complex<int8_t>> expanded(timestepsPerRead * nSamplesInTimestep);
+        for(size_t r {first_read}; r < last_read; r++){
+            const size_t first_timestep {r * timestepsPerRead};
+            const size_t timesteps {std::min<size_t>(timestepsPerRead, nTimesteps - first_timestep)};
+            expand_dat_timesteps(buffer + r * bytesPerRead, timesteps, first_timestep,
+                obsInfo, nIntegrationSteps, edge, expanded.data(), output);
+        }
+    }, n_threads);
+    ASTROIO_TIMER_ADD(timer, nTimesteps * bytesPerTimestep, nTimesteps * nSamplesInTimestep);
+    return nTimesteps * bytesPerTimestep;
+}
+
+
+
+void zero_missing_timesteps(size_t n_timesteps, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        std::complex<int8_t> *output){
+    const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+    const size_t samplesInTimeInterval {nSamplesInTimestep * nIntegrationSteps};
+    const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1)/ nIntegrationSteps };
+    size_t interval {n_timesteps / nIntegrationSteps};
+    if(interval >= nIntegrationIntervals) return;
+    const size_t first_step {n_timesteps % nIntegrationSteps};
+    // In the interval holding the last timestep, each sample ends with a run of missing steps.
+    if(first_step > 0){
+        std::complex<int8_t> *out {output + interval * samplesInTimeInterval + first_step};
+        for(size_t s {0}; s < nSamplesInTimestep; s++)
+            std::fill_n(out + s * nIntegrationSteps, nIntegrationSteps - first_step, std::complex<int8_t> {0, 0});
+        interval++;
+    }
+    std::fill(output + interval * samplesInTimeInterval, output + nIntegrationIntervals * samplesInTimeInterval,
+        std::complex<int8_t> {0, 0});
+}
+
+
+
+void load_8bit_samples(const std::complex<int8_t> *input, size_t n_timesteps, const ObservationInfo& obsInfo,
+        unsigned int nIntegrationSteps, std::complex<int8_t> *output, unsigned int n_threads){
+    const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+    // Each thread reorders blocks of about `reorder_block_bytes` bytes of input at a time, so that
+    // the timesteps being transposed stay in cache.
+    const size_t timestepsPerBlock {std::max<size_t>(1, reorder_block_bytes / (nSamplesInTimestep * sizeof(std::complex<int8_t>)))};
+    const size_t nBlocks {(n_timesteps + timestepsPerBlock - 1) / timestepsPerBlock};
+    parallel_for(nBlocks, [&](size_t first_block, size_t last_block){
+        for(size_t b {first_block}; b < last_block; b++){
+            const size_t first_timestep {b * timestepsPerBlock};
+            const size_t timesteps {std::min(timestepsPerBlock, n_timesteps - first_timestep)};
+            reorder_timesteps(input + first_timestep * nSamplesInTimestep, timesteps, first_timestep,
+                obsInfo, nIntegrationSteps, 0, output);
+        }
+    }, n_threads);
+    zero_missing_timesteps(n_timesteps, obsInfo, nIntegrationSteps, output);
+}
+
+
+
+#ifdef __GPU__
+/*
+    Expands the `input_size` bytes of a chunk of consecutive timesteps, the first of which has index
+    `first_timestep` within the observation.
+*/
+__global__ void dat_file_expansion_kernel(int8_t *input, size_t input_size, size_t first_timestep, ObservationInfo obsInfo,
+        unsigned int nIntegrationSteps, unsigned int edge, int8_t* output){
+
+    size_t start_index {blockDim.x * blockIdx.x + threadIdx.x};
+    size_t grid_size {gridDim.x * blockDim.x};
+    uint16_t *buffer = reinterpret_cast<uint16_t*>(input);
+    const size_t samplesInPol {nIntegrationSteps};
+    const size_t samplesInAntenna {samplesInPol * obsInfo.nPolarizations};
+    const size_t samplesInFrequency {samplesInAntenna * obsInfo.nAntennas};
+    const size_t samplesInTimeInterval {samplesInFrequency * obsInfo.nFrequencies};
+
+    int8_t expanded[4];
+
+    for(size_t idx {start_index}; idx < input_size / 2; idx += grid_size){
+        size_t sample_idx = idx * 2;
+        size_t a = idx % obsInfo.nAntennas;
+        size_t ch = (sample_idx / (obsInfo.nAntennas * obsInfo.nPolarizations)) % obsInfo.nFrequencies;
+        size_t currentTimeStep = first_timestep + sample_idx / (obsInfo.nAntennas * obsInfo.nPolarizations * obsInfo.nFrequencies);
+        size_t currentTimeInterval = currentTimeStep / nIntegrationSteps;
+        size_t currentIntegratorStep = currentTimeStep % nIntegrationSteps;
+
+        // set edge channels to 0
+        if(ch < edge || ch >= (obsInfo.nFrequencies - edge)){
+            expanded[0] = 0;
+            expanded[1] = 0;
+            expanded[2] = 0;
+            expanded[3] = 0;
+        }else{
+            uint16_t raw_samples = buffer[idx];
+            int value = 0;
+            uint8_t original = 0;
+            uint8_t answer = 0;
+            uint8_t outval = 0;
+            for (outval = 0; outval < 4 ; outval++){
+                original = raw_samples >> (outval * 4);
+                original = original & 0xf; // the sample
+                if(original >= 0x8) { // it is a negative number
+                    // https://en.wikipedia.org/wiki/Two%27s_complement#Subtraction_from_2N
+                    value = original - 0x10;
+                }
+                else {
+                    value = original;
+                }
+                answer = value & 0xff;
+                expanded[outval] = answer;
+            }
+        }
+
+        // output layout is Time, Frequency, Antenna, Polarization, Integration Step
+        size_t outIndex = currentTimeInterval * samplesInTimeInterval + ch * samplesInFrequency + a * samplesInAntenna;
+        output[2*(outIndex + currentIntegratorStep)] = expanded[0];
+        output[2*(outIndex + currentIntegratorStep) + 1] = expanded[1];
+        output[2*(outIndex + samplesInPol + currentIntegratorStep)] = expanded[2];
+        output[2*(outIndex + samplesInPol + currentIntegratorStep) + 1] = expanded[3];
+    }
+}
+
+
+
+namespace {
+    // A block of the specialised kernel expands tiles of `expansion_tile_timesteps` timesteps by
+    // `expansion_tile_samples` consecutive samples of each timestep.
+    constexpr unsigned int expansion_tile_timesteps {32};
+    constexpr unsigned int expansion_tile_samples {256};
+    constexpr unsigned int expansion_block_size {256};
+}
+
+
+
+/*
+    Same as `dat_file_expansion_kernel`, with the shape of a timestep fixed at compile time.
+
+    The output index of a sample is `interval * samplesInTimeInterval + s * nIntegrationSteps + step`,
+    `s` being its index within the timestep: consecutive timesteps of a sample are contiguous in
+    the output, while in the input they are a whole timestep apart. Each tile is read with 64-bit
+    loads along the samples, expanded into shared memory and written out along the timesteps, so
+    that the threads of a warp store consecutive samples.
+*/
+template <unsigned int NFrequencies, unsigned int NAntennas, unsigned int NPolarizations>
+__global__ void dat_file_expansion_kernel_fixed(const uint8_t *input, size_t n_timesteps, size_t first_timestep,
+        unsigned int nIntegrationSteps, unsigned int edge, uint16_t *output){
+    constexpr unsigned int samplesInTimestep {NFrequencies * NAntennas * NPolarizations};
+    constexpr unsigned int tileSamples {expansion_tile_samples};
+    constexpr unsigned int tileTimesteps {expansion_tile_timesteps};
+    static_assert(samplesInTimestep % tileSamples == 0, "dat_file_expansion_kernel_fixed: timesteps must be "
+        "a whole number of tiles.");
+    constexpr unsigned int tilesInTimestep {samplesInTimestep / tileSamples};
+    constexpr unsigned int wordsInRow {tileSamples / 8};
+    // Expanded samples are 16-bit: a row of an odd number of 32-bit words avoids bank conflicts
+    // when reading along the timesteps.
+    __shared__ uint16_t tile[tileSamples][tileTimesteps + 2];
+
+    const size_t samplesInTimeInterval {static_cast<size_t>(samplesInTimestep) * nIntegrationSteps};
+    const size_t nTiles {(n_timesteps + tileTimesteps - 1) / tileTimesteps * tilesInTimestep};
+
+    for(size_t tile_idx {blockIdx.x}; tile_idx < nTiles; tile_idx += gridDim.x){
+        const unsigned int s0 {static_cast<unsigned int>(tile_idx % tilesInTimestep) * tileSamples};
+        const size_t t0 {tile_idx / tilesInTimestep * tileTimesteps};
+        const unsigned int nt {n_timesteps - t0 < tileTimesteps ? static_cast<unsigned int>(n_timesteps - t0) : tileTimesteps};
+
+        for(unsigned int w {threadIdx.x}; w < wordsInRow * nt; w += blockDim.x){
+            const unsigned int t {w / wordsInRow};
+            const unsigned int col {(w % wordsInRow) * 8};
+            const uint64_t word {*reinterpret_cast<const uint64_t*>(input + (t0 + t) * samplesInTimestep + s0 + col)};
+            #pragma unroll
+            for(unsigned int k {0}; k < 8; k++){
+                const unsigned int ch {(s0 + col + k) / (NAntennas * NPolarizations)};
+                const uint8_t raw {static_cast<uint8_t>(word >> (8 * k))};
+                uint16_t value {0};
+                if(ch >= edge && ch < NFrequencies - edge){
+                    // Lower nibble: real part, upper nibble: imaginary part, both sign extended.
+                    const uint8_t re {static_cast<uint8_t>(static_cast<int8_t>(raw << 4) >> 4)};
+                    const uint8_t im {static_cast<uint8_t>(static_cast<int8_t>(raw) >> 4)};
+                    value = static_cast<uint16_t>(re | (im << 8));
+                }
+                tile[col + k][t] = value;
+            }
+        }
+        __syncthreads();
+
+        for(unsigned int e {threadIdx.x}; e < tileSamples * tileTimesteps; e += blockDim.x){
+            const unsigned int s {e / tileTimesteps};
+            const unsigned int t {e % tileTimesteps};
+            if(t >= nt) continue;
+            const size_t timestep {first_timestep + t0 + t};
+            const size_t interval {timestep / nIntegrationSteps};
+            const size_t step {timestep % nIntegrationSteps};
+            output[interval * samplesInTimeInterval + static_cast<size_t>(s0 + s) * nIntegrationSteps + step] = tile[s][t];
+        }
+        // The tile is overwritten by the next iteration.
+        __syncthreads();
+    }
+}
+
+
+
+namespace {
+    using ExpansionLauncher = void (*)(const int8_t *input, size_t input_size, size_t first_timestep,
+        const ObservationInfo& obsInfo, unsigned int nIntegrationSteps, unsigned int edge, int8_t *output,
+        unsigned int n_blocks, gpuStream_t stream);
+
+    // Expansion kernel suited to an observation, and the number of blocks it is launched with.
+    struct ExpansionLaunch {
+        ExpansionLauncher launch;
+        unsigned int n_blocks;
+    };
+
+    template <typename Kernel>
+    unsigned int resident_blocks(Kernel kernel, int block_size, int n_multiprocessors){
+        int blocks_per_multiprocessor {0};
+        gpuOccupancyMaxActiveBlocksPerMultiprocessor(&blocks_per_multiprocessor, kernel, block_size, 0);
+        return static_cast<unsigned int>(std::max(1, blocks_per_multiprocessor) * n_multiprocessors);
+    }
+
+    void launch_generic_expansion(const int8_t *input, size_t input_size, size_t first_timestep,
+            const ObservationInfo& obsInfo, unsigned int nIntegrationSteps, unsigned int edge, int8_t *output,
+            unsigned int n_blocks, gpuStream_t stream){
+        dat_file_expansion_kernel<<<n_blocks, 1024, 0, stream>>>(const_cast<int8_t*>(input), input_size,
+            first_timestep, obsInfo, nIntegrationSteps, edge, output);
+    }
+
+    template <unsigned int NFrequencies, unsigned int NAntennas, unsigned int NPolarizations>
+    void launch_fixed_expansion(const int8_t *input, size_t input_size, size_t first_timestep,
+            const ObservationInfo& obsInfo, unsigned int nIntegrationSteps, unsigned int edge, int8_t *output,
+            unsigned int n_blocks, gpuStream_t stream){
+        (void) obsInfo;
+        const size_t nTimesteps {input_size / (NFrequencies * NAntennas * NPolarizations)};
+        const size_t nTiles {(nTimesteps + expansion_tile_timesteps - 1) / expansion_tile_timesteps *
+            (NFrequencies * NAntennas * NPolarizations / expansion_tile_samples)};
+        if(nTiles == 0) return;
+        n_blocks = static_cast<unsigned int>(std::min<size_t>(n_blocks, nTiles));
+        dat_file_expansion_kernel_fixed<NFrequencies, NAntennas, NPolarizations>
+            <<<n_blocks, expansion_block_size, 0, stream>>>(reinterpret_cast<const uint8_t*>(input), nTimesteps,
+            first_timestep, nIntegrationSteps, edge, reinterpret_cast<uint16_t*>(output));
+    }
+
+    /*
+        Specialised kernels exist for the layouts of VCS (128 channels, 128 antennas) and EDA2
+        (1 channel, 256 antennas) data; anything else is expanded by the generic kernel. Either is
+        launched with as many blocks as can be resident on the current GPU at the same time.
+    */
+    ExpansionLaunch select_expansion_kernel(const ObservationInfo& obsInfo, int n_multiprocessors){
+        if(obsInfo.nPolarizations == 2 && obsInfo.nAntennas == 128 && obsInfo.nFrequencies == 128)
+            return {launch_fixed_expansion<128, 128, 2>,
+                resident_blocks(dat_file_expansion_kernel_fixed<128, 128, 2>, expansion_block_size, n_multiprocessors)};
+        if(obsInfo.nPolarizations == 2 && obsInfo.nAntennas == 256 && obsInfo.nFrequencies == 1)
+            return {launch_fixed_expansion<1, 256, 2>,
+                resident_blocks(dat_file_expansion_kernel_fixed<1, 256, 2>, expansion_block_size, n_multiprocessors)};
+        return {launch_generic_expansion, resident_blocks(dat_file_expansion_kernel, 1024, n_multiprocessors)};
+    }
+}
+
+
+
+/*
+    Sets to zero the steps from `first_step` on of each of the `n_samples` samples of the
+    interval starting at `output`.
+*/
+__global__ void zero_missing_steps_kernel(uint16_t *output, size_t n_samples, unsigned int first_step,
+        unsigned int nIntegrationSteps){
+    const size_t nMissing {nIntegrationSteps - first_step};
+    const size_t grid_size {static_cast<size_t>(gridDim.x) * blockDim.x};
+    for(size_t idx {blockDim.x * blockIdx.x + threadIdx.x}; idx < n_samples * nMissing; idx += grid_size)
+        output[idx / nMissing * nIntegrationSteps + first_step + idx % nMissing] = 0;
+}
+
+
+
+/*
+    Queue on `stream` the zeroing of the samples of `output`, in the `Voltages` layout, past the
+    first `n_timesteps` timesteps.
+*/
+void zero_missing_timesteps_gpu(size_t n_timesteps, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        std::complex<int8_t> *output, gpuStream_t stream){
+    const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+    const size_t samplesInTimeInterval {nSamplesInTimestep * nIntegrationSteps};
+    const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1)/ nIntegrationSteps };
+    size_t interval {n_timesteps / nIntegrationSteps};
+    const unsigned int first_step {static_cast<unsigned int>(n_timesteps % nIntegrationSteps)};
+    if(interval < nIntegrationIntervals && first_step > 0){
+        const size_t n_values {nSamplesInTimestep * (nIntegrationSteps - first_step)};
+        const unsigned int zero_blocks {static_cast<unsigned int>(std::min<size_t>((n_values + 1023) / 1024, 65535))};
+        zero_missing_steps_kernel<<<zero_blocks, 1024, 0, stream>>>(reinterpret_cast<uint16_t*>(output + interval * samplesInTimeInterval),
+            nSamplesInTimestep, first_step, nIntegrationSteps);
+        gpuCheckLastError();
+        interval++;
+    }
+    if(interval < nIntegrationIntervals)
+        gpuMemsetAsync(output + interval * samplesInTimeInterval, 0,
+            sizeof(std::complex<int8_t>) * (nIntegrationIntervals - interval) * samplesInTimeInterval, stream);
+}
+
+
+
+size_t load_dat_file_gpu(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        std::complex<int8_t> *voltages, VoltageLoadStats *stats, size_t chunk_size, bool pin_mapping){
+    using clock = std::chrono::steady_clock;
+    clock::time_point t1 = clock::now();
+    ASTROIO_NAMED_TIMER(timer, "dat_file_load_gpu");
+    std::ifstream fin;
+    // With `pin_mapping`, chunks are copied to the GPU straight from the registered mapping.
+    std::unique_ptr<MappedFile> mapping;
+    size_t fileSize;
+    double readTime {0.0};
+    if(pin_mapping){
+        // Registering the mapping reads the whole file: it is accounted as reading time.
+        clock::time_point r1 = clock::now();
+        ASTROIO_TIMED_SCOPE("dat_map_and_register");
+        mapping = std::make_unique<MappedFile>(filename, true);
+        fileSize = mapping->size();
+        readTime += std::chrono::duration<double>(clock::now() - r1).count();
+    }else{
+        fin.open(filename, std::ios::binary | std::ios::ate);
+        if(!fin) throw std::runtime_error {"load_dat_file_gpu: error happened when opening the input file " + filename};
+        fileSize = static_cast<size_t>(fin.tellg());
+        fin.seekg(0);
+    }
+    const size_t bytesPerTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+    // The same timesteps as `load_dat_file`.
+    const size_t nTimesteps {dat_file_timesteps(fileSize, obsInfo, nIntegrationSteps)};
+    // Chunks always hold a whole number of timesteps.
+    const size_t timestepsPerChunk {std::max<size_t>(1, std::min(chunk_size / bytesPerTimestep, nTimesteps))};
+    const size_t bytesPerChunk {timestepsPerChunk * bytesPerTimestep};
+    const size_t nChunks {(nTimesteps + timestepsPerChunk - 1) / timestepsPerChunk};
+
+    struct gpuDeviceProp_t props;
+    int gpu_id = -1;
+    gpuGetDevice(&gpu_id);
+    gpuGetDeviceProperties(&props, gpu_id);
+    const ExpansionLaunch expansion {select_expansion_kernel(obsInfo, props.multiProcessorCount)};
+
+    /*
+        Double buffering: while chunk `c` is copied to the GPU and expanded on stream `c % 2`,
+        the host reads chunk `c + 1` from disk into the other pinned buffer. A pinned buffer is
+        refilled only after the event recorded at the end of its previous use has completed.
+        Chunks of a registered mapping are copied as they are, and only the device buffers
+        alternate.
+    */
+    const int nBuffers {2};
+    MemoryBuffer<int8_t> hostChunks[nBuffers], deviceChunks[nBuffers];
+    gpuStream_t streams[nBuffers];
+    gpuEvent_t chunkDone[nBuffers];
+    for(int b {0}; b < nBuffers; b++){
+        if(!mapping) hostChunks[b].allocate(bytesPerChunk, MemoryType::PINNED);
+        deviceChunks[b].allocate(bytesPerChunk, MemoryType::DEVICE);
+        gpuStreamCreate(&streams[b]);
+        gpuEventCreate(&chunkDone[b]);
+    }
+    // Timesteps not present in the file must read as zero.
+    zero_missing_timesteps_gpu(nTimesteps, obsInfo, nIntegrationSteps, voltages, streams[0]);
+
+    size_t totalBytesRead {0};
+    for(size_t c {0}; c < nChunks; c++){
+        const int b {static_cast<int>(c % nBuffers)};
+        const size_t firstTimestep {c * timestepsPerChunk};
+        const size_t chunkBytes {std::min(timestepsPerChunk, nTimesteps - firstTimestep) * bytesPerTimestep};
+        const int8_t *chunk {nullptr};
+        if(mapping){
+            // Copies on the stream of the device buffer wait for its previous expansion.
+            chunk = reinterpret_cast<const int8_t*>(mapping->data()) + firstTimestep * bytesPerTimestep;
+        }else{
+            if(c >= nBuffers) gpuEventSynchronize(chunkDone[b]);
+            clock::time_point r1 = clock::now();
+            {
+                ASTROIO_TIMED_SCOPE("dat_read", chunkBytes);
+                fin.read(reinterpret_cast<char*>(hostChunks[b].data()), chunkBytes);
+            }
+            readTime += std::chrono::duration<double>(clock::now() - r1).count();
+            if(static_cast<size_t>(fin.gcount()) != chunkBytes){
+                // The file was truncated while being read: as for a shorter file, the samples
+                // from the first incomplete chunk on read as zero.
+                zero_missing_timesteps_gpu(firstTimestep, obsInfo, nIntegrationSteps, voltages, streams[b]);
+                break;
+            }
+            chunk = hostChunks[b].data();
+        }
+        totalBytesRead += chunkBytes;
+        {
+            ASTROIO_GPU_TIMED_SCOPE("dat_copy_to_gpu", streams[b], chunkBytes);
+            gpuMemcpyAsync(deviceChunks[b].data(), chunk, chunkBytes, gpuMemcpyHostToDevice, streams[b]);
+        }
+        {
+            ASTROIO_GPU_TIMED_SCOPE("dat_expand_gpu", streams[b], chunkBytes, chunkBytes);
+            expansion.launch(deviceChunks[b].data(), chunkBytes, firstTimestep, obsInfo, nIntegrationSteps, 0,
+                reinterpret_cast<int8_t*>(voltages), expansion.n_blocks, streams[b]);
+        }
+        gpuCheckLastError();
+        gpuEventRecord(chunkDone[b], streams[b]);
+    }
+    fin.close();
+    for(int b {0}; b < nBuffers; b++){
+        gpuStreamSynchronize(streams[b]);
+        gpuEventDestroy(chunkDone[b]);
+        gpuStreamDestroy(streams[b]);
+    }
+    if(stats){
+        stats->bytes_read = totalBytesRead;
+        stats->read_time = readTime;
+        stats->total_time = std::chrono::duration<double>(clock::now() - t1).count();
+    }
+    ASTROIO_TIMER_ADD(timer, totalBytesRead, totalBytesRead);
+    return totalBytesRead;
+}
+
+
+
+/*
+    Reorders `n_timesteps` timesteps of `samplesInTimestep` 8+8 bit samples, seen as 16-bit words,
+    into the `Voltages` layout. As in `dat_file_expansion_kernel_fixed`, tiles are read along the
+    samples and written along the timesteps through shared memory; the shape of a timestep is
+    only known at run time, so the last tile of a timestep may be partial.
+*/
+__global__ void reorder_8bit_kernel(const uint16_t *input, size_t n_timesteps, size_t first_timestep,
+        unsigned int samplesInTimestep, unsigned int nIntegrationSteps, uint16_t *output){
+    constexpr unsigned int tileSamples {expansion_tile_samples};
+    constexpr unsigned int tileTimesteps {expansion_tile_timesteps};
+    __shared__ uint16_t tile[tileSamples][tileTimesteps + 2];
+
+    const unsigned int tilesInTimestep {(samplesInTimestep + tileSamples - 1) / tileSamples};
+    const size_t samplesInTimeInterval {static_cast<size_t>(samplesInTimestep) * nIntegrationSteps};
+    const size_t nTiles {(n_timesteps + tileTimesteps - 1) / tileTimesteps * tilesInTimestep};
+
+    for(size_t tile_idx {blockIdx.x}; tile_idx < nTiles; tile_idx += gridDim.x){
+        const unsigned int s0 {static_cast<unsigned int>(tile_idx % tilesInTimestep) * tileSamples};
+        const size_t t0 {tile_idx / tilesInTimestep * tileTimesteps};
+        const unsigned int nt {n_timesteps - t0 < tileTimesteps ? static_cast<unsigned int>(n_timesteps - t0) : tileTimesteps};
+        const unsigned int ns {samplesInTimestep - s0 < tileSamples ? samplesInTimestep - s0 : tileSamples};
+
+        for(unsigned int e {threadIdx.x}; e < ns * nt; e += blockDim.x){
+            const unsigned int t {e / ns};
+            const unsigned int s {e % ns};
+            tile[s][t] = input[(t0 + t) * samplesInTimestep + s0 + s];
+        }
+        __syncthreads();
+
+        for(unsigned int e {threadIdx.x}; e < tileSamples * tileTimesteps; e += blockDim.x){
+            const unsigned int s {e / tileTimesteps};
+            const unsigned int t {e % tileTimesteps};
+            if(t >= nt || s >= ns) continue;
+            const size_t timestep {first_timestep + t0 + t};
+            const size_t interval {timestep / nIntegrationSteps};
+            const size_t step {timestep % nIntegrationSteps};
+            output[interval * samplesInTimeInterval + static_cast<size_t>(s0 + s) * nIntegrationSteps + step] = tile[s][t];
+        }
+        // The tile is overwritten by the next iteration.
+        __syncthreads();
+    }
+}
+
+
+
+size_t load_8bit_samples_gpu(const std::complex<int8_t> *input, size_t n_timesteps, const ObservationInfo& obsInfo,
+        unsigned int nIntegrationSteps, std::complex<int8_t> *output, VoltageLoadStats *stats, size_t chunk_size){
+    using clock = std::chrono::steady_clock;
+    clock::time_point t1 = clock::now();
+    ASTROIO_NAMED_TIMER(timer, "from_memory_gpu");
+    const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+    const size_t bytesPerTimestep {nSamplesInTimestep * sizeof(std::complex<int8_t>)};
+    const size_t samplesInTimeInterval {nSamplesInTimestep * nIntegrationSteps};
+    const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1)/ nIntegrationSteps };
+    // Chunks always hold a whole number of timesteps.
+    const size_t timestepsPerChunk {std::max<size_t>(1, std::min(chunk_size / bytesPerTimestep, n_timesteps))};
+    const size_t bytesPerChunk {timestepsPerChunk * bytesPerTimestep};
+    const size_t nChunks {(n_timesteps + timestepsPerChunk - 1) / timestepsPerChunk};
+
+    struct gpuDeviceProp_t props;
+    int gpu_id = -1;
+    gpuGetDevice(&gpu_id);
+    gpuGetDeviceProperties(&props, gpu_id);
+    const unsigned int n_blocks {resident_blocks(reorder_8bit_kernel, expansion_block_size, props.multiProcessorCount)};
+
+    /*
+        Same double buffering as `load_dat_file_gpu`: while chunk `c` is copied to the GPU and
+        reordered on stream `c % 2`, the host copies chunk `c + 1` into the other pinned buffer.
+    */
+    const int nBuffers {2};
+    MemoryBuffer<int8_t> hostChunks[nBuffers], deviceChunks[nBuffers];
+    gpuStream_t streams[nBuffers];
+    gpuEvent_t chunkDone[nBuffers];
+    for(int b {0}; b < nBuffers; b++){
+        hostChunks[b].allocate(bytesPerChunk, MemoryType::PINNED);
+        deviceChunks[b].allocate(bytesPerChunk, MemoryType::DEVICE);
+        gpuStreamCreate(&streams[b]);
+        gpuEventCreate(&chunkDone[b]);
+    }
+    // Only the samples past the last timestep are not overwritten, and must read as zero.
+    zero_missing_timesteps_gpu(n_timesteps, obsInfo, nIntegrationSteps, output, streams[0]);
+
+    double copyTime {0.0};
+    for(size_t c {0}; c < nChunks; c++){
+        const int b {static_cast<int>(c % nBuffers)};
+        const size_t firstTimestep {c * timestepsPerChunk};
+        const size_t timesteps {std::min(timestepsPerChunk, n_timesteps - firstTimestep)};
+        const size_t chunkBytes {timesteps * bytesPerTimestep};
+        if(c >= nBuffers) gpuEventSynchronize(chunkDone[b]);
+        clock::time_point r1 = clock::now();
+        {
+            // Includes reading from disk, when the input is a mapped file.
+            ASTROIO_TIMED_SCOPE("from_memory_stage", chunkBytes);
+            std::memcpy(hostChunks[b].data(), input + firstTimestep * nSamplesInTimestep, chunkBytes);
+        }
+        copyTime += std::chrono::duration<double>(clock::now() - r1).count();
+        {
+            ASTROIO_GPU_TIMED_SCOPE("from_memory_copy_to_gpu", streams[b], chunkBytes);
+            gpuMemcpyAsync(deviceChunks[b].data(), hostChunks[b].data(), chunkBytes, gpuMemcpyHostToDevice, streams[b]);
+        }
+        {
+            ASTROIO_GPU_TIMED_SCOPE("from_memory_reorder_gpu", streams[b], chunkBytes, timesteps * nSamplesInTimestep);
+            const size_t nTiles {(timesteps + expansion_tile_timesteps - 1) / expansion_tile_timesteps *
+                ((nSamplesInTimestep + expansion_tile_samples - 1) / expansion_tile_samples)};
+            reorder_8bit_kernel<<<static_cast<unsigned int>(std::min<size_t>(n_blocks, nTiles)), expansion_block_size, 0, streams[b]>>>(
+                reinterpret_cast<const uint16_t*>(deviceChunks[b].data()), timesteps, firstTimestep,
+                static_cast<unsigned int>(nSamplesInTimestep), nIntegrationSteps, reinterpret_cast<uint16_t*>(output));
+        }
+        gpuCheckLastError();
+        gpuEventRecord(chunkDone[b], streams[b]);
+    }
+    for(int b {0}; b < nBuffers; b++){
+        gpuStreamSynchronize(streams[b]);
+        gpuEventDestroy(chunkDone[b]);
+        gpuStreamDestroy(streams[b]);
+    }
+    const size_t totalBytes {n_timesteps * bytesPerTimestep};
+    if(stats){
+        stats->bytes_read = totalBytes;
+        stats->read_time = copyTime;
+        stats->total_time = std::chrono::duration<double>(clock::now() - t1).count();
+    }
+    ASTROIO_TIMER_ADD(timer, totalBytes, n_timesteps * nSamplesInTimestep);
+    return totalBytes;
+}
+#endif
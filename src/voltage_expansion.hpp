@@ -0,0 +1,140 @@
+#ifndef __VOLTAGE_EXPANSION_H__
+#define __VOLTAGE_EXPANSION_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <complex>
+#include <string>
+#include "astroio.hpp"
+
+/**
+ * @brief Expand packed 4+4 bit complex samples into 8+8 bit ones.
+ *
+ * Each input byte holds a complex sample, the lower nibble being the real part and the
+ * upper nibble the imaginary part, both in two's complement. The routine uses SSE2, AVX2
+ * or AVX-512BW (x86) or NEON (ARM) instructions depending on what the compiler targets, with a
+ * scalar fallback. The result is identical across all implementations.
+ *
+ * @param input array of `n_samples` packed complex samples.
+ * @param n_samples number of complex samples (i.e. bytes) in `input`.
+ * @param output array of `n_samples` complex values the expanded samples are written to.
+ */
+void expand_4bit_samples(const uint8_t *input, size_t n_samples, std::complex<int8_t> *output);
+
+
+/**
+ * @brief Reorder a block of consecutive timesteps into the `Voltages` layout.
+ *
+ * The input is an array of `n_timesteps` timesteps, each one laid out as
+ * [channel][antenna][polarization]. Samples are copied into `output`, which has the layout
+ * [time_interval][channel][antenna][polarization][integration_step], using a cache-blocked
+ * transpose.
+ *
+ * @param input timesteps to be reordered.
+ * @param n_timesteps number of timesteps in `input`.
+ * @param first_timestep index, within the observation, of the first timestep in `input`.
+ * @param obsInfo observation the samples belong to.
+ * @param nIntegrationSteps number of timesteps in an integration interval.
+ * @param edge number of channels at the top and the bottom of the band to be set to zero.
+ * @param output base pointer of the `Voltages` data array.
+ */
+void reorder_timesteps(const std::complex<int8_t> *input, size_t n_timesteps, size_t first_timestep,
+        const ObservationInfo& obsInfo, unsigned int nIntegrationSteps, unsigned int edge,
+        std::complex<int8_t> *output);
+
+
+/**
+ * @brief Expand and reorder a block of consecutive timesteps read from a .dat file.
+ *
+ * @param input raw content of `n_timesteps` timesteps, as stored in the .dat file.
+ * @param scratch buffer of at least `n_timesteps * nFrequencies * nAntennas * nPolarizations`
+ * elements used to hold the expanded samples before they are reordered.
+ *
+ * See `reorder_timesteps` for the other parameters.
+ */
+void expand_dat_timesteps(const uint8_t *input, size_t n_timesteps, size_t first_timestep,
+        const ObservationInfo& obsInfo, unsigned int nIntegrationSteps, unsigned int edge,
+        std::complex<int8_t> *scratch, std::complex<int8_t> *output);
+
+
+/**
+ * @brief Number of complex samples in the `Voltages` array holding `obsInfo.nTimesteps` timesteps,
+ * rounded up to a whole number of integration intervals.
+ */
+size_t dat_file_output_size(const ObservationInfo& obsInfo, unsigned int nIntegrationSteps);
+
+
+/**
+ * @brief Read a .dat file, expanding and reordering its samples into a caller provided array.
+ *
+ * This is the implementation of `Voltages::from_dat_file`; it allows several files to be loaded
+ * into distinct regions of the same allocation.
+ *
+ * @param output array of at least `dat_file_output_size(obsInfo, nIntegrationSteps)` elements.
+ * Samples not present in the file are set to zero.
+ * @param n_threads number of threads used to expand the samples (0 = all hardware threads).
+ * @return the number of bytes of the file that were processed.
+ */
+size_t load_dat_file(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        std::complex<int8_t> *output, unsigned int n_threads = 0);
+
+
+/**
+ * @brief Set to zero the samples of the `Voltages` array `output` that belong to the timesteps
+ * from `n_timesteps` to the end of the last integration interval of the observation. The
+ * others are left untouched.
+ */
+void zero_missing_timesteps(size_t n_timesteps, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        std::complex<int8_t> *output);
+
+
+/**
+ * @brief Reorder `n_timesteps` timesteps of 8+8 bit complex samples, each one laid out as
+ * [channel][antenna][polarization], into the `Voltages` layout. This is the implementation of
+ * `Voltages::from_memory`.
+ *
+ * Blocks of timesteps are reordered in parallel with `reorder_timesteps`. Only the samples past
+ * the last timestep are set to zero (see `zero_missing_timesteps`).
+ *
+ * @param output array of at least `dat_file_output_size(obsInfo, nIntegrationSteps)` elements.
+ * @param n_threads number of threads used to reorder the samples (0 = all hardware threads).
+ */
+void load_8bit_samples(const std::complex<int8_t> *input, size_t n_timesteps, const ObservationInfo& obsInfo,
+        unsigned int nIntegrationSteps, std::complex<int8_t> *output, unsigned int n_threads = 0);
+
+
+#ifdef __GPU__
+/**
+ * @brief Same as `load_dat_file`, but the samples are copied to and expanded on the current GPU.
+ * This is the implementation of `Voltages::from_dat_file_gpu`. The same timesteps are loaded from
+ * files of any length; the ones missing, also when the file is truncated while being read, are
+ * set to zero.
+ *
+ * @param output device array of at least `dat_file_output_size(obsInfo, nIntegrationSteps)` elements.
+ * @param stats if not null, filled with timing information about the loading process.
+ * @param chunk_size size, in bytes, of each read.
+ * @param pin_mapping if `true`, the file is mapped in memory and registered as pinned memory
+ * (see `MappedFile`), and chunks are copied to the GPU straight from the page cache rather than
+ * read into pinned buffers first.
+ * @return the number of bytes of the file that were processed.
+ */
+size_t load_dat_file_gpu(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        std::complex<int8_t> *output, VoltageLoadStats *stats = nullptr, size_t chunk_size = 64ul * 1024ul * 1024ul,
+        bool pin_mapping = false);
+
+/**
+ * @brief Same as `load_8bit_samples`, but the samples are copied to and reordered on the current
+ * GPU, a chunk of `chunk_size` bytes at a time. This is the implementation of `Voltages::from_memory_gpu`.
+ *
+ * @param input host array of `n_timesteps` timesteps.
+ * @param output device array of at least `dat_file_output_size(obsInfo, nIntegrationSteps)` elements.
+ * @param stats if not null, filled with timing information; `read_time` is the time spent copying
+ * the input into pinned buffers.
+ * @return the number of bytes of the input that were processed.
+ */
+size_t load_8bit_samples_gpu(const std::complex<int8_t> *input, size_t n_timesteps, const ObservationInfo& obsInfo,
+        unsigned int nIntegrationSteps, std::complex<int8_t> *output, VoltageLoadStats *stats = nullptr,
+        size_t chunk_size = 64ul * 1024ul * 1024ul);
+#endif
+
+#endif
@@ -0,0 +1,142 @@
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include "voltage_stream.hpp"
+#include "voltage_expansion.hpp"
+
+
+VoltageStream::VoltageStream(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+        Format format, unsigned int intervals_per_block, unsigned int ring_size, unsigned int timesteps_per_read) :
+        filename {filename}, obsInfo {obsInfo}, nIntegrationSteps {nIntegrationSteps}, format {format},
+        intervals_per_block {intervals_per_block}, timesteps_per_read {timesteps_per_read} {
+    if(nIntegrationSteps == 0 || intervals_per_block == 0 || ring_size == 0 || timesteps_per_read == 0)
+        throw std::invalid_argument {"VoltageStream: `nIntegrationSteps`, `intervals_per_block`, `ring_size` "
+            "and `timesteps_per_read` must be positive numbers."};
+    std::ifstream fin {filename, std::ios::binary | std::ios::ate};
+    if(!fin) throw std::runtime_error {"VoltageStream: error happened when opening the input file " + filename};
+    const size_t fileSize {static_cast<size_t>(fin.tellg())};
+    fin.close();
+
+    const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+    const size_t bytesPerTimestep {nSamplesInTimestep * (format == Format::DAT ? 1 : 2)};
+    const size_t nIntegrationIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1) / nIntegrationSteps};
+    const size_t capacity {nIntegrationIntervals * nIntegrationSteps};
+    if(format == Format::DAT){
+        // Same as `from_dat_file`: only complete reads are processed.
+        const size_t bytesPerRead {bytesPerTimestep * timesteps_per_read};
+        n_timesteps = std::min(fileSize / bytesPerRead * timesteps_per_read, capacity);
+    }else{
+        n_timesteps = std::min(fileSize / bytesPerTimestep, capacity);
+    }
+    const size_t timestepsPerBlock {static_cast<size_t>(intervals_per_block) * nIntegrationSteps};
+    n_blocks = (n_timesteps + timestepsPerBlock - 1) / timestepsPerBlock;
+    if(n_blocks == 0) return;
+
+    const size_t nSlots {std::min<size_t>(ring_size, n_blocks)};
+    ObservationInfo blockInfo {obsInfo};
+    blockInfo.nTimesteps = timestepsPerBlock;
+    ring.reserve(nSlots);
+    for(size_t i {0}; i < nSlots; i++){
+        MemoryBuffer<std::complex<int8_t>> mb {timestepsPerBlock * nSamplesInTimestep};
+        ring.emplace_back(std::move(mb), blockInfo, nIntegrationSteps);
+    }
+    states.resize(nSlots, SlotState::FREE);
+    reader = std::thread {&VoltageStream::read_blocks, this};
+}
+
+
+
+VoltageStream::~VoltageStream(){
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        stop = true;
+    }
+    cv.notify_all();
+    if(reader.joinable()) reader.join();
+}
+
+
+
+void VoltageStream::read_blocks(){
+    try {
+        const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+        const size_t bytesPerTimestep {nSamplesInTimestep * (format == Format::DAT ? 1 : 2)};
+        const size_t timestepsPerBlock {static_cast<size_t>(intervals_per_block) * nIntegrationSteps};
+        const unsigned int edge {0};
+        std::ifstream fin {filename, std::ios::binary};
+        if(!fin) throw std::runtime_error {"VoltageStream: error happened when opening the input file " + filename};
+        std::vector<char> buffer(timesteps_per_read * bytesPerTimestep);
+        std::vector<std::complex<int8_t>> expanded;
+        if(format == Format::DAT) expanded.resize(timesteps_per_read * nSamplesInTimestep);
+
+        for(size_t b {0}; b < n_blocks; b++){
+            const size_t slot {b % ring.size()};
+            {
+                std::unique_lock<std::mutex> lock {mutex};
+                cv.wait(lock, [&](){ return stop || states[slot] == SlotState::FREE; });
+                if(stop) return;
+            }
+            Voltages& block {ring[slot]};
+            const size_t firstTimestep {b * timestepsPerBlock};
+            const size_t blockTimesteps {std::min(timestepsPerBlock, n_timesteps - firstTimestep)};
+            block.obsInfo.nTimesteps = blockTimesteps;
+            // A partial block leaves the end of the block unwritten: it must be zero.
+            if(blockTimesteps < timestepsPerBlock){
+                ObservationInfo blockInfo {obsInfo};
+                blockInfo.nTimesteps = timestepsPerBlock;
+                zero_missing_timesteps(blockTimesteps, blockInfo, nIntegrationSteps, block.data());
+            }
+            for(size_t ts {0}; ts < blockTimesteps; ts += timesteps_per_read){
+                const size_t timesteps {std::min<size_t>(timesteps_per_read, blockTimesteps - ts)};
+                fin.read(buffer.data(), timesteps * bytesPerTimestep);
+                if(static_cast<size_t>(fin.gcount()) != timesteps * bytesPerTimestep)
+                    throw std::runtime_error {"VoltageStream: unexpected end of the input file."};
+                if(format == Format::DAT){
+                    expand_dat_timesteps(reinterpret_cast<const uint8_t*>(buffer.data()), timesteps, ts,
+                        obsInfo, nIntegrationSteps, edge, expanded.data(), block.data());
+                }else{
+                    reorder_timesteps(reinterpret_cast<const std::complex<int8_t>*>(buffer.data()), timesteps, ts,
+                        obsInfo, nIntegrationSteps, edge, block.data());
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock {mutex};
+                states[slot] = SlotState::READY;
+            }
+            cv.notify_all();
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            error = std::current_exception();
+        }
+        cv.notify_all();
+    }
+}
+
+
+
+const Voltages* VoltageStream::next(){
+    std::unique_lock<std::mutex> lock {mutex};
+    if(consumer_slot >= 0){
+        states[consumer_slot] = SlotState::FREE;
+        consumer_slot = -1;
+        cv.notify_all();
+    }
+    if(next_block >= n_blocks) return nullptr;
+    const size_t slot {next_block % ring.size()};
+    cv.wait(lock, [&](){ return states[slot] == SlotState::READY || error; });
+    if(states[slot] != SlotState::READY) std::rethrow_exception(error);
+    states[slot] = SlotState::IN_USE;
+    consumer_slot = static_cast<long long>(slot);
+    next_block++;
+    return &ring[slot];
+}
+
+
+
+void VoltageStream::for_each(const std::function<void(const Voltages&, size_t)>& callback){
+    while(const Voltages *block = next()){
+        callback(*block, current_interval());
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef __VOLTAGE_STREAM_H__
+#define __VOLTAGE_STREAM_H__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include "astroio.hpp"
+
+/**
+ * @brief Read voltages from a file incrementally, a block of integration intervals at a time.
+ *
+ * Instead of allocating memory for the whole observation, as `Voltages::from_dat_file` and
+ * `Voltages::from_eda2_file` do, the stream owns a fixed-size ring of `Voltages` objects, each one
+ * holding `intervals_per_block` integration intervals. A background thread reads the file,
+ * `timestepsPerRead` timesteps at a time, and fills the ring slots ahead of the consumer. Peak
+ * memory usage is therefore independent of the number of timesteps in the file, and processing
+ * of the first intervals can start before the whole file is read.
+ *
+ * Each block has the same layout as the output of `from_dat_file`. The concatenation of all the
+ * blocks is identical to the array returned by the corresponding `Voltages::from_*` method.
+ *
+ * Example:
+ *      VoltageStream stream {filename, VCS_OBSERVATION_INFO, 100};
+ *      while(const Voltages *block = stream.next()){
+ *          // correlate block, interval `stream.current_interval()` of the observation.
+ *      }
+ */
+class VoltageStream {
+
+    public:
+    // Supported input formats.
+    enum class Format {
+        DAT, // MWA Phase I .dat file, 4+4 bit complex samples.
+        EDA2 // EDA2 binary dump, 8+8 bit complex samples.
+    };
+
+    private:
+    enum class SlotState {FREE, READY, IN_USE};
+
+    std::string filename;
+    ObservationInfo obsInfo;
+    unsigned int nIntegrationSteps;
+    Format format;
+    unsigned int intervals_per_block;
+    unsigned int timesteps_per_read;
+    size_t n_timesteps {0};
+    size_t n_blocks {0};
+
+    std::vector<Voltages> ring;
+    std::vector<SlotState> states;
+    size_t next_block {0};
+    // ring slot currently held by the consumer, if any.
+    long long consumer_slot {-1};
+
+    std::thread reader;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop {false};
+    std::exception_ptr error;
+
+    void read_blocks();
+
+    public:
+    /**
+     * @brief Open a voltage file for streaming.
+     *
+     * @param filename path to the file to read.
+     * @param obsInfo metadata information regarding the observation. `obsInfo.nTimesteps` is the
+     * maximum number of timesteps that will be read from the file.
+     * @param nIntegrationSteps number of timesteps in an integration interval.
+     * @param format format of the input file.
+     * @param intervals_per_block number of integration intervals in each block returned by `next`.
+     * @param ring_size number of blocks in the ring of reusable buffers. The reader thread can be
+     * up to `ring_size - 1` blocks ahead of the consumer.
+     * @param timesteps_per_read number of timesteps read from the file at each read call.
+     */
+    VoltageStream(const std::string& filename, const ObservationInfo& obsInfo, unsigned int nIntegrationSteps,
+            Format format = Format::DAT, unsigned int intervals_per_block = 1, unsigned int ring_size = 2,
+            unsigned int timesteps_per_read = 100);
+
+    ~VoltageStream();
+
+    VoltageStream(const VoltageStream&) = delete;
+    VoltageStream& operator=(const VoltageStream&) = delete;
+
+    /**
+     * @brief Return the next block of voltages, or `nullptr` when the end of the file is reached.
+     *
+     * The returned object stays valid until the following call to `next`, when its memory is
+     * recycled to hold a new block. Errors raised by the reader thread are rethrown here.
+     */
+    const Voltages* next();
+
+    /**
+     * @brief Invoke `callback` on every remaining block of the file, in order.
+     * @param callback function taking a block and the index of its first integration interval.
+     */
+    void for_each(const std::function<void(const Voltages&, size_t)>& callback);
+
+    /**
+     * @return the number of blocks the file is split into.
+     */
+    size_t size() const { return n_blocks; }
+
+    /**
+     * @return the index, within the observation, of the first integration interval of the block
+     * last returned by `next`.
+     */
+    size_t current_interval() const { return next_block == 0 ? 0 : (next_block - 1) * intervals_per_block; }
+};
+
+#endif
@@ -1,7 +1,14 @@
 #include <iostream>
 #include <chrono>
+#include <fstream>
 #include "../src/astroio.hpp"
+#include "../src/voltage_expansion.hpp"
 #include "../src/utils.hpp"
+#include "../src/voltage_stream.hpp"
+#include "../src/voltage_batch.hpp"
+#include "../src/observation_prefetcher.hpp"
+#include "../src/observation_catalogue.hpp"
+#include "../src/files.hpp"
 #include "common.hpp"
 
 
@@ -16,7 +23,8 @@ void test_from_dat_file(){
     high_resolution_clock::time_point volt1_stop = high_resolution_clock::now();
     //auto voltages_optim = Voltages::from_dat_file_optim(dataRootDir + "/offline_correlator/1240826896_1240827191_ch146.dat", VCS_OBSERVATION_INFO, 100);
     high_resolution_clock::time_point volt2_stop = high_resolution_clock::now();
-    auto voltages_gpu = Voltages::from_dat_file_gpu(dataRootDir + "/offline_correlator/1240826896_1240827191_ch146.dat", VCS_OBSERVATION_INFO, 100);
+    VoltageLoadStats gpu_stats;
+    auto voltages_gpu = Voltages::from_dat_file_gpu(dataRootDir + "/offline_correlator/1240826896_1240827191_ch146.dat", VCS_OBSERVATION_INFO, 100, &gpu_stats);
     high_resolution_clock::time_point volt3_stop = high_resolution_clock::now();
     
     duration<double> volt1_dur = duration_cast<duration<double>>(volt1_stop - volt1_start);
@@ -25,7 +33,8 @@ void test_from_dat_file(){
 
     std::cout << "Original method took " << volt1_dur.count() << " seconds." << std::endl;
     // // std::cout << "New method took " << volt2_dur.count() << " seconds." << std::endl;
-    std::cout << "GPU method took " << volt3_dur.count() << " seconds." << std::endl;
+    std::cout << "GPU method took " << volt3_dur.count() << " seconds (" << gpu_stats.read_time << " seconds reading, "
+        << gpu_stats.bandwidth() / 1e9 << " GB/s)." << std::endl;
     voltages.to_cpu();
     voltages_gpu.to_cpu();
     if(voltages.size() != voltages_gpu.size())
@@ -42,6 +51,184 @@ void test_from_dat_file(){
 
 
 
+void test_from_dat_file_threads(){
+    const std::string filename {dataRootDir + "/offline_correlator/1240826896_1240827191_ch146.dat"};
+    auto voltages_serial = Voltages::from_dat_file(filename, VCS_OBSERVATION_INFO, 100, 1);
+    auto voltages_parallel = Voltages::from_dat_file(filename, VCS_OBSERVATION_INFO, 100);
+    if(voltages_serial.size() != voltages_parallel.size())
+        throw TestFailed("test_from_dat_file_threads: voltage objects are not of the same size.");
+    for(size_t i {0}; i < voltages_serial.size(); i++){
+        if(voltages_serial[i] != voltages_parallel[i]){
+            std::stringstream ss;
+            ss << "test_from_dat_file_threads: voltages_serial[" << i << "] != voltages_parallel[" << i << "]" << std::endl;
+            throw TestFailed(ss.str().c_str());
+        }
+    }
+    std::cout << "'test_from_dat_file_threads' passed." << std::endl;
+}
+
+
+
+void test_from_dat_file_gpu_layouts(){
+    // EDA2 data is expanded by a specialised kernel, the other layout by the generic one.
+    ObservationInfo layouts[2] {EDA2_OBSERVATION_INFO, VCS_OBSERVATION_INFO};
+    layouts[0].nTimesteps = 1000;
+    layouts[1].nAntennas = 16;
+    layouts[1].nFrequencies = 8;
+    layouts[1].nTimesteps = 300;
+    const std::string tmpfile {dataRootDir + "/test_dat_layouts.dat.tmp"};
+    for(const ObservationInfo& obsInfo : layouts){
+        const size_t bytesPerTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+        {
+            std::ofstream fout {tmpfile, std::ios::binary};
+            for(size_t i {0}; i < bytesPerTimestep * obsInfo.nTimesteps; i++) fout.put(static_cast<char>(i * 37 + i / 11));
+        }
+        auto voltages = Voltages::from_dat_file(tmpfile, obsInfo, 100);
+        // Read into pinned buffers, or copied from the registered mapping of the file.
+        for(bool pin_mapping : {false, true}){
+            // Chunks that are not a whole number of tiles.
+            auto voltages_gpu = Voltages::from_dat_file_gpu(tmpfile, obsInfo, 100, nullptr, bytesPerTimestep * 150, -1, pin_mapping);
+            voltages_gpu.to_cpu();
+            if(voltages.size() != voltages_gpu.size())
+                throw TestFailed("test_from_dat_file_gpu_layouts: voltage objects are not of the same size.");
+            for(size_t i {0}; i < voltages.size(); i++){
+                if(voltages[i] != voltages_gpu[i]){
+                    std::stringstream ss;
+                    ss << "test_from_dat_file_gpu_layouts: voltages[" << i << "] != voltages_gpu[" << i << "] with "
+                        << obsInfo.nAntennas << " antennas" << (pin_mapping ? ", from the pinned mapping." : ".") << std::endl;
+                    std::remove(tmpfile.c_str());
+                    throw TestFailed(ss.str().c_str());
+                }
+            }
+        }
+    }
+    std::remove(tmpfile.c_str());
+    std::cout << "'test_from_dat_file_gpu_layouts' passed." << std::endl;
+}
+
+
+
+void test_from_dat_file_truncated(){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nAntennas = 16;
+    obsInfo.nFrequencies = 8;
+    obsInfo.nTimesteps = 300;
+    const unsigned int n_steps {100};
+    const size_t bytesPerTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+    const std::string tmpfile {dataRootDir + "/test_dat_truncated.dat.tmp"};
+    const auto write_file = [&](size_t n_bytes){
+        std::ofstream fout {tmpfile, std::ios::binary | std::ios::trunc};
+        for(size_t i {0}; i < n_bytes; i++) fout.put(static_cast<char>(i * 37 + i / 11));
+    };
+    write_file(bytesPerTimestep * obsInfo.nTimesteps);
+    const size_t n_samples {dat_file_output_size(obsInfo, n_steps)};
+    MemoryBuffer<std::complex<int8_t>> reference {n_samples}, truncated {n_samples};
+    load_dat_file(tmpfile, obsInfo, n_steps, reference.data());
+    // 250 and a half timesteps: only the first two groups of 100 are loaded.
+    write_file(bytesPerTimestep * 250 + bytesPerTimestep / 2);
+    const size_t loaded {load_dat_file(tmpfile, obsInfo, n_steps, truncated.data())};
+    const size_t samplesInTimeInterval {bytesPerTimestep * n_steps};
+    const auto check = [&](const MemoryBuffer<std::complex<int8_t>>& voltages, size_t n_bytes, const std::string& method){
+        if(n_bytes != 200 * bytesPerTimestep)
+            throw TestFailed("test_from_dat_file_truncated: wrong number of bytes loaded by " + method + ".");
+        for(size_t i {0}; i < n_samples; i++){
+            const std::complex<int8_t> expected {i < 2 * samplesInTimeInterval ? reference[i] : std::complex<int8_t> {0, 0}};
+            if(voltages[i] != expected)
+                throw TestFailed("test_from_dat_file_truncated: wrong sample " + std::to_string(i) + " loaded by " + method + ".");
+        }
+    };
+    check(truncated, loaded, "load_dat_file");
+    #ifdef __GPU__
+    for(bool pin_mapping : {false, true}){
+        MemoryBuffer<std::complex<int8_t>> voltages_gpu {n_samples, MemoryType::DEVICE};
+        // Fill with garbage, which must not survive in the missing timesteps.
+        gpuMemset(voltages_gpu.data(), 0x5a, n_samples * sizeof(std::complex<int8_t>));
+        const size_t loaded_gpu {load_dat_file_gpu(tmpfile, obsInfo, n_steps, voltages_gpu.data(), nullptr,
+            bytesPerTimestep * 64, pin_mapping)};
+        voltages_gpu.to_cpu();
+        check(voltages_gpu, loaded_gpu, pin_mapping ? "load_dat_file_gpu with a pinned mapping" : "load_dat_file_gpu");
+    }
+    #endif
+    std::remove(tmpfile.c_str());
+    std::cout << "'test_from_dat_file_truncated' passed." << std::endl;
+}
+
+
+
+void test_voltage_stream(){
+    const std::string filename {dataRootDir + "/offline_correlator/1240826896_1240827191_ch146.dat"};
+    auto voltages = Voltages::from_dat_file(filename, VCS_OBSERVATION_INFO, 100);
+    VoltageStream stream {filename, VCS_OBSERVATION_INFO, 100, VoltageStream::Format::DAT, 4};
+    size_t offset {0};
+    while(const Voltages *block = stream.next()){
+        const size_t n_samples {std::min(block->MemoryBuffer::size(), voltages.MemoryBuffer::size() - offset)};
+        if(memcmp(voltages.data() + offset, block->data(), n_samples * sizeof(std::complex<int8_t>)))
+            throw TestFailed("test_voltage_stream: streamed block differs from from_dat_file output.");
+        offset += n_samples;
+    }
+    if(offset != voltages.MemoryBuffer::size())
+        throw TestFailed("test_voltage_stream: streamed data does not cover the whole file.");
+    std::cout << "'test_voltage_stream' passed." << std::endl;
+}
+
+
+void test_voltage_batch(){
+    const std::string filename {dataRootDir + "/offline_correlator/1240826896_1240827191_ch146.dat"};
+    auto voltages = Voltages::from_dat_file(filename, VCS_OBSERVATION_INFO, 100);
+    // The same file pretending to be three different coarse channels, out of order.
+    std::vector<DatFile> files;
+    for(unsigned int coarse_channel : {146u, 144u, 145u}){
+        ObservationInfo obs_info {VCS_OBSERVATION_INFO};
+        obs_info.coarseChannel = coarse_channel;
+        files.push_back({filename, obs_info});
+    }
+    BatchLoadOptions options;
+    options.n_io_threads = 2;
+    auto batch = VoltageBatch::from_dat_files(files, 100, options);
+    if(batch.n_channels() != files.size() || batch.channel_size() != voltages.MemoryBuffer::size())
+        throw TestFailed("test_voltage_batch: batch has the wrong size.");
+    for(size_t c {0}; c < batch.n_channels(); c++){
+        if(batch.obsInfos[c].coarseChannel != 144u + c || batch.obsInfos[c].coarse_channel_index != c)
+            throw TestFailed("test_voltage_batch: coarse channels are not sorted.");
+        if(memcmp(voltages.data(), batch.channel_data(c), batch.channel_size() * sizeof(std::complex<int8_t>)))
+            throw TestFailed("test_voltage_batch: batch differs from from_dat_file output.");
+    }
+    std::cout << "'test_voltage_batch' passed." << std::endl;
+}
+
+
+
+void test_observation_prefetcher(){
+    const std::string filename {dataRootDir + "/offline_correlator/1240826896_1240827191_ch146.dat"};
+    auto voltages = Voltages::from_dat_file(filename, VCS_OBSERVATION_INFO, 100);
+    // Three "seconds" of two coarse channels each, all backed by the same file.
+    std::vector<std::vector<DatFile>> seconds;
+    for(time_t second {0}; second < 3; second++){
+        std::vector<DatFile> files;
+        for(unsigned int coarse_channel : {145u, 146u}){
+            ObservationInfo obs_info {VCS_OBSERVATION_INFO};
+            obs_info.coarseChannel = coarse_channel;
+            obs_info.startTime = second;
+            files.push_back({filename, obs_info});
+        }
+        seconds.push_back(files);
+    }
+    ObservationPrefetcher prefetcher {seconds, 100, 1};
+    size_t n_seconds {0};
+    while(const VoltageBatch *batch = prefetcher.next()){
+        if(batch->obsInfos[0].startTime != static_cast<time_t>(prefetcher.current_index()))
+            throw TestFailed("test_observation_prefetcher: seconds returned out of order.");
+        if(memcmp(voltages.data(), batch->channel_data(1), batch->channel_size() * sizeof(std::complex<int8_t>)))
+            throw TestFailed("test_observation_prefetcher: batch differs from from_dat_file output.");
+        n_seconds++;
+    }
+    if(n_seconds != seconds.size() || prefetcher.stats().batches_loaded != seconds.size())
+        throw TestFailed("test_observation_prefetcher: not all the seconds were returned.");
+    std::cout << "'test_observation_prefetcher' passed." << std::endl;
+}
+
+
+
 void test_from_memory(){
     char *input_char;
     size_t insize;
@@ -54,6 +241,54 @@ void test_from_memory(){
 
 
 
+void test_from_memory_reorder(){
+    // Timesteps that are not a whole number of integration intervals, nor of reorder blocks.
+    ObservationInfo layouts[2] {EDA2_OBSERVATION_INFO, VCS_OBSERVATION_INFO};
+    layouts[0].nTimesteps = 1250;
+    layouts[1].nAntennas = 6;
+    layouts[1].nFrequencies = 5;
+    layouts[1].nTimesteps = 333;
+    const unsigned int nIntegrationSteps {100};
+    for(const ObservationInfo& obsInfo : layouts){
+        const size_t nSamplesInTimestep {static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * obsInfo.nPolarizations};
+        std::vector<int8_t> input(obsInfo.nTimesteps * nSamplesInTimestep * 2);
+        for(size_t i {0}; i < input.size(); i++) input[i] = static_cast<int8_t>(i * 37 + i / 11);
+        // Reference: the sample `s` of timestep `t` goes to step `t % nIntegrationSteps` of the
+        // interval `t / nIntegrationSteps`; samples past the last timestep are zero.
+        const size_t nIntervals {(obsInfo.nTimesteps + nIntegrationSteps - 1) / nIntegrationSteps};
+        std::vector<std::complex<int8_t>> expected(nIntervals * nIntegrationSteps * nSamplesInTimestep);
+        for(size_t t {0}; t < obsInfo.nTimesteps; t++)
+            for(size_t s {0}; s < nSamplesInTimestep; s++)
+                expected[(t / nIntegrationSteps * nSamplesInTimestep + s) * nIntegrationSteps + t % nIntegrationSteps] =
+                    {input[2 * (t * nSamplesInTimestep + s)], input[2 * (t * nSamplesInTimestep + s) + 1]};
+        std::vector<Voltages> results;
+        results.push_back(Voltages::from_memory(input.data(), input.size(), obsInfo, nIntegrationSteps, 1));
+        results.push_back(Voltages::from_memory(input.data(), input.size(), obsInfo, nIntegrationSteps));
+        if(num_available_gpus() > 0){
+            // Chunks that are not a whole number of tiles.
+            results.push_back(Voltages::from_memory_gpu(input.data(), input.size(), obsInfo, nIntegrationSteps,
+                nullptr, nSamplesInTimestep * 2 * 150));
+            results.back().to_cpu();
+        }
+        for(const Voltages& voltages : results){
+            // The padding past the last timestep is checked too.
+            if(voltages.MemoryBuffer::size() != expected.size())
+                throw TestFailed("test_from_memory_reorder: wrong number of samples.");
+            for(size_t i {0}; i < expected.size(); i++){
+                if(voltages[i] != expected[i]){
+                    std::stringstream ss;
+                    ss << "test_from_memory_reorder: voltages[" << i << "] != expected[" << i << "] with "
+                        << obsInfo.nAntennas << " antennas." << std::endl;
+                    throw TestFailed(ss.str().c_str());
+                }
+            }
+        }
+    }
+    std::cout << "'test_from_memory_reorder' passed." << std::endl;
+}
+
+
+
 void test_simply_writing_and_reading_fits_file(){
     ObservationInfo obsInfo;
     obsInfo.nAntennas = 128;
@@ -91,6 +326,250 @@ void test_simply_writing_and_reading_fits_file(){
 
 
 
+void test_from_fits_file_interval_range(){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nAntennas = 16;
+    obsInfo.nTimesteps = 300;
+    const size_t n_baselines {((obsInfo.nAntennas + 1) * obsInfo.nAntennas) / 2};
+    const size_t nValuesInTimeInterval {n_baselines * 4 * obsInfo.nFrequencies};
+    MemoryBuffer<std::complex<float>> xcorr {nValuesInTimeInterval * 3};
+    for(size_t i {0}; i < xcorr.size(); i++) xcorr[i] = {static_cast<float>(i), -1.0f};
+    Visibilities v {std::move(xcorr), obsInfo, 100, 1};
+    std::string tmpfile {dataRootDir + "/test_fits_range.fits.tmp"};
+    v.to_fits_file(tmpfile);
+    auto v2 = Visibilities::from_fits_file(tmpfile, obsInfo, 1, 2);
+    std::remove(tmpfile.c_str());
+    if(v2.integration_intervals() != 2 || v2.size() != 2 * nValuesInTimeInterval)
+        throw TestFailed("test_from_fits_file_interval_range: wrong number of intervals.");
+    if(memcmp(v.data() + nValuesInTimeInterval, v2.data(), v2.size() * sizeof(std::complex<float>)))
+        throw TestFailed("test_from_fits_file_interval_range: elements differ!");
+    std::cout << "'test_from_fits_file_interval_range' passed." << std::endl;
+}
+
+
+
+void test_to_fits_file_mwax(){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nTimesteps = 200;
+    obsInfo.id = "1240826896";
+    const size_t n_baselines {((obsInfo.nAntennas + 1) * obsInfo.nAntennas) / 2};
+    const size_t n_pols {obsInfo.nPolarizations * obsInfo.nPolarizations};
+    const size_t nValuesInTimeInterval {n_baselines * n_pols * obsInfo.nFrequencies};
+    MemoryBuffer<std::complex<float>> xcorr {nValuesInTimeInterval * 2};
+    for(size_t i {0}; i < xcorr.size(); i++){
+        xcorr[i].real(static_cast<float>(i % 1000));
+        xcorr[i].imag(-static_cast<float>(i % 777));
+    }
+    Visibilities v {std::move(xcorr), obsInfo, 100, 1};
+    std::string tmpfile {dataRootDir + "/test_fits_mwax.fits.tmp"};
+    v.to_fits_file_mwax(tmpfile, 0);
+    FITS fits_file {tmpfile, FITS::Mode::READ};
+    std::remove(tmpfile.c_str());
+    // primary HDU, then one visibility and one weight HDU per interval.
+    if(fits_file.size() != 1 + 2 * v.integration_intervals())
+        throw TestFailed("test_to_fits_file_mwax: wrong number of HDUs.");
+    for(size_t interval {0}; interval < v.integration_intervals(); interval++){
+        const std::complex<float> *pImage {reinterpret_cast<const std::complex<float>*>(fits_file[1 + 2 * interval].get_image_data())};
+        for(size_t b {0}; b < n_baselines; b++){
+            for(size_t ch {0}; ch < obsInfo.nFrequencies; ch++){
+                for(size_t pol {0}; pol < n_pols; pol++){
+                    if(pImage[(b * obsInfo.nFrequencies + ch) * n_pols + pol] !=
+                            v.data()[interval * nValuesInTimeInterval + (ch * n_baselines + b) * n_pols + pol])
+                        throw TestFailed("test_to_fits_file_mwax: visibilities are not in MWAX order.");
+                }
+            }
+        }
+    }
+    std::cout << "'test_to_fits_file_mwax' passed." << std::endl;
+}
+
+
+
+void test_compressed_fits_file(){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nAntennas = 8;
+    obsInfo.nFrequencies = 16;
+    obsInfo.nTimesteps = 200;
+    obsInfo.id = "1240826896";
+    const size_t n_values {((obsInfo.nAntennas + 1) * obsInfo.nAntennas) / 2 * 4 * obsInfo.nFrequencies * 2};
+    MemoryBuffer<std::complex<float>> xcorr {n_values};
+    for(size_t i {0}; i < xcorr.size(); i++) xcorr[i] = {static_cast<float>(i % 1000) * 0.25f, -static_cast<float>(i % 777)};
+    Visibilities v {std::move(xcorr), obsInfo, 100, 1};
+    const std::string tmpfile {dataRootDir + "/test_fits_compressed.fits.tmp"};
+    for(VisibilityLayout layout : {VisibilityLayout::CHANNEL_BASELINE_POL, VisibilityLayout::BASELINE_CHANNEL_POL}){
+        v.convert_layout(layout);
+        for(int mwax {0}; mwax < 2; mwax++){
+            FitsOutputOptions options;
+            options.compression = mwax ? FitsCompression::GZIP : FitsCompression::RICE;
+            options.encoding = mwax ? PixelEncoding::FLOAT16 : PixelEncoding::INT16_SCALED;
+            // Largest value of an interval over 32767, or the precision of half floats.
+            const float tolerance {mwax ? 0.5f : 999.0f / 32767.0f};
+            if(mwax) v.to_fits_file_mwax(tmpfile, 0, options);
+            else v.to_fits_file(tmpfile, options);
+            Visibilities read {Visibilities::from_fits_file(tmpfile, obsInfo)};
+            read.convert_layout(layout);
+            Visibilities loaded {read};
+            Visibilities::load_fits_file(tmpfile, loaded.view(), 0);
+            std::remove(tmpfile.c_str());
+            if(read.size() != v.size() || read.integration_intervals() != 2)
+                throw TestFailed("test_compressed_fits_file: wrong number of visibilities.");
+            for(size_t i {0}; i < v.size(); i++){
+                if(std::abs(read.data()[i].real() - v.data()[i].real()) > tolerance || std::abs(read.data()[i].imag() - v.data()[i].imag()) > tolerance
+                        || loaded.data()[i] != read.data()[i])
+                    throw TestFailed("test_compressed_fits_file: visibilities differ.");
+            }
+        }
+    }
+    std::cout << "'test_compressed_fits_file' passed." << std::endl;
+}
+
+
+
+void test_visibility_layout(){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nAntennas = 16;
+    obsInfo.nTimesteps = 200;
+    obsInfo.id = "1240826896";
+    const size_t n_baselines {((obsInfo.nAntennas + 1) * obsInfo.nAntennas) / 2};
+    MemoryBuffer<std::complex<float>> xcorr {n_baselines * 4 * obsInfo.nFrequencies * 2};
+    for(size_t i {0}; i < xcorr.size(); i++) xcorr[i] = {static_cast<float>(i), 1.0f};
+    Visibilities v {std::move(xcorr), obsInfo, 100, 1};
+    Visibilities mwax {v};
+    mwax.convert_layout(VisibilityLayout::BASELINE_CHANNEL_POL);
+    // MWAX files are read back without reordering, both layouts are written in the same way.
+    std::string tmpfile {dataRootDir + "/test_fits_layout.fits.tmp"};
+    mwax.to_fits_file_mwax(tmpfile, 0);
+    auto from_mwax = Visibilities::from_fits_file(tmpfile, obsInfo);
+    mwax.to_fits_file(tmpfile);
+    auto from_internal = Visibilities::from_fits_file(tmpfile, obsInfo);
+    std::remove(tmpfile.c_str());
+    if(from_mwax.layout != VisibilityLayout::BASELINE_CHANNEL_POL || from_internal.layout != VisibilityLayout::CHANNEL_BASELINE_POL)
+        throw TestFailed("test_visibility_layout: wrong layout after reading the files.");
+    for(unsigned int interval {0}; interval < v.integration_intervals(); interval++){
+        for(unsigned int ch {0}; ch < v.nFrequencies; ch++){
+            for(unsigned int a1 {0}; a1 < obsInfo.nAntennas; a1++){
+                for(unsigned int a2 {0}; a2 <= a1; a2++){
+                    for(unsigned int pol {0}; pol < 4; pol++){
+                        const std::complex<float> expected {v.at(interval, ch, a1, a2)[pol]};
+                        if(mwax.at(interval, ch, a1, a2)[pol] != expected || from_mwax.at(interval, ch, a1, a2)[pol] != expected
+                                || from_internal.at(interval, ch, a1, a2)[pol] != expected)
+                            throw TestFailed("test_visibility_layout: at() returns different values across layouts.");
+                    }
+                }
+            }
+        }
+    }
+    std::cout << "'test_visibility_layout' passed." << std::endl;
+}
+
+
+
+void test_visibility_views(){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nAntennas = 16;
+    obsInfo.nTimesteps = 300;
+    obsInfo.id = "1240826896";
+    const size_t n_baselines {((obsInfo.nAntennas + 1) * obsInfo.nAntennas) / 2};
+    MemoryBuffer<std::complex<float>> xcorr {n_baselines * 4 * obsInfo.nFrequencies * 3};
+    for(size_t i {0}; i < xcorr.size(); i++) xcorr[i] = {static_cast<float>(i), 2.0f};
+    Visibilities v {std::move(xcorr), obsInfo, 100, 1};
+    Visibilities mwax {v};
+    mwax.convert_layout(VisibilityLayout::BASELINE_CHANNEL_POL);
+    // Views index visibilities in the same way whatever the layout.
+    const ConstVisibilityView view {v.view()}, mwax_view {mwax.view()};
+    for(unsigned int interval {0}; interval < v.integration_intervals(); interval++)
+        for(unsigned int ch {0}; ch < v.nFrequencies; ch++)
+            for(unsigned int b {0}; b < n_baselines; b++)
+                for(unsigned int pol {0}; pol < 4; pol++)
+                    if(view(interval, ch, b, pol) != v.at(interval, ch, b)[pol] || mwax_view(interval, ch, b, pol) != view(interval, ch, b, pol))
+                        throw TestFailed("test_visibility_views: views and at() disagree.");
+
+    // Save intervals [1, 3) and channels [32, 96) of the MWAX copy, then read them back into a slice of another object.
+    const ConstVisibilityView part {mwax_view.slice(0, 1, 2).slice(1, 32, 64)};
+    std::string tmpfile {dataRootDir + "/test_fits_views.fits.tmp"};
+    mwax.to_fits_file(tmpfile, part);
+    MemoryBuffer<std::complex<float>> zeros {v.size()};
+    for(size_t i {0}; i < zeros.size(); i++) zeros[i] = {0.0f, 0.0f};
+    Visibilities loaded {std::move(zeros), obsInfo, 100, 1};
+    Visibilities::load_fits_file(tmpfile, loaded.view().slice(0, 1, 2).slice(1, 32, 64));
+    FITS fits_file {tmpfile, FITS::Mode::READ};
+    std::remove(tmpfile.c_str());
+    if(fits_file.size() != 2 || fits_file[1].get_keyword<int>("MILLITIM").first != 20)
+        throw TestFailed("test_visibility_views: wrong HDUs written for the view.");
+    for(unsigned int interval {0}; interval < v.integration_intervals(); interval++)
+        for(unsigned int ch {0}; ch < v.nFrequencies; ch++)
+            for(unsigned int b {0}; b < n_baselines; b++){
+                const bool selected {interval >= 1 && ch >= 32 && ch < 96};
+                const std::complex<float> expected {selected ? v.at(interval, ch, b)[3] : std::complex<float> {0.0f, 0.0f}};
+                if(loaded.at(interval, ch, b)[3] != expected)
+                    throw TestFailed("test_visibility_views: elements differ!");
+            }
+    std::cout << "'test_visibility_views' passed." << std::endl;
+}
+
+
+
+void test_observation_catalogue(){
+    const std::string directory {dataRootDir + "/test_catalogue.tmp"};
+    blink::imager::create_directory(directory);
+    auto touch = [&](const std::string& obs_id, time_t second, unsigned int channel){
+        std::stringstream ss;
+        ss << directory << "/" << obs_id << "_" << second << "_ch" << channel << ".dat";
+        std::ofstream {ss.str()};
+        return ss.str();
+    };
+    // Two observations of two and one seconds, and a file that is not a .dat file.
+    for(unsigned int ch {109}; ch < 133; ch++){
+        touch("1240826896", 1240827191, ch);
+        touch("1240826896", 1240827192, ch);
+        touch("1240830000", 1240830010, ch);
+    }
+    std::ofstream {directory + "/notes.txt"};
+
+    ObservationCatalogue catalogue {directory};
+    if(catalogue.size() != 72 || catalogue.observations().size() != 2 || catalogue.n_seconds("1240826896") != 2)
+        throw TestFailed("test_observation_catalogue: wrong content of the catalogue.");
+    auto seconds = catalogue.select_all(1, 2);
+    if(seconds.size() != 2 || seconds[0].size() != 24 || seconds[1][0].second.id != "1240830000"
+            || seconds[0][0].second.coarseChannel != 109 || seconds[0][23].second.coarseChannel != 132
+            || seconds[0][0].second.startTime != gps_to_unix(1240827192))
+        throw TestFailed("test_observation_catalogue: wrong selection across observations.");
+    if(catalogue.select_time_range("1240826896", 1240827192, 1240827300).size() != 1)
+        throw TestFailed("test_observation_catalogue: wrong selection by time range.");
+
+    // An incomplete second is listed but cannot be selected; completing it fixes that.
+    for(unsigned int ch {109}; ch < 120; ch++) touch("1240826896", 1240827193, ch);
+    touch("1240826896", 1240827193, 120);
+    std::remove((directory + "/1240830000_1240830010_ch109.dat").c_str());
+    if(catalogue.refresh() != 12 || catalogue.size() != 83 || catalogue.n_seconds("1240826896") != 3)
+        throw TestFailed("test_observation_catalogue: new files not indexed.");
+    bool thrown {false};
+    try { catalogue.select("1240826896", 2, 1); } catch (std::invalid_argument&) { thrown = true; }
+    if(!thrown) throw TestFailed("test_observation_catalogue: incomplete second selected.");
+
+    auto from_dir = parse_mwa_dat_files(directory, 0, 2);
+    if(from_dir.size() != 2 || from_dir[1][0].second.startTime != gps_to_unix(1240827192))
+        throw TestFailed("test_observation_catalogue: wrong result of parse_mwa_dat_files.");
+
+    // Files added by hand are not new to the next scan, and are dropped once removed.
+    const std::string added {touch("1240826896", 1240827193, 121)};
+    if(!catalogue.add(added) || catalogue.add(added) || catalogue.size() != 84)
+        throw TestFailed("test_observation_catalogue: file not added.");
+    if(catalogue.refresh() != 0 || catalogue.size() != 84)
+        throw TestFailed("test_observation_catalogue: added file indexed twice.");
+    std::remove(added.c_str());
+    catalogue.refresh();
+    if(catalogue.size() != 83 || !catalogue.find("1240826896", 1240827193, 121).empty())
+        throw TestFailed("test_observation_catalogue: removed file still in the catalogue.");
+
+    for(const auto& name : blink::imager::list_files_in_dir(directory))
+        if(name != "." && name != "..") std::remove((directory + "/" + name).c_str());
+    std::remove(directory.c_str());
+    std::cout << "'test_observation_catalogue' passed." << std::endl;
+}
+
+
+
 int main(void){
     char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
     if(!pathToData){
@@ -100,8 +579,21 @@ int main(void){
     dataRootDir = std::string {pathToData};
     try{
         test_from_dat_file();
+        test_from_dat_file_threads();
+        test_from_dat_file_gpu_layouts();
+        test_from_dat_file_truncated();
+        test_voltage_stream();
+        test_voltage_batch();
+        test_observation_prefetcher();
+        test_observation_catalogue();
         test_from_memory();
+        test_from_memory_reorder();
         test_simply_writing_and_reading_fits_file();
+        test_from_fits_file_interval_range();
+        test_to_fits_file_mwax();
+        test_compressed_fits_file();
+        test_visibility_layout();
+        test_visibility_views();
     } catch (std::exception& ex){
         std::cerr << ex.what() << std::endl;
         return 1;
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <fstream>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <sstream>
+#include "common.hpp"
+#include "../src/calibration.hpp"
+
+
+std::string dataRootDir;
+
+
+std::vector<JonesMatrix<float>> make_solutions(unsigned int n_antennas, unsigned int n_channels){
+    std::vector<JonesMatrix<float>> solutions(static_cast<size_t>(n_antennas) * n_channels);
+    for(size_t i {0}; i < solutions.size(); i++){
+        const float x {static_cast<float>(i % 13) / 13.0f};
+        solutions[i].XX = {1.0f + x, 0.5f - x};
+        solutions[i].XY = {0.1f * x, -0.2f};
+        solutions[i].YX = {-0.3f, 0.05f * x};
+        solutions[i].YY = {0.8f - x, x};
+    }
+    return solutions;
+}
+
+
+
+Visibilities make_visibilities(unsigned int n_antennas, unsigned int n_channels, VisibilityLayout layout){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nAntennas = n_antennas;
+    obsInfo.nFrequencies = n_channels;
+    obsInfo.nTimesteps = 200;
+    const size_t n_baselines {((n_antennas + 1) * n_antennas) / 2};
+    MemoryBuffer<std::complex<float>> data {n_baselines * 4 * n_channels * 2};
+    for(size_t i {0}; i < data.size(); i++)
+        data[i] = {static_cast<float>(i % 17) - 8.0f, static_cast<float>(i % 11) * 0.5f};
+    Visibilities vis {std::move(data), obsInfo, 100, 1};
+    vis.convert_layout(layout);
+    return vis;
+}
+
+
+
+void check_calibrated(const Visibilities& original, Visibilities& calibrated, const CalibrationSolutions& solutions,
+        unsigned int channel_offset, const std::string& test_name){
+    Visibilities& input {const_cast<Visibilities&>(original)};
+    for(unsigned int interval {0}; interval < input.integration_intervals(); interval++){
+        for(unsigned int ch {0}; ch < input.nFrequencies; ch++){
+            for(unsigned int a1 {0}; a1 < input.obsInfo.nAntennas; a1++){
+                for(unsigned int a2 {0}; a2 <= a1; a2++){
+                    const JonesMatrix<float> v {JonesMatrix<float>::from_array<float>(reinterpret_cast<float*>(input.at(interval, ch, a1, a2)))};
+                    const JonesMatrix<float> expected {solutions.get(a1, ch + channel_offset) * v *
+                        solutions.get(a2, ch + channel_offset).conjtrans()};
+                    const JonesMatrix<float> result {JonesMatrix<float>::from_array<float>(reinterpret_cast<float*>(calibrated.at(interval, ch, a1, a2)))};
+                    const JonesMatrix<float> diff {result - expected};
+                    const double error {diff.XX.magnitude() + diff.XY.magnitude() + diff.YX.magnitude() + diff.YY.magnitude()};
+                    if(!(error < 1e-3)){
+                        std::stringstream ss;
+                        ss << "'" << test_name << "' failed: wrong value for interval " << interval << ", channel " << ch
+                            << ", baseline (" << a1 << ", " << a2 << ").";
+                        throw TestFailed(ss.str());
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+void test_apply_calibration(){
+    // Antenna counts not multiple of the SIMD width exercise the scalar remainder.
+    const unsigned int n_antennas {19}, n_channels {10};
+    CalibrationSolutions solutions {n_antennas, n_channels, make_solutions(n_antennas, n_channels)};
+    for(VisibilityLayout layout : {VisibilityLayout::CHANNEL_BASELINE_POL, VisibilityLayout::BASELINE_CHANNEL_POL}){
+        Visibilities vis {make_visibilities(n_antennas, n_channels, layout)};
+        Visibilities calibrated {vis};
+        apply_calibration(calibrated, solutions, 3);
+        check_calibrated(vis, calibrated, solutions, 0, "test_apply_calibration");
+        // Same result on GPU (data stays on CPU in CPU builds).
+        Visibilities calibrated_gpu {vis};
+        calibrated_gpu.to_gpu();
+        apply_calibration(calibrated_gpu, solutions);
+        calibrated_gpu.to_cpu();
+        check_calibrated(vis, calibrated_gpu, solutions, 0, "test_apply_calibration");
+    }
+    // Identity solutions leave the data unchanged.
+    Visibilities vis {make_visibilities(n_antennas, n_channels, VisibilityLayout::CHANNEL_BASELINE_POL)};
+    Visibilities calibrated {vis};
+    apply_calibration(calibrated, CalibrationSolutions {n_antennas, n_channels});
+    for(size_t i {0}; i < vis.size(); i++)
+        if(calibrated.data()[i] != vis.data()[i]) throw TestFailed("'test_apply_calibration' failed: identity changed the data.");
+    std::cout << "'test_apply_calibration' passed." << std::endl;
+}
+
+
+
+void test_apply_calibration_coarse_channel(){
+    const unsigned int n_antennas {8}, n_channels {4};
+    CalibrationSolutions solutions {n_antennas, 24 * n_channels, make_solutions(n_antennas, 24 * n_channels)};
+    Visibilities vis {make_visibilities(n_antennas, n_channels, VisibilityLayout::CHANNEL_BASELINE_POL)};
+    vis.obsInfo.coarse_channel_index = 5;
+    Visibilities calibrated {vis};
+    apply_calibration(calibrated, solutions);
+    check_calibrated(vis, calibrated, solutions, 5 * n_channels, "test_apply_calibration_coarse_channel");
+    bool thrown {false};
+    try {
+        apply_calibration(calibrated, CalibrationSolutions {n_antennas, n_channels + 1});
+    } catch (std::invalid_argument&) {
+        thrown = true;
+    }
+    if(!thrown) throw TestFailed("'test_apply_calibration_coarse_channel' failed: mismatching solutions were accepted.");
+    std::cout << "'test_apply_calibration_coarse_channel' passed." << std::endl;
+}
+
+
+
+void test_solutions_from_file(){
+    const unsigned int n_intervals {2}, n_antennas {5}, n_channels {3};
+    const std::string tmpfile {dataRootDir + "/test_solutions.bin.tmp"};
+    {
+        std::ofstream fout {tmpfile, std::ios::binary};
+        const uint32_t header[6] {0, 0, n_intervals, n_antennas, n_channels, 4};
+        const double time_range[2] {0.0, 1.0};
+        fout.write("MWAOCAL", 8);
+        fout.write(reinterpret_cast<const char*>(header), sizeof(header));
+        fout.write(reinterpret_cast<const char*>(time_range), sizeof(time_range));
+        for(size_t i {0}; i < static_cast<size_t>(n_intervals) * n_antennas * n_channels * 4; i++){
+            const std::complex<double> value {static_cast<double>(i), -static_cast<double>(i)};
+            fout.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+    }
+    auto solutions = CalibrationSolutions::load(tmpfile, 1);
+    auto again = CalibrationSolutions::load(tmpfile, 1);
+    std::remove(tmpfile.c_str());
+    if(solutions != again) throw TestFailed("'test_solutions_from_file' failed: the file was read twice.");
+    if(solutions->n_antennas() != n_antennas || solutions->n_channels() != n_channels)
+        throw TestFailed("'test_solutions_from_file' failed: wrong dimensions.");
+    // Antenna 2, channel 1 of the second interval.
+    const float first {static_cast<float>(((n_antennas + 2) * n_channels + 1) * 4)};
+    const JonesMatrix<float> m {solutions->get(2, 1)};
+    if(m.XX.real != first || m.XX.imag != -first || m.XY.real != first + 1 || m.YY.imag != -(first + 3))
+        throw TestFailed("'test_solutions_from_file' failed: wrong matrix.");
+    CalibrationSolutions::clear_cache();
+    std::cout << "'test_solutions_from_file' passed." << std::endl;
+}
+
+
+
+int main(void){
+    char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
+    if(!pathToData){
+        std::cerr << "'" << ENV_DATA_ROOT_DIR << "' environment variable is not set." << std::endl;
+        return -1;
+    }
+    dataRootDir = std::string {pathToData};
+    try{
+        test_apply_calibration();
+        test_apply_calibration_coarse_channel();
+        test_solutions_from_file();
+    } catch (std::exception& ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed." << std::endl;
+    return 0;
+}
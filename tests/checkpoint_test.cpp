@@ -0,0 +1,219 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <complex>
+#include <fstream>
+#include <future>
+#include "common.hpp"
+#include "../src/checkpoint.hpp"
+
+
+std::string dataRootDir;
+
+
+ObservationInfo make_observation_info(){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nAntennas = 6;
+    obsInfo.nFrequencies = 4;
+    obsInfo.nTimesteps = 250;
+    obsInfo.timeResolution = 1.0 / 3.0;
+    obsInfo.coarse_channel_index = 7;
+    obsInfo.id = "1313388762";
+    obsInfo.telescope = TelescopeID::MWA3;
+    obsInfo.metadata_file = "/data/obs 1/1313388762.metafits";
+    return obsInfo;
+}
+
+
+
+void check_observation_info(const ObservationInfo& a, const ObservationInfo& b, const std::string& test_name){
+    if(a.nAntennas != b.nAntennas || a.nFrequencies != b.nFrequencies || a.nPolarizations != b.nPolarizations
+            || a.nTimesteps != b.nTimesteps || a.timeResolution != b.timeResolution || a.frequencyResolution != b.frequencyResolution
+            || a.coarseChannelBandwidth != b.coarseChannelBandwidth || a.startTime != b.startTime || a.coarseChannel != b.coarseChannel
+            || a.geo_long_deg != b.geo_long_deg || a.geo_lat_deg != b.geo_lat_deg || a.coarse_channel_index != b.coarse_channel_index
+            || a.id != b.id || a.telescope != b.telescope || a.metadata_file != b.metadata_file
+            || a.calibration_solutions_file != b.calibration_solutions_file)
+        throw TestFailed("'" + test_name + "' failed: ObservationInfo was not restored.");
+}
+
+
+
+template <typename T>
+void check_data(const MemoryBuffer<T>& a, const MemoryBuffer<T>& b, const std::string& test_name){
+    if(a.size() != b.size()) throw TestFailed("'" + test_name + "' failed: wrong number of elements.");
+    for(size_t i {0}; i < a.size(); i++)
+        if(a.data()[i] != b.data()[i]) throw TestFailed("'" + test_name + "' failed: wrong data.");
+}
+
+
+
+void test_voltages_checkpoint(){
+    const ObservationInfo obsInfo {make_observation_info()};
+    const unsigned int n_steps {100};
+    MemoryBuffer<std::complex<int8_t>> data {3ul * obsInfo.nFrequencies * obsInfo.nAntennas * 2 * n_steps};
+    for(size_t i {0}; i < data.size(); i++) data[i] = {static_cast<int8_t>(i % 251), static_cast<int8_t>(-(i % 7))};
+    const Voltages voltages {std::move(data), obsInfo, n_steps};
+    const std::string filename {dataRootDir + "/test_voltages.ckpt.tmp"};
+    save_checkpoint(filename, voltages);
+
+    const CheckpointInfo info {read_checkpoint_info(filename)};
+    if(info.content != CheckpointContent::VOLTAGES || info.element_type != "complex_int8" || info.dims.size() != 5
+            || info.dims[0] != 3 || info.dims[4] != n_steps || info.data_offset % CHECKPOINT_ALIGNMENT != 0
+            || info.attributes.at("n_integration_steps") != "100")
+        throw TestFailed("'test_voltages_checkpoint' failed: wrong header.");
+
+    Voltages loaded {load_voltages_checkpoint(filename)};
+    check_observation_info(voltages.obsInfo, loaded.obsInfo, "test_voltages_checkpoint");
+    if(loaded.nIntegrationSteps != n_steps) throw TestFailed("'test_voltages_checkpoint' failed: wrong integration steps.");
+    check_data<std::complex<int8_t>>(voltages, loaded, "test_voltages_checkpoint");
+    // The buffer maps the file privately: changes do not reach it.
+    loaded.data()[0] = {1, 1};
+    Voltages again {load_voltages_checkpoint(filename, MemoryType::PAGEABLE)};
+    check_data<std::complex<int8_t>>(voltages, again, "test_voltages_checkpoint");
+    // Saving again replaces the file without affecting the buffers mapping the old one.
+    save_checkpoint(filename, loaded);
+    check_data<std::complex<int8_t>>(voltages, again, "test_voltages_checkpoint");
+    if(num_available_gpus() > 0){
+        Voltages on_gpu {load_voltages_checkpoint(filename, MemoryType::DEVICE)};
+        if(!on_gpu.on_gpu()) throw TestFailed("'test_voltages_checkpoint' failed: data is not on GPU.");
+        const std::string gpu_filename {dataRootDir + "/test_voltages_gpu.ckpt.tmp"};
+        save_checkpoint(gpu_filename, on_gpu);
+        if(!on_gpu.on_gpu()) throw TestFailed("'test_voltages_checkpoint' failed: saving moved the data off the GPU.");
+        Voltages from_gpu {load_voltages_checkpoint(gpu_filename)};
+        std::remove(gpu_filename.c_str());
+        check_data<std::complex<int8_t>>(loaded, from_gpu, "test_voltages_checkpoint");
+    }
+    std::remove(filename.c_str());
+    std::cout << "'test_voltages_checkpoint' passed." << std::endl;
+}
+
+
+
+void test_visibilities_checkpoint(){
+    ObservationInfo obsInfo {make_observation_info()};
+    obsInfo.nTimesteps = 200;
+    const size_t n_baselines {(obsInfo.nAntennas * (obsInfo.nAntennas + 1)) / 2};
+    MemoryBuffer<std::complex<float>> data {2 * 2 * n_baselines * 4};
+    for(size_t i {0}; i < data.size(); i++) data[i] = {static_cast<float>(i) * 0.5f, -static_cast<float>(i % 13)};
+    Visibilities vis {std::move(data), obsInfo, 100, 2};
+    vis.convert_layout(VisibilityLayout::BASELINE_CHANNEL_POL);
+    const std::string filename {dataRootDir + "/test_visibilities.ckpt.tmp"};
+    // Written in the background, from a copy.
+    std::future<void> written {save_checkpoint_async(filename, Visibilities {vis})};
+    written.get();
+    Visibilities loaded {load_visibilities_checkpoint(filename)};
+    std::remove(filename.c_str());
+    check_observation_info(vis.obsInfo, loaded.obsInfo, "test_visibilities_checkpoint");
+    if(loaded.layout != VisibilityLayout::BASELINE_CHANNEL_POL || loaded.nAveragedChannels != 2 || loaded.nFrequencies != 2
+            || loaded.nIntegrationSteps != 100)
+        throw TestFailed("'test_visibilities_checkpoint' failed: wrong parameters.");
+    check_data<std::complex<float>>(vis, loaded, "test_visibilities_checkpoint");
+    bool thrown {false};
+    try {
+        load_voltages_checkpoint(filename);
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    if(!thrown) throw TestFailed("'test_visibilities_checkpoint' failed: a missing file was accepted.");
+    std::cout << "'test_visibilities_checkpoint' passed." << std::endl;
+}
+
+
+
+void test_images_checkpoint(){
+    const unsigned int side {8}, n_intervals {2}, n_channels {3};
+    MemoryBuffer<std::complex<float>> data {n_intervals * n_channels * side * side};
+    for(size_t i {0}; i < data.size(); i++) data[i] = {static_cast<float>(i), 1.0f};
+    Images images {std::move(data), make_observation_info(), n_intervals, n_channels, side, 12.5, -26.7, 0.01, 0.02};
+    std::vector<bool> flags(n_intervals * n_channels, false);
+    flags[4] = true;
+    images.set_flags(flags);
+    const std::string filename {dataRootDir + "/test_images.ckpt.tmp"};
+    save_checkpoint(filename, images);
+    Images loaded {load_images_checkpoint(filename, MemoryType::PAGEABLE)};
+    check_observation_info(images.obsInfo, loaded.obsInfo, "test_images_checkpoint");
+    if(loaded.side_size != side || loaded.n_intervals != n_intervals || loaded.n_channels != n_channels
+            || loaded.ra_deg != 12.5 || loaded.dec_deg != -26.7 || loaded.pixscale_ra != 0.01 || loaded.pixscale_dec != 0.02)
+        throw TestFailed("'test_images_checkpoint' failed: wrong parameters.");
+    if(!loaded.is_flagged(1, 1) || loaded.is_flagged(0, 0)) throw TestFailed("'test_images_checkpoint' failed: wrong flags.");
+    check_data<std::complex<float>>(images, loaded, "test_images_checkpoint");
+    // Wrong element type.
+    bool thrown {false};
+    try {
+        load_buffer_checkpoint<float>(filename);
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    std::remove(filename.c_str());
+    if(!thrown) throw TestFailed("'test_images_checkpoint' failed: images were loaded as a buffer of floats.");
+    std::cout << "'test_images_checkpoint' passed." << std::endl;
+}
+
+
+
+void test_buffer_checkpoint(){
+    MemoryBuffer<float> buffer {10000};
+    for(size_t i {0}; i < buffer.size(); i++) buffer[i] = static_cast<float>(i) / 3.0f;
+    const std::string filename {dataRootDir + "/test_buffer.ckpt.tmp"};
+    save_checkpoint(filename, buffer);
+    check_data(buffer, load_buffer_checkpoint<float>(filename), "test_buffer_checkpoint");
+    check_data(buffer, load_buffer_checkpoint<float>(filename, MemoryType::PAGEABLE, 0), "test_buffer_checkpoint");
+
+    // An empty buffer.
+    const std::string empty_filename {dataRootDir + "/test_empty_buffer.ckpt.tmp"};
+    save_checkpoint(empty_filename, MemoryBuffer<float> {});
+    const MemoryBuffer<float> empty {load_buffer_checkpoint<float>(empty_filename)};
+    std::remove(empty_filename.c_str());
+    if(empty.size() != 0) throw TestFailed("'test_buffer_checkpoint' failed: an empty buffer was loaded with elements.");
+
+    // A truncated file is rejected.
+    const CheckpointInfo info {read_checkpoint_info(filename)};
+    {
+        std::ifstream fin {filename, std::ios::binary};
+        std::string content((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+        std::ofstream fout {filename, std::ios::binary | std::ios::trunc};
+        fout.write(content.data(), static_cast<std::streamsize>(info.data_offset + info.data_bytes / 2));
+    }
+    bool thrown {false};
+    try {
+        load_buffer_checkpoint<float>(filename);
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    std::remove(filename.c_str());
+    if(!thrown) throw TestFailed("'test_buffer_checkpoint' failed: a truncated file was accepted.");
+
+    // Raw dumps.
+    const std::string dump_filename {dataRootDir + "/test_buffer.dump.tmp"};
+    buffer.to_gpu();
+    buffer.dump(dump_filename);
+    const bool was_on_gpu {buffer.on_gpu()};
+    buffer.to_cpu();
+    MemoryBuffer<float> from_dump {MemoryBuffer<float>::from_dump(dump_filename)};
+    std::remove(dump_filename.c_str());
+    if(was_on_gpu != (num_available_gpus() > 0)) throw TestFailed("'test_buffer_checkpoint' failed: dump moved the data.");
+    check_data(buffer, from_dump, "test_buffer_checkpoint");
+    std::cout << "'test_buffer_checkpoint' passed." << std::endl;
+}
+
+
+
+int main(void){
+    char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
+    if(!pathToData){
+        std::cerr << "'" << ENV_DATA_ROOT_DIR << "' environment variable is not set." << std::endl;
+        return -1;
+    }
+    dataRootDir = std::string {pathToData};
+    try{
+        test_voltages_checkpoint();
+        test_visibilities_checkpoint();
+        test_images_checkpoint();
+        test_buffer_checkpoint();
+    } catch (std::exception& ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <complex>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include "common.hpp"
+#include "../src/correlation.hpp"
+#include "../src/utils.hpp"
+
+
+std::string dataRootDir;
+
+
+/*
+    Straightforward correlation of baseline (a1, a2), polarisations (p1, p2), in double precision.
+*/
+std::complex<double> reference_visibility(const Voltages& voltages, unsigned int interval, unsigned int out_channel,
+        unsigned int n_averaged, unsigned int a1, unsigned int a2, unsigned int p1, unsigned int p2){
+    const ObservationInfo& obsInfo {voltages.obsInfo};
+    const size_t n_steps {voltages.nIntegrationSteps};
+    const size_t valid_steps {std::min(n_steps, obsInfo.nTimesteps - interval * n_steps)};
+    std::complex<double> sum {0.0, 0.0};
+    for(unsigned int c {out_channel * n_averaged}; c < (out_channel + 1) * n_averaged; c++){
+        const size_t base {((static_cast<size_t>(interval) * obsInfo.nFrequencies + c) * obsInfo.nAntennas) * 2 * n_steps};
+        for(size_t t {0}; t < valid_steps; t++){
+            const std::complex<int8_t> v1 {voltages.data()[base + (2 * a1 + p1) * n_steps + t]};
+            const std::complex<int8_t> v2 {voltages.data()[base + (2 * a2 + p2) * n_steps + t]};
+            sum += std::complex<double> {static_cast<double>(v1.real()), static_cast<double>(v1.imag())} *
+                std::conj(std::complex<double> {static_cast<double>(v2.real()), static_cast<double>(v2.imag())});
+        }
+    }
+    return sum / static_cast<double>(valid_steps * n_averaged);
+}
+
+
+
+void check_visibilities(const Voltages& voltages, Visibilities& vis, unsigned int n_averaged, unsigned int baseline_step,
+        const std::string& test_name){
+    const unsigned int n_antennas {voltages.obsInfo.nAntennas};
+    if(vis.nFrequencies != voltages.obsInfo.nFrequencies / n_averaged || vis.layout != VisibilityLayout::CHANNEL_BASELINE_POL)
+        throw TestFailed("'" + test_name + "' failed: wrong output dimensions.");
+    unsigned int n_checked {0};
+    for(unsigned int interval {0}; interval < vis.integration_intervals(); interval++){
+        for(unsigned int ch {0}; ch < vis.nFrequencies; ch++){
+            for(unsigned int a1 {0}; a1 < n_antennas; a1++){
+                for(unsigned int a2 {0}; a2 <= a1; a2++){
+                    if(n_checked++ % baseline_step != 0) continue;
+                    for(unsigned int pol {0}; pol < 4; pol++){
+                        const std::complex<double> expected {reference_visibility(voltages, interval, ch, n_averaged, a1, a2, pol / 2, pol % 2)};
+                        const std::complex<float> value {vis.at(interval, ch, a1, a2)[pol]};
+                        if(std::abs(std::complex<double> {value.real(), value.imag()} - expected) > 1e-3 * (1.0 + std::abs(expected))){
+                            std::stringstream ss;
+                            ss << "'" << test_name << "' failed: wrong value for interval " << interval << ", channel " << ch
+                                << ", baseline (" << a1 << ", " << a2 << "), polarisation " << pol << ": " << value << " != " << expected << ".";
+                            throw TestFailed(ss.str());
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+void test_cross_correlation(){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nAntennas = 11;
+    obsInfo.nFrequencies = 6;
+    // The last interval is half full.
+    obsInfo.nTimesteps = 250;
+    const unsigned int n_steps {100};
+    const size_t n_samples {3 * static_cast<size_t>(obsInfo.nFrequencies) * obsInfo.nAntennas * 2 * n_steps};
+    MemoryBuffer<std::complex<int8_t>> data {n_samples};
+    std::mt19937 gen {42};
+    std::uniform_int_distribution<int> dist {-128, 127};
+    for(size_t i {0}; i < n_samples; i++)
+        data[i] = {static_cast<int8_t>(dist(gen)), static_cast<int8_t>(dist(gen))};
+    Voltages voltages {std::move(data), obsInfo, n_steps};
+    for(unsigned int n_averaged : {1u, 3u}){
+        Visibilities vis {cross_correlation(voltages, n_averaged, 4)};
+        check_visibilities(voltages, vis, n_averaged, 1, "test_cross_correlation");
+        // Same result on GPU (data stays on CPU in CPU builds).
+        Voltages voltages_gpu {voltages};
+        voltages_gpu.to_gpu();
+        Visibilities vis_gpu {cross_correlation(voltages_gpu, n_averaged)};
+        vis_gpu.to_cpu();
+        check_visibilities(voltages, vis_gpu, n_averaged, 1, "test_cross_correlation");
+    }
+    bool thrown {false};
+    try {
+        cross_correlation(voltages, 4);
+    } catch (std::invalid_argument&) {
+        thrown = true;
+    }
+    if(!thrown) throw TestFailed("'test_cross_correlation' failed: 4 averaged channels out of 6 were accepted.");
+    std::cout << "'test_cross_correlation' passed." << std::endl;
+}
+
+
+
+void test_cross_correlation_xgpu_input(){
+    char *input_char;
+    size_t insize;
+    read_data_from_file(dataRootDir + "/xGPU/input_array_128_128_128_100.bin", input_char, insize);
+    ObservationInfo obsInfo {.nAntennas = 128, .nFrequencies = 128, .nPolarizations = 2, .nTimesteps=100};
+    auto voltages = Voltages::from_memory(reinterpret_cast<int8_t *>(input_char), insize, obsInfo, 100);
+    delete[] input_char;
+    Visibilities vis {cross_correlation(voltages, 4)};
+    // A sample of the baselines, not to take too long.
+    check_visibilities(voltages, vis, 4, 97, "test_cross_correlation_xgpu_input");
+    std::cout << "'test_cross_correlation_xgpu_input' passed." << std::endl;
+}
+
+
+
+int main(void){
+    char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
+    if(!pathToData){
+        std::cerr << "'" << ENV_DATA_ROOT_DIR << "' environment variable is not set." << std::endl;
+        return -1;
+    }
+    dataRootDir = std::string {pathToData};
+    try{
+        test_cross_correlation();
+        test_cross_correlation_xgpu_input();
+    } catch (std::exception& ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed." << std::endl;
+    return 0;
+}
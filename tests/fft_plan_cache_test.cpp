@@ -0,0 +1,113 @@
+#include <iostream>
+#include <complex>
+#include <cmath>
+#include <sstream>
+#include "common.hpp"
+#include "../src/fft_plan_cache.hpp"
+
+
+Images make_images(unsigned int n_intervals, unsigned int n_channels, unsigned int side_size){
+    MemoryBuffer<std::complex<float>> data {static_cast<size_t>(n_intervals) * n_channels * side_size * side_size};
+    // Only the shape of the cube matters to the transforms; the rest is zero.
+    ObservationInfo obsInfo {};
+    obsInfo.nFrequencies = n_channels;
+    obsInfo.nPolarizations = 2;
+    obsInfo.nTimesteps = n_intervals;
+    obsInfo.timeResolution = 1.0;
+    return Images {std::move(data), obsInfo, n_intervals, n_channels, side_size, 0.0, 0.0, 1.0, 1.0};
+}
+
+
+
+void test_fft_images_c2c(){
+    Images images {make_images(2, 3, 16)};
+    const size_t n_values {images.size() * images.image_size()};
+    for(size_t i {0}; i < n_values; i++)
+        images.data()[i] = {static_cast<float>(i % 7), static_cast<float>(i % 5) - 2.0f};
+    MemoryBuffer<std::complex<float>> expected {images};
+
+    images.to_gpu();
+    fft_images_c2c(images, GPUFFT_FORWARD);
+    fft_images_c2c(images, GPUFFT_BACKWARD);
+    gpuDeviceSynchronize();
+    images.to_cpu();
+
+    // Transforms are not normalised.
+    const float scale {static_cast<float>(images.image_size())};
+    for(size_t i {0}; i < n_values; i++){
+        if(std::abs(images.data()[i] / scale - expected[i]) > 1e-3){
+            std::stringstream ss;
+            ss << "'test_fft_images_c2c' failed: wrong value at position " << i << ": " << images.data()[i] / scale
+                << " != " << expected[i] << ".";
+            throw TestFailed(ss.str());
+        }
+    }
+    std::cout << "'test_fft_images_c2c' passed." << std::endl;
+}
+
+
+
+void test_fft_images_c2r(){
+    Images images {make_images(1, 4, 32)};
+    const size_t n_values {images.size() * images.image_size()};
+    // A constant real image has a single non-zero Fourier coefficient.
+    for(size_t i {0}; i < n_values; i++) images.data()[i] = 0.0f;
+    for(size_t c {0}; c < images.n_channels; c++) images.at(0, c)[0] = 1.0f;
+    images.to_gpu();
+    MemoryBuffer<float> output;
+    fft_images_c2r(images, output);
+    gpuDeviceSynchronize();
+    output.to_cpu();
+    if(output.size() != n_values) throw TestFailed("'test_fft_images_c2r' failed: wrong output size.");
+    for(size_t i {0}; i < n_values; i++){
+        if(std::abs(output[i] - 1.0f) > 1e-5){
+            std::stringstream ss;
+            ss << "'test_fft_images_c2r' failed: wrong value at position " << i << ": " << output[i] << " != 1.";
+            throw TestFailed(ss.str());
+        }
+    }
+    std::cout << "'test_fft_images_c2r' passed." << std::endl;
+}
+
+
+
+void test_fft_plan_cache(){
+    FftPlanCache cache {2};
+    {
+        FftPlanCache::Lease first {cache.acquire(64, 4, FftType::C2C)};
+        // The plan is in use: a second one must be created.
+        FftPlanCache::Lease second {cache.acquire(64, 4, FftType::C2C)};
+        if(!first || !second || first.handle() == second.handle())
+            throw TestFailed("'test_fft_plan_cache' failed: the same plan was leased twice.");
+    }
+    { FftPlanCache::Lease again {cache.acquire(64, 4, FftType::C2C)}; }
+    { FftPlanCache::Lease other {cache.acquire(64, 8, FftType::C2C)}; }
+    FftPlanCacheStats stats {cache.stats()};
+    if(stats.requests != 4 || stats.hits != 1 || stats.plans_created != 3)
+        throw TestFailed("'test_fft_plan_cache' failed: plans were not reused.");
+    // Three idle plans, of which one beyond the limit.
+    if(stats.plans_destroyed != 1)
+        throw TestFailed("'test_fft_plan_cache' failed: the least recently used plan was not destroyed.");
+    cache.clear();
+    if(cache.stats().plans_destroyed != 3 || cache.stats().work_area_bytes != 0)
+        throw TestFailed("'test_fft_plan_cache' failed: 'clear' did not destroy all the plans.");
+    std::cout << "'test_fft_plan_cache' passed." << std::endl;
+}
+
+
+
+int main(void){
+    try{
+
+        test_fft_images_c2c();
+        test_fft_images_c2r();
+        test_fft_plan_cache();
+
+    } catch (TestFailed ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed." << std::endl;
+    return 0;
+}
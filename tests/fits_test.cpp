@@ -1,8 +1,15 @@
 #include <iostream>
 #include <stdexcept>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
 
 #include "common.hpp"
 #include "../src/FITS.hpp"
+#include "../src/fits_writer.hpp"
 
 
 std::string dataRootDir;
@@ -43,6 +50,382 @@ void test_write_read_simple_fits(){
 }
 
 
+
+void test_hdu_ownership(){
+    float data[] {1.0f, 2.0f, 3.0f, 4.0f};
+    FITS::HDU view;
+    view.set_image(data, 2, 2);
+    FITS::HDU viewCopy {view};
+    if(view.owns_image() || viewCopy.get_image_data() != data)
+        throw TestFailed("test_hdu_ownership: copies of a view must point to the caller buffer.");
+
+    std::unique_ptr<char[]> pixels {new char[sizeof(data)]};
+    std::copy(reinterpret_cast<char*>(data), reinterpret_cast<char*>(data) + sizeof(data), pixels.get());
+    const char *pPixels {pixels.get()};
+    FITS::HDU owner;
+    owner.set_image(FLOAT_IMG, std::move(pixels), 2, 2);
+    FITS::HDU ownerCopy {owner};
+    if(!owner.owns_image() || ownerCopy.get_image_data() != pPixels || ownerCopy != view)
+        throw TestFailed("test_hdu_ownership: copies of an owning HDU must share its pixels.");
+    FITS::HDU moved {std::move(owner)};
+    if(!moved.owns_image() || moved.get_image_data() != pPixels || owner.has_image())
+        throw TestFailed("test_hdu_ownership: moving an HDU must transfer the pixels it owns.");
+    // Rebinding to a view releases the pixels only when no copy refers to them.
+    ownerCopy.set_image(data, 2, 2);
+    if(ownerCopy.owns_image() || moved != view)
+        throw TestFailed("test_hdu_ownership: pixels released while still in use.");
+    std::cout << "'test_hdu_ownership' passed." << std::endl;
+}
+
+
+
+void test_header(){
+    FITS::HDU hdu;
+    hdu.add_keyword("NFINECHS", 32, "Number of fine channels");
+    hdu.add_keyword("INTTIME", 0.5f, "Integration time (s)");
+    hdu.add_keyword("PROJID", std::string {"G0008"}, "Project ID");
+    hdu.add_keyword("GPSTIME", "1240826896", "GPS time");
+    // Existing keywords are not overwritten.
+    hdu.add_keyword("NFINECHS", 64, "Number of fine channels");
+
+    const auto& header = hdu.get_header();
+    if(header.size() != 4 || header.count("NFINECHS") != 1 || header.count("NAXIS") != 0)
+        throw TestFailed("test_header: wrong number of keywords.");
+    std::string previous;
+    for(const auto& entry : header){
+        if(entry.keyword.str() <= previous) throw TestFailed("test_header: keywords are not sorted.");
+        previous = entry.keyword.str();
+    }
+    if(hdu.get_keyword<int>("NFINECHS") != std::make_pair(32, std::string {"Number of fine channels"}))
+        throw TestFailed("test_header: wrong integer keyword.");
+    if(hdu.get_keyword<float>("INTTIME").first != 0.5f)
+        throw TestFailed("test_header: wrong floating point keyword.");
+    if(hdu.get_keyword<std::string>("PROJID").first != "G0008")
+        throw TestFailed("test_header: wrong string keyword.");
+    if(hdu.get_keyword<long>("GPSTIME").first != 1240826896l)
+        throw TestFailed("test_header: string keyword not converted to a number.");
+    // Values longer than a card are not truncated.
+    const std::string long_value (3 * FLEN_VALUE, 'x');
+    hdu.add_keyword("LONGSTR", long_value, "Value spanning several cards");
+    if(hdu.get_keyword<std::string>("LONGSTR").first != long_value
+            || std::string {static_cast<const char*>(hdu.get_header().at("LONGSTR").value())} != long_value)
+        throw TestFailed("test_header: long string keyword truncated.");
+    bool thrown {false};
+    try {
+        hdu.get_keyword<int>("PROJID");
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    try {
+        hdu.get_keyword<int>("MISSING");
+        thrown = false;
+    } catch (const std::out_of_range&) {}
+    if(!thrown) throw TestFailed("test_header: invalid lookups did not throw.");
+    std::cout << "'test_header' passed." << std::endl;
+}
+
+
+
+void test_lazy_read(){
+    const std::string filename {"myLazyTestFits.fits"};
+    float data[3][6];
+    {
+        FITS myFITSImage {filename, FITS::Mode::WRITE};
+        for(int h {0}; h < 3; h++){
+            for(int i {0}; i < 6; i++) data[h][i] = h * 10.0f + i;
+            FITS::HDU newHDU;
+            newHDU.set_image(data[h], 3, 2);
+            newHDU.add_keyword("INDEX", h, "HDU index.");
+            myFITSImage.add_HDU(newHDU);
+        }
+        myFITSImage.write();
+    }
+    FITS myFITSImageAgain {filename, FITS::Mode::READ};
+    std::remove(filename.c_str());
+    for(int h {0}; h < 3; h++){
+        FITS::HDU& hdu {myFITSImageAgain[h]};
+        if(hdu.image_loaded() || !hdu.has_image() || hdu.image_bytes() != sizeof(data[h]))
+            throw TestFailed("test_lazy_read: pixels should not be loaded when the file is opened.");
+        if(hdu.get_keyword<int>("INDEX").first != h)
+            throw TestFailed("test_lazy_read: wrong header value.");
+    }
+    // Reading into a caller buffer does not load the HDU.
+    float buffer[6];
+    myFITSImageAgain[1].read_image(buffer);
+    if(memcmp(buffer, data[1], sizeof(buffer)) || myFITSImageAgain[1].image_loaded())
+        throw TestFailed("test_lazy_read: read_image returned the wrong pixels.");
+    // First access loads the pixels.
+    if(memcmp(myFITSImageAgain[2].get_image_data(), data[2], sizeof(data[2])) || !myFITSImageAgain[2].image_loaded())
+        throw TestFailed("test_lazy_read: get_image_data returned the wrong pixels.");
+    // An HDU without pixels, nor a file to read them from, cannot be read.
+    bool thrown {false};
+    try {
+        FITS::HDU {}.read_image(buffer);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    if(!thrown) throw TestFailed("test_lazy_read: reading an empty HDU did not throw.");
+    std::cout << "'test_lazy_read' passed." << std::endl;
+}
+
+
+
+void test_async_writer(){
+    const std::string filename {"myAsyncTestFits.fits"};
+    std::remove(filename.c_str());
+    const int nImages {4};
+    {
+        // A small queue, so that the producer is throttled by the writer.
+        AsyncFitsWriter writer {2, 3 * 6 * sizeof(float)};
+        for(int h {0}; h < nImages; h++){
+            MemoryBuffer<float> image {6};
+            for(int i {0}; i < 6; i++) image[i] = h * 10.0f + i;
+            FITS::HDU header;
+            header.add_keyword("INDEX", h, "HDU index.");
+            writer.write_image(filename, std::move(image), 3, 2, std::move(header));
+        }
+        writer.fence().wait();
+        if(writer.pending() != 0 || writer.stats().max_queued_bytes > 3 * 6 * sizeof(float))
+            throw TestFailed("test_async_writer: queue bound not respected.");
+        writer.flush();
+        // Errors of the I/O threads are reported to the producer.
+        writer.submit(filename, 0, AsyncFitsWriter::Action {[](std::unique_ptr<FITS>&){
+            throw std::runtime_error {"write failed"};
+        }});
+        bool thrown {false};
+        try {
+            writer.flush();
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        if(!thrown) throw TestFailed("test_async_writer: error not propagated by flush.");
+    }
+    FITS written {filename, FITS::Mode::READ};
+    std::remove(filename.c_str());
+    if(written.size() != nImages) throw TestFailed("test_async_writer: wrong number of HDUs.");
+    for(int h {0}; h < nImages; h++){
+        const float *pixels {static_cast<const float*>(written[h].get_image_data())};
+        if(written[h].get_keyword<int>("INDEX").first != h || pixels[5] != h * 10.0f + 5)
+            throw TestFailed("test_async_writer: images written out of order.");
+    }
+    std::cout << "'test_async_writer' passed." << std::endl;
+}
+
+
+
+void test_async_encoded_writer(){
+    const std::string filename {"myAsyncEncodedTestFits.fits"};
+    const long x_dim {32}, y_dim {16};
+    std::vector<float> data(x_dim * y_dim);
+    for(size_t i {0}; i < data.size(); i++) data[i] = std::cos(0.02f * i) * 50.0f;
+    struct Case { FitsCompression compression; PixelEncoding encoding; float tolerance; };
+    const Case cases[] {{FitsCompression::RICE, PixelEncoding::FLOAT32, 0.5f},
+        {FitsCompression::NONE, PixelEncoding::INT16_SCALED, 50.0f / 32767.0f}};
+    const float scale {int16_scale(max_abs_value(data.data(), data.size()))};
+    for(const Case& c : cases){
+        std::remove(filename.c_str());
+        FitsOutputOptions options;
+        options.compression = c.compression;
+        options.encoding = c.encoding;
+        {
+            AsyncFitsWriter writer;
+            MemoryBuffer<float> image {data.size()};
+            std::copy(data.begin(), data.end(), image.data());
+            FITS::HDU header;
+            header.add_keyword("INDEX", 0, "HDU index.");
+            writer.write_image(filename, std::move(image), x_dim, y_dim, std::move(header), options);
+            // Pixels encoded by the caller, as those downloaded from GPU.
+            MemoryBuffer<int16_t> encoded {data.size()};
+            encode_pixels(data.data(), data.size(), PixelEncoding::INT16_SCALED, scale, encoded.data());
+            header = FITS::HDU {};
+            header.add_keyword("INDEX", 1, "HDU index.");
+            writer.write_encoded_image(filename, std::move(encoded), x_dim, y_dim, PixelEncoding::INT16_SCALED, scale,
+                std::move(header), options);
+            writer.flush();
+        }
+        FITS fits {filename, FITS::Mode::READ};
+        std::remove(filename.c_str());
+        const size_t first {c.compression == FitsCompression::NONE ? 0ul : 1ul};
+        if(fits.size() != first + 2 || (first == 1 && fits[0].has_image()))
+            throw TestFailed("test_async_encoded_writer: the compression of the writer was not applied.");
+        for(size_t h {0}; h < 2; h++){
+            const FITS::HDU& hdu {fits[first + h]};
+            if(hdu.get_bitpix() != FLOAT_IMG || hdu.get_keyword<int>("INDEX").first != static_cast<int>(h))
+                throw TestFailed("test_async_encoded_writer: wrong header.");
+            std::vector<float> pixels(data.size());
+            hdu.read_image(pixels.data(), TFLOAT);
+            const float tolerance {h == 0 ? c.tolerance : scale};
+            bool exact {true};
+            for(size_t i {0}; i < data.size(); i++){
+                if(std::fabs(pixels[i] - data[i]) > tolerance)
+                    throw TestFailed("test_async_encoded_writer: wrong pixel " + std::to_string(i) + ": " + std::to_string(pixels[i]));
+                exact = exact && pixels[i] == data[i];
+            }
+            // Scaled images are quantised.
+            if(h == 0 && c.encoding == PixelEncoding::INT16_SCALED && exact)
+                throw TestFailed("test_async_encoded_writer: the encoding of the writer was not applied.");
+        }
+    }
+    std::cout << "'test_async_encoded_writer' passed." << std::endl;
+}
+
+
+
+void test_pixel_encoding(){
+    const float nan {std::numeric_limits<float>::quiet_NaN()}, inf {std::numeric_limits<float>::infinity()};
+    // Long enough to exercise both the vectorised loops and the scalar tails.
+    std::vector<float> values {1.0f, -2.0f, 0.0f, -0.0f, 65504.0f, 65519.0f, 65520.0f, 1e-8f, 3e-8f, 6.1e-5f,
+        0.333333f, -1234.5f, inf, -inf, nan, 1.00048828125f, 1.00146484375f, 7.5e20f, -3.1e-3f, 42.0f};
+    for(int i {0}; i < 23; i++) values.push_back(std::sin(0.37f * i) * 1000.0f);
+    const size_t n {values.size()};
+    std::vector<int16_t> encoded(n), element(1);
+    std::vector<float> decoded(n);
+
+    // Values are converted the same way by the vectorised and the scalar code.
+    for(PixelEncoding encoding : {PixelEncoding::INT16_SCALED, PixelEncoding::FLOAT16, PixelEncoding::BFLOAT16}){
+        const float scale {int16_scale(1234.5f)};
+        encode_pixels(values.data(), n, encoding, scale, encoded.data());
+        for(size_t i {0}; i < n; i++){
+            encode_pixels(&values[i], 1, encoding, scale, element.data());
+            if(std::isnan(values[i]) && encoding != PixelEncoding::INT16_SCALED){
+                // Payloads can differ, as long as the result is a NaN.
+                float v;
+                decode_pixels(&encoded[i], 1, encoding, scale, &v);
+                if(!std::isnan(v)) throw TestFailed("test_pixel_encoding: NaN not preserved.");
+            }else if(element[0] != encoded[i]){
+                throw TestFailed("test_pixel_encoding: vectorised and scalar encoding differ for " + std::to_string(values[i]));
+            }
+        }
+    }
+
+    encode_pixels(values.data(), n, PixelEncoding::FLOAT16, 1.0f, encoded.data());
+    const uint16_t expected_half[] {0x3c00, 0xc000, 0x0000, 0x8000, 0x7bff, 0x7bff, 0x7c00, 0x0000, 0x0001, 0x03ff};
+    for(size_t i {0}; i < 10; i++)
+        if(static_cast<uint16_t>(encoded[i]) != expected_half[i]) throw TestFailed("test_pixel_encoding: wrong half precision value of " + std::to_string(values[i]));
+    // Ties round to even.
+    if(static_cast<uint16_t>(encoded[15]) != 0x3c00 || static_cast<uint16_t>(encoded[16]) != 0x3c02)
+        throw TestFailed("test_pixel_encoding: half precision values not rounded to even.");
+    decode_pixels(encoded.data(), n, PixelEncoding::FLOAT16, 1.0f, decoded.data());
+    if(decoded[0] != 1.0f || decoded[4] != 65504.0f || decoded[6] != inf || decoded[13] != -inf || !std::isnan(decoded[14])
+            || std::fabs(decoded[10] - values[10]) > 1e-4f)
+        throw TestFailed("test_pixel_encoding: wrong decoded half precision values.");
+
+    encode_pixels(values.data(), n, PixelEncoding::BFLOAT16, 1.0f, encoded.data());
+    if(static_cast<uint16_t>(encoded[0]) != 0x3f80 || static_cast<uint16_t>(encoded[1]) != 0xc000)
+        throw TestFailed("test_pixel_encoding: wrong bfloat16 values.");
+    decode_pixels(encoded.data(), n, PixelEncoding::BFLOAT16, 1.0f, decoded.data());
+    for(size_t i {0}; i < n; i++)
+        if(!std::isnan(values[i]) && std::fabs(decoded[i] - values[i]) > std::fabs(values[i]) / 256.0f)
+            throw TestFailed("test_pixel_encoding: bfloat16 value too far from " + std::to_string(values[i]));
+
+    // Scaled integers, with the scale set by the largest finite value.
+    std::vector<float> finite;
+    for(float v : values) if(std::isfinite(v) && std::fabs(v) < 1e6f) finite.push_back(v);
+    finite.push_back(nan);
+    const float max_abs {max_abs_value(finite.data(), finite.size())};
+    if(max_abs != 65520.0f) throw TestFailed("test_pixel_encoding: wrong largest absolute value.");
+    const float scale {int16_scale(max_abs)};
+    encode_pixels(finite.data(), finite.size(), PixelEncoding::INT16_SCALED, scale, encoded.data());
+    decode_pixels(encoded.data(), finite.size(), PixelEncoding::INT16_SCALED, scale, decoded.data());
+    if(encoded[finite.size() - 1] != INT16_BLANK || !std::isnan(decoded[finite.size() - 1]))
+        throw TestFailed("test_pixel_encoding: NaN not stored as BLANK.");
+    for(size_t i {0}; i + 1 < finite.size(); i++)
+        if(std::fabs(decoded[i] - finite[i]) > scale * 0.5f + std::fabs(finite[i]) * 1e-6f || encoded[i] == INT16_BLANK)
+            throw TestFailed("test_pixel_encoding: scaled value too far from " + std::to_string(finite[i]));
+
+    // Scaled images are read as float ones, whose header can be written again as it is.
+    const std::string filename {"myEncodedTestFits.fits"}, copy_filename {"myEncodedTestFitsCopy.fits"};
+    std::remove(filename.c_str());
+    std::remove(copy_filename.c_str());
+    {
+        FitsOutputOptions options;
+        options.encoding = PixelEncoding::INT16_SCALED;
+        FITS fits {filename, FITS::Mode::APPEND};
+        fits.set_output_options(options);
+        FITS::HDU hdu;
+        hdu.add_keyword("INDEX", 3, "HDU index.");
+        hdu.set_image(finite.data(), static_cast<long>(finite.size()), 1);
+        fits.add_HDU(hdu);
+    }
+    std::vector<float> first_read(finite.size());
+    {
+        FITS fits {filename, FITS::Mode::READ};
+        const FITS::HDU& hdu {fits[0]};
+        if(hdu.get_bitpix() != FLOAT_IMG || hdu.get_header().count("BLANK") || hdu.get_header().count("BSCALE"))
+            throw TestFailed("test_pixel_encoding: scaled image read with the keywords of its encoding.");
+        hdu.read_image(first_read.data());
+        FITS copy {copy_filename, FITS::Mode::APPEND};
+        copy.add_HDU(hdu);
+    }
+    FITS copy {copy_filename, FITS::Mode::READ};
+    std::remove(filename.c_str());
+    std::remove(copy_filename.c_str());
+    if(copy.size() != 1 || copy[0].get_bitpix() != FLOAT_IMG || copy[0].get_header().count("BLANK")
+            || copy[0].get_keyword<int>("INDEX").first != 3)
+        throw TestFailed("test_pixel_encoding: wrong header of the rewritten scaled image.");
+    std::vector<float> second_read(finite.size());
+    copy[0].read_image(second_read.data());
+    for(size_t i {0}; i < finite.size(); i++)
+        if(std::isnan(first_read[i]) != std::isnan(second_read[i]) || (!std::isnan(first_read[i]) && first_read[i] != second_read[i]))
+            throw TestFailed("test_pixel_encoding: rewritten scaled image differs.");
+    std::cout << "'test_pixel_encoding' passed." << std::endl;
+}
+
+
+
+void test_compressed_fits(){
+    const std::string filename {"myCompressedTestFits.fits"};
+    const long x_dim {64}, y_dim {32};
+    std::vector<float> data(x_dim * y_dim);
+    for(size_t i {0}; i < data.size(); i++) data[i] = std::sin(0.01f * i) * 100.0f;
+    data[7] = std::numeric_limits<float>::quiet_NaN();
+    struct Case { FitsCompression compression; PixelEncoding encoding; float tolerance; };
+    const Case cases[] {{FitsCompression::RICE, PixelEncoding::FLOAT32, 0.5f}, {FitsCompression::GZIP, PixelEncoding::FLOAT32, 0.0f},
+        {FitsCompression::HCOMPRESS, PixelEncoding::INT16_SCALED, 100.0f / 32767.0f}, {FitsCompression::NONE, PixelEncoding::INT16_SCALED, 100.0f / 32767.0f},
+        {FitsCompression::RICE, PixelEncoding::FLOAT16, 0.05f}, {FitsCompression::NONE, PixelEncoding::BFLOAT16, 0.5f}};
+    for(const Case& c : cases){
+        std::remove(filename.c_str());
+        {
+            FitsOutputOptions options;
+            options.compression = c.compression;
+            options.encoding = c.encoding;
+            if(c.tolerance == 0.0f) options.quantize_level = 0.0f;
+            FITS fits {filename, FITS::Mode::APPEND};
+            fits.set_output_options(options);
+            // One image written at once, one streamed.
+            FITS::HDU hdu;
+            hdu.add_keyword("INDEX", 0, "HDU index.");
+            hdu.set_image(data.data(), x_dim, y_dim);
+            fits.add_HDU(hdu);
+            FITS::HDU header;
+            header.add_keyword("INDEX", 1, "HDU index.");
+            fits.append_image_hdu(header, FLOAT_IMG, x_dim, y_dim, max_abs_value(data.data(), data.size()));
+            fits.write_image_rows(data.data(), 0, y_dim / 2);
+            fits.write_image_rows(data.data() + data.size() / 2, y_dim / 2, y_dim / 2);
+        }
+        FITS fits {filename, FITS::Mode::READ};
+        std::remove(filename.c_str());
+        // Compressed images follow a primary HDU without pixels.
+        const size_t first {c.compression == FitsCompression::NONE ? 0ul : 1ul};
+        if(fits.size() != first + 2 || (first == 1 && fits[0].has_image()))
+            throw TestFailed("test_compressed_fits: wrong number of HDUs.");
+        for(size_t h {0}; h < 2; h++){
+            const FITS::HDU& hdu {fits[first + h]};
+            if(hdu.get_bitpix() != FLOAT_IMG || hdu.get_keyword<int>("INDEX").first != static_cast<int>(h) || hdu.get_header().count("BSCALE"))
+                throw TestFailed("test_compressed_fits: wrong header.");
+            std::vector<float> pixels(data.size());
+            hdu.read_image(pixels.data(), TFLOAT);
+            for(size_t i {0}; i < data.size(); i++){
+                if(std::isnan(data[i]) != std::isnan(pixels[i]) || std::fabs(pixels[i] - data[i]) > c.tolerance)
+                    throw TestFailed("test_compressed_fits: wrong pixel " + std::to_string(i) + ": " + std::to_string(pixels[i]));
+            }
+        }
+    }
+    std::cout << "'test_compressed_fits' passed." << std::endl;
+}
+
+
+
 int main(void){
     char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
     if(!pathToData){
@@ -53,6 +436,13 @@ int main(void){
     try{
         test_fits_equal();
         test_write_read_simple_fits();
+        test_hdu_ownership();
+        test_header();
+        test_lazy_read();
+        test_async_writer();
+        test_async_encoded_writer();
+        test_pixel_encoding();
+        test_compressed_fits();
     } catch (std::exception& ex){
         std::cerr << ex.what() << std::endl;
         return 1;
@@ -0,0 +1,220 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <complex>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "common.hpp"
+#include "../src/images.hpp"
+#include "../src/files.hpp"
+#include "../src/fits_writer.hpp"
+
+
+std::string dataRootDir;
+
+
+Images make_images(unsigned int n_intervals, unsigned int n_channels, unsigned int side_size, double ra_deg, double dec_deg){
+    ObservationInfo obsInfo {VCS_OBSERVATION_INFO};
+    obsInfo.nTimesteps = 200;
+    // Intervals 1000 seconds apart, so that the LST, and the WCS keywords, change noticeably.
+    obsInfo.timeResolution = 10.0;
+    MemoryBuffer<std::complex<float>> data {static_cast<size_t>(n_intervals) * n_channels * side_size * side_size};
+    for(size_t i {0}; i < data.size(); i++) data[i] = {static_cast<float>(i), -static_cast<float>(i % 17)};
+    return Images {std::move(data), obsInfo, n_intervals, n_channels, side_size, ra_deg, dec_deg, 0.01, 0.02};
+}
+
+
+
+bool same_wcs(const FITS::HDU& a, const FITS::HDU& b){
+    for(const char *key : {"CRPIX1", "CDELT1", "CRVAL1", "CRPIX2", "CDELT2", "CRVAL2", "PV2_1", "PV2_2"})
+        if(a.get_keyword<double>(key).first != b.get_keyword<double>(key).first) return false;
+    for(const char *key : {"CTYPE1", "CTYPE2", "CUNIT1", "CUNIT2"})
+        if(a.get_keyword<std::string>(key).first != b.get_keyword<std::string>(key).first) return false;
+    return true;
+}
+
+
+
+void test_interval_header_cache(){
+    const unsigned int n_intervals {2}, n_channels {2}, side {8};
+    Images images {make_images(n_intervals, n_channels, side, 30.0, -40.0)};
+    for(int pointing {0}; pointing < 2; pointing++){
+        // HDUs are kept in memory: the file is never written.
+        FITS fits {dataRootDir + "/test_interval_header.fits.tmp", FITS::Mode::WRITE};
+        for(unsigned int interval {0}; interval < n_intervals; interval++)
+            for(unsigned int ch {0}; ch < n_channels; ch++)
+                images.to_fits_file(fits, interval, ch);
+        // Headers computed by objects whose cache is empty.
+        FITS expected {dataRootDir + "/test_interval_header_expected.fits.tmp", FITS::Mode::WRITE};
+        for(unsigned int interval {0}; interval < n_intervals; interval++){
+            Images uncached {make_images(n_intervals, n_channels, side, images.ra_deg, images.dec_deg)};
+            uncached.to_fits_file(expected, interval, 0);
+        }
+        for(unsigned int interval {0}; interval < n_intervals; interval++){
+            for(unsigned int ch {0}; ch < n_channels; ch++){
+                if(!same_wcs(fits[interval * n_channels + ch], expected[interval]))
+                    throw TestFailed("'test_interval_header_cache' failed: the cached header differs from the computed one.");
+            }
+        }
+        if(fits[0].get_keyword<double>("PV2_1").first == fits[n_channels].get_keyword<double>("PV2_1").first
+                || fits[0].get_keyword<double>("PV2_2").first == fits[n_channels].get_keyword<double>("PV2_2").first)
+            throw TestFailed("'test_interval_header_cache' failed: intervals share the same LST dependent keywords.");
+        if(fits[0].get_keyword<double>("CRVAL1").first != images.ra_deg || fits[0].get_keyword<double>("CRVAL2").first != images.dec_deg)
+            throw TestFailed("'test_interval_header_cache' failed: the header does not follow the pointing.");
+        // A new pointing invalidates the cache.
+        images.ra_deg = 120.0;
+        images.dec_deg = -10.0;
+    }
+    std::cout << "'test_interval_header_cache' passed." << std::endl;
+}
+
+
+
+// Pixels of all the HDUs of the file at `path`, one after the other.
+std::vector<float> read_pixels(const std::string& path){
+    FITS fits {path, FITS::Mode::READ};
+    std::vector<float> pixels;
+    for(const FITS::HDU& hdu : fits){
+        // Compressed images follow a primary HDU without pixels.
+        if(!hdu.has_image()) continue;
+        const size_t offset {pixels.size()};
+        pixels.resize(offset + hdu.get_xdim() * hdu.get_ydim());
+        hdu.read_image(pixels.data() + offset);
+    }
+    return pixels;
+}
+
+
+
+// Pixels of the cube written by `to_fits_files` in `directory`, deleting the file.
+std::vector<float> read_cube(const std::string& directory){
+    std::vector<float> pixels;
+    for(const std::string& file : blink::imager::list_files_in_dir(directory, ".fits")){
+        const std::vector<float> cube {read_pixels(file)};
+        pixels.insert(pixels.end(), cube.begin(), cube.end());
+        std::remove(file.c_str());
+    }
+    return pixels;
+}
+
+
+
+void test_async_images_to_fits(){
+    const unsigned int n_intervals {2}, n_channels {2}, side {16};
+    Images images {make_images(n_intervals, n_channels, side, 30.0, -40.0)};
+    FitsOutputOptions compressed, scaled;
+    compressed.compression = FitsCompression::GZIP;
+    compressed.quantize_level = 0.0f;
+    scaled.encoding = PixelEncoding::INT16_SCALED;
+    const std::string path {dataRootDir + "/test_async_images"};
+    blink::imager::create_directory(path);
+    for(const std::string& file : blink::imager::list_files_in_dir(path, ".fits")) std::remove(file.c_str());
+    images.to_fits_files(path, false, true);
+    const std::vector<float> plain {read_cube(path)};
+    for(const FitsOutputOptions& options : {compressed, scaled}){
+        images.to_fits_files(path, false, true, options);
+        const std::vector<float> expected {read_cube(path)};
+        // Lossless compression keeps the pixels as they are, 16-bit integers do not.
+        if((expected == plain) != (options.encoding == PixelEncoding::FLOAT32))
+            throw TestFailed("'test_async_images_to_fits' failed: wrong pixels written by the synchronous version.");
+        {
+            AsyncFitsWriter writer {2};
+            images.to_fits_files(writer, path, false, true, options);
+            writer.flush();
+        }
+        const std::vector<std::string> files {blink::imager::list_files_in_dir(path, ".fits")};
+        if(files.size() != 1)
+            throw TestFailed("'test_async_images_to_fits' failed: wrong number of files written.");
+        {
+            FITS fits {files[0], FITS::Mode::READ};
+            const size_t first {options.compression == FitsCompression::NONE ? 0ul : 1ul};
+            if(fits.size() != first + 2ul * n_intervals * n_channels || fits[0].has_image() == (first == 1))
+                throw TestFailed("'test_async_images_to_fits' failed: the options of the writer were not applied.");
+        }
+        const std::vector<float> pixels {read_cube(path)};
+        if(pixels.size() != 2ul * n_intervals * n_channels * side * side || pixels != expected)
+            throw TestFailed("'test_async_images_to_fits' failed: the images written in background differ.");
+    }
+    std::cout << "'test_async_images_to_fits' passed." << std::endl;
+}
+
+
+
+#ifdef __GPU__
+void test_gpu_images_to_fits(){
+    const unsigned int n_intervals {2}, n_channels {3}, side {16};
+    Images cpu_images {make_images(n_intervals, n_channels, side, 30.0, -40.0)};
+    Images gpu_images {cpu_images};
+    gpu_images.to_gpu();
+    for(PixelEncoding encoding : {PixelEncoding::FLOAT32, PixelEncoding::INT16_SCALED}){
+        FitsOutputOptions options;
+        options.encoding = encoding;
+        std::vector<float> pixels[2];
+        for(int k {0}; k < 2; k++){
+            Images& images {k == 0 ? cpu_images : gpu_images};
+            const std::string path {dataRootDir + (k == 0 ? "/test_gpu_images_cpu" : "/test_gpu_images_gpu")};
+            // One image at a time, then the whole cube, double buffered on GPU.
+            std::remove((path + ".fits.tmp").c_str());
+            {
+                FITS fits {path + ".fits.tmp", FITS::Mode::APPEND};
+                fits.set_output_options(options);
+                for(unsigned int interval {0}; interval < n_intervals; interval++)
+                    for(unsigned int ch {0}; ch < n_channels; ch++)
+                        images.to_fits_file(fits, interval, ch, false, true);
+            }
+            pixels[k] = read_pixels(path + ".fits.tmp");
+            std::remove((path + ".fits.tmp").c_str());
+            blink::imager::create_directory(path);
+            for(const std::string& file : blink::imager::list_files_in_dir(path, ".fits")) std::remove(file.c_str());
+            images.to_fits_files(path, false, true, options);
+            const std::vector<float> cube {read_cube(path)};
+            pixels[k].insert(pixels[k].end(), cube.begin(), cube.end());
+            // And in background.
+            {
+                AsyncFitsWriter writer;
+                images.to_fits_files(writer, path, false, true, options);
+                writer.flush();
+            }
+            const std::vector<float> async_cube {read_cube(path)};
+            pixels[k].insert(pixels[k].end(), async_cube.begin(), async_cube.end());
+        }
+        if(pixels[0].size() != 6ul * n_intervals * n_channels * side * side)
+            throw TestFailed("'test_gpu_images_to_fits' failed: wrong number of pixels written.");
+        // 16-bit pixels may differ by a quantisation step, if the GPU rounds the scale differently.
+        float tolerance {0.0f};
+        if(encoding != PixelEncoding::FLOAT32)
+            for(float value : pixels[0]) tolerance = std::max(tolerance, std::abs(value) / 32000.0f);
+        for(size_t i {0}; i < pixels[0].size(); i++)
+            if(!(std::abs(pixels[0][i] - pixels[1][i]) <= tolerance))
+                throw TestFailed("'test_gpu_images_to_fits' failed: images written from GPU differ from the ones written from CPU.");
+    }
+    if(!gpu_images.on_gpu())
+        throw TestFailed("'test_gpu_images_to_fits' failed: the cube was moved off the GPU.");
+    std::cout << "'test_gpu_images_to_fits' passed." << std::endl;
+}
+#endif
+
+
+
+int main(void){
+    char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
+    if(!pathToData){
+        std::cerr << "'" << ENV_DATA_ROOT_DIR << "' environment variable is not set." << std::endl;
+        return -1;
+    }
+    dataRootDir = std::string {pathToData};
+    try{
+        test_interval_header_cache();
+        test_async_images_to_fits();
+        #ifdef __GPU__
+        test_gpu_images_to_fits();
+        #endif
+    } catch (std::exception& ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "common.hpp"
+#include "../src/instrumentation.hpp"
+#include "../src/astroio.hpp"
+
+
+std::string dataRootDir;
+
+
+void test_disabled(){
+    instrumentation::enable(false);
+    instrumentation::reset();
+    {
+        instrumentation::ScopedTimer timer {"test_disabled", 10};
+    }
+    instrumentation::count("test_disabled", 10);
+    if(!instrumentation::stats().empty())
+        throw TestFailed("'test_disabled' failed: measurements recorded while disabled.");
+    std::cout << "'test_disabled' passed." << std::endl;
+}
+
+
+
+void test_scoped_timer(){
+    instrumentation::reset();
+    instrumentation::enable();
+    for(int i {0}; i < 3; i++){
+        instrumentation::ScopedTimer outer {"test_outer", 100, 50};
+        {
+            instrumentation::ScopedTimer inner {"test_inner"};
+            inner.add(7, 1);
+            std::this_thread::sleep_for(std::chrono::milliseconds {2});
+        }
+    }
+    instrumentation::count("test_counter", 11, 3);
+    instrumentation::count("test_counter", 11, 3);
+    instrumentation::enable(false);
+
+    const instrumentation::StageStats outer {instrumentation::stats("test_outer")};
+    const instrumentation::StageStats inner {instrumentation::stats("test_inner")};
+    const instrumentation::StageStats counter {instrumentation::stats("test_counter")};
+    if(outer.calls != 3 || outer.bytes != 300 || outer.samples != 150 || outer.gpu)
+        throw TestFailed("'test_scoped_timer' failed: wrong counters for the outer scope.");
+    if(inner.calls != 3 || inner.bytes != 21 || inner.samples != 3)
+        throw TestFailed("'test_scoped_timer' failed: wrong counters for the inner scope.");
+    if(inner.min_seconds < 2e-3 || inner.max_seconds < inner.min_seconds || inner.total_seconds < 6e-3
+            || outer.total_seconds < inner.total_seconds)
+        throw TestFailed("'test_scoped_timer' failed: wrong timings.");
+    if(counter.calls != 0 || counter.bytes != 22 || counter.samples != 6)
+        throw TestFailed("'test_scoped_timer' failed: wrong counter values.");
+    if(instrumentation::stats("test_missing").calls != 0 || instrumentation::stats().size() != 3)
+        throw TestFailed("'test_scoped_timer' failed: unexpected stages.");
+    std::cout << "'test_scoped_timer' passed." << std::endl;
+}
+
+
+
+void test_threads(){
+    instrumentation::reset();
+    instrumentation::enable();
+    std::vector<std::thread> threads;
+    for(int t {0}; t < 4; t++){
+        threads.emplace_back([]{
+            for(int i {0}; i < 100; i++) instrumentation::ScopedTimer timer {"test_thread", 1};
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    instrumentation::enable(false);
+    const instrumentation::StageStats s {instrumentation::stats("test_thread")};
+    if(s.calls != 400 || s.bytes != 400)
+        throw TestFailed("'test_threads' failed: measurements were lost.");
+    std::cout << "'test_threads' passed." << std::endl;
+}
+
+
+
+void test_chrome_trace(){
+    instrumentation::reset();
+    instrumentation::enable();
+    {
+        instrumentation::ScopedTimer timer {"test_\"quoted\"", 5};
+    }
+    instrumentation::count("test_counter", 4);
+    instrumentation::enable(false);
+    std::stringstream ss;
+    instrumentation::write_chrome_trace(ss);
+    const std::string trace {ss.str()};
+    if(trace.rfind("{\"traceEvents\":[", 0) != 0 || trace.find("\"displayTimeUnit\":\"ms\"") == std::string::npos)
+        throw TestFailed("'test_chrome_trace' failed: not a trace: " + trace);
+    if(trace.find("\"name\":\"test_\\\"quoted\\\"\"") == std::string::npos || trace.find("\"ph\":\"X\"") == std::string::npos
+            || trace.find("\"bytes\":5") == std::string::npos)
+        throw TestFailed("'test_chrome_trace' failed: timed event missing: " + trace);
+    if(trace.find("\"ph\":\"C\"") == std::string::npos)
+        throw TestFailed("'test_chrome_trace' failed: counter event missing: " + trace);
+    // Balanced brackets, outside of strings.
+    int depth {0};
+    bool in_string {false};
+    for(size_t i {0}; i < trace.size(); i++){
+        const char c {trace[i]};
+        if(in_string){
+            if(c == '\\') i++;
+            else if(c == '"') in_string = false;
+        }else if(c == '"') in_string = true;
+        else if(c == '{' || c == '[') depth++;
+        else if(c == '}' || c == ']') depth--;
+        if(depth < 0) break;
+    }
+    if(depth != 0 || in_string) throw TestFailed("'test_chrome_trace' failed: malformed JSON: " + trace);
+
+    const std::string tmpfile {dataRootDir + "/test_trace.json.tmp"};
+    instrumentation::write_chrome_trace(tmpfile);
+    std::ifstream fin {tmpfile};
+    std::stringstream from_file;
+    from_file << fin.rdbuf();
+    std::remove(tmpfile.c_str());
+    if(from_file.str() != trace) throw TestFailed("'test_chrome_trace' failed: the file differs from the stream output.");
+
+    // Events beyond the limit are dropped from the trace only.
+    instrumentation::reset();
+    instrumentation::set_max_trace_events(2);
+    instrumentation::enable();
+    for(int i {0}; i < 5; i++) instrumentation::ScopedTimer timer {"test_limit"};
+    instrumentation::enable(false);
+    instrumentation::set_max_trace_events(1 << 20);
+    if(instrumentation::dropped_trace_events() != 3 || instrumentation::stats("test_limit").calls != 5)
+        throw TestFailed("'test_chrome_trace' failed: wrong handling of the event limit.");
+    std::cout << "'test_chrome_trace' passed." << std::endl;
+}
+
+
+
+void test_instrumented_stages(){
+    #ifdef ASTROIO_INSTRUMENTATION
+    ObservationInfo obsInfo {.nAntennas = 4, .nFrequencies = 2, .nPolarizations = 2, .nTimesteps = 10};
+    const size_t length {static_cast<size_t>(obsInfo.nAntennas) * obsInfo.nFrequencies * obsInfo.nPolarizations * obsInfo.nTimesteps * 2};
+    std::vector<int8_t> buffer(length, 1);
+    instrumentation::reset();
+    instrumentation::enable();
+    Voltages voltages {Voltages::from_memory(buffer.data(), length, obsInfo, 5)};
+    instrumentation::enable(false);
+    const instrumentation::StageStats s {instrumentation::stats("from_memory_reorder")};
+    if(s.calls != 1 || s.bytes != length || s.samples != length / 2)
+        throw TestFailed("'test_instrumented_stages' failed: the reorder of `from_memory` was not timed.");
+    instrumentation::reset();
+    std::cout << "'test_instrumented_stages' passed." << std::endl;
+    #endif
+}
+
+
+
+int main(void){
+    char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
+    if(!pathToData){
+        std::cerr << "'" << ENV_DATA_ROOT_DIR << "' environment variable is not set." << std::endl;
+        return -1;
+    }
+    dataRootDir = std::string {pathToData};
+    try{
+        test_disabled();
+        test_scoped_timer();
+        test_threads();
+        test_chrome_trace();
+        test_instrumented_stages();
+    } catch (std::exception& ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed." << std::endl;
+    return 0;
+}
@@ -81,6 +81,117 @@ void test_memory_buffer_default_constructor(){
 
 
 
+void test_memory_pool(){
+    PoolAllocator& pool {memory_pool()};
+    const MemoryPoolStats before {pool.stats(MemoryType::DEVICE)};
+    int *first {nullptr};
+    {
+        MemoryBuffer<int> mem_gpu {1000, MemoryType::DEVICE};
+        first = mem_gpu.data();
+    }
+    // Releasing and allocating the same size reuses the cached block, without driver calls.
+    MemoryBuffer<int> mem_gpu {1000, MemoryType::DEVICE};
+    const MemoryPoolStats after {pool.stats(MemoryType::DEVICE)};
+    if(mem_gpu.data() != first || after.hits != before.hits + 1 || after.requests != before.requests + 2)
+        throw TestFailed("'test_memory_pool' failed: device block not reused.");
+    if(after.bytes_in_use < 1000 * sizeof(int) || after.high_water_mark < after.bytes_in_use)
+        throw TestFailed("'test_memory_pool' failed: wrong usage statistics.");
+
+    // Transfers recycle pinned host memory too.
+    MemoryBuffer<int> mem_cpu {1000, MemoryType::PINNED};
+    for(int i {0}; i < 1000; i++) mem_cpu[i] = i;
+    mem_cpu.to_gpu();
+    mem_cpu.to_cpu(MemoryType::PINNED);
+    if(mem_cpu[999] != 999 || pool.stats(MemoryType::PINNED).hits == 0)
+        throw TestFailed("'test_memory_pool' failed: pinned block not reused.");
+    std::cout << "'test_memory_pool' passed." << std::endl;
+}
+
+
+
+void test_memory_buffer_async(){
+    gpuStream_t stream;
+    gpuEvent_t event;
+    gpuStreamCreate(&stream);
+    gpuEventCreate(&event);
+    MemoryBuffer<int> mem {5, MemoryType::PINNED};
+    for(int i {0}; i < 5; i++) mem[i] = i;
+    int *host_ptr {mem.data()};
+    int *dev_out;
+    gpuMalloc(&dev_out, sizeof(int));
+    int expected_out {0};
+    for(int iter {0}; iter < 3; iter++){
+        mem.to_gpu_async(stream);
+        int *dev_ptr {mem.data()};
+        if(!mem.on_gpu() || mem.mirror() != host_ptr)
+            throw TestFailed("'test_memory_buffer_async' failed: host array not kept as mirror.");
+        gpuMemsetAsync(dev_out, 0, sizeof(int), stream);
+        test_values<<<1, 5, 0, stream>>>(mem.data(), mem.size(), dev_out);
+        mem.to_cpu_async(stream, MemoryType::PINNED, event);
+        gpuEventSynchronize(event);
+        // Round trips reuse the same two arrays.
+        if(!mem.pinned() || mem.data() != host_ptr || mem.mirror() != dev_ptr)
+            throw TestFailed("'test_memory_buffer_async' failed: arrays reallocated.");
+        int out;
+        gpuMemcpy(&out, dev_out, sizeof(int), gpuMemcpyDeviceToHost);
+        expected_out = 0;
+        for(int i {0}; i < 5; i++) expected_out += mem[i];
+        if(out != expected_out){
+            std::stringstream ss;
+            ss << "'test_memory_buffer_async' failed: wrong result (" << out << " != " << expected_out << ").\n";
+            throw TestFailed(ss.str());
+        }
+        for(int i {0}; i < 5; i++) mem[i] += 1;
+    }
+    mem.release_mirror();
+    if(mem.mirrored()) throw TestFailed("'test_memory_buffer_async' failed: mirror not released.");
+    gpuFree(dev_out);
+    gpuEventDestroy(event);
+    gpuStreamDestroy(stream);
+    std::cout << "'test_memory_buffer_async' passed." << std::endl;
+}
+
+
+
+void test_memory_buffer_devices(){
+    const int n_gpus {num_available_gpus()};
+    MemoryBuffer<int> mem {5};
+    for(int i {0}; i < 5; i++) mem[i] = i;
+    int *dev_out;
+    gpuMalloc(&dev_out, sizeof(int));
+    // Visit every GPU, ending on the first one: the data moves with peer copies.
+    for(int d {0}; d <= n_gpus; d++){
+        const int device {d % n_gpus};
+        mem.to_gpu(device);
+        if(!mem.on_gpu() || mem.device_id() != device)
+            throw TestFailed("'test_memory_buffer_devices' failed: data not on the requested device.");
+    }
+    int current;
+    gpuGetDevice(&current);
+    if(current != 0) throw TestFailed("'test_memory_buffer_devices' failed: current device changed.");
+    gpuMemset(dev_out, 0, sizeof(int));
+    test_values<<<1, 5>>>(mem.data(), mem.size(), dev_out);
+    int out;
+    gpuMemcpy(&out, dev_out, sizeof(int), gpuMemcpyDeviceToHost);
+    if(out != 10) throw TestFailed("'test_memory_buffer_devices' failed: data corrupted by peer copies.");
+
+    // Managed memory stays where it is and is only migrated.
+    MemoryBuffer<int> managed {5, MemoryType::MANAGED};
+    for(int i {0}; i < 5; i++) managed[i] = i;
+    managed.to_gpu(n_gpus - 1);
+    if(managed.device_id() != n_gpus - 1 || managed.memory_type() != MemoryType::MANAGED)
+        throw TestFailed("'test_memory_buffer_devices' failed: managed memory not placed on the requested device.");
+    gpuDeviceSynchronize();
+    gpuMemset(dev_out, 0, sizeof(int));
+    test_values<<<1, 5>>>(managed.data(), managed.size(), dev_out);
+    gpuMemcpy(&out, dev_out, sizeof(int), gpuMemcpyDeviceToHost);
+    if(out != 10) throw TestFailed("'test_memory_buffer_devices' failed: wrong result on managed memory.");
+    gpuFree(dev_out);
+    std::cout << "'test_memory_buffer_devices' passed." << std::endl;
+}
+
+
+
 int main(void){
     char *path_to_data {std::getenv(ENV_DATA_ROOT_DIR)};
     if(!path_to_data){
@@ -92,6 +203,9 @@ int main(void){
         
         test_memory_buffer();
         test_memory_buffer_default_constructor();
+        test_memory_pool();
+        test_memory_buffer_async();
+        test_memory_buffer_devices();
 
     } catch (TestFailed ex){
         std::cerr << ex.what() << std::endl;
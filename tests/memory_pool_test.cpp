@@ -0,0 +1,131 @@
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include "common.hpp"
+#include "../src/memory_pool.hpp"
+
+
+std::string dataRootDir;
+
+
+// Forwards to `DirectAllocator`, counting the blocks obtained from it and not yet returned.
+class CountingAllocator : public MemoryAllocator {
+    DirectAllocator direct;
+
+    public:
+    size_t allocations {0};
+    size_t live_blocks {0};
+    size_t live_bytes {0};
+
+    void* allocate(size_t bytes, MemoryType type) override {
+        allocations++;
+        live_blocks++;
+        live_bytes += bytes;
+        return direct.allocate(bytes, type);
+    }
+
+    void deallocate(void *ptr, size_t bytes, MemoryType type) override {
+        live_blocks--;
+        live_bytes -= bytes;
+        direct.deallocate(ptr, bytes, type);
+    }
+};
+
+
+
+void test_block_reuse(){
+    CountingAllocator upstream;
+    PoolAllocator pool {1ul << 20, &upstream};
+    void *first {pool.allocate(1000, MemoryType::PAGEABLE)};
+    pool.deallocate(first, 1000, MemoryType::PAGEABLE);
+    // Same size class: the cached block is handed out again.
+    void *second {pool.allocate(1020, MemoryType::PAGEABLE)};
+    const MemoryPoolStats stats {pool.stats(MemoryType::PAGEABLE)};
+    if(second != first || upstream.allocations != 1)
+        throw TestFailed("'test_block_reuse' failed: the cached block was not reused.");
+    if(stats.requests != 2 || stats.hits != 1 || stats.bytes_cached != 0 || stats.bytes_in_use != PoolAllocator::size_class(1000))
+        throw TestFailed("'test_block_reuse' failed: wrong statistics.");
+    pool.deallocate(second, 1020, MemoryType::PAGEABLE);
+    std::cout << "'test_block_reuse' passed." << std::endl;
+}
+
+
+
+void test_size_classes(){
+    if(PoolAllocator::size_class(1) != 256 || PoolAllocator::size_class(1000) != 1024
+            || PoolAllocator::size_class(1100) != 1280 || PoolAllocator::size_class(1024) != 1024)
+        throw TestFailed("'test_size_classes' failed: wrong size classes.");
+    CountingAllocator upstream;
+    PoolAllocator pool {1ul << 20, &upstream};
+    void *small {pool.allocate(1000, MemoryType::PAGEABLE)};
+    pool.deallocate(small, 1000, MemoryType::PAGEABLE);
+    // A larger size class is not served by the cached block.
+    void *large {pool.allocate(1100, MemoryType::PAGEABLE)};
+    if(large == small || upstream.allocations != 2 || pool.stats(MemoryType::PAGEABLE).hits != 0)
+        throw TestFailed("'test_size_classes' failed: a block was reused across size classes.");
+    if(pool.stats(MemoryType::PAGEABLE).bytes_cached != 1024 || upstream.live_bytes != 1024 + 1280)
+        throw TestFailed("'test_size_classes' failed: wrong cached memory.");
+    pool.deallocate(large, 1100, MemoryType::PAGEABLE);
+    std::cout << "'test_size_classes' passed." << std::endl;
+}
+
+
+
+void test_cache_limit(){
+    CountingAllocator upstream;
+    PoolAllocator pool {2048, &upstream};
+    void *blocks[3];
+    for(void *&block : blocks) block = pool.allocate(1024, MemoryType::PAGEABLE);
+    for(void *block : blocks) pool.deallocate(block, 1024, MemoryType::PAGEABLE);
+    // The third block does not fit in the cache and goes back to the system.
+    if(upstream.live_blocks != 2 || pool.stats(MemoryType::PAGEABLE).bytes_cached != 2048)
+        throw TestFailed("'test_cache_limit' failed: the cache exceeds its limit.");
+    std::cout << "'test_cache_limit' passed." << std::endl;
+}
+
+
+
+void test_release(){
+    CountingAllocator upstream;
+    {
+        PoolAllocator pool {1ul << 20, &upstream};
+        void *a {pool.allocate(300, MemoryType::PAGEABLE)};
+        void *b {pool.allocate(5000, MemoryType::PAGEABLE)};
+        pool.deallocate(a, 300, MemoryType::PAGEABLE);
+        pool.deallocate(b, 5000, MemoryType::PAGEABLE);
+        if(upstream.live_blocks != 2)
+            throw TestFailed("'test_release' failed: freed blocks were not cached.");
+        pool.release_cached();
+        if(upstream.live_blocks != 0 || upstream.live_bytes != 0 || pool.stats(MemoryType::PAGEABLE).bytes_cached != 0)
+            throw TestFailed("'test_release' failed: release_cached kept cached blocks.");
+        // Blocks cached again are released when the pool is destroyed.
+        pool.deallocate(pool.allocate(2000, MemoryType::PAGEABLE), 2000, MemoryType::PAGEABLE);
+        if(upstream.live_blocks != 1)
+            throw TestFailed("'test_release' failed: the freed block was not cached.");
+    }
+    if(upstream.live_blocks != 0 || upstream.live_bytes != 0)
+        throw TestFailed("'test_release' failed: the destructor kept cached blocks.");
+    std::cout << "'test_release' passed." << std::endl;
+}
+
+
+
+int main(void){
+    char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
+    if(!pathToData){
+        std::cerr << "'" << ENV_DATA_ROOT_DIR << "' environment variable is not set." << std::endl;
+        return -1;
+    }
+    dataRootDir = std::string {pathToData};
+    try{
+        test_block_reuse();
+        test_size_classes();
+        test_cache_limit();
+        test_release();
+    } catch (std::exception& ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed." << std::endl;
+    return 0;
+}
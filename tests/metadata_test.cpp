@@ -23,10 +23,36 @@ void test_read_metafits_mapping(){
 void test_read_obsinfo(){
     std::string metadata_file {data_root_dir + "/mwax/1402778200.metafits"}; 
 	auto obsinfo = read_obsinfo(metadata_file);
-    
+    if(obsinfo.nAntennas == 0 || obsinfo.nPolarizations != 2)
+        throw TestFailed("'test_read_obsinfo' failed: wrong number of antennas or polarisations.");
+    if(obsinfo.id != "1402778200") throw TestFailed("'test_read_obsinfo' failed: wrong observation id.");
+    if(obsinfo.metadata_file != metadata_file) throw TestFailed("'test_read_obsinfo' failed: wrong metadata file.");
     std::cout << "'test_read_obsinfo' passed." << std::endl;
 }
 
+
+
+void test_read_metafits(){
+	std::string metadata_file {data_root_dir + "/mwa/1276619416/20200619163000.metafits"}; 
+    auto info = read_metafits(metadata_file);
+    if(info->tiles.size() != 128 || info->obsInfo.nAntennas != 128)
+        throw TestFailed("'test_read_metafits' failed: number of tiles is not 128.");
+    // Same mapping as the one checked by `test_read_metafits_mapping`.
+    if(info->input_mapping.size() != 256 || info->input_mapping[75] != 220)
+        throw TestFailed("'test_read_metafits' failed: wrong input mapping.");
+    for(size_t a {0}; a < info->tiles.size(); a++){
+        if(info->tiles[a].antenna != static_cast<int>(a) || info->tiles[a].name.empty())
+            throw TestFailed("'test_read_metafits' failed: tiles are not indexed by antenna.");
+    }
+    // The file is parsed only once.
+    if(read_metafits(metadata_file) != info) throw TestFailed("'test_read_metafits' failed: result not cached.");
+    clear_metafits_cache();
+    auto again = read_metafits(metadata_file);
+    if(again == info || again->input_mapping != info->input_mapping)
+        throw TestFailed("'test_read_metafits' failed: wrong result after clearing the cache.");
+    std::cout << "'test_read_metafits' passed." << std::endl;
+}
+
 int main(void){
     char *pathToData {std::getenv(ENV_DATA_ROOT_DIR)};
     if(!pathToData){
@@ -37,7 +63,8 @@ int main(void){
     try{
         
         test_read_metafits_mapping();
-        // test_read_obsinfo();
+        test_read_obsinfo();
+        test_read_metafits();
     } catch (TestFailed ex){
         std::cerr << ex.what() << std::endl;
         return 1;
@@ -3,6 +3,7 @@
 #include <string>
 #include "common.hpp"
 #include "../src/utils.hpp"
+#include "../src/mapped_file.hpp"
 
 
 std::string dataRootDir;
@@ -20,6 +21,15 @@ void test_read_data_from_file(){
 
 
 
+void test_mapped_file(){
+    MappedFile input {dataRootDir + "/simple/text_input.txt"};
+    if(input.size() != 17) throw TestFailed("'test_mapped_file' (1) failed.");
+    if(std::string(input.data(), input.size()) != "simple text input") throw TestFailed("'test_mapped_file' (2) failed.");
+    std::cout << "'test_mapped_file' passed." << std::endl;
+}
+
+
+
 void test_parse_timespec(){
     if(
         parse_timespec("1s") != 1.0 ||
@@ -57,6 +67,7 @@ int main(void){
         
         test_parse_timespec();
         test_read_data_from_file();
+        test_mapped_file();
 
     } catch (TestFailed ex){
         std::cerr << ex.what() << std::endl;